@@ -27,10 +27,16 @@
  * SUCH DAMAGE.
  */
 
+/*
+ * This file is shared between libc and the kernel, so don't put anything
+ * in here that won't work in both contexts.
+ */
+
 #ifdef _KERNEL
 #include <types.h>
 #include <lib.h>
 #else
+#include <stdint.h>
 #include <string.h>
 #endif
 
@@ -42,10 +48,46 @@ void *
 memset(void *ptr, int ch, size_t len)
 {
 	char *p = ptr;
-	size_t i;
 
-	for (i=0; i<len; i++) {
-		p[i] = ch;
+	/*
+	 * Store bytes until the pointer is word-aligned, then whole words
+	 * of CH, eight per loop iteration, then the leftover bytes. The
+	 * word is CH replicated into every byte: ~0UL/0xff is 0x0101...01.
+	 */
+
+	if (len >= sizeof(long)) {
+		unsigned long w = (~0UL / 0xff) * (unsigned char)ch;
+		unsigned long *lp;
+
+		while ((uintptr_t)p % sizeof(long) != 0) {
+			*p++ = ch;
+			len--;
+		}
+
+		lp = (unsigned long *)p;
+		while (len >= 8*sizeof(long)) {
+			lp[0] = w;
+			lp[1] = w;
+			lp[2] = w;
+			lp[3] = w;
+			lp[4] = w;
+			lp[5] = w;
+			lp[6] = w;
+			lp[7] = w;
+			lp += 8;
+			len -= 8*sizeof(long);
+		}
+		while (len >= sizeof(long)) {
+			*lp++ = w;
+			len -= sizeof(long);
+		}
+
+		p = (char *)lp;
+	}
+
+	while (len > 0) {
+		*p++ = ch;
+		len--;
 	}
 
 	return ptr;
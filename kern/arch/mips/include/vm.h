@@ -55,9 +55,10 @@
 
 /*
  * The first 512 megs of physical space can be addressed in both kseg0 and
- * kseg1. We use kseg0 for the kernel. This macro returns the kernel virtual
- * address of a given physical address within that range. (We assume we're
- * not using systems with more physical space than that anyway.)
+ * kseg1. We use kseg0 for the kernel. PADDR_TO_KVADDR returns the kernel
+ * virtual address of a given physical address within that range, and
+ * KVADDR_TO_PADDR goes the other way. (We assume we're not using systems
+ * with more physical space than that anyway.)
  *
  * N.B. If you, say, call a function that returns a paddr or 0 on error,
  * check the paddr for being 0 *before* you use this macro. While paddr 0
@@ -66,6 +67,7 @@
  * a valid address, and will make a *huge* mess if you scribble on it.
  */
 #define PADDR_TO_KVADDR(paddr) ((paddr)+MIPS_KSEG0)
+#define KVADDR_TO_PADDR(vaddr) ((vaddr)-MIPS_KSEG0)
 
 /*
  * The top of user space. (Actually, the address immediately above the
@@ -103,10 +105,15 @@
  * ram_stealmem can be used before ram_getsize is called to allocate
  * memory that cannot be freed later. This is intended for use early
  * in bootup before VM initialization is complete.
+ *
+ * ram_nextfree returns the address the next ram_stealmem call will
+ * hand out, without taking it. Like ram_stealmem it is not
+ * synchronized.
  */
 
 void ram_bootstrap(void);
 paddr_t ram_stealmem(unsigned long npages);
+paddr_t ram_nextfree(void);
 paddr_t ram_getsize(void);
 paddr_t ram_getfirstfree(void);
 
@@ -117,11 +117,7 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
 	kprintf("Fatal user mode trap %u sig %d (%s, epc 0x%x, vaddr 0x%x)\n",
 		code, sig, trapcodenames[code], epc, vaddr);
 	KASSERT(curproc != NULL);
-	struct proc *proc = procTable[curproc->pid];
-	KASSERT(proc != NULL);
-	proc->exitcode = _MKWAIT_SIG(sig);
-	V(proc->sem_exit);
-	thread_exit();
+	proc_exit(_MKWAIT_SIG(sig));
 }
 
 /*
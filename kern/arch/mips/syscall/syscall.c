@@ -32,6 +32,7 @@
 #include <kern/syscall.h>
 #include <lib.h>
 #include <mips/trapframe.h>
+#include <cpu.h>
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
@@ -39,6 +40,7 @@
 #include <proc_syscalls.h>
 #include <copyinout.h>
 #include <addrspace.h>
+#include <scstats.h>
 
 
 /*
@@ -95,11 +97,19 @@ syscall(struct trapframe *tf)
 	int32_t whence;
 	off_t pos;
 
+	// for scstats
+	unsigned startcpu;
+	uint32_t startcycles;
+
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
 	KASSERT(curthread->t_iplhigh_count == 0);
 
+	startcpu = curcpu->c_number;
+	startcycles = cpu_getcycles();
+
 	callno = tf->tf_v0;
+	scstats_enter(callno);
 
 	/*
 	 * Initialize retval to 0. Many of the system calls don't
@@ -139,6 +149,48 @@ syscall(struct trapframe *tf)
 		err = sys_read((int)tf->tf_a0, (void *)tf->tf_a1, (size_t)tf->tf_a2, &retval);
 		break;
 
+		/*
+		 * The positional calls have a 64-bit offset after three
+		 * 32-bit arguments, which puts it on the user stack.
+		 */
+		case SYS_pread:
+		case SYS_pwrite:
+		case SYS_preadv:
+		case SYS_pwritev:
+		err = copyin((const_userptr_t)tf->tf_sp + 16, &pos, sizeof(pos));
+		if (err) {
+			break;
+		}
+		switch (callno) {
+		    case SYS_pread:
+			err = sys_pread((int)tf->tf_a0, (void *)tf->tf_a1,
+					(size_t)tf->tf_a2, pos, &retval);
+			break;
+		    case SYS_pwrite:
+			err = sys_pwrite((int)tf->tf_a0, (const void *)tf->tf_a1,
+					 (size_t)tf->tf_a2, pos, &retval);
+			break;
+		    case SYS_preadv:
+			err = sys_preadv((int)tf->tf_a0,
+					 (const struct iovec *)tf->tf_a1,
+					 (int)tf->tf_a2, pos, &retval);
+			break;
+		    case SYS_pwritev:
+			err = sys_pwritev((int)tf->tf_a0,
+					  (const struct iovec *)tf->tf_a1,
+					  (int)tf->tf_a2, pos, &retval);
+			break;
+		}
+		break;
+
+		case SYS_readv:
+		err = sys_readv((int)tf->tf_a0, (const struct iovec *)tf->tf_a1, (int)tf->tf_a2, &retval);
+		break;
+
+		case SYS_writev:
+		err = sys_writev((int)tf->tf_a0, (const struct iovec *)tf->tf_a1, (int)tf->tf_a2, &retval);
+		break;
+
 		case SYS_lseek:
 		result = copyin((const_userptr_t)tf->tf_sp + 16, &whence, sizeof(int32_t));
 		if (result) {
@@ -184,16 +236,38 @@ syscall(struct trapframe *tf)
 		err = sys_dup2((int)tf->tf_a0, (int)tf->tf_a1, &retval);
 		break;
 
+		case SYS_pipe:
+		err = sys_pipe((userptr_t)tf->tf_a0, &retval);
+		break;
+
 		case SYS_execv:
 		err = sys_execv((const char *)tf->tf_a0, (char**)tf->tf_a1);
 		break;
 
+		case SYS_spawn:
+		err = sys_spawn((const char *)tf->tf_a0, (char**)tf->tf_a1, &retval);
+		break;
+
+		case SYS_fsync:
+		err = sys_fsync((int)tf->tf_a0);
+		break;
+
+		case SYS_sync:
+		err = sys_sync();
+		break;
+
+		case SYS_sysbatch:
+		err = sys_sysbatch((userptr_t)tf->tf_a0, (int)tf->tf_a1, &retval);
+		break;
+
 	    default:
 		kprintf("Unknown syscall %d\n", callno);
 		err = ENOSYS;
 		break;
 	}
 
+	scstats_record(tf, callno, err, retval, startcpu, startcycles);
+
 	if (err) {
 		/*
 		 * Return the error code. This gets converted at
@@ -100,6 +100,21 @@ cpu_machdep_init(struct cpu *c)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Cycle counter. c0_count counts every cycle; lamebus_machdep.c also
+ * uses it, via c0_compare, for the on-chip timer.
+ */
+uint32_t
+cpu_getcycles(void)
+{
+	uint32_t count;
+
+	__asm volatile("mfc0 %0,$9" : "=r" (count));
+	return count;
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Return the type name of the currently running CPU.
  *
@@ -35,6 +35,11 @@
 #include <spinlock.h>
 #include <proc.h>
 #include <current.h>
+#include <membar.h>
+#include <bitmap.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
@@ -64,10 +69,64 @@
  */
 static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
 
+/*
+ * Pre-zeroed memory. dumbvm takes memory from ram_stealmem in address
+ * order and never gives it back, so the free memory is just everything
+ * from ram_nextfree() up. Idle cpus zero it a page at a time, up to
+ * DUMBVM_PREZERO pages ahead, so that getppages_zeroed mostly doesn't
+ * have to. Memory from ram_nextfree() up to dumbvm_zeroed is known to
+ * be zero. Protected by stealmem_lock.
+ */
+#define DUMBVM_PREZERO (2 * DUMBVM_STACKPAGES)
+static paddr_t dumbvm_zeroed;
+
+/*
+ * Demand loading of executables.
+ *
+ * A region defined with a backing file gets a dumbvm_image, which
+ * says where in the file the region's contents come from and which
+ * of its pages have been read in so far. Nothing is read at exec
+ * time; vm_fault zero-fills and reads each page the first time it is
+ * touched. (The physical memory is still allocated in one piece up
+ * front, as dumbvm does for everything.) Since pages are read long
+ * after exec, the file must stay as it was: each image counts itself
+ * with vnode_textref, and writing to the file fails with ETXTBSY.
+ *
+ * Read-only regions (program text) are shared: an address space
+ * defining the same segment of the same file as an existing image
+ * just takes a reference to it, so processes running the same
+ * program share both the memory and the cost of reading it in.
+ * Their pages go into the TLB without TLBLO_DIRTY, so stores to them
+ * fault. Writable regions get a private image each.
+ */
+struct dumbvm_image {
+	struct vnode *di_vnode;		/* file the contents come from */
+	off_t di_offset;		/* file offset of di_segvaddr */
+	vaddr_t di_segvaddr;		/* where the file contents start */
+	size_t di_filesz;		/* how much comes from the file */
+	vaddr_t di_vbase;		/* page-aligned region */
+	size_t di_npages;
+	paddr_t di_pbase;		/* 0 until as_prepare_load */
+	bool di_shared;			/* read-only, on dumbvm_images */
+	unsigned di_refcount;		/* address spaces using it */
+	struct bitmap *di_loaded;	/* pages read in so far */
+	struct bitmap *di_busy;		/* pages being read in now */
+	struct lock *di_lock;		/* for di_pbase and the bitmaps */
+	struct cv *di_cv;		/* for waiting on di_busy */
+	struct dumbvm_image *di_next;	/* next on dumbvm_images */
+};
+
+/* Shared images, and a lock for the list and their refcounts */
+static struct dumbvm_image *dumbvm_images;
+static struct lock *dumbvm_imagelock;
+
 void
 vm_bootstrap(void)
 {
-	/* Do nothing. */
+	dumbvm_imagelock = lock_create("dumbvm_images");
+	if (dumbvm_imagelock == NULL) {
+		panic("dumbvm: Could not create image lock\n");
+	}
 }
 
 /*
@@ -104,6 +163,336 @@ getppages(unsigned long npages)
 	return addr;
 }
 
+/*
+ * Like getppages, but the memory comes back zeroed. Whatever part of
+ * it the idle cpus already got to doesn't need doing again.
+ */
+static
+paddr_t
+getppages_zeroed(unsigned long npages)
+{
+	paddr_t addr;
+	size_t size, done;
+
+	size = npages * PAGE_SIZE;
+	done = 0;
+
+	spinlock_acquire(&stealmem_lock);
+
+	addr = ram_stealmem(npages);
+	if (addr != 0 && dumbvm_zeroed > addr) {
+		done = dumbvm_zeroed - addr;
+		if (done > size) {
+			done = size;
+		}
+	}
+
+	spinlock_release(&stealmem_lock);
+
+	if (addr != 0 && done < size) {
+		bzero((void *)PADDR_TO_KVADDR(addr + done), size - done);
+	}
+	return addr;
+}
+
+/*
+ * Zero the next free page, if we aren't far enough ahead already.
+ * This runs on an idle cpu with interrupts off, holding stealmem_lock
+ * so the page can't be taken while we're writing it; one page at a
+ * time keeps both of those short.
+ */
+bool
+vm_idle(void)
+{
+	paddr_t next;
+	bool did = false;
+
+	spinlock_acquire(&stealmem_lock);
+
+	next = ram_nextfree();
+	if (dumbvm_zeroed < next) {
+		dumbvm_zeroed = next;
+	}
+	if (next != 0 &&
+	    dumbvm_zeroed < next + DUMBVM_PREZERO * PAGE_SIZE &&
+	    dumbvm_zeroed + PAGE_SIZE <= ram_getsize()) {
+		bzero((void *)PADDR_TO_KVADDR(dumbvm_zeroed), PAGE_SIZE);
+		dumbvm_zeroed += PAGE_SIZE;
+		did = true;
+	}
+
+	spinlock_release(&stealmem_lock);
+	return did;
+}
+
+/*
+ * Make a new image for a region, holding a reference to its file.
+ */
+static
+struct dumbvm_image *
+dumbvm_image_create(struct vnode *v, off_t offset, vaddr_t segvaddr,
+		    size_t filesz, vaddr_t vbase, size_t npages, bool shared)
+{
+	struct dumbvm_image *di;
+
+	di = kmalloc(sizeof(*di));
+	if (di == NULL) {
+		return NULL;
+	}
+	di->di_loaded = bitmap_create(npages);
+	di->di_busy = bitmap_create(npages);
+	di->di_lock = lock_create("dumbvm_image");
+	di->di_cv = cv_create("dumbvm_image");
+	if (di->di_loaded == NULL || di->di_busy == NULL ||
+	    di->di_lock == NULL || di->di_cv == NULL) {
+		if (di->di_cv != NULL) {
+			cv_destroy(di->di_cv);
+		}
+		if (di->di_lock != NULL) {
+			lock_destroy(di->di_lock);
+		}
+		if (di->di_busy != NULL) {
+			bitmap_destroy(di->di_busy);
+		}
+		if (di->di_loaded != NULL) {
+			bitmap_destroy(di->di_loaded);
+		}
+		kfree(di);
+		return NULL;
+	}
+	VOP_INCREF(v);
+	vnode_textref(v);
+	di->di_vnode = v;
+	di->di_offset = offset;
+	di->di_segvaddr = segvaddr;
+	di->di_filesz = filesz;
+	di->di_vbase = vbase;
+	di->di_npages = npages;
+	di->di_pbase = 0;
+	di->di_shared = shared;
+	di->di_refcount = 1;
+	di->di_next = NULL;
+	return di;
+}
+
+/*
+ * Free an image. Its memory is leaked, like everything else here.
+ */
+static
+void
+dumbvm_image_destroy(struct dumbvm_image *di)
+{
+	vnode_textunref(di->di_vnode);
+	VOP_DECREF(di->di_vnode);
+	cv_destroy(di->di_cv);
+	lock_destroy(di->di_lock);
+	bitmap_destroy(di->di_busy);
+	bitmap_destroy(di->di_loaded);
+	kfree(di);
+}
+
+/*
+ * Get the image for a region backed by a file: a reference to a
+ * matching shared one if the region is read-only and there is one,
+ * otherwise a new one.
+ */
+static
+struct dumbvm_image *
+dumbvm_image_get(struct vnode *v, off_t offset, vaddr_t segvaddr,
+		 size_t filesz, vaddr_t vbase, size_t npages, bool shared)
+{
+	struct dumbvm_image *di;
+
+	if (!shared) {
+		return dumbvm_image_create(v, offset, segvaddr, filesz,
+					   vbase, npages, false);
+	}
+
+	lock_acquire(dumbvm_imagelock);
+	for (di = dumbvm_images; di != NULL; di = di->di_next) {
+		if (di->di_vnode == v && di->di_offset == offset &&
+		    di->di_segvaddr == segvaddr && di->di_filesz == filesz &&
+		    di->di_vbase == vbase && di->di_npages == npages) {
+			di->di_refcount++;
+			lock_release(dumbvm_imagelock);
+			return di;
+		}
+	}
+	di = dumbvm_image_create(v, offset, segvaddr, filesz,
+				 vbase, npages, true);
+	if (di != NULL) {
+		di->di_next = dumbvm_images;
+		dumbvm_images = di;
+	}
+	lock_release(dumbvm_imagelock);
+	return di;
+}
+
+/*
+ * Drop a reference to an image.
+ */
+static
+void
+dumbvm_image_release(struct dumbvm_image *di)
+{
+	struct dumbvm_image **dp;
+
+	if (!di->di_shared) {
+		dumbvm_image_destroy(di);
+		return;
+	}
+
+	lock_acquire(dumbvm_imagelock);
+	KASSERT(di->di_refcount > 0);
+	di->di_refcount--;
+	if (di->di_refcount > 0) {
+		lock_release(dumbvm_imagelock);
+		return;
+	}
+	for (dp = &dumbvm_images; *dp != di; dp = &(*dp)->di_next) {
+		KASSERT(*dp != NULL);
+	}
+	*dp = di->di_next;
+	lock_release(dumbvm_imagelock);
+
+	dumbvm_image_destroy(di);
+}
+
+/*
+ * Get an image for a copy of an address space: another reference if
+ * it's shared, otherwise a private copy that knows the same pages
+ * are loaded. The caller copies the memory itself.
+ */
+static
+struct dumbvm_image *
+dumbvm_image_copy(struct dumbvm_image *old)
+{
+	struct dumbvm_image *di;
+	unsigned i;
+
+	if (old->di_shared) {
+		lock_acquire(dumbvm_imagelock);
+		old->di_refcount++;
+		lock_release(dumbvm_imagelock);
+		return old;
+	}
+
+	di = dumbvm_image_create(old->di_vnode, old->di_offset,
+				 old->di_segvaddr, old->di_filesz,
+				 old->di_vbase, old->di_npages, false);
+	if (di == NULL) {
+		return NULL;
+	}
+	for (i=0; i<old->di_npages; i++) {
+		if (bitmap_isset(old->di_loaded, i)) {
+			bitmap_mark(di->di_loaded, i);
+		}
+	}
+	return di;
+}
+
+/*
+ * Give a shared image its memory if nobody has yet, or a private
+ * image the region's memory. Returns the physical base.
+ */
+static
+paddr_t
+dumbvm_image_alloc(struct dumbvm_image *di)
+{
+	paddr_t pa;
+
+	lock_acquire(di->di_lock);
+	if (di->di_pbase == 0) {
+		di->di_pbase = getppages(di->di_npages);
+	}
+	pa = di->di_pbase;
+	lock_release(di->di_lock);
+	return pa;
+}
+
+/*
+ * Make sure the page at VADDR in an image has been read in: zero it,
+ * and read whatever part of the file falls in it.
+ *
+ * The read happens with di_lock released and the page marked busy,
+ * so faults on other pages of the image don't wait for it and faults
+ * on this page wait only for it. A thread faulting here must not
+ * hold anything VOP_READ needs, which is why the filesystems never
+ * touch user memory under their locks (see sfs_bounceio and
+ * emu_doread).
+ */
+static
+int
+dumbvm_image_pagein(struct dumbvm_image *di, vaddr_t vaddr)
+{
+	unsigned pageno;
+	vaddr_t start, end;
+	char *kva;
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(vaddr >= di->di_vbase);
+	pageno = (vaddr - di->di_vbase) / PAGE_SIZE;
+	KASSERT(pageno < di->di_npages);
+
+	/* Usually it's just a TLB refill. */
+	if (bitmap_isset(di->di_loaded, pageno)) {
+		membar_load_load();
+		return 0;
+	}
+
+	dumbvm_can_sleep();
+	lock_acquire(di->di_lock);
+	while (bitmap_isset(di->di_busy, pageno)) {
+		cv_wait(di->di_cv, di->di_lock);
+	}
+	if (bitmap_isset(di->di_loaded, pageno)) {
+		/* someone else got it while we waited */
+		lock_release(di->di_lock);
+		return 0;
+	}
+	bitmap_mark(di->di_busy, pageno);
+	lock_release(di->di_lock);
+
+	kva = (char *)PADDR_TO_KVADDR(di->di_pbase + pageno * PAGE_SIZE);
+	bzero(kva, PAGE_SIZE);
+
+	/* The part of the page that comes from the file */
+	start = vaddr;
+	end = vaddr + PAGE_SIZE;
+	if (start < di->di_segvaddr) {
+		start = di->di_segvaddr;
+	}
+	if (end > di->di_segvaddr + di->di_filesz) {
+		end = di->di_segvaddr + di->di_filesz;
+	}
+
+	result = 0;
+	if (start < end) {
+		DEBUG(DB_VM, "dumbvm: paging in 0x%x\n", vaddr);
+		uio_kinit(&iov, &ku, kva + (start - vaddr), end - start,
+			  di->di_offset + (start - di->di_segvaddr),
+			  UIO_READ);
+		result = VOP_READ(di->di_vnode, &ku);
+		if (result == 0 && ku.uio_resid != 0) {
+			/* The file shrank since exec; the rest stays zero */
+			kprintf("dumbvm: short read paging in 0x%x\n",
+				vaddr);
+		}
+	}
+
+	lock_acquire(di->di_lock);
+	bitmap_unmark(di->di_busy, pageno);
+	if (result == 0) {
+		membar_store_store();
+		bitmap_mark(di->di_loaded, pageno);
+	}
+	cv_broadcast(di->di_cv, di->di_lock);
+	lock_release(di->di_lock);
+	return result;
+}
+
 /* Allocate/free some kernel-space virtual pages */
 vaddr_t
 alloc_kpages(unsigned npages)
@@ -150,7 +539,9 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	int i;
 	uint32_t ehi, elo;
 	struct addrspace *as;
+	struct dumbvm_image *image;
 	int spl;
+	int result;
 
 	faultaddress &= PAGE_FRAME;
 
@@ -158,8 +549,8 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 
 	switch (faulttype) {
 	    case VM_FAULT_READONLY:
-		/* We always create pages read-write, so we can't get this */
-		panic("dumbvm: got VM_FAULT_READONLY\n");
+		/* A store to shared program text */
+		return EFAULT;
 	    case VM_FAULT_READ:
 	    case VM_FAULT_WRITE:
 		break;
@@ -208,12 +599,15 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 
 	if (faultaddress >= vbase1 && faultaddress < vtop1) {
 		paddr = (faultaddress - vbase1) + as->as_pbase1;
+		image = as->as_image1;
 	}
 	else if (faultaddress >= vbase2 && faultaddress < vtop2) {
 		paddr = (faultaddress - vbase2) + as->as_pbase2;
+		image = as->as_image2;
 	}
 	else if (faultaddress >= stackbase && faultaddress < stacktop) {
 		paddr = (faultaddress - stackbase) + as->as_stackpbase;
+		image = NULL;
 	}
 	else {
 		return EFAULT;
@@ -222,6 +616,17 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	/* make sure it's page-aligned */
 	KASSERT((paddr & PAGE_FRAME) == paddr);
 
+	/* Read the page in if this is the first touch */
+	if (image != NULL) {
+		if (image->di_shared && faulttype == VM_FAULT_WRITE) {
+			return EFAULT;
+		}
+		result = dumbvm_image_pagein(image, faultaddress);
+		if (result) {
+			return result;
+		}
+	}
+
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
@@ -231,7 +636,10 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 			continue;
 		}
 		ehi = faultaddress;
-		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
+		elo = paddr | TLBLO_VALID;
+		if (image == NULL || !image->di_shared) {
+			elo |= TLBLO_DIRTY;
+		}
 		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
 		tlb_write(ehi, elo, i);
 		splx(spl);
@@ -254,9 +662,11 @@ as_create(void)
 	as->as_vbase1 = 0;
 	as->as_pbase1 = 0;
 	as->as_npages1 = 0;
+	as->as_image1 = NULL;
 	as->as_vbase2 = 0;
 	as->as_pbase2 = 0;
 	as->as_npages2 = 0;
+	as->as_image2 = NULL;
 	as->as_stackpbase = 0;
 
 	return as;
@@ -266,6 +676,12 @@ void
 as_destroy(struct addrspace *as)
 {
 	dumbvm_can_sleep();
+	if (as->as_image1 != NULL) {
+		dumbvm_image_release(as->as_image1);
+	}
+	if (as->as_image2 != NULL) {
+		dumbvm_image_release(as->as_image2);
+	}
 	kfree(as);
 }
 
@@ -298,9 +714,12 @@ as_deactivate(void)
 
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
+		 struct vnode *v, off_t offset, size_t filesz,
 		 int readable, int writeable, int executable)
 {
+	vaddr_t segvaddr = vaddr;
 	size_t npages;
+	struct dumbvm_image *image = NULL;
 
 	dumbvm_can_sleep();
 
@@ -313,23 +732,37 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 
 	npages = sz / PAGE_SIZE;
 
-	/* We don't use these - all pages are read-write */
+	/* Only writeability matters, and only for file-backed regions */
 	(void)readable;
-	(void)writeable;
 	(void)executable;
 
+	if (as->as_vbase1 != 0 && as->as_vbase2 != 0) {
+		goto toomany;
+	}
+
+	if (v != NULL) {
+		image = dumbvm_image_get(v, offset, segvaddr, filesz,
+					 vaddr, npages, !writeable);
+		if (image == NULL) {
+			return ENOMEM;
+		}
+	}
+
 	if (as->as_vbase1 == 0) {
 		as->as_vbase1 = vaddr;
 		as->as_npages1 = npages;
+		as->as_image1 = image;
 		return 0;
 	}
 
 	if (as->as_vbase2 == 0) {
 		as->as_vbase2 = vaddr;
 		as->as_npages2 = npages;
+		as->as_image2 = image;
 		return 0;
 	}
 
+ toomany:
 	/*
 	 * Support for more than two regions is not available.
 	 */
@@ -337,13 +770,6 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 	return ENOSYS;
 }
 
-static
-void
-as_zero_region(paddr_t paddr, unsigned npages)
-{
-	bzero((void *)PADDR_TO_KVADDR(paddr), npages * PAGE_SIZE);
-}
-
 int
 as_prepare_load(struct addrspace *as)
 {
@@ -353,25 +779,32 @@ as_prepare_load(struct addrspace *as)
 
 	dumbvm_can_sleep();
 
-	as->as_pbase1 = getppages(as->as_npages1);
+	/* File-backed pages get zeroed as they're read in */
+	if (as->as_image1 != NULL) {
+		as->as_pbase1 = dumbvm_image_alloc(as->as_image1);
+	}
+	else {
+		as->as_pbase1 = getppages_zeroed(as->as_npages1);
+	}
 	if (as->as_pbase1 == 0) {
 		return ENOMEM;
 	}
 
-	as->as_pbase2 = getppages(as->as_npages2);
+	if (as->as_image2 != NULL) {
+		as->as_pbase2 = dumbvm_image_alloc(as->as_image2);
+	}
+	else {
+		as->as_pbase2 = getppages_zeroed(as->as_npages2);
+	}
 	if (as->as_pbase2 == 0) {
 		return ENOMEM;
 	}
 
-	as->as_stackpbase = getppages(DUMBVM_STACKPAGES);
+	as->as_stackpbase = getppages_zeroed(DUMBVM_STACKPAGES);
 	if (as->as_stackpbase == 0) {
 		return ENOMEM;
 	}
 
-	as_zero_region(as->as_pbase1, as->as_npages1);
-	as_zero_region(as->as_pbase2, as->as_npages2);
-	as_zero_region(as->as_stackpbase, DUMBVM_STACKPAGES);
-
 	return 0;
 }
 
@@ -409,6 +842,22 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	new->as_vbase2 = old->as_vbase2;
 	new->as_npages2 = old->as_npages2;
 
+	/* Shared text stays shared; private images get copied */
+	if (old->as_image1 != NULL) {
+		new->as_image1 = dumbvm_image_copy(old->as_image1);
+		if (new->as_image1 == NULL) {
+			as_destroy(new);
+			return ENOMEM;
+		}
+	}
+	if (old->as_image2 != NULL) {
+		new->as_image2 = dumbvm_image_copy(old->as_image2);
+		if (new->as_image2 == NULL) {
+			as_destroy(new);
+			return ENOMEM;
+		}
+	}
+
 	/* (Mis)use as_prepare_load to allocate some physical memory. */
 	if (as_prepare_load(new)) {
 		as_destroy(new);
@@ -419,13 +868,17 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	KASSERT(new->as_pbase2 != 0);
 	KASSERT(new->as_stackpbase != 0);
 
-	memmove((void *)PADDR_TO_KVADDR(new->as_pbase1),
-		(const void *)PADDR_TO_KVADDR(old->as_pbase1),
-		old->as_npages1*PAGE_SIZE);
+	if (new->as_pbase1 != old->as_pbase1) {
+		memmove((void *)PADDR_TO_KVADDR(new->as_pbase1),
+			(const void *)PADDR_TO_KVADDR(old->as_pbase1),
+			old->as_npages1*PAGE_SIZE);
+	}
 
-	memmove((void *)PADDR_TO_KVADDR(new->as_pbase2),
-		(const void *)PADDR_TO_KVADDR(old->as_pbase2),
-		old->as_npages2*PAGE_SIZE);
+	if (new->as_pbase2 != old->as_pbase2) {
+		memmove((void *)PADDR_TO_KVADDR(new->as_pbase2),
+			(const void *)PADDR_TO_KVADDR(old->as_pbase2),
+			old->as_npages2*PAGE_SIZE);
+	}
 
 	memmove((void *)PADDR_TO_KVADDR(new->as_stackpbase),
 		(const void *)PADDR_TO_KVADDR(old->as_stackpbase),
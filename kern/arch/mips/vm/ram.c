@@ -109,6 +109,17 @@ ram_stealmem(unsigned long npages)
 	return paddr;
 }
 
+/*
+ * Return where the next ram_stealmem will take memory from, so a
+ * caller can (for instance) prepare memory ahead of time. As with
+ * ram_stealmem, the caller provides any synchronization.
+ */
+paddr_t
+ram_nextfree(void)
+{
+	return firstpaddr;
+}
+
 /*
  * This function is intended to be called by the VM system when it
  * initializes in order to find out what memory it has available to
@@ -263,12 +263,19 @@ emu_close(struct emu_softc *sc, uint32_t handle)
 
 /*
  * Common code for read and readdir.
+ *
+ * Transfers to and from user space go through a bounce buffer, so
+ * that e_lock isn't held while touching user memory: executables are
+ * paged in on demand, so the fault could need this device again.
  */
 static
 int
 emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	   uint32_t op, struct uio *uio)
 {
+	char *bounce = NULL;
+	uint32_t amt;
+	off_t newoffset;
 	int result;
 
 	KASSERT(uio->uio_rw == UIO_READ);
@@ -278,6 +285,13 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 		return 0;
 	}
 
+	if (uio->uio_segflg != UIO_SYSSPACE) {
+		bounce = kmalloc(len);
+		if (bounce == NULL) {
+			return ENOMEM;
+		}
+	}
+
 	lock_acquire(sc->e_lock);
 
 	emu_wreg(sc, REG_HANDLE, handle);
@@ -286,16 +300,26 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	emu_wreg(sc, REG_OPER, op);
 	result = emu_waitdone(sc);
 	if (result) {
-		goto out;
+		lock_release(sc->e_lock);
+		kfree(bounce);
+		return result;
 	}
 
 	membar_load_load();
-	result = uiomove(sc->e_iobuf, emu_rreg(sc, REG_IOLEN), uio);
-
-	uio->uio_offset = emu_rreg(sc, REG_OFFSET);
+	amt = emu_rreg(sc, REG_IOLEN);
+	newoffset = emu_rreg(sc, REG_OFFSET);
+	if (bounce == NULL) {
+		result = uiomove(sc->e_iobuf, amt, uio);
+		lock_release(sc->e_lock);
+	}
+	else {
+		memcpy(bounce, sc->e_iobuf, amt);
+		lock_release(sc->e_lock);
+		result = uiomove(bounce, amt, uio);
+		kfree(bounce);
+	}
 
- out:
-	lock_release(sc->e_lock);
+	uio->uio_offset = newoffset;
 	return result;
 }
 
@@ -329,6 +353,8 @@ int
 emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	  struct uio *uio)
 {
+	char *bounce = NULL;
+	off_t offset;
 	int result;
 
 	KASSERT(uio->uio_rw == UIO_WRITE);
@@ -337,13 +363,34 @@ emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 		return EFBIG;
 	}
 
+	/* As in emu_doread, don't touch user memory under e_lock */
+	offset = uio->uio_offset;
+	if (uio->uio_segflg != UIO_SYSSPACE) {
+		bounce = kmalloc(len);
+		if (bounce == NULL) {
+			return ENOMEM;
+		}
+		result = uiomove(bounce, len, uio);
+		if (result) {
+			kfree(bounce);
+			return result;
+		}
+	}
+
 	lock_acquire(sc->e_lock);
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_IOLEN, len);
-	emu_wreg(sc, REG_OFFSET, uio->uio_offset);
+	emu_wreg(sc, REG_OFFSET, offset);
 
-	result = uiomove(sc->e_iobuf, len, uio);
+	if (bounce == NULL) {
+		result = uiomove(sc->e_iobuf, len, uio);
+	}
+	else {
+		memcpy(sc->e_iobuf, bounce, len);
+		kfree(bounce);
+		result = 0;
+	}
 	membar_store_store();
 	if (result) {
 		goto out;
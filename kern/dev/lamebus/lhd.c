@@ -36,7 +36,7 @@
 #include <lib.h>
 #include <uio.h>
 #include <membar.h>
-#include <synch.h>
+#include <spinlock.h>
 #include <platform/bus.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
@@ -96,15 +96,106 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Start the sector lh_curdone of the current request. The disk does
+ * one sector at a time through the on-card buffer.
  */
 static
 void
+lhd_startsector(struct lhd_softc *lh)
+{
+	struct bio *bio = lh->lh_cur;
+	char *data = (char *)bio->bio_data + lh->lh_curdone * LHD_SECTSIZE;
+	uint32_t statval = LHD_WORKING;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+
+	/* Are we writing? If so, load the on-card buffer. */
+	if (bio->bio_rw == UIO_WRITE) {
+		memcpy(lh->lh_buf, data, LHD_SECTSIZE);
+		membar_store_store();
+		statval |= LHD_ISWRITE;
+	}
+
+	/* Tell it what sector we want... */
+	lhd_wreg(lh, LHD_REG_SECT, bio->bio_block + lh->lh_curdone);
+
+	/* and start the operation. */
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * If the disk is idle, start the next queued chain of requests.
+ */
+static
+void
+lhd_start(struct lhd_softc *lh)
+{
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+
+	if (lh->lh_curchain != NULL) {
+		return;
+	}
+	lh->lh_curchain = bioq_remove(&lh->lh_queue);
+	if (lh->lh_curchain == NULL) {
+		return;
+	}
+	lh->lh_cur = lh->lh_curchain;
+	lh->lh_curdone = 0;
+	lhd_startsector(lh);
+}
+
+/*
+ * A sector operation finished with result ERR. Collect the data if
+ * it was a read, and go on to the next sector of the request, or the
+ * next request in the chain. When the chain is done, start the next
+ * one and return the finished chain so the caller can finish its
+ * requests after dropping the lock.
+ */
+static
+struct bio *
 lhd_iodone(struct lhd_softc *lh, int err)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct bio *bio, *done;
+	char *data;
+
+	spinlock_acquire(&lh->lh_lock);
+
+	bio = lh->lh_cur;
+	if (bio == NULL) {
+		/* Spurious completion; nothing was running */
+		spinlock_release(&lh->lh_lock);
+		return NULL;
+	}
+
+	if (err == 0 && bio->bio_rw == UIO_READ) {
+		data = (char *)bio->bio_data + lh->lh_curdone * LHD_SECTSIZE;
+		membar_load_load();
+		memcpy(data, lh->lh_buf, LHD_SECTSIZE);
+	}
+
+	if (err == 0 && ++lh->lh_curdone < bio->bio_len / LHD_SECTSIZE) {
+		lhd_startsector(lh);
+		spinlock_release(&lh->lh_lock);
+		return NULL;
+	}
+
+	/* This request is done; an error only fails this one. */
+	bio->bio_result = err;
+	if (bio->bio_chain != NULL) {
+		lh->lh_cur = bio->bio_chain;
+		lh->lh_curdone = 0;
+		lhd_startsector(lh);
+		spinlock_release(&lh->lh_lock);
+		return NULL;
+	}
+
+	done = lh->lh_curchain;
+	lh->lh_curchain = NULL;
+	lh->lh_cur = NULL;
+	lhd_start(lh);
+
+	spinlock_release(&lh->lh_lock);
+	return done;
 }
 
 /*
@@ -116,6 +207,7 @@ void
 lhd_irq(void *vlh)
 {
 	struct lhd_softc *lh = vlh;
+	struct bio *bio, *next;
 	uint32_t val;
 
 	val = lhd_rdreg(lh, LHD_REG_STAT);
@@ -128,7 +220,13 @@ lhd_irq(void *vlh)
 	    case LHD_INVSECT:
 	    case LHD_MEDIA:
 		lhd_wreg(lh, LHD_REG_STAT, 0);
-		lhd_iodone(lh, lhd_code_to_errno(lh, val));
+		bio = lhd_iodone(lh, lhd_code_to_errno(lh, val));
+		while (bio != NULL) {
+			next = bio->bio_chain;
+			bio->bio_chain = NULL;
+			bio_finish(bio, bio->bio_result);
+			bio = next;
+		}
 		break;
 	}
 }
@@ -179,95 +277,116 @@ lhd_reset(struct lhd_softc *lh)
 }
 #endif
 
+/*
+ * Queue a request. If the disk is idle it starts right away;
+ * otherwise the interrupt handler starts it when its turn comes.
+ */
+static
+void
+lhd_strategy(struct device *d, struct bio *bio)
+{
+	struct lhd_softc *lh = d->d_data;
+	uint32_t len = bio->bio_len / LHD_SECTSIZE;
+
+	/* Don't allow I/O that isn't whole sectors. */
+	if (bio->bio_len % LHD_SECTSIZE != 0 || len == 0) {
+		bio_finish(bio, EINVAL);
+		return;
+	}
+
+	/* Don't allow I/O past the end of the disk. */
+	if (bio->bio_block >= lh->lh_dev.d_blocks ||
+	    len > lh->lh_dev.d_blocks - bio->bio_block) {
+		bio_finish(bio, EINVAL);
+		return;
+	}
+
+	spinlock_acquire(&lh->lh_lock);
+	bioq_insert(&lh->lh_queue, bio);
+	lhd_start(lh);
+	spinlock_release(&lh->lh_lock);
+}
+
 /*
  * I/O function (for both reads and writes)
+ *
+ * This is the synchronous path, through the same queue. Kernel
+ * buffers (which is what file systems use) are handed to the disk
+ * directly; anything else goes a sector at a time through a bounce
+ * buffer.
  */
 static
 int
 lhd_io(struct device *d, struct uio *uio)
 {
-	struct lhd_softc *lh = d->d_data;
-
 	uint32_t sector = uio->uio_offset / LHD_SECTSIZE;
 	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
-	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	uint32_t i;
-	uint32_t statval = LHD_WORKING;
+	struct iovec *iov;
+	char *bounce;
+	size_t len;
 	int result;
 
 	/* Don't allow I/O that isn't sector-aligned. */
 	if (sectoff != 0 || lenoff != 0) {
 		return EINVAL;
 	}
+	if (uio->uio_resid == 0) {
+		return 0;
+	}
 
-	/* Don't allow I/O past the end of the disk. */
-	/* XXX this check can overflow */
-	if (sector+len > lh->lh_dev.d_blocks) {
-		return EINVAL;
+	if (uio->uio_segflg == UIO_SYSSPACE && uio->uio_iovcnt == 1) {
+		iov = uio->uio_iov;
+		len = uio->uio_resid;
+		KASSERT(iov->iov_len >= len);
+
+		result = bio_io(d, sector, iov->iov_kbase, len, uio->uio_rw);
+		if (result) {
+			return result;
+		}
+		iov->iov_kbase = (char *)iov->iov_kbase + len;
+		iov->iov_len -= len;
+		uio->uio_offset += len;
+		uio->uio_resid = 0;
+		return 0;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	bounce = kmalloc(LHD_SECTSIZE);
+	if (bounce == NULL) {
+		return ENOMEM;
 	}
 
 	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
-
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
-
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
+	result = 0;
+	while (uio->uio_resid > 0) {
 		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			membar_store_store();
+			result = uiomove(bounce, LHD_SECTSIZE, uio);
 			if (result) {
-				V(lh->lh_clear);
-				return result;
+				break;
 			}
 		}
-
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
-
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
-
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
-
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
-
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			membar_load_load();
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-		}
-
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
+		result = bio_io(d, sector, bounce, LHD_SECTSIZE, uio->uio_rw);
 		if (result) {
-			return result;
+			break;
 		}
+		if (uio->uio_rw == UIO_READ) {
+			result = uiomove(bounce, LHD_SECTSIZE, uio);
+			if (result) {
+				break;
+			}
+		}
+		sector++;
 	}
 
-	return 0;
+	kfree(bounce);
+	return result;
 }
 
 static const struct device_ops lhd_devops = {
 	.devop_eachopen = lhd_eachopen,
 	.devop_io = lhd_io,
 	.devop_ioctl = lhd_ioctl,
+	.devop_strategy = lhd_strategy,
 };
 
 /*
@@ -276,25 +395,18 @@ static const struct device_ops lhd_devops = {
 int
 config_lhd(struct lhd_softc *lh, int lhdno)
 {
-	char name[32];
-
 	/* Figure out what our name is. */
-	snprintf(name, sizeof(name), "lhd%d", lhdno);
+	snprintf(lh->lh_name, sizeof(lh->lh_name), "lhd%d", lhdno);
 
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
-		return ENOMEM;
-	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
-		return ENOMEM;
-	}
+	/* Set up the request queue. */
+	spinlock_init(&lh->lh_lock);
+	bioq_init(&lh->lh_queue, lh->lh_name, &lh->lh_lock, LHD_SECTSIZE);
+	lh->lh_curchain = NULL;
+	lh->lh_cur = NULL;
+	lh->lh_curdone = 0;
 
 	/* Set up the VFS device structure. */
 	lh->lh_dev.d_ops = &lhd_devops;
@@ -304,5 +416,5 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	lh->lh_dev.d_data = lh;
 
 	/* Add the VFS device structure to the VFS device list. */
-	return vfs_adddev(name, &lh->lh_dev, 1);
+	return vfs_adddev(lh->lh_name, &lh->lh_dev, 1);
 }
@@ -30,7 +30,9 @@
 #ifndef _LAMEBUS_LHD_H_
 #define _LAMEBUS_LHD_H_
 
+#include <spinlock.h>
 #include <device.h>
+#include <bio.h>
 
 /*
  * Our sector size
@@ -50,10 +52,13 @@ struct lhd_softc {
 	 * Initialized by config_lhd
 	 */
 
+	char lh_name[16];		/* Our device name */
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+	struct spinlock lh_lock;	/* Protects the following */
+	struct bioqueue lh_queue;	/* Requests waiting for the disk */
+	struct bio *lh_curchain;	/* Chain of requests in progress */
+	struct bio *lh_cur;		/* Request in progress in the chain */
+	uint32_t lh_curdone;		/* Sectors of lh_cur finished so far */
 
 	struct device lh_dev;		/* VFS device structure */
 };
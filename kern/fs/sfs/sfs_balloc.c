@@ -33,22 +33,32 @@
  * Block allocation.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <bitmap.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 /*
- * Zero out a disk block.
+ * Zero out a disk block. This only zeroes a cache buffer; the zeros
+ * reach the disk when the buffer is written back, if nothing else
+ * has been put in it by then.
  */
 static
 int
 sfs_clearblock(struct sfs_fs *sfs, daddr_t block)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
+	struct sfs_buf *b;
+	int result;
 
-	return sfs_writeblock(sfs, block, zeros, SFS_BLOCKSIZE);
+	result = sfs_buf_get(sfs, block, false, &b);
+	if (result) {
+		return result;
+	}
+	bzero(b->b_data, SFS_BLOCKSIZE);
+	sfs_buf_markdirty(b);
+	sfs_buf_release(b);
+	return 0;
 }
 
 /*
@@ -59,11 +69,17 @@ sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
 {
 	int result;
 
+	/* Blocks reserved for delayed allocation aren't up for grabs */
+	if (sfs->sfs_nfree <= sfs->sfs_ndelayed) {
+		return ENOSPC;
+	}
+
 	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
 	if (result) {
 		return result;
 	}
 	sfs->sfs_freemapdirty = true;
+	sfs->sfs_nfree--;
 
 	if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: balloc: invalid block %u\n",
@@ -74,6 +90,7 @@ sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
 	result = sfs_clearblock(sfs, *diskblock);
 	if (result) {
 		bitmap_unmark(sfs->sfs_freemap, *diskblock);
+		sfs->sfs_nfree++;
 	}
 	return result;
 }
@@ -84,8 +101,17 @@ sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
 void
 sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 {
+	/* Whatever is cached for the block is garbage now */
+	sfs_cache_invalidate(sfs, diskblock);
+
+	/* With a journal, the block stays taken until the free commits */
+	if (sfs_journal_free(sfs, diskblock)) {
+		return;
+	}
+
 	bitmap_unmark(sfs->sfs_freemap, diskblock);
 	sfs->sfs_freemapdirty = true;
+	sfs->sfs_nfree++;
 }
 
 /*
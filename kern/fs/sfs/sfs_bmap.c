@@ -227,6 +227,9 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 
 	vfs_biglock_acquire();
 
+	/* Drop data past the new end that hasn't got a disk block yet */
+	sfs_cache_truncate(sv, blocklen);
+
 	/*
 	 * Go through the direct blocks. Discard any that are
 	 * past the limit we're truncating to.
@@ -0,0 +1,1015 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * SFS filesystem
+ *
+ * Block cache, write-back, and sequential read-ahead.
+ *
+ * Each mounted volume keeps a cache of disk blocks. The cache is
+ * write-back: sfs_writeblock and file writes only change the cached
+ * copy and mark it dirty, and the disk catches up later. Buffers are
+ * obtained with sfs_buf_get or one of its relatives, which hand back
+ * the buffer held; a held buffer is never recycled, and the holder
+ * calls sfs_buf_release when done with it. Like the rest of sfs the
+ * cache is protected by the vfs big lock, except for b_busy, which
+ * the disk interrupt handler clears and which is therefore under
+ * sfs_buflock.
+ *
+ * Dirty blocks get written when
+ *    - they have been dirty for SFS_DIRTY_MAXAGE seconds (the flusher
+ *      thread looks once a second);
+ *    - more than SFS_DIRTY_HIWAT buffers are dirty, in which case all
+ *      of them are started right away;
+ *    - the buffer is the one chosen for recycling;
+ *    - someone calls sfs_cache_flush, which is how sync and fsync
+ *      make things durable.
+ * Writes other than the recycling case are asynchronous. Metadata
+ * blocks pinned by the journal (b_jpinned) are exempt from all of
+ * these until their transaction commits; see sfs_journal.c.
+ *
+ * File data written into a hole is not given a disk block right
+ * away. Instead the buffer is kept on the file's sv_delayed list,
+ * keyed by file block, and a block is allocated for it only when it
+ * is about to be written. That way a file written and removed before
+ * the flusher gets to it never touches the freemap, and a file
+ * written in one go gets its blocks allocated together. Each delayed
+ * buffer holds a reservation of one free block (sfs_ndelayed) so the
+ * eventual allocation can't run out of space; to keep that exact,
+ * writes that would also need the indirect block allocated are not
+ * delayed.
+ *
+ * What fills the cache (besides ordinary reads) is read-ahead. When
+ * sfs_read sees a file being read sequentially it submits
+ * asynchronous reads for the next few blocks of the file and returns;
+ * the disk works on them while the process is busy with the data it
+ * already has. The window doubles on each sequential read up to
+ * SFS_RA_MAXWINDOW and collapses to zero on a seek.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <clock.h>
+#include <thread.h>
+#include <vfs.h>
+#include <bio.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+/* Read-ahead window bounds, in blocks */
+#define SFS_RA_MINWINDOW   2
+#define SFS_RA_MAXWINDOW   16
+
+/* Write-back thresholds */
+#define SFS_DIRTY_MAXAGE   5                 /* seconds */
+#define SFS_DIRTY_HIWAT    (SFS_NBUFS / 2)   /* buffers */
+#define SFS_DELAYED_MAX    (SFS_NBUFS / 4)   /* buffers */
+
+/* Dirty time to pass to sfs_cache_startwrites to mean "all of them" */
+#define SFS_ALLDIRTY       ((time_t)0x7fffffffffffffffLL)
+
+#define SFS_BUFHASHFN(block) ((block) % SFS_BUFHASH)
+
+/*
+ * Mounted volumes, for the flusher thread. Protected by the big lock.
+ */
+static struct sfs_fs *sfs_volumes;
+static bool sfs_flusher_started;
+
+static void sfs_flusher(void *, unsigned long);
+
+////////////////////////////////////////////////////////////
+// Block cache
+
+/*
+ * Set up the block cache for a volume.
+ */
+int
+sfs_cache_init(struct sfs_fs *sfs)
+{
+	struct sfs_buf *b;
+	unsigned i;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(sfs->sfs_bufs == NULL);
+
+	if (!sfs_flusher_started) {
+		result = thread_fork("sfs_flusher", NULL, sfs_flusher,
+				     NULL, 0);
+		if (result) {
+			return result;
+		}
+		sfs_flusher_started = true;
+	}
+
+	sfs->sfs_bufwchan = wchan_create("sfs_buf");
+	if (sfs->sfs_bufwchan == NULL) {
+		return ENOMEM;
+	}
+	sfs->sfs_bufs = kmalloc(SFS_NBUFS * sizeof(struct sfs_buf));
+	if (sfs->sfs_bufs == NULL) {
+		wchan_destroy(sfs->sfs_bufwchan);
+		sfs->sfs_bufwchan = NULL;
+		return ENOMEM;
+	}
+	for (i=0; i<SFS_NBUFS; i++) {
+		b = &sfs->sfs_bufs[i];
+		b->b_block = 0;
+		b->b_sv = NULL;
+		b->b_fileblock = 0;
+		b->b_valid = false;
+		b->b_dirty = false;
+		b->b_jpinned = false;
+		b->b_dirtytime = 0;
+		b->b_refcount = 0;
+		b->b_busy = false;
+		b->b_lastuse = 0;
+		b->b_hashnext = NULL;
+		b->b_fs = sfs;
+		b->b_bio.bio_rw = UIO_READ;
+		b->b_bio.bio_result = 0;
+		b->b_data = kmalloc(SFS_BLOCKSIZE);
+		if (b->b_data == NULL) {
+			while (i-- > 0) {
+				kfree(sfs->sfs_bufs[i].b_data);
+			}
+			kfree(sfs->sfs_bufs);
+			sfs->sfs_bufs = NULL;
+			wchan_destroy(sfs->sfs_bufwchan);
+			sfs->sfs_bufwchan = NULL;
+			return ENOMEM;
+		}
+	}
+	for (i=0; i<SFS_BUFHASH; i++) {
+		sfs->sfs_bufhash[i] = NULL;
+	}
+	sfs->sfs_bufclock = 0;
+	sfs->sfs_ndirty = 0;
+	sfs->sfs_ndelayed = 0;
+
+	sfs->sfs_nextvol = sfs_volumes;
+	sfs_volumes = sfs;
+	return 0;
+}
+
+/*
+ * Wait for any I/O in progress on a buffer to finish.
+ */
+static
+void
+sfs_cache_wait(struct sfs_fs *sfs, struct sfs_buf *b)
+{
+	spinlock_acquire(&sfs->sfs_buflock);
+	while (b->b_busy) {
+		wchan_sleep(sfs->sfs_bufwchan, &sfs->sfs_buflock);
+	}
+	spinlock_release(&sfs->sfs_buflock);
+}
+
+/*
+ * Wait until no buffer has I/O in progress.
+ */
+static
+void
+sfs_cache_waitall(struct sfs_fs *sfs)
+{
+	unsigned i;
+
+	spinlock_acquire(&sfs->sfs_buflock);
+	for (i=0; i<SFS_NBUFS; i++) {
+		while (sfs->sfs_bufs[i].b_busy) {
+			wchan_sleep(sfs->sfs_bufwchan, &sfs->sfs_buflock);
+		}
+	}
+	spinlock_release(&sfs->sfs_buflock);
+}
+
+/*
+ * Throw away the block cache. The volume has been synced, so nothing
+ * should be dirty, but a failed write might have left something.
+ */
+void
+sfs_cache_cleanup(struct sfs_fs *sfs)
+{
+	struct sfs_fs **sp;
+	unsigned i;
+
+	if (sfs->sfs_bufs == NULL) {
+		return;
+	}
+
+	for (sp = &sfs_volumes; *sp != NULL; sp = &(*sp)->sfs_nextvol) {
+		if (*sp == sfs) {
+			*sp = sfs->sfs_nextvol;
+			break;
+		}
+	}
+
+	sfs_cache_waitall(sfs);
+	if (sfs->sfs_ndirty > 0) {
+		kprintf("sfs: %s: discarding %u dirty blocks\n",
+			sfs->sfs_sb.sb_volname, sfs->sfs_ndirty);
+	}
+	for (i=0; i<SFS_NBUFS; i++) {
+		KASSERT(sfs->sfs_bufs[i].b_refcount == 0);
+		kfree(sfs->sfs_bufs[i].b_data);
+	}
+	kfree(sfs->sfs_bufs);
+	sfs->sfs_bufs = NULL;
+	wchan_destroy(sfs->sfs_bufwchan);
+	sfs->sfs_bufwchan = NULL;
+}
+
+/*
+ * Find the buffer for BLOCK, if any. It might still be busy.
+ */
+static
+struct sfs_buf *
+sfs_cache_find(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_buf *b;
+
+	for (b = sfs->sfs_bufhash[SFS_BUFHASHFN(block)];
+	     b != NULL; b = b->b_hashnext) {
+		if (b->b_block == block) {
+			KASSERT(b->b_valid);
+			return b;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Put a buffer on the hash chain for BLOCK.
+ */
+static
+void
+sfs_cache_hash(struct sfs_fs *sfs, struct sfs_buf *b, daddr_t block)
+{
+	unsigned h;
+
+	KASSERT(!b->b_valid);
+	KASSERT(block != 0);
+
+	h = SFS_BUFHASHFN(block);
+	b->b_block = block;
+	b->b_sv = NULL;
+	b->b_valid = true;
+	b->b_hashnext = sfs->sfs_bufhash[h];
+	sfs->sfs_bufhash[h] = b;
+}
+
+/*
+ * Take a buffer off its hash chain, or its file's delayed list, and
+ * mark it empty. Anything dirty in it is lost.
+ */
+static
+void
+sfs_cache_unhash(struct sfs_fs *sfs, struct sfs_buf *b)
+{
+	struct sfs_buf **bp;
+
+	KASSERT(b->b_valid);
+	KASSERT(!b->b_busy);
+
+	if (b->b_sv != NULL) {
+		bp = &b->b_sv->sv_delayed;
+	}
+	else {
+		bp = &sfs->sfs_bufhash[SFS_BUFHASHFN(b->b_block)];
+	}
+	while (*bp != b) {
+		if (*bp == NULL) {
+			panic("sfs: %s: cached block %u not on its chain\n",
+			      sfs->sfs_sb.sb_volname, b->b_block);
+		}
+		bp = &(*bp)->b_hashnext;
+	}
+	*bp = b->b_hashnext;
+	b->b_hashnext = NULL;
+
+	if (b->b_jpinned) {
+		sfs_journal_forget(sfs, b);
+	}
+	if (b->b_sv != NULL) {
+		KASSERT(sfs->sfs_ndelayed > 0);
+		sfs->sfs_ndelayed--;
+		b->b_sv = NULL;
+	}
+	if (b->b_dirty) {
+		KASSERT(sfs->sfs_ndirty > 0);
+		sfs->sfs_ndirty--;
+		b->b_dirty = false;
+	}
+	b->b_valid = false;
+}
+
+/*
+ * Completion function for asynchronous I/O on the cache. Runs in
+ * interrupt context; bio_result stays behind for sfs_cache_reap.
+ */
+static
+void
+sfs_cache_iodone(struct bio *bio)
+{
+	struct sfs_buf *b = bio->bio_arg;
+	struct sfs_fs *sfs = b->b_fs;
+
+	spinlock_acquire(&sfs->sfs_buflock);
+	b->b_busy = false;
+	wchan_wakeall(sfs->sfs_bufwchan, &sfs->sfs_buflock);
+	spinlock_release(&sfs->sfs_buflock);
+}
+
+/*
+ * Deal with the outcome of finished asynchronous I/O on a buffer. A
+ * failed read leaves nothing worth keeping, so the buffer is dropped;
+ * a failed write leaves the buffer dirty so it gets tried again.
+ */
+static
+int
+sfs_cache_reap(struct sfs_fs *sfs, struct sfs_buf *b)
+{
+	int result;
+
+	KASSERT(!b->b_busy);
+
+	result = b->b_bio.bio_result;
+	if (result == 0) {
+		return 0;
+	}
+	b->b_bio.bio_result = 0;
+
+	if (b->b_bio.bio_rw == UIO_READ) {
+		sfs_cache_unhash(sfs, b);
+	}
+	else {
+		kprintf("sfs: %s: write of block %u failed: %s\n",
+			sfs->sfs_sb.sb_volname, b->b_block, strerror(result));
+		if (!b->b_dirty) {
+			b->b_dirty = true;
+			sfs->sfs_ndirty++;
+		}
+	}
+	return result;
+}
+
+/*
+ * Start writing a dirty buffer back to disk.
+ */
+static
+void
+sfs_cache_startwrite(struct sfs_fs *sfs, struct sfs_buf *b)
+{
+	KASSERT(b->b_valid);
+	KASSERT(b->b_dirty);
+	KASSERT(b->b_sv == NULL);
+	KASSERT(!b->b_busy);
+
+	b->b_dirty = false;
+	sfs->sfs_ndirty--;
+
+	b->b_busy = true;
+	bio_init(&b->b_bio, b->b_block, b->b_data, SFS_BLOCKSIZE, UIO_WRITE,
+		 sfs_cache_iodone, b);
+	bio_submit(sfs->sfs_device, &b->b_bio);
+}
+
+/*
+ * Start writing every dirty buffer with a disk block that isn't held
+ * or pinned by the journal and has been dirty since OLDEST or
+ * earlier. Don't wait.
+ */
+static
+void
+sfs_cache_startwrites(struct sfs_fs *sfs, time_t oldest)
+{
+	struct sfs_buf *b;
+	unsigned i;
+
+	for (i=0; i<SFS_NBUFS; i++) {
+		b = &sfs->sfs_bufs[i];
+		if (b->b_valid && b->b_dirty && b->b_sv == NULL &&
+		    b->b_refcount == 0 && !b->b_busy && !b->b_jpinned &&
+		    b->b_dirtytime <= oldest) {
+			sfs_cache_startwrite(sfs, b);
+		}
+	}
+}
+
+/*
+ * Get an empty buffer, recycling the least recently used one that
+ * isn't held, busy, waiting for a disk block, or pinned by the
+ * journal. Clean buffers are preferred; if there are none the chosen
+ * one is written first. If only pinned buffers are left, commit the
+ * running transaction to unpin them.
+ */
+static
+int
+sfs_cache_newbuf(struct sfs_fs *sfs, struct sfs_buf **ret)
+{
+	struct sfs_buf *b, *clean, *dirty;
+	unsigned i;
+	bool anybusy, anypinned;
+	int result;
+
+ again:
+	clean = dirty = NULL;
+	anybusy = anypinned = false;
+	for (i=0; i<SFS_NBUFS; i++) {
+		b = &sfs->sfs_bufs[i];
+		if (!b->b_valid) {
+			*ret = b;
+			return 0;
+		}
+		if (b->b_busy) {
+			anybusy = true;
+			continue;
+		}
+		if (b->b_refcount > 0 || b->b_sv != NULL) {
+			continue;
+		}
+		if (b->b_jpinned) {
+			anypinned = true;
+			continue;
+		}
+		if (b->b_dirty) {
+			if (dirty == NULL || b->b_lastuse < dirty->b_lastuse) {
+				dirty = b;
+			}
+		}
+		else {
+			if (clean == NULL || b->b_lastuse < clean->b_lastuse) {
+				clean = b;
+			}
+		}
+	}
+
+	if (clean != NULL) {
+		b = clean;
+	}
+	else if (dirty != NULL) {
+		b = dirty;
+		sfs_cache_startwrite(sfs, b);
+		sfs_cache_wait(sfs, b);
+		result = sfs_cache_reap(sfs, b);
+		if (result) {
+			return result;
+		}
+	}
+	else if (anybusy) {
+		/* Everything is in flight; wait for something to land. */
+		spinlock_acquire(&sfs->sfs_buflock);
+		for (i=0; i<SFS_NBUFS; i++) {
+			if (sfs->sfs_bufs[i].b_busy) {
+				wchan_sleep(sfs->sfs_bufwchan,
+					    &sfs->sfs_buflock);
+				break;
+			}
+		}
+		spinlock_release(&sfs->sfs_buflock);
+		goto again;
+	}
+	else if (anypinned) {
+		result = sfs_journal_commit(sfs);
+		if (result) {
+			return result;
+		}
+		goto again;
+	}
+	else {
+		panic("sfs: %s: every buffer is held or delayed\n",
+		      sfs->sfs_sb.sb_volname);
+	}
+
+	if (b->b_valid) {
+		sfs_cache_unhash(sfs, b);
+	}
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Look BLOCK up in the cache and return it held, or NULL if it
+ * isn't there.
+ */
+struct sfs_buf *
+sfs_buf_lookup(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_buf *b;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (sfs->sfs_bufs == NULL) {
+		return NULL;
+	}
+	b = sfs_cache_find(sfs, block);
+	if (b == NULL) {
+		return NULL;
+	}
+	if (b->b_busy) {
+		sfs_cache_wait(sfs, b);
+	}
+	sfs_cache_reap(sfs, b);
+	if (!b->b_valid) {
+		return NULL;
+	}
+	b->b_refcount++;
+	b->b_lastuse = ++sfs->sfs_bufclock;
+	return b;
+}
+
+/*
+ * Get BLOCK from the cache, held. If it isn't there, take a new
+ * buffer for it, and fill it from the disk if DOREAD is set. If
+ * DOREAD isn't set, the caller must overwrite all of b_data, or
+ * give the buffer back with sfs_buf_discard.
+ */
+int
+sfs_buf_get(struct sfs_fs *sfs, daddr_t block, bool doread,
+	    struct sfs_buf **ret)
+{
+	struct sfs_buf *b;
+	int result;
+
+	KASSERT(sfs->sfs_bufs != NULL);
+
+	b = sfs_buf_lookup(sfs, block);
+	if (b != NULL) {
+		*ret = b;
+		return 0;
+	}
+
+	result = sfs_cache_newbuf(sfs, &b);
+	if (result) {
+		return result;
+	}
+	sfs_cache_hash(sfs, b, block);
+	b->b_refcount = 1;
+	b->b_lastuse = ++sfs->sfs_bufclock;
+
+	if (doread) {
+		result = sfs_diskio(sfs, block, b->b_data, UIO_READ);
+		if (result) {
+			b->b_refcount = 0;
+			sfs_cache_unhash(sfs, b);
+			return result;
+		}
+	}
+
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Let go of a held buffer.
+ */
+void
+sfs_buf_release(struct sfs_buf *b)
+{
+	KASSERT(b->b_refcount > 0);
+	b->b_refcount--;
+}
+
+/*
+ * Note that a held buffer has been changed. If that makes too much
+ * of the cache dirty, start writing it back.
+ */
+void
+sfs_buf_markdirty(struct sfs_buf *b)
+{
+	struct sfs_fs *sfs = b->b_fs;
+	struct timespec ts;
+
+	KASSERT(b->b_refcount > 0);
+
+	if (!b->b_dirty) {
+		gettime(&ts);
+		b->b_dirty = true;
+		b->b_dirtytime = ts.tv_sec;
+		sfs->sfs_ndirty++;
+	}
+	if (sfs->sfs_ndirty > SFS_DIRTY_HIWAT) {
+		sfs_cache_startwrites(sfs, SFS_ALLDIRTY);
+	}
+}
+
+/*
+ * Give back a held buffer and throw away its contents.
+ */
+void
+sfs_buf_discard(struct sfs_buf *b)
+{
+	KASSERT(b->b_refcount == 1);
+	b->b_refcount = 0;
+	sfs_cache_unhash(b->b_fs, b);
+}
+
+/*
+ * Drop BLOCK from the cache, if it's there, dirty or not.
+ */
+void
+sfs_cache_invalidate(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_buf *b;
+
+	b = sfs_buf_lookup(sfs, block);
+	if (b != NULL) {
+		sfs_buf_discard(b);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Delayed allocation
+
+/*
+ * Find the delayed buffer for block FILEBLOCK of a file and return
+ * it held, or NULL if there isn't one.
+ */
+struct sfs_buf *
+sfs_buf_finddelayed(struct sfs_vnode *sv, uint32_t fileblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *b;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	for (b = sv->sv_delayed; b != NULL; b = b->b_hashnext) {
+		if (b->b_fileblock == fileblock) {
+			b->b_refcount++;
+			b->b_lastuse = ++sfs->sfs_bufclock;
+			return b;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Make a zero-filled delayed buffer for block FILEBLOCK of a file,
+ * which must not have a disk block yet, and return it held. Returns
+ * NULL if allocation can't be put off: too many buffers are delayed
+ * already, the free space is all spoken for, or the block would also
+ * need the indirect block allocated. The caller then allocates the
+ * block itself.
+ */
+struct sfs_buf *
+sfs_buf_newdelayed(struct sfs_vnode *sv, uint32_t fileblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *b;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (sfs->sfs_bufs == NULL ||
+	    sfs->sfs_ndelayed >= SFS_DELAYED_MAX ||
+	    sfs->sfs_nfree <= sfs->sfs_ndelayed ||
+	    (fileblock >= SFS_NDIRECT && sv->sv_i.sfi_indirect == 0)) {
+		return NULL;
+	}
+	if (sfs_cache_newbuf(sfs, &b)) {
+		return NULL;
+	}
+
+	bzero(b->b_data, SFS_BLOCKSIZE);
+	b->b_block = 0;
+	b->b_sv = sv;
+	b->b_fileblock = fileblock;
+	b->b_valid = true;
+	b->b_refcount = 1;
+	b->b_lastuse = ++sfs->sfs_bufclock;
+	b->b_hashnext = sv->sv_delayed;
+	sv->sv_delayed = b;
+	sfs->sfs_ndelayed++;
+	return b;
+}
+
+/*
+ * Give a delayed buffer its disk block. The buffer stays dirty.
+ */
+static
+int
+sfs_cache_place(struct sfs_fs *sfs, struct sfs_buf *b)
+{
+	struct sfs_vnode *sv = b->b_sv;
+	struct sfs_buf **bp;
+	daddr_t block;
+	int result;
+
+	KASSERT(sv != NULL);
+	KASSERT(b->b_refcount == 0);
+
+	/*
+	 * Give back our reservation for sfs_balloc to use. The buffer
+	 * stays on the delayed list meanwhile so sfs_cache_newbuf
+	 * leaves it alone.
+	 */
+	KASSERT(sfs->sfs_ndelayed > 0);
+	sfs->sfs_ndelayed--;
+	result = sfs_bmap(sv, b->b_fileblock, true, &block);
+	if (result) {
+		sfs->sfs_ndelayed++;
+		return result;
+	}
+
+	/* sfs_balloc cached a zeroed copy of the new block; drop it */
+	sfs_cache_invalidate(sfs, block);
+
+	for (bp = &sv->sv_delayed; *bp != b; bp = &(*bp)->b_hashnext) {
+		KASSERT(*bp != NULL);
+	}
+	*bp = b->b_hashnext;
+	b->b_hashnext = NULL;
+	b->b_valid = false;
+	sfs_cache_hash(sfs, b, block);
+	return 0;
+}
+
+/*
+ * Allocate disk blocks for all the delayed buffers of a file.
+ */
+int
+sfs_cache_placevnode(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	while (sv->sv_delayed != NULL) {
+		result = sfs_cache_place(sfs, sv->sv_delayed);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Allocate disk blocks for every delayed buffer on the volume.
+ */
+int
+sfs_cache_placeall(struct sfs_fs *sfs)
+{
+	struct sfs_buf *b;
+	unsigned i;
+	int result, ret = 0;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (sfs->sfs_bufs == NULL) {
+		return 0;
+	}
+	for (i=0; i<SFS_NBUFS; i++) {
+		b = &sfs->sfs_bufs[i];
+		if (b->b_valid && b->b_sv != NULL) {
+			result = sfs_cache_place(sfs, b);
+			if (result && ret == 0) {
+				ret = result;
+			}
+		}
+	}
+	return ret;
+}
+
+/*
+ * Throw away the delayed buffers of a file from block NBLOCKS on,
+ * because it's being truncated.
+ */
+void
+sfs_cache_truncate(struct sfs_vnode *sv, uint32_t nblocks)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *b, *next;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	for (b = sv->sv_delayed; b != NULL; b = next) {
+		next = b->b_hashnext;
+		if (b->b_fileblock >= nblocks) {
+			KASSERT(b->b_refcount == 0);
+			sfs_cache_unhash(sfs, b);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Write-back
+
+/*
+ * Write back everything dirty and wait for it. Delayed buffers are
+ * not touched; the caller places them first (see sfs_sync).
+ */
+int
+sfs_cache_flush(struct sfs_fs *sfs)
+{
+	unsigned i;
+	int result, ret = 0;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (sfs->sfs_bufs == NULL) {
+		return 0;
+	}
+
+	sfs_cache_startwrites(sfs, SFS_ALLDIRTY);
+	sfs_cache_waitall(sfs);
+
+	for (i=0; i<SFS_NBUFS; i++) {
+		if (sfs->sfs_bufs[i].b_valid) {
+			result = sfs_cache_reap(sfs, &sfs->sfs_bufs[i]);
+			if (result && ret == 0) {
+				ret = result;
+			}
+		}
+	}
+	return ret;
+}
+
+/*
+ * One pass of the flusher over a volume: place and start writing
+ * whatever is too old, or everything if too much is dirty.
+ */
+static
+void
+sfs_cache_writeback(struct sfs_fs *sfs)
+{
+	struct sfs_buf *b;
+	struct timespec ts;
+	time_t oldest;
+	unsigned i;
+
+	gettime(&ts);
+	oldest = ts.tv_sec - SFS_DIRTY_MAXAGE;
+	if (sfs->sfs_ndirty > SFS_DIRTY_HIWAT) {
+		oldest = SFS_ALLDIRTY;
+	}
+
+	for (i=0; i<SFS_NBUFS; i++) {
+		b = &sfs->sfs_bufs[i];
+		if (b->b_valid && b->b_sv != NULL && b->b_refcount == 0 &&
+		    b->b_dirtytime <= oldest) {
+			/* On failure it stays delayed; sync will complain */
+			sfs_cache_place(sfs, b);
+		}
+	}
+	sfs_cache_startwrites(sfs, oldest);
+}
+
+/*
+ * The flusher thread.
+ */
+static
+void
+sfs_flusher(void *unused1, unsigned long unused2)
+{
+	struct sfs_fs *sfs;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		clocksleep(1);
+
+		vfs_biglock_acquire();
+		for (sfs = sfs_volumes; sfs != NULL; sfs = sfs->sfs_nextvol) {
+			if (sfs->sfs_jbufs != NULL && sfs->sfs_jnest == 0) {
+				/* Errors will come up again at sync */
+				sfs_journal_groupcommit(sfs);
+			}
+			if (sfs->sfs_ndirty > 0) {
+				sfs_cache_writeback(sfs);
+			}
+		}
+		vfs_biglock_release();
+	}
+}
+
+/*
+ * Start reading BLOCK into the cache, unless it's already there, and
+ * don't wait for it. Errors are dropped: whoever actually wants the
+ * block will find it missing and read it again themselves.
+ */
+void
+sfs_cache_prefetch(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_buf *b;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (sfs->sfs_bufs == NULL) {
+		return;
+	}
+	if (sfs_cache_find(sfs, block) != NULL) {
+		return;
+	}
+	if (sfs_cache_newbuf(sfs, &b)) {
+		return;
+	}
+	sfs_cache_hash(sfs, b, block);
+	b->b_lastuse = ++sfs->sfs_bufclock;
+
+	b->b_busy = true;
+	bio_init(&b->b_bio, block, b->b_data, SFS_BLOCKSIZE, UIO_READ,
+		 sfs_cache_iodone, b);
+	bio_submit(sfs->sfs_device, &b->b_bio);
+}
+
+////////////////////////////////////////////////////////////
+// Read-ahead
+
+/*
+ * Called by sfs_read after a successful read that started in file
+ * block FIRSTBLOCK and ended at byte ENDPOS. Update the sequential
+ * access state of the file and, if it's being read sequentially,
+ * start reads to keep the read-ahead window filled.
+ *
+ * This tracks access per vnode rather than per open file, because
+ * the open file isn't visible at this level; two processes reading
+ * the same file in lockstep still look sequential.
+ */
+void
+sfs_readahead(struct sfs_vnode *sv, uint32_t firstblock, off_t endpos)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t nextblock, nfileblocks, start, end, fileblock;
+	daddr_t diskblock;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	nextblock = endpos / SFS_BLOCKSIZE;
+
+	/*
+	 * A read is sequential if it starts where the last one left
+	 * off. (The last one may have ended partway through a block,
+	 * in which case this one starts in that same block.)
+	 */
+	if (firstblock == sv->sv_ranext) {
+		if (sv->sv_rawindow == 0) {
+			sv->sv_rawindow = SFS_RA_MINWINDOW;
+		}
+		else if (sv->sv_rawindow < SFS_RA_MAXWINDOW) {
+			sv->sv_rawindow *= 2;
+		}
+	}
+	else {
+		sv->sv_rawindow = 0;
+		sv->sv_raend = nextblock;
+	}
+	sv->sv_ranext = nextblock;
+
+	if (sv->sv_rawindow == 0) {
+		return;
+	}
+
+	/* Don't ask for blocks we've already asked for, or past EOF */
+	nfileblocks = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
+	start = sv->sv_raend > nextblock ? sv->sv_raend : nextblock;
+	end = nextblock + sv->sv_rawindow;
+	if (end > nfileblocks) {
+		end = nfileblocks;
+	}
+
+	for (fileblock = start; fileblock < end; fileblock++) {
+		result = sfs_bmap(sv, fileblock, false, &diskblock);
+		if (result) {
+			break;
+		}
+		if (diskblock != 0) {
+			sfs_cache_prefetch(sfs, diskblock);
+		}
+	}
+	if (end > sv->sv_raend) {
+		sv->sv_raend = end;
+	}
+}
@@ -42,6 +42,7 @@
 #include <vfs.h>
 #include <device.h>
 #include <sfs.h>
+#include <kmemcache.h>
 #include "sfsprivate.h"
 
 
@@ -75,6 +76,9 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 	char *freemapdata;
 	int result;
 
+	/* Staging area for writes; we hold the big lock */
+	static char writebuf[SFS_BLOCKSIZE];
+
 	/* Number of blocks in the free block bitmap. */
 	freemapblocks = SFS_FS_FREEMAPBLOCKS(sfs);
 
@@ -93,8 +97,13 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 					       SFS_BLOCKSIZE);
 		}
 		else {
-			result = sfs_writeblock(sfs, SFS_FREEMAP_START+j, ptr,
-						SFS_BLOCKSIZE);
+			/*
+			 * Blocks the journal is holding back from reuse
+			 * are free as far as the disk is concerned.
+			 */
+			sfs_journal_freemapblock(sfs, j, writebuf);
+			result = sfs_writeblock(sfs, SFS_FREEMAP_START+j,
+						writebuf, SFS_BLOCKSIZE);
 		}
 
 		/* If we failed, stop. */
@@ -114,11 +123,15 @@ sfs_sync_vnodes(struct sfs_fs *sfs)
 {
 	unsigned i, num;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
+	/*
+	 * Go over the array of loaded vnodes, syncing as we go. (Not
+	 * with VOP_FSYNC, which would also write out the whole volume
+	 * each time.)
+	 */
 	num = vnodearray_num(sfs->sfs_vnodes);
 	for (i=0; i<num; i++) {
 		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+		sfs_sync_inode(v->vn_data);
 	}
 	return 0;
 }
@@ -163,6 +176,53 @@ sfs_sync_superblock(struct sfs_fs *sfs)
 	return 0;
 }
 
+/*
+ * Get the in-memory metadata into the cache (and, with a journal,
+ * into the running transaction): the loaded inodes, the freemap, and
+ * the superblock. Nothing is written to disk.
+ */
+int
+sfs_sync_metadata(struct sfs_fs *sfs)
+{
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	/* If any vnodes need to be written, write them. */
+	result = sfs_sync_vnodes(sfs);
+	if (result) {
+		return result;
+	}
+
+	/* If the free block map needs to be written, write it. */
+	result = sfs_sync_freemap(sfs);
+	if (result) {
+		return result;
+	}
+
+	/* If the superblock needs to be written, write it. */
+	return sfs_sync_superblock(sfs);
+}
+
+/*
+ * Write out everything: the metadata, via the journal if there is
+ * one, and then all the dirty blocks in the cache. Doesn't return
+ * until it's all on disk.
+ */
+int
+sfs_sync_volume(struct sfs_fs *sfs)
+{
+	int result;
+
+	result = sfs_sync_metadata(sfs);
+	if (result) {
+		return result;
+	}
+
+	/* Commit, push the cache to disk, and empty the journal. */
+	return sfs_journal_checkpoint(sfs);
+}
+
 /*
  * Sync routine. This is what gets invoked if you do FS_SYNC on the
  * sfs filesystem structure.
@@ -208,22 +268,18 @@ sfs_sync(struct fs *fs)
 
 	sfs = fs->fs_data;
 
-	/* If any vnodes need to be written, write them. */
-	result = sfs_sync_vnodes(sfs);
+	/*
+	 * Give file data still waiting for disk blocks its blocks.
+	 * This changes inodes and the freemap, so it goes first.
+	 */
+	result = sfs_cache_placeall(sfs);
 	if (result) {
 		vfs_biglock_release();
 		return result;
 	}
 
-	/* If the free block map needs to be written, write it. */
-	result = sfs_sync_freemap(sfs);
-	if (result) {
-		vfs_biglock_release();
-		return result;
-	}
-
-	/* If the superblock needs to be written, write it. */
-	result = sfs_sync_superblock(sfs);
+	/* Write the rest and wait for it. */
+	result = sfs_sync_volume(sfs);
 	if (result) {
 		vfs_biglock_release();
 		return result;
@@ -259,10 +315,14 @@ static
 void
 sfs_fs_destroy(struct sfs_fs *sfs)
 {
+	sfs_journal_cleanup(sfs);
+	sfs_cache_cleanup(sfs);
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
+	kmem_cache_destroy(sfs->sfs_vnodecache);
 	vnodearray_destroy(sfs->sfs_vnodes);
+	spinlock_cleanup(&sfs->sfs_buflock);
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
 }
@@ -328,6 +388,9 @@ sfs_fs_create(void)
 	COMPILE_ASSERT(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	COMPILE_ASSERT(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	COMPILE_ASSERT(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	COMPILE_ASSERT(sizeof(struct sfs_jheader)==SFS_BLOCKSIZE);
+	COMPILE_ASSERT(sizeof(struct sfs_jdesc)==SFS_BLOCKSIZE);
+	COMPILE_ASSERT(sizeof(struct sfs_jcommit)==SFS_BLOCKSIZE);
 
 	/* Allocate object */
 	sfs = kmalloc(sizeof(struct sfs_fs));
@@ -355,13 +418,45 @@ sfs_fs_create(void)
 	if (sfs->sfs_vnodes == NULL) {
 		goto cleanup_object;
 	}
+	sfs->sfs_vnodecache = kmem_cache_create("sfs_vnode",
+						sizeof(struct sfs_vnode),
+						NULL, NULL);
+	if (sfs->sfs_vnodecache == NULL) {
+		goto cleanup_vnodes;
+	}
 
 	/* freemap */
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
+	sfs->sfs_nfree = 0;
+
+	/* block cache (set up by sfs_domount) */
+	sfs->sfs_bufs = NULL;
+	spinlock_init(&sfs->sfs_buflock);
+	sfs->sfs_bufwchan = NULL;
+	sfs->sfs_ndirty = 0;
+	sfs->sfs_ndelayed = 0;
+	sfs->sfs_nextvol = NULL;
+
+	/* journal (set up by sfs_domount) */
+	sfs->sfs_jbufs = NULL;
+	sfs->sfs_jnbufs = 0;
+	sfs->sfs_jrevoked = NULL;
+	sfs->sfs_jnrevoked = 0;
+	sfs->sfs_jnest = 0;
+	sfs->sfs_jseq = 0;
+	sfs->sfs_jhead = 0;
+	sfs->sfs_jlogged = NULL;
+	sfs->sfs_jfreed = NULL;
+	sfs->sfs_jbios = NULL;
+	sfs->sfs_jdesc = NULL;
+	sfs->sfs_jcommit = NULL;
+	sfs->sfs_jpending = 0;
 
 	return sfs;
 
+cleanup_vnodes:
+	vnodearray_destroy(sfs->sfs_vnodes);
 cleanup_object:
 	kfree(sfs);
 fail:
@@ -387,6 +482,7 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 {
 	int result;
 	struct sfs_fs *sfs;
+	uint32_t i;
 
 	vfs_biglock_acquire();
 
@@ -448,6 +544,15 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Ensure null termination of the volume name */
 	sfs->sfs_sb.sb_volname[sizeof(sfs->sfs_sb.sb_volname)-1] = 0;
 
+	/* Finish whatever the journal says was committed */
+	result = sfs_journal_replay(sfs);
+	if (result) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* Load free block bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_FREEMAPBITS(sfs));
 	if (sfs->sfs_freemap == NULL) {
@@ -464,6 +569,31 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		return result;
 	}
 
+	/* Count the free blocks, for delayed allocation's reservations */
+	for (i=0; i<SFS_FS_NBLOCKS(sfs); i++) {
+		if (!bitmap_isset(sfs->sfs_freemap, i)) {
+			sfs->sfs_nfree++;
+		}
+	}
+
+	/* Set up the block cache */
+	result = sfs_cache_init(sfs);
+	if (result) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		vfs_biglock_release();
+		return result;
+	}
+
+	/* and the journal */
+	result = sfs_journal_init(sfs);
+	if (result) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
@@ -37,6 +37,7 @@
 #include <lib.h>
 #include <vfs.h>
 #include <sfs.h>
+#include <kmemcache.h>
 #include "sfsprivate.h"
 
 
@@ -92,19 +93,38 @@ sfs_reclaim(struct vnode *v)
 		return EBUSY;
 	}
 	spinlock_release(&v->vn_countlock);
+	result = sfs_trans_begin(sfs);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
 
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount == 0) {
 		result = sfs_itrunc(sv, 0);
 		if (result) {
+			sfs_trans_end(sfs);
 			vfs_biglock_release();
 			return result;
 		}
 	}
 
+	/*
+	 * Give any data still waiting for disk blocks its blocks, since
+	 * the cache can't refer to the vnode once it's gone. If that
+	 * fails the data is lost either way.
+	 */
+	result = sfs_cache_placevnode(sv);
+	if (result) {
+		kprintf("sfs: %s: inode %u: lost delayed writes: %s\n",
+			sfs->sfs_sb.sb_volname, sv->sv_ino, strerror(result));
+		sfs_cache_truncate(sv, 0);
+	}
+
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
+		sfs_trans_end(sfs);
 		vfs_biglock_release();
 		return result;
 	}
@@ -133,10 +153,11 @@ sfs_reclaim(struct vnode *v)
 
 	vnode_cleanup(&sv->sv_absvn);
 
+	sfs_trans_end(sfs);
 	vfs_biglock_release();
 
 	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	kmem_cache_free(sfs->sfs_vnodecache, sv);
 
 	/* Done */
 	return 0;
@@ -184,7 +205,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 
 	/* Didn't have it loaded; load it */
 
-	sv = kmalloc(sizeof(struct sfs_vnode));
+	sv = kmem_cache_alloc(sfs->sfs_vnodecache);
 	if (sv==NULL) {
 		return ENOMEM;
 	}
@@ -198,7 +219,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Read the block the inode is in */
 	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(sfs->sfs_vnodecache, sv);
 		return result;
 	}
 
@@ -235,18 +256,22 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(sfs->sfs_vnodecache, sv);
 		return result;
 	}
 
 	/* Set the other fields in our vnode structure */
 	sv->sv_ino = ino;
+	sv->sv_ranext = 0;
+	sv->sv_raend = 0;
+	sv->sv_rawindow = 0;
+	sv->sv_delayed = NULL;
 
 	/* Add it to our table */
 	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
 	if (result) {
 		vnode_cleanup(&sv->sv_absvn);
-		kfree(sv);
+		kmem_cache_free(sfs->sfs_vnodecache, sv);
 		return result;
 	}
 
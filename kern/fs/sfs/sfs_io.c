@@ -102,33 +102,98 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 }
 
 /*
- * Read a block.
+ * Read or write a block straight to or from the disk, bypassing the
+ * cache.
  */
 int
-sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+sfs_diskio(struct sfs_fs *sfs, daddr_t block, void *data, enum uio_rw rw)
 {
 	struct iovec iov;
 	struct uio ku;
 
+	SFSUIO(&iov, &ku, data, block, rw);
+	return sfs_rwblock(sfs, &ku);
+}
+
+/*
+ * Read a block, through the cache once there is one.
+ */
+int
+sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+{
+	struct sfs_buf *b;
+	int result;
+
 	KASSERT(len == SFS_BLOCKSIZE);
 
-	SFSUIO(&iov, &ku, data, block, UIO_READ);
-	return sfs_rwblock(sfs, &ku);
+	if (sfs->sfs_bufs == NULL) {
+		return sfs_diskio(sfs, block, data, UIO_READ);
+	}
+
+	result = sfs_buf_get(sfs, block, true, &b);
+	if (result) {
+		return result;
+	}
+	memcpy(data, b->b_data, len);
+	sfs_buf_release(b);
+	return 0;
 }
 
 /*
- * Write a block.
+ * Check if two blocks' worth of data are the same.
+ */
+static
+bool
+sfs_samedata(const void *a, const void *b, size_t len)
+{
+	const uint32_t *wa = a, *wb = b;
+	size_t i;
+
+	KASSERT(len % sizeof(uint32_t) == 0);
+	for (i=0; i<len/sizeof(uint32_t); i++) {
+		if (wa[i] != wb[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Write a block. Once the cache is up this only updates the cached
+ * copy; the cache writes it back later. Everything that comes
+ * through here is metadata, so with a journal the block also goes
+ * into the running transaction. Rewriting a cached block with what
+ * it already holds is a no-op, which keeps sync from logging every
+ * loaded inode and the whole freemap each time.
  */
 int
 sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
-	struct iovec iov;
-	struct uio ku;
+	struct sfs_buf *b;
+	int result;
 
 	KASSERT(len == SFS_BLOCKSIZE);
 
-	SFSUIO(&iov, &ku, data, block, UIO_WRITE);
-	return sfs_rwblock(sfs, &ku);
+	if (sfs->sfs_bufs == NULL) {
+		return sfs_diskio(sfs, block, data, UIO_WRITE);
+	}
+
+	b = sfs_buf_lookup(sfs, block);
+	if (b != NULL && sfs_samedata(b->b_data, data, len)) {
+		sfs_buf_release(b);
+		return 0;
+	}
+	if (b == NULL) {
+		result = sfs_buf_get(sfs, block, false, &b);
+		if (result) {
+			return result;
+		}
+	}
+	memcpy(b->b_data, data, len);
+	sfs_buf_markdirty(b);
+	result = sfs_journal_add(sfs, b);
+	sfs_buf_release(b);
+	return result;
 }
 
 ////////////////////////////////////////////////////////////
@@ -136,10 +201,73 @@ sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 // File-level I/O
 
 /*
- * Do I/O to a block of a file that doesn't cover the whole block.  We
- * need to read in the original block first, even if we're writing, so
- * we don't clobber the portion of the block we're not intending to
- * write over.
+ * Get the buffer to write block FILEBLOCK of a file into, held. If
+ * WHOLEBLOCK is set the caller is about to overwrite all of it, so
+ * there's no need to read what's on disk.
+ *
+ * A block that isn't allocated yet normally stays that way: the data
+ * goes into a delayed buffer and gets its disk block when it's
+ * written back. If sfs_buf_newdelayed won't do that, allocate now.
+ */
+static
+int
+sfs_getwritebuf(struct sfs_vnode *sv, uint32_t fileblock, bool wholeblock,
+		struct sfs_buf **ret)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t diskblock;
+	int result;
+
+	result = sfs_bmap(sv, fileblock, false, &diskblock);
+	if (result) {
+		return result;
+	}
+
+	if (diskblock == 0) {
+		*ret = sfs_buf_finddelayed(sv, fileblock);
+		if (*ret != NULL) {
+			return 0;
+		}
+		*ret = sfs_buf_newdelayed(sv, fileblock);
+		if (*ret != NULL) {
+			return 0;
+		}
+		result = sfs_bmap(sv, fileblock, true, &diskblock);
+		if (result) {
+			return result;
+		}
+	}
+
+	return sfs_buf_get(sfs, diskblock, !wholeblock, ret);
+}
+
+/*
+ * Copy LEN bytes from UIO into a held buffer at offset SKIPSTART,
+ * and let go of the buffer. If the copy fails, a buffer that was
+ * clean is thrown away so none of the partial data survives.
+ */
+static
+int
+sfs_fillbuf(struct sfs_buf *b, uint32_t skipstart, uint32_t len,
+	    struct uio *uio)
+{
+	bool wasdirty = b->b_dirty;
+	int result;
+
+	result = uiomove(b->b_data + skipstart, len, uio);
+	if (result && !wasdirty) {
+		sfs_buf_discard(b);
+		return result;
+	}
+	sfs_buf_markdirty(b);
+	sfs_buf_release(b);
+	return result;
+}
+
+/*
+ * Do I/O to a block of a file that doesn't cover the whole block.
+ * This goes through the cache: the block is read in if it isn't
+ * there, and for a write the cached copy is modified and left dirty.
  *
  * SKIPSTART is the number of bytes to skip past at the beginning of
  * the sector; LEN is the number of bytes to actually read or write.
@@ -150,33 +278,30 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *b;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
 
-	/* Allocate missing blocks if and only if we're writing */
-	bool doalloc = (uio->uio_rw==UIO_WRITE);
-
 	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
 
-	/* We're using a global static buffer; it had better be locked */
+	/* The cache is protected by the big lock */
 	KASSERT(vfs_biglock_do_i_hold());
 
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
+	if (uio->uio_rw == UIO_WRITE) {
+		result = sfs_getwritebuf(sv, fileblock, false, &b);
+		if (result) {
+			return result;
+		}
+		return sfs_fillbuf(b, skipstart, len, uio);
+	}
+
 	/* Get the disk block number */
-	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	result = sfs_bmap(sv, fileblock, false, &diskblock);
 	if (result) {
 		return result;
 	}
@@ -184,40 +309,23 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
-		 */
-		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
-	}
-	else {
-		/*
-		 * Read the block.
+		 * Either it's waiting for one, or it's a hole.
 		 */
-		result = sfs_readblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
+		b = sfs_buf_finddelayed(sv, fileblock);
+		if (b == NULL) {
+			return uiomovezeros(len, uio);
 		}
 	}
-
-	/*
-	 * Now perform the requested operation into/out of the buffer.
-	 */
-	result = uiomove(iobuf+skipstart, len, uio);
-	if (result) {
-		return result;
-	}
-
-	/*
-	 * If it was a write, write back the modified block.
-	 */
-	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_writeblock(sfs, diskblock, iobuf, sizeof(iobuf));
+	else {
+		result = sfs_buf_get(sfs, diskblock, true, &b);
 		if (result) {
 			return result;
 		}
 	}
 
-	return 0;
+	result = uiomove(b->b_data + skipstart, len, uio);
+	sfs_buf_release(b);
+	return result;
 }
 
 /*
@@ -228,10 +336,10 @@ int
 sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *b;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
-	bool doalloc = (uio->uio_rw==UIO_WRITE);
 	off_t saveoff;
 	off_t diskoff;
 	off_t saveres;
@@ -240,21 +348,38 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
+	if (uio->uio_rw == UIO_WRITE) {
+		result = sfs_getwritebuf(sv, fileblock, true, &b);
+		if (result) {
+			return result;
+		}
+		return sfs_fillbuf(b, 0, SFS_BLOCKSIZE, uio);
+	}
+
 	/* Look up the disk block number */
-	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	result = sfs_bmap(sv, fileblock, false, &diskblock);
 	if (result) {
 		return result;
 	}
 
+	/*
+	 * If the block is in the cache (because it's dirty, or read-ahead
+	 * brought it in, or it has no disk block yet) copy it from there.
+	 */
 	if (diskblock == 0) {
-		/*
-		 * No block - fill with zeros.
-		 *
-		 * We must be reading, or sfs_bmap would have
-		 * allocated a block for us.
-		 */
-		KASSERT(uio->uio_rw == UIO_READ);
-		return uiomovezeros(SFS_BLOCKSIZE, uio);
+		b = sfs_buf_finddelayed(sv, fileblock);
+		if (b == NULL) {
+			/* No block - fill with zeros. */
+			return uiomovezeros(SFS_BLOCKSIZE, uio);
+		}
+	}
+	else {
+		b = sfs_buf_lookup(sfs, diskblock);
+	}
+	if (b != NULL) {
+		result = uiomove(b->b_data, SFS_BLOCKSIZE, uio);
+		sfs_buf_release(b);
+		return result;
 	}
 
 	/*
@@ -0,0 +1,830 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * SFS filesystem
+ *
+ * Metadata journal.
+ *
+ * Every metadata block SFS writes (inodes, indirect blocks, directory
+ * blocks, the freemap, the superblock) goes through sfs_writeblock,
+ * which with a journal adds the cache buffer to the running
+ * transaction. A buffer in the running transaction is pinned: the
+ * cache won't write it to its home location until the transaction
+ * has been committed, that is, until a copy of every block in it is
+ * safely in the on-disk journal (see kern/sfs.h for the format).
+ * After that it's an ordinary dirty buffer and goes home whenever
+ * the cache gets to it. After a crash, sfs_journal_replay copies the
+ * committed blocks home again, so the volume always reflects some
+ * whole number of transactions.
+ *
+ * Since all of SFS runs under the big lock, the in-memory state is
+ * consistent whenever nobody is in the middle of an operation. So
+ * rather than one transaction per operation, many operations share
+ * the running transaction and it is committed as a group: once a
+ * second by the flusher, when it gets big (checked in sfs_trans_begin,
+ * which vnode operations call on the way in), and on sync and fsync.
+ * A commit is one descriptor, the copies, and one commit block,
+ * written together and in order, however many operations went in.
+ *
+ * The journal is not circular. When there's no longer room for a
+ * maximal transaction, sfs_trans_begin checkpoints: commit, write
+ * everything home, and empty the journal. sync does the same.
+ *
+ * Two things keep replay from doing damage:
+ *    - A block freed in the running transaction can't be reused until
+ *      the transaction commits (sfs_jfreed), because its new contents
+ *      might otherwise reach the disk while the committed metadata
+ *      still says it belongs to its old owner.
+ *    - A freed block that's in the journal is revoked, so that replay
+ *      doesn't write its old metadata over whatever it holds later.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <bitmap.h>
+#include <vfs.h>
+#include <bio.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+/* Largest transaction, in journal blocks */
+#define SFS_JMAXTRANS      (SFS_JDESC_NENTRIES + 2)
+
+/* Smallest journal we'll use: header plus room for two transactions */
+#define SFS_JMINBLOCKS     (1 + 2 * SFS_JMAXTRANS)
+
+/*
+ * Descriptor entries held back for each operation: sfs_trans_begin
+ * commits first unless this many are free, so that no operation has
+ * to be split across two commits.
+ */
+#define SFS_JOPMAX         64
+
+/* Commit early once the running transaction has this many entries */
+#define SFS_JCOMMIT_THRESH 48
+
+/*
+ * Checksum over a block, for jc_sum: rotate left one bit and add
+ * each word in turn.
+ */
+static
+uint32_t
+sfs_jsum(uint32_t sum, const void *block)
+{
+	const uint32_t *words = block;
+	unsigned i;
+
+	for (i=0; i<SFS_BLOCKSIZE/sizeof(uint32_t); i++) {
+		sum = ((sum << 1) | (sum >> 31)) + words[i];
+	}
+	return sum;
+}
+
+/*
+ * Write the journal header, emptying the journal.
+ */
+static
+int
+sfs_journal_writeheader(struct sfs_fs *sfs, uint32_t seq)
+{
+	struct sfs_jheader *jh;
+	int result;
+
+	jh = kmalloc(sizeof(*jh));
+	if (jh == NULL) {
+		return ENOMEM;
+	}
+	bzero(jh, sizeof(*jh));
+	jh->jh_magic = SFS_JMAGIC_HEAD;
+	jh->jh_seq = seq;
+	result = sfs_diskio(sfs, sfs->sfs_sb.sb_journalstart, jh, UIO_WRITE);
+	kfree(jh);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// Recovery
+
+/*
+ * Return true if block BLOCK is revoked by any of the transactions
+ * DESCS[0..N-1].
+ */
+static
+bool
+sfs_journal_isrevoked(const struct sfs_jdesc *descs, unsigned n,
+		      uint32_t block)
+{
+	unsigned i, j;
+
+	for (i=0; i<n; i++) {
+		for (j=0; j<descs[i].jd_nrevoked; j++) {
+			if (descs[i].jd_entries[descs[i].jd_nblocks+j]
+			    == block) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/*
+ * Replay the journal, if the volume has one. Called at mount time
+ * after the superblock has been read, before anything else; goes
+ * straight to the disk.
+ */
+int
+sfs_journal_replay(struct sfs_fs *sfs)
+{
+	struct sfs_jheader *jh;
+	struct sfs_jdesc *descs, *jd;
+	struct sfs_jcommit *jc;
+	uint32_t *positions;
+	uint32_t nblocks, start, size, pos, seq, sum, home;
+	unsigned ntrans, maxtrans, t, i;
+	char *blk;
+	int result;
+
+	start = sfs->sfs_sb.sb_journalstart;
+	size = sfs->sfs_sb.sb_journalblocks;
+	if (size == 0) {
+		return 0;
+	}
+	nblocks = sfs->sfs_sb.sb_nblocks;
+	if (start < SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(nblocks) ||
+	    size < 3 || size > nblocks || start > nblocks - size) {
+		kprintf("sfs: %s: bad journal location %u+%u\n",
+			sfs->sfs_sb.sb_volname, start, size);
+		return EINVAL;
+	}
+
+	maxtrans = size / 3;
+	blk = kmalloc(SFS_BLOCKSIZE);
+	descs = kmalloc(maxtrans * sizeof(struct sfs_jdesc));
+	positions = kmalloc(maxtrans * sizeof(uint32_t));
+	if (blk == NULL || descs == NULL || positions == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+
+	result = sfs_diskio(sfs, start, blk, UIO_READ);
+	if (result) {
+		goto out;
+	}
+	jh = (struct sfs_jheader *)blk;
+	if (jh->jh_magic != SFS_JMAGIC_HEAD) {
+		kprintf("sfs: %s: journal header is missing\n",
+			sfs->sfs_sb.sb_volname);
+		result = EINVAL;
+		goto out;
+	}
+	seq = jh->jh_seq;
+
+	/*
+	 * First pass: find the transactions that made it, and keep
+	 * their descriptors for the revoke lists.
+	 */
+	ntrans = 0;
+	pos = 1;
+	while (ntrans < maxtrans && pos + 2 <= size) {
+		jd = &descs[ntrans];
+		result = sfs_diskio(sfs, start + pos, jd, UIO_READ);
+		if (result) {
+			goto out;
+		}
+		if (jd->jd_magic != SFS_JMAGIC_DESC || jd->jd_seq != seq ||
+		    jd->jd_nblocks + jd->jd_nrevoked > SFS_JDESC_NENTRIES ||
+		    pos + jd->jd_nblocks + 2 > size) {
+			break;
+		}
+		sum = sfs_jsum(0, jd);
+		for (i=0; i<jd->jd_nblocks; i++) {
+			result = sfs_diskio(sfs, start + pos + 1 + i, blk,
+					    UIO_READ);
+			if (result) {
+				goto out;
+			}
+			sum = sfs_jsum(sum, blk);
+		}
+		result = sfs_diskio(sfs, start + pos + 1 + jd->jd_nblocks,
+				    blk, UIO_READ);
+		if (result) {
+			goto out;
+		}
+		jc = (struct sfs_jcommit *)blk;
+		if (jc->jc_magic != SFS_JMAGIC_COMMIT || jc->jc_seq != seq ||
+		    jc->jc_sum != sum) {
+			/* Torn transaction; it never happened */
+			break;
+		}
+		positions[ntrans++] = pos;
+		pos += jd->jd_nblocks + 2;
+		seq++;
+	}
+
+	/*
+	 * Second pass: write each copy home, unless a later
+	 * transaction revoked the block.
+	 */
+	for (t=0; t<ntrans; t++) {
+		jd = &descs[t];
+		for (i=0; i<jd->jd_nblocks; i++) {
+			home = jd->jd_entries[i];
+			if (home >= sfs->sfs_sb.sb_nblocks ||
+			    (home >= start && home < start + size)) {
+				kprintf("sfs: %s: journal: bogus block %u\n",
+					sfs->sfs_sb.sb_volname, home);
+				continue;
+			}
+			if (sfs_journal_isrevoked(descs + t + 1,
+						  ntrans - t - 1, home)) {
+				continue;
+			}
+			result = sfs_diskio(sfs, start + positions[t] + 1 + i,
+					    blk, UIO_READ);
+			if (result) {
+				goto out;
+			}
+			result = sfs_diskio(sfs, home, blk, UIO_WRITE);
+			if (result) {
+				goto out;
+			}
+		}
+	}
+
+	/* Empty the journal. Later commits continue the sequence. */
+	result = sfs_journal_writeheader(sfs, seq);
+	if (result) {
+		goto out;
+	}
+	sfs->sfs_jseq = seq;
+
+	if (ntrans > 0) {
+		kprintf("sfs: %s: replayed %u journal transaction%s\n",
+			sfs->sfs_sb.sb_volname, ntrans, ntrans==1 ? "" : "s");
+
+		/* The superblock may have been in there too */
+		result = sfs_diskio(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
+				    UIO_READ);
+		if (result) {
+			goto out;
+		}
+		sfs->sfs_sb.sb_volname[sizeof(sfs->sfs_sb.sb_volname)-1] = 0;
+	}
+
+ out:
+	kfree(positions);
+	kfree(descs);
+	kfree(blk);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// Setup
+
+/*
+ * Set up to journal a freshly mounted volume. Call after replay and
+ * after the block cache is up.
+ */
+int
+sfs_journal_init(struct sfs_fs *sfs)
+{
+	uint32_t size = sfs->sfs_sb.sb_journalblocks;
+
+	KASSERT(sfs->sfs_jbufs == NULL);
+
+	if (size == 0) {
+		return 0;
+	}
+	if (size < SFS_JMINBLOCKS) {
+		kprintf("sfs: %s: journal too small (%u blocks); "
+			"not journaling\n", sfs->sfs_sb.sb_volname, size);
+		return 0;
+	}
+
+	sfs->sfs_jbufs = kmalloc(SFS_JDESC_NENTRIES * sizeof(struct sfs_buf *));
+	sfs->sfs_jrevoked = kmalloc(SFS_JDESC_NENTRIES * sizeof(daddr_t));
+	sfs->sfs_jbios = kmalloc((SFS_JDESC_NENTRIES+1) * sizeof(struct bio));
+	sfs->sfs_jdesc = kmalloc(sizeof(struct sfs_jdesc));
+	sfs->sfs_jcommit = kmalloc(sizeof(struct sfs_jcommit));
+	sfs->sfs_jlogged = bitmap_create(sfs->sfs_sb.sb_nblocks);
+	sfs->sfs_jfreed = bitmap_create(SFS_FREEMAPBITS(sfs->sfs_sb.sb_nblocks));
+	if (sfs->sfs_jbufs == NULL || sfs->sfs_jrevoked == NULL ||
+	    sfs->sfs_jbios == NULL || sfs->sfs_jdesc == NULL ||
+	    sfs->sfs_jcommit == NULL || sfs->sfs_jlogged == NULL ||
+	    sfs->sfs_jfreed == NULL) {
+		sfs_journal_cleanup(sfs);
+		return ENOMEM;
+	}
+
+	sfs->sfs_jnbufs = 0;
+	sfs->sfs_jnrevoked = 0;
+	sfs->sfs_jnest = 0;
+	sfs->sfs_jhead = 1;
+	sfs->sfs_jpending = 0;
+	return 0;
+}
+
+/*
+ * Release the journal state. The volume should have been synced.
+ */
+void
+sfs_journal_cleanup(struct sfs_fs *sfs)
+{
+	KASSERT(sfs->sfs_jnbufs == 0);
+
+	kfree(sfs->sfs_jbufs);
+	kfree(sfs->sfs_jrevoked);
+	kfree(sfs->sfs_jbios);
+	kfree(sfs->sfs_jdesc);
+	kfree(sfs->sfs_jcommit);
+	if (sfs->sfs_jlogged != NULL) {
+		bitmap_destroy(sfs->sfs_jlogged);
+	}
+	if (sfs->sfs_jfreed != NULL) {
+		bitmap_destroy(sfs->sfs_jfreed);
+	}
+	sfs->sfs_jbufs = NULL;
+	sfs->sfs_jrevoked = NULL;
+	sfs->sfs_jbios = NULL;
+	sfs->sfs_jdesc = NULL;
+	sfs->sfs_jcommit = NULL;
+	sfs->sfs_jlogged = NULL;
+	sfs->sfs_jfreed = NULL;
+}
+
+////////////////////////////////////////////////////////////
+// The running transaction
+
+/*
+ * Give up on atomicity for the running transaction: unpin it,
+ * write everything home, and empty the journal. Used if a single
+ * operation overflows the journal or its reserved share of the
+ * descriptor, which shouldn't happen.
+ */
+static
+int
+sfs_journal_abandon(struct sfs_fs *sfs)
+{
+	unsigned i;
+	int result;
+
+	kprintf("sfs: %s: transaction too large for the journal\n",
+		sfs->sfs_sb.sb_volname);
+
+	for (i=0; i<sfs->sfs_jnbufs; i++) {
+		sfs->sfs_jbufs[i]->b_jpinned = false;
+	}
+	sfs->sfs_jnbufs = 0;
+	sfs->sfs_jnrevoked = 0;
+
+	result = sfs_cache_flush(sfs);
+	if (result) {
+		return result;
+	}
+	return sfs_journal_reset(sfs);
+}
+
+/*
+ * Make room for one more entry in the running transaction's
+ * descriptor. We're in the middle of an operation, so committing
+ * here would split it; sfs_trans_begin reserved SFS_JOPMAX entries
+ * to prevent that, and if an operation runs past them anyway all we
+ * can do is abandon the transaction.
+ */
+static
+int
+sfs_journal_room(struct sfs_fs *sfs)
+{
+	if (sfs->sfs_jnbufs + sfs->sfs_jnrevoked < SFS_JDESC_NENTRIES) {
+		return 0;
+	}
+	return sfs_journal_abandon(sfs);
+}
+
+/*
+ * Add a held, dirty metadata buffer to the running transaction.
+ */
+int
+sfs_journal_add(struct sfs_fs *sfs, struct sfs_buf *b)
+{
+	int result;
+
+	KASSERT(b->b_refcount > 0);
+	KASSERT(b->b_sv == NULL);
+
+	if (sfs->sfs_jbufs == NULL || b->b_jpinned) {
+		return 0;
+	}
+	result = sfs_journal_room(sfs);
+	if (result) {
+		return result;
+	}
+	b->b_jpinned = true;
+	sfs->sfs_jbufs[sfs->sfs_jnbufs++] = b;
+	return 0;
+}
+
+/*
+ * Take a buffer that's being thrown away out of the running
+ * transaction.
+ */
+void
+sfs_journal_forget(struct sfs_fs *sfs, struct sfs_buf *b)
+{
+	unsigned i;
+
+	KASSERT(b->b_jpinned);
+
+	for (i=0; i<sfs->sfs_jnbufs; i++) {
+		if (sfs->sfs_jbufs[i] == b) {
+			sfs->sfs_jbufs[i] = sfs->sfs_jbufs[--sfs->sfs_jnbufs];
+			b->b_jpinned = false;
+			return;
+		}
+	}
+	panic("sfs: %s: pinned block %u not in transaction\n",
+	      sfs->sfs_sb.sb_volname, b->b_block);
+}
+
+/*
+ * Note that a block has been freed. Returns true if the journal
+ * will take care of releasing it in the freemap when the running
+ * transaction commits; false if the caller should do it now.
+ */
+bool
+sfs_journal_free(struct sfs_fs *sfs, daddr_t block)
+{
+	int result;
+
+	if (sfs->sfs_jbufs == NULL) {
+		return false;
+	}
+	if (bitmap_isset(sfs->sfs_jlogged, block)) {
+		/* If this abandons, the journal is empty: no revoke needed */
+		result = sfs_journal_room(sfs);
+		if (result) {
+			kprintf("sfs: %s: journal: cannot revoke block %u: "
+				"%s\n", sfs->sfs_sb.sb_volname, block,
+				strerror(result));
+		}
+		else if (bitmap_isset(sfs->sfs_jlogged, block)) {
+			sfs->sfs_jrevoked[sfs->sfs_jnrevoked++] = block;
+		}
+	}
+	bitmap_mark(sfs->sfs_jfreed, block);
+	sfs->sfs_freemapdirty = true;
+	return true;
+}
+
+/*
+ * The freemap as it should be written: blocks freed by the running
+ * transaction are free on disk, though we're not reusing them yet.
+ * Block J of the freemap is returned in BUF.
+ */
+void
+sfs_journal_freemapblock(struct sfs_fs *sfs, unsigned j, char *buf)
+{
+	const char *map, *freed;
+	unsigned i;
+
+	map = (char *)bitmap_getdata(sfs->sfs_freemap) + j*SFS_BLOCKSIZE;
+	if (sfs->sfs_jfreed == NULL) {
+		memcpy(buf, map, SFS_BLOCKSIZE);
+		return;
+	}
+	freed = (char *)bitmap_getdata(sfs->sfs_jfreed) + j*SFS_BLOCKSIZE;
+	for (i=0; i<SFS_BLOCKSIZE; i++) {
+		buf[i] = map[i] & ~freed[i];
+	}
+}
+
+/*
+ * Release the blocks freed by the transaction that just committed.
+ */
+static
+void
+sfs_journal_releasefreed(struct sfs_fs *sfs)
+{
+	unsigned char *freed;
+	unsigned i, nbytes, bit;
+	daddr_t block;
+
+	freed = bitmap_getdata(sfs->sfs_jfreed);
+	nbytes = SFS_FREEMAPBITS(sfs->sfs_sb.sb_nblocks) / CHAR_BIT;
+	for (i=0; i<nbytes; i++) {
+		if (freed[i] == 0) {
+			continue;
+		}
+		for (bit=0; bit<CHAR_BIT; bit++) {
+			if (freed[i] & (1 << bit)) {
+				block = i * CHAR_BIT + bit;
+				bitmap_unmark(sfs->sfs_freemap, block);
+				sfs->sfs_nfree++;
+			}
+		}
+		freed[i] = 0;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Commit
+
+/*
+ * Completion function for journal writes. Interrupt context.
+ */
+static
+void
+sfs_journal_iodone(struct bio *bio)
+{
+	struct sfs_fs *sfs = bio->bio_arg;
+
+	spinlock_acquire(&sfs->sfs_buflock);
+	KASSERT(sfs->sfs_jpending > 0);
+	sfs->sfs_jpending--;
+	if (sfs->sfs_jpending == 0) {
+		wchan_wakeall(sfs->sfs_bufwchan, &sfs->sfs_buflock);
+	}
+	spinlock_release(&sfs->sfs_buflock);
+}
+
+/*
+ * Commit the running transaction: write the descriptor and the
+ * copies, all at once, wait, and then write the commit block.
+ */
+int
+sfs_journal_commit(struct sfs_fs *sfs)
+{
+	struct sfs_jdesc *jd = sfs->sfs_jdesc;
+	struct sfs_jcommit *jc = sfs->sfs_jcommit;
+	unsigned n, r, i;
+	daddr_t base;
+	uint32_t sum;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (sfs->sfs_jbufs == NULL) {
+		return 0;
+	}
+	n = sfs->sfs_jnbufs;
+	r = sfs->sfs_jnrevoked;
+	if (n == 0 && r == 0) {
+		return 0;
+	}
+	if (sfs->sfs_jhead + n + 2 > sfs->sfs_sb.sb_journalblocks) {
+		return ENOSPC;
+	}
+
+	bzero(jd, sizeof(*jd));
+	jd->jd_magic = SFS_JMAGIC_DESC;
+	jd->jd_seq = sfs->sfs_jseq;
+	jd->jd_nblocks = n;
+	jd->jd_nrevoked = r;
+	for (i=0; i<n; i++) {
+		jd->jd_entries[i] = sfs->sfs_jbufs[i]->b_block;
+	}
+	for (i=0; i<r; i++) {
+		jd->jd_entries[n+i] = sfs->sfs_jrevoked[i];
+	}
+
+	sum = sfs_jsum(0, jd);
+	for (i=0; i<n; i++) {
+		sum = sfs_jsum(sum, sfs->sfs_jbufs[i]->b_data);
+	}
+
+	bzero(jc, sizeof(*jc));
+	jc->jc_magic = SFS_JMAGIC_COMMIT;
+	jc->jc_seq = sfs->sfs_jseq;
+	jc->jc_sum = sum;
+
+	/*
+	 * The descriptor and copies are contiguous, so the disk queue
+	 * will send them down together.
+	 */
+	base = sfs->sfs_sb.sb_journalstart + sfs->sfs_jhead;
+	spinlock_acquire(&sfs->sfs_buflock);
+	sfs->sfs_jpending = n + 1;
+	spinlock_release(&sfs->sfs_buflock);
+
+	bio_init(&sfs->sfs_jbios[0], base, jd, SFS_BLOCKSIZE, UIO_WRITE,
+		 sfs_journal_iodone, sfs);
+	bio_submit(sfs->sfs_device, &sfs->sfs_jbios[0]);
+	for (i=0; i<n; i++) {
+		bio_init(&sfs->sfs_jbios[i+1], base + 1 + i,
+			 sfs->sfs_jbufs[i]->b_data, SFS_BLOCKSIZE, UIO_WRITE,
+			 sfs_journal_iodone, sfs);
+		bio_submit(sfs->sfs_device, &sfs->sfs_jbios[i+1]);
+	}
+
+	spinlock_acquire(&sfs->sfs_buflock);
+	while (sfs->sfs_jpending > 0) {
+		wchan_sleep(sfs->sfs_bufwchan, &sfs->sfs_buflock);
+	}
+	spinlock_release(&sfs->sfs_buflock);
+
+	for (i=0; i<=n; i++) {
+		if (sfs->sfs_jbios[i].bio_result) {
+			return sfs->sfs_jbios[i].bio_result;
+		}
+	}
+
+	/* Only once the rest is down does the commit block go */
+	result = sfs_diskio(sfs, base + n + 1, jc, UIO_WRITE);
+	if (result) {
+		return result;
+	}
+
+	/* Committed. The buffers can go home now. */
+	for (i=0; i<n; i++) {
+		sfs->sfs_jbufs[i]->b_jpinned = false;
+		if (!bitmap_isset(sfs->sfs_jlogged,
+				  sfs->sfs_jbufs[i]->b_block)) {
+			bitmap_mark(sfs->sfs_jlogged,
+				    sfs->sfs_jbufs[i]->b_block);
+		}
+	}
+	sfs->sfs_jnbufs = 0;
+	sfs->sfs_jnrevoked = 0;
+	sfs->sfs_jhead += n + 2;
+	sfs->sfs_jseq++;
+	return 0;
+}
+
+/*
+ * Empty the journal. Everything it holds must be home already, and
+ * nothing may be pinned.
+ */
+int
+sfs_journal_reset(struct sfs_fs *sfs)
+{
+	unsigned char *logged;
+	unsigned i, nbytes;
+	int result;
+
+	if (sfs->sfs_jbufs == NULL || sfs->sfs_jhead == 1) {
+		return 0;
+	}
+	KASSERT(sfs->sfs_jnbufs == 0);
+
+	result = sfs_journal_writeheader(sfs, sfs->sfs_jseq);
+	if (result) {
+		return result;
+	}
+	sfs->sfs_jhead = 1;
+
+	logged = bitmap_getdata(sfs->sfs_jlogged);
+	nbytes = DIVROUNDUP(sfs->sfs_sb.sb_nblocks, CHAR_BIT);
+	for (i=0; i<nbytes; i++) {
+		logged[i] = 0;
+	}
+	return 0;
+}
+
+/*
+ * Checkpoint: commit the running transaction, write everything home,
+ * and empty the journal. The caller has already synced the in-memory
+ * metadata. Without a journal this is just a cache flush.
+ */
+int
+sfs_journal_checkpoint(struct sfs_fs *sfs)
+{
+	int result;
+
+	if (sfs->sfs_jbufs == NULL) {
+		return sfs_cache_flush(sfs);
+	}
+
+	result = sfs_journal_commit(sfs);
+	if (result == ENOSPC) {
+		/* This flushes and resets */
+		return sfs_journal_abandon(sfs);
+	}
+	if (result) {
+		return result;
+	}
+	result = sfs_cache_flush(sfs);
+	if (result) {
+		return result;
+	}
+	result = sfs_journal_reset(sfs);
+	if (result) {
+		return result;
+	}
+	sfs_journal_releasefreed(sfs);
+	return 0;
+}
+
+/*
+ * Group commit: put everything dirty in memory into the running
+ * transaction and commit it. If the journal is getting full,
+ * checkpoint instead. Either way the inodes and freemap on disk (or
+ * in the journal) no longer refer to the blocks in sfs_jfreed, so
+ * they can be reused now. (Not after other commits: those can come
+ * in the middle of an operation, before the freemap or the inode
+ * that let go of the block has been written.)
+ */
+int
+sfs_journal_groupcommit(struct sfs_fs *sfs)
+{
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (sfs->sfs_jbufs == NULL) {
+		return 0;
+	}
+	if (sfs->sfs_jhead + 2 * SFS_JMAXTRANS > sfs->sfs_sb.sb_journalblocks) {
+		return sfs_sync_volume(sfs);
+	}
+	result = sfs_sync_metadata(sfs);
+	if (result) {
+		return result;
+	}
+	result = sfs_journal_commit(sfs);
+	if (result == ENOSPC) {
+		result = sfs_journal_abandon(sfs);
+	}
+	if (result) {
+		return result;
+	}
+	sfs_journal_releasefreed(sfs);
+	return 0;
+}
+
+/*
+ * Called on the way into an operation that changes metadata. At the
+ * outermost level, nothing is half done, so this is a safe place to
+ * commit the running transaction if it's getting large or hasn't
+ * SFS_JOPMAX entries to spare, or to checkpoint if the journal is
+ * getting full. If that fails, so does the operation, before it has
+ * changed anything; the caller should not call sfs_trans_end.
+ */
+int
+sfs_trans_begin(struct sfs_fs *sfs)
+{
+	unsigned used;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (sfs->sfs_jbufs == NULL) {
+		return 0;
+	}
+	if (sfs->sfs_jnest == 0) {
+		used = sfs->sfs_jnbufs + sfs->sfs_jnrevoked;
+		if (used >= SFS_JCOMMIT_THRESH ||
+		    used + SFS_JOPMAX > SFS_JDESC_NENTRIES ||
+		    sfs->sfs_jhead + 2 * SFS_JMAXTRANS >
+		    sfs->sfs_sb.sb_journalblocks) {
+			result = sfs_journal_groupcommit(sfs);
+			if (result) {
+				return result;
+			}
+		}
+	}
+	sfs->sfs_jnest++;
+	return 0;
+}
+
+/*
+ * Called on the way out of such an operation.
+ */
+void
+sfs_trans_end(struct sfs_fs *sfs)
+{
+	if (sfs->sfs_jbufs == NULL) {
+		return;
+	}
+	KASSERT(sfs->sfs_jnest > 0);
+	sfs->sfs_jnest--;
+}
@@ -42,6 +42,9 @@
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/* Chunk size for user I/O; see sfs_bounceio */
+#define SFS_BOUNCESIZE (8 * SFS_BLOCKSIZE)
+
 ////////////////////////////////////////////////////////////
 // Vnode operations.
 
@@ -91,43 +94,150 @@ sfs_eachopendir(struct vnode *v, int openflags)
 }
 
 /*
- * Called for read(). sfs_io() does the work.
+ * Read into a kernel buffer. sfs_io() does the work; afterwards, let
+ * read-ahead see where the read went.
  */
 static
 int
-sfs_read(struct vnode *v, struct uio *uio)
+sfs_doread(struct sfs_vnode *sv, struct uio *uio)
 {
-	struct sfs_vnode *sv = v->vn_data;
+	uint32_t firstblock;
 	int result;
 
-	KASSERT(uio->uio_rw==UIO_READ);
-
 	vfs_biglock_acquire();
+	firstblock = uio->uio_offset / SFS_BLOCKSIZE;
 	result = sfs_io(sv, uio);
+	if (result == 0) {
+		/* Keep sequential readers ahead of the disk */
+		sfs_readahead(sv, firstblock, uio->uio_offset);
+	}
 	vfs_biglock_release();
 
 	return result;
 }
 
 /*
- * Called for write(). sfs_io() does the work.
+ * Write from a kernel buffer, as one operation. sfs_io() does the work.
  */
 static
 int
-sfs_write(struct vnode *v, struct uio *uio)
+sfs_dowrite(struct sfs_vnode *sv, struct uio *uio)
 {
-	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	int result;
 
-	KASSERT(uio->uio_rw==UIO_WRITE);
-
 	vfs_biglock_acquire();
+	result = sfs_trans_begin(sfs);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
 	result = sfs_io(sv, uio);
+	sfs_trans_end(sfs);
 	vfs_biglock_release();
 
 	return result;
 }
 
+/*
+ * Do I/O to or from user memory through a kernel buffer, a chunk at a
+ * time, so that user memory is never touched under the big lock. A
+ * fault on program text that hasn't been read in yet reads it from
+ * its file, which takes the big lock (see dumbvm.c), and may have to
+ * wait for another process already doing that, which may be waiting
+ * for us.
+ */
+static
+int
+sfs_bounceio(struct sfs_vnode *sv, struct uio *uio)
+{
+	struct iovec iov;
+	struct uio ku;
+	char *bounce;
+	size_t len, done;
+	int result = 0, result2;
+
+	bounce = kmalloc(SFS_BOUNCESIZE);
+	if (bounce == NULL) {
+		return ENOMEM;
+	}
+
+	while (uio->uio_resid > 0) {
+		len = uio->uio_resid;
+		if (len > SFS_BOUNCESIZE) {
+			len = SFS_BOUNCESIZE;
+		}
+		uio_kinit(&iov, &ku, bounce, len, uio->uio_offset,
+			  uio->uio_rw);
+
+		if (uio->uio_rw == UIO_READ) {
+			result = sfs_doread(sv, &ku);
+			done = len - ku.uio_resid;
+			if (done > 0) {
+				result2 = uiomove(bounce, done, uio);
+				if (result == 0) {
+					result = result2;
+				}
+			}
+		}
+		else {
+			result = uiomove(bounce, len, uio);
+			if (result) {
+				break;
+			}
+			result = sfs_dowrite(sv, &ku);
+			done = len - ku.uio_resid;
+			/*
+			 * Give back what didn't get written. (Only the
+			 * offset and count; nobody looks at the iovecs
+			 * of a uio that has failed.)
+			 */
+			uio->uio_offset -= ku.uio_resid;
+			uio->uio_resid += ku.uio_resid;
+		}
+		if (result || done < len) {
+			break;
+		}
+	}
+
+	kfree(bounce);
+	return result;
+}
+
+/*
+ * Called for read().
+ */
+static
+int
+sfs_read(struct vnode *v, struct uio *uio)
+{
+	struct sfs_vnode *sv = v->vn_data;
+
+	KASSERT(uio->uio_rw==UIO_READ);
+
+	if (uio->uio_segflg != UIO_SYSSPACE) {
+		return sfs_bounceio(sv, uio);
+	}
+	return sfs_doread(sv, uio);
+}
+
+/*
+ * Called for write().
+ */
+static
+int
+sfs_write(struct vnode *v, struct uio *uio)
+{
+	struct sfs_vnode *sv = v->vn_data;
+
+	KASSERT(uio->uio_rw==UIO_WRITE);
+
+	if (uio->uio_segflg != UIO_SYSSPACE) {
+		return sfs_bounceio(sv, uio);
+	}
+	return sfs_dowrite(sv, uio);
+}
+
 /*
  * Called for ioctl()
  */
@@ -216,16 +326,29 @@ sfs_isseekable(struct vnode *v)
 /*
  * Called for fsync(), and also on filesystem unmount, global sync(),
  * and some other cases.
+ *
+ * The file's data may be sitting in the cache without disk blocks
+ * and its inode and indirect block may be dirty there too, so this
+ * places the data and then writes back the whole volume, inode and all.
  */
 static
 int
 sfs_fsync(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	int result;
 
 	vfs_biglock_acquire();
-	result = sfs_sync_inode(sv);
+
+	result = sfs_cache_placevnode(sv);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
+	/* This gets the inode too */
+	result = sfs_sync_volume(sfs);
 	vfs_biglock_release();
 
 	return result;
@@ -250,8 +373,20 @@ int
 sfs_truncate(struct vnode *v, off_t len)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	int result;
 
-	return sfs_itrunc(sv, len);
+	vfs_biglock_acquire();
+	result = sfs_trans_begin(sfs);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+	result = sfs_itrunc(sv, len);
+	sfs_trans_end(sfs);
+	vfs_biglock_release();
+
+	return result;
 }
 
 /*
@@ -290,16 +425,23 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	int result;
 
 	vfs_biglock_acquire();
+	result = sfs_trans_begin(sfs);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
 
 	/* Look up the name */
 	result = sfs_dir_findname(sv, name, &ino, NULL, NULL);
 	if (result!=0 && result!=ENOENT) {
+		sfs_trans_end(sfs);
 		vfs_biglock_release();
 		return result;
 	}
 
 	/* If it exists and we didn't want it to, fail */
 	if (result==0 && excl) {
+		sfs_trans_end(sfs);
 		vfs_biglock_release();
 		return EEXIST;
 	}
@@ -308,10 +450,12 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 		/* We got something; load its vnode and return */
 		result = sfs_loadvnode(sfs, ino, SFS_TYPE_INVAL, &newguy);
 		if (result) {
+			sfs_trans_end(sfs);
 			vfs_biglock_release();
 			return result;
 		}
 		*ret = &newguy->sv_absvn;
+		sfs_trans_end(sfs);
 		vfs_biglock_release();
 		return 0;
 	}
@@ -319,6 +463,7 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	/* Didn't exist - create it */
 	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
 	if (result) {
+		sfs_trans_end(sfs);
 		vfs_biglock_release();
 		return result;
 	}
@@ -330,6 +475,7 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	result = sfs_dir_link(sv, name, newguy->sv_ino, NULL);
 	if (result) {
 		VOP_DECREF(&newguy->sv_absvn);
+		sfs_trans_end(sfs);
 		vfs_biglock_release();
 		return result;
 	}
@@ -342,6 +488,7 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 
 	*ret = &newguy->sv_absvn;
 
+	sfs_trans_end(sfs);
 	vfs_biglock_release();
 	return 0;
 }
@@ -357,14 +504,21 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 {
 	struct sfs_vnode *sv = dir->vn_data;
 	struct sfs_vnode *f = file->vn_data;
+	struct sfs_fs *sfs = dir->vn_fs->fs_data;
 	int result;
 
 	KASSERT(file->vn_fs == dir->vn_fs);
 
 	vfs_biglock_acquire();
+	result = sfs_trans_begin(sfs);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
 
 	/* Hard links to directories aren't allowed. */
 	if (f->sv_i.sfi_type == SFS_TYPE_DIR) {
+		sfs_trans_end(sfs);
 		vfs_biglock_release();
 		return EINVAL;
 	}
@@ -372,6 +526,7 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 	/* Create the link */
 	result = sfs_dir_link(sv, name, f->sv_ino, NULL);
 	if (result) {
+		sfs_trans_end(sfs);
 		vfs_biglock_release();
 		return result;
 	}
@@ -380,6 +535,7 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 	f->sv_i.sfi_linkcount++;
 	f->sv_dirty = true;
 
+	sfs_trans_end(sfs);
 	vfs_biglock_release();
 	return 0;
 }
@@ -392,15 +548,22 @@ int
 sfs_remove(struct vnode *dir, const char *name)
 {
 	struct sfs_vnode *sv = dir->vn_data;
+	struct sfs_fs *sfs = dir->vn_fs->fs_data;
 	struct sfs_vnode *victim;
 	int slot;
 	int result;
 
 	vfs_biglock_acquire();
+	result = sfs_trans_begin(sfs);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
 
 	/* Look for the file and fetch a vnode for it. */
 	result = sfs_lookonce(sv, name, &victim, &slot);
 	if (result) {
+		sfs_trans_end(sfs);
 		vfs_biglock_release();
 		return result;
 	}
@@ -417,6 +580,7 @@ sfs_remove(struct vnode *dir, const char *name)
 	/* Discard the reference that sfs_lookonce got us */
 	VOP_DECREF(&victim->sv_absvn);
 
+	sfs_trans_end(sfs);
 	vfs_biglock_release();
 	return result;
 }
@@ -439,6 +603,11 @@ sfs_rename(struct vnode *d1, const char *n1,
 	int result, result2;
 
 	vfs_biglock_acquire();
+	result = sfs_trans_begin(sfs);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
 
 	KASSERT(d1==d2);
 	KASSERT(sv->sv_ino == SFS_ROOTDIR_INO);
@@ -446,6 +615,7 @@ sfs_rename(struct vnode *d1, const char *n1,
 	/* Look up the old name of the file and get its inode and slot number*/
 	result = sfs_lookonce(sv, n1, &g1, &slot1);
 	if (result) {
+		sfs_trans_end(sfs);
 		vfs_biglock_release();
 		return result;
 	}
@@ -487,6 +657,7 @@ sfs_rename(struct vnode *d1, const char *n1,
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_absvn);
 
+	sfs_trans_end(sfs);
 	vfs_biglock_release();
 	return 0;
 
@@ -507,6 +678,7 @@ sfs_rename(struct vnode *d1, const char *n1,
  puke:
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_absvn);
+	sfs_trans_end(sfs);
 	vfs_biglock_release();
 	return result;
 }
@@ -52,6 +52,25 @@ int sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		daddr_t *diskblock);
 int sfs_itrunc(struct sfs_vnode *sv, off_t len);
 
+/* Functions in sfs_cache.c */
+int sfs_cache_init(struct sfs_fs *sfs);
+void sfs_cache_cleanup(struct sfs_fs *sfs);
+struct sfs_buf *sfs_buf_lookup(struct sfs_fs *sfs, daddr_t block);
+int sfs_buf_get(struct sfs_fs *sfs, daddr_t block, bool doread,
+		struct sfs_buf **ret);
+void sfs_buf_release(struct sfs_buf *b);
+void sfs_buf_markdirty(struct sfs_buf *b);
+void sfs_buf_discard(struct sfs_buf *b);
+void sfs_cache_invalidate(struct sfs_fs *sfs, daddr_t block);
+struct sfs_buf *sfs_buf_finddelayed(struct sfs_vnode *sv, uint32_t fileblock);
+struct sfs_buf *sfs_buf_newdelayed(struct sfs_vnode *sv, uint32_t fileblock);
+int sfs_cache_placevnode(struct sfs_vnode *sv);
+int sfs_cache_placeall(struct sfs_fs *sfs);
+void sfs_cache_truncate(struct sfs_vnode *sv, uint32_t nblocks);
+int sfs_cache_flush(struct sfs_fs *sfs);
+void sfs_cache_prefetch(struct sfs_fs *sfs, daddr_t block);
+void sfs_readahead(struct sfs_vnode *sv, uint32_t firstblock, off_t endpos);
+
 /* Functions in sfs_dir.c */
 int sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 		uint32_t *ino, int *slot, int *emptyslot);
@@ -62,6 +81,10 @@ int sfs_lookonce(struct sfs_vnode *sv, const char *name,
 		struct sfs_vnode **ret,
 		int *slot);
 
+/* Functions in sfs_fsops.c */
+int sfs_sync_metadata(struct sfs_fs *sfs);
+int sfs_sync_volume(struct sfs_fs *sfs);
+
 /* Functions in sfs_inode.c */
 int sfs_sync_inode(struct sfs_vnode *sv);
 int sfs_reclaim(struct vnode *v);
@@ -71,11 +94,28 @@ int sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret);
 int sfs_getroot(struct fs *fs, struct vnode **ret);
 
 /* Functions in sfs_io.c */
+int sfs_diskio(struct sfs_fs *sfs, daddr_t block, void *data,
+	       enum uio_rw rw);
 int sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_io(struct sfs_vnode *sv, struct uio *uio);
 int sfs_metaio(struct sfs_vnode *sv, off_t pos, void *data, size_t len,
 	       enum uio_rw rw);
 
+/* Functions in sfs_journal.c */
+int sfs_journal_replay(struct sfs_fs *sfs);
+int sfs_journal_init(struct sfs_fs *sfs);
+void sfs_journal_cleanup(struct sfs_fs *sfs);
+int sfs_journal_add(struct sfs_fs *sfs, struct sfs_buf *b);
+void sfs_journal_forget(struct sfs_fs *sfs, struct sfs_buf *b);
+bool sfs_journal_free(struct sfs_fs *sfs, daddr_t block);
+void sfs_journal_freemapblock(struct sfs_fs *sfs, unsigned j, char *buf);
+int sfs_journal_commit(struct sfs_fs *sfs);
+int sfs_journal_reset(struct sfs_fs *sfs);
+int sfs_journal_checkpoint(struct sfs_fs *sfs);
+int sfs_journal_groupcommit(struct sfs_fs *sfs);
+int sfs_trans_begin(struct sfs_fs *sfs);
+void sfs_trans_end(struct sfs_fs *sfs);
+
 
 #endif /* _SFSPRIVATE_H_ */
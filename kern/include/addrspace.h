@@ -40,6 +40,7 @@
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct dumbvm_image;
 
 
 /*
@@ -54,9 +55,11 @@ struct addrspace {
         vaddr_t as_vbase1;
         paddr_t as_pbase1;
         size_t as_npages1;
+        struct dumbvm_image *as_image1;  /* file backing, or NULL */
         vaddr_t as_vbase2;
         paddr_t as_pbase2;
         size_t as_npages2;
+        struct dumbvm_image *as_image2;
         paddr_t as_stackpbase;
 #else
         /* Put stuff here for your VM system */
@@ -88,7 +91,10 @@ struct addrspace {
  *                the way this works if implementing user-level threads.
  *
  *    as_define_region - set up a region of memory within the address
- *                space.
+ *                space. If V is not NULL, the first FILESZ bytes of
+ *                the region come from file V at offset OFFSET, and
+ *                the rest is zero; the VM system reads them in as
+ *                the pages are touched.
  *
  *    as_prepare_load - this is called before actually loading from an
  *                executable into the address space.
@@ -112,6 +118,8 @@ void              as_destroy(struct addrspace *);
 
 int               as_define_region(struct addrspace *as,
                                    vaddr_t vaddr, size_t sz,
+                                   struct vnode *v, off_t offset,
+                                   size_t filesz,
                                    int readable,
                                    int writeable,
                                    int executable);
@@ -122,9 +130,10 @@ int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 
 /*
  * Functions in loadelf.c
- *    load_elf - load an ELF user program executable into the current
- *               address space. Returns the entry point (initial PC)
- *               in the space pointed to by ENTRYPOINT.
+ *    load_elf - set up the current address space to run an ELF user
+ *               program executable, whose pages are read in on
+ *               demand. Returns the entry point (initial PC) in the
+ *               space pointed to by ENTRYPOINT.
  */
 
 int load_elf(struct vnode *v, vaddr_t *entrypoint);
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _BIO_H_
+#define _BIO_H_
+
+/*
+ * Block I/O requests.
+ *
+ * A struct bio describes a transfer of whole device blocks between a
+ * kernel buffer and a block device. bio_submit hands it to the device
+ * and returns at once; when the transfer is finished the device calls
+ * bio_finish, which records the result and calls the request's done
+ * function. That usually happens in the device's interrupt handler,
+ * so done functions must not sleep.
+ *
+ * bio_io does a transfer synchronously: it submits a request and
+ * sleeps until it completes.
+ *
+ * The request stays owned by the device from bio_submit until the
+ * done function is called; the submitter must not touch it or its
+ * buffer in between.
+ */
+
+#include <uio.h>		/* for enum uio_rw */
+#include <spinlock.h>
+
+struct device;			/* in <device.h> */
+
+struct bio {
+	daddr_t bio_block;		/* first device block */
+	void *bio_data;			/* kernel buffer */
+	size_t bio_len;			/* bytes; a multiple of blocksize */
+	enum uio_rw bio_rw;		/* UIO_READ or UIO_WRITE */
+	int bio_result;			/* errno value, set on completion */
+	void (*bio_done)(struct bio *);	/* completion function */
+	void *bio_arg;			/* for the completion function */
+	struct bio *bio_next;		/* link for device request queues */
+	struct bio *bio_chain;		/* requests merged behind this one */
+	unsigned bio_deadline;		/* latest dispatch to issue it in */
+};
+
+/*
+ * A device's queue of pending requests.
+ *
+ * The queue hands requests to the driver in the order chosen by its
+ * scheduling policy (see bio.c). When a request is queued right
+ * behind another one going the same way, it is merged: chained onto
+ * bio_chain of the earlier one and issued along with it. The driver
+ * does the chain as one transfer and finishes each request in it.
+ *
+ * The queue is protected by a spinlock belonging to the driver, which
+ * must hold it when calling bioq_insert and bioq_remove.
+ */
+struct biosched;		/* scheduling policy; private to bio.c */
+
+struct bioqueue {
+	const char *bq_name;		/* device name, for stats */
+	struct spinlock *bq_lock;	/* the driver's lock */
+	size_t bq_blocksize;		/* device block size */
+	const struct biosched *bq_sched; /* current policy */
+	struct bio *bq_head;		/* pending requests, in policy order */
+	struct bio *bq_tail;
+	unsigned bq_count;		/* number of requests in the list */
+	daddr_t bq_headpos;		/* block after the last one issued */
+	unsigned bq_dispatched;		/* number of chains issued */
+	struct bioqueue *bq_nextq;	/* list of all queues */
+
+	/* statistics */
+	unsigned bq_maxcount;		/* deepest the queue has been */
+	unsigned bq_merged;		/* requests merged into others */
+	unsigned bq_expired;		/* chains issued early for deadline */
+	uint64_t bq_seektotal;		/* blocks moved between chains */
+	daddr_t bq_seekmax;		/* longest single seek */
+};
+
+/*
+ * Functions:
+ *    bio_bootstrap - set up; called by vfs_bootstrap.
+ *    bio_init      - fill in a request.
+ *    bio_submit    - start a request. Errors are reported through
+ *                    bio_result, never by bio_submit itself.
+ *    bio_io        - do a request and wait for it; returns bio_result.
+ *    bio_finish    - for device drivers: complete a request.
+ *    bio_setsched  - change the scheduling policy of the named
+ *                    device's queue ("fifo" or "clook").
+ *    bio_printstats - print per-device queue statistics.
+ */
+void bio_bootstrap(void);
+void bio_init(struct bio *bio, daddr_t block, void *data, size_t len,
+	      enum uio_rw rw, void (*done)(struct bio *), void *arg);
+void bio_submit(struct device *d, struct bio *bio);
+int bio_io(struct device *d, daddr_t block, void *data, size_t len,
+	   enum uio_rw rw);
+void bio_finish(struct bio *bio, int result);
+int bio_setsched(const char *devname, const char *policy);
+void bio_printstats(void);
+
+/*
+ * Request queue functions, for device drivers:
+ *    bioq_init    - initialize an empty queue and register it by name.
+ *    bioq_insert  - add a request.
+ *    bioq_remove  - take the next chain of requests to issue, or NULL.
+ *    bioq_isempty - check if there are requests waiting.
+ */
+void bioq_init(struct bioqueue *bq, const char *name,
+	       struct spinlock *lock, size_t blocksize);
+void bioq_insert(struct bioqueue *bq, struct bio *bio);
+struct bio *bioq_remove(struct bioqueue *bq);
+bool bioq_isempty(struct bioqueue *bq);
+
+
+#endif /* _BIO_H_ */
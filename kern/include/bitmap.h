@@ -38,8 +38,12 @@
  *                      Returns NULL on error.
  *     bitmap_getdata - return pointer to raw bit data (for I/O).
  *     bitmap_alloc   - locate a cleared bit, set it, and return its index.
+ *                      Always finds the lowest-numbered clear bit.
  *     bitmap_mark    - set a clear bit by its index.
  *     bitmap_unmark  - clear a set bit by its index.
+ *     bitmap_alloc_run - locate the first run of COUNT cleared bits, set
+ *                      them, and return the index of the first.
+ *     bitmap_unmark_run - clear COUNT set bits starting at an index.
  *     bitmap_isset   - return whether a particular bit is set or not.
  *     bitmap_destroy - destroy bitmap.
  */
@@ -52,6 +56,10 @@ void          *bitmap_getdata(struct bitmap *);
 int            bitmap_alloc(struct bitmap *, unsigned *index);
 void           bitmap_mark(struct bitmap *, unsigned index);
 void           bitmap_unmark(struct bitmap *, unsigned index);
+int            bitmap_alloc_run(struct bitmap *, unsigned count,
+                                unsigned *index);
+void           bitmap_unmark_run(struct bitmap *, unsigned index,
+                                 unsigned count);
 int            bitmap_isset(struct bitmap *, unsigned index);
 void           bitmap_destroy(struct bitmap *);
 
@@ -35,8 +35,18 @@
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
+struct scstats;
+struct kmalloc_cpu;
+
 extern unsigned num_cpus;
 
+/*
+ * Number of freed thread stacks, and of dead threads (along with
+ * their stacks), each cpu holds on to for reuse.
+ */
+#define CPU_NSTACKS 4
+#define CPU_NTHREADS 8
+
 /*
  * Per-cpu structure
  *
@@ -62,6 +72,11 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	struct scstats *c_scstats;	/* System call statistics */
+	struct kmalloc_cpu *c_kmalloc;	/* kmalloc magazines */
+	void *c_stacks[CPU_NSTACKS];	/* Recently freed thread stacks */
+	unsigned c_nstacks;		/* Number of stacks in c_stacks */
+	struct threadlist c_freethreads;	/* Dead threads for reuse */
 
 	/*
 	 * Accessed by other cpus.
@@ -143,6 +158,13 @@ void cpu_irqon(void);
 void cpu_idle(void);
 void cpu_halt(void);
 
+/*
+ * Read the current CPU's cycle counter. It runs freely and wraps, and
+ * different CPUs' counters aren't synchronized, so only differences
+ * taken on one CPU mean anything.
+ */
+uint32_t cpu_getcycles(void);
+
 /*
  * Interprocessor interrupts.
  *
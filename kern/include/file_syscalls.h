@@ -1,10 +1,22 @@
 #include <types.h>
 
+struct iovec;
+
 int sys_open(const char *, int, int32_t *);
 int sys_close(int);
 int sys_write(int, void *, size_t, ssize_t *);
 int sys_read(int, void *, size_t, ssize_t *);
+int sys_pread(int, void *, size_t, off_t, ssize_t *);
+int sys_pwrite(int, const void *, size_t, off_t, ssize_t *);
+int sys_readv(int, const struct iovec *, int, ssize_t *);
+int sys_writev(int, const struct iovec *, int, ssize_t *);
+int sys_preadv(int, const struct iovec *, int, off_t, ssize_t *);
+int sys_pwritev(int, const struct iovec *, int, off_t, ssize_t *);
 int sys_lseek(int, off_t, int, off_t *);
 int sys___getcwd(char *, size_t, int32_t *);
 int sys_chdir(const char *);
-int sys_dup2(int, int, int32_t *);
\ No newline at end of file
+int sys_dup2(int, int, int32_t *);
+int sys_pipe(userptr_t, int32_t *);
+int sys_fsync(int);
+int sys_sync(void);
+int sys_sysbatch(userptr_t, int, int32_t *);
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_SCSTATS_H_
+#define _KERN_SCSTATS_H_
+
+/*
+ * System call statistics, as returned by reading the "scstats:"
+ * device. One read returns the whole structure, summed over all CPUs.
+ *
+ * For each call number there is a count of calls, a count of those
+ * that failed, the total latency in cycles from trap to return, and a
+ * histogram of latencies: sc_hist[n][0] counts calls that took under
+ * 2 cycles, and sc_hist[n][b] for b > 0 counts calls that took from
+ * 2^b to 2^(b+1)-1 cycles, except the last bucket, which also takes
+ * everything longer.
+ *
+ * A call whose thread moved to another CPU before it returned is
+ * counted but not timed, since the two CPUs' cycle counters don't
+ * agree; so are _exit, and execv when it works, which never return.
+ * The histogram total is the number of timed calls.
+ */
+
+#define SCSTATS_NCALLS    128	/* more than the largest SYS_* number */
+#define SCSTATS_NBUCKETS  24	/* top bucket starts at 2^23 cycles */
+
+struct scstats {
+	__u32 sc_calls[SCSTATS_NCALLS];
+	__u32 sc_errors[SCSTATS_NCALLS];
+	__u64 sc_cycles[SCSTATS_NCALLS];
+	__u32 sc_hist[SCSTATS_NCALLS][SCSTATS_NBUCKETS];
+};
+
+#endif /* _KERN_SCSTATS_H_ */
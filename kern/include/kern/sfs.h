@@ -49,6 +49,10 @@
 #define SFS_FREEMAP_START 2             /* 1st block of the freemap */
 #define SFS_NOINO         0             /* inode # for free dir entry */
 #define SFS_ROOTDIR_INO   1             /* loc'n of the root dir inode */
+#define SFS_JMAGIC_HEAD   0x5f4a4844    /* journal header magic */
+#define SFS_JMAGIC_DESC   0x5f4a4453    /* journal descriptor magic */
+#define SFS_JMAGIC_COMMIT 0x5f4a434d    /* journal commit magic */
+#define SFS_JOURNAL_SIZE  256           /* default journal size (blocks) */
 
 /* Number of bits in a block */
 #define SFS_BITSPERBLOCK (SFS_BLOCKSIZE * CHAR_BIT)
@@ -74,7 +78,9 @@ struct sfs_superblock {
 	uint32_t sb_magic;		/* Magic number; should be SFS_MAGIC */
 	uint32_t sb_nblocks;			/* Number of blocks in fs */
 	char sb_volname[SFS_VOLNAME_SIZE];	/* Name of this volume */
-	uint32_t reserved[118];			/* unused, set to 0 */
+	uint32_t sb_journalstart;		/* First block of journal */
+	uint32_t sb_journalblocks;		/* Journal size; 0 if none */
+	uint32_t reserved[116];			/* unused, set to 0 */
 };
 
 /*
@@ -97,5 +103,48 @@ struct sfs_direntry {
 	char sfd_name[SFS_NAMELEN];		/* Filename */
 };
 
+/*
+ * Metadata journal.
+ *
+ * The journal is a region of sb_journalblocks blocks starting at
+ * sb_journalstart. Its first block is the header; transactions are
+ * laid down one after another from the second block on. Each is a
+ * descriptor block, copies of the metadata blocks it lists, and a
+ * commit block. A transaction counts only if its descriptor and
+ * commit carry the expected sequence number (the header's for the
+ * first one, then one more each time) and the commit checksum
+ * matches. Recovery writes the copies of each such transaction to
+ * their home locations, except blocks a later transaction revoked
+ * (freed), then rewrites the header to empty the journal.
+ *
+ * The checksum runs over the descriptor and then each copy in order,
+ * treating them as 32-bit words: sum = ((sum << 1) | (sum >> 31)) + word,
+ * starting from 0.
+ */
+
+/* Entries in a descriptor: home blocks, then revoked blocks */
+#define SFS_JDESC_NENTRIES  124
+
+struct sfs_jheader {
+	uint32_t jh_magic;			/* SFS_JMAGIC_HEAD */
+	uint32_t jh_seq;			/* Sequence # of first trans. */
+	uint32_t jh_waste[126];			/* unused, set to 0 */
+};
+
+struct sfs_jdesc {
+	uint32_t jd_magic;			/* SFS_JMAGIC_DESC */
+	uint32_t jd_seq;			/* Sequence number */
+	uint32_t jd_nblocks;			/* # of block copies following */
+	uint32_t jd_nrevoked;			/* # of revoked blocks */
+	uint32_t jd_entries[SFS_JDESC_NENTRIES];
+};
+
+struct sfs_jcommit {
+	uint32_t jc_magic;			/* SFS_JMAGIC_COMMIT */
+	uint32_t jc_seq;			/* Sequence number */
+	uint32_t jc_sum;			/* Checksum of desc. and copies */
+	uint32_t jc_waste[125];			/* unused, set to 0 */
+};
+
 
 #endif /* _KERN_SFS_H_ */
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_SYSBATCH_H_
+#define _KERN_SYSBATCH_H_
+
+/*
+ * Batched system calls.
+ *
+ * sysbatch() takes an array of struct sysop, runs each operation in
+ * order as if it had been made as its own system call, and writes the
+ * results back into the same array, all for the price of one trap.
+ * The fields each operation uses are:
+ *
+ *     SYSOP_OPEN    so_buf (path), so_arg (flags)
+ *     SYSOP_CLOSE   so_fd
+ *     SYSOP_READ    so_fd, so_buf, so_len
+ *     SYSOP_WRITE   so_fd, so_buf, so_len
+ *     SYSOP_PREAD   so_fd, so_buf, so_len, so_pos
+ *     SYSOP_PWRITE  so_fd, so_buf, so_len, so_pos
+ *     SYSOP_LSEEK   so_fd, so_pos, so_arg (whence)
+ *
+ * On return so_error is 0 or the error code, and so_result is what the
+ * call would have returned (-1 on error).
+ */
+
+/* Operations */
+#define SYSOP_OPEN    1
+#define SYSOP_CLOSE   2
+#define SYSOP_READ    3
+#define SYSOP_WRITE   4
+#define SYSOP_PREAD   5
+#define SYSOP_PWRITE  6
+#define SYSOP_LSEEK   7
+
+/* Flags */
+#define SYSOP_STOP    1   /* if this operation fails, skip the rest */
+
+struct sysop {
+	int so_op;			/* SYSOP_* */
+	int so_flags;			/* SYSOP_STOP, or 0 */
+	int so_fd;			/* file handle */
+	int so_arg;			/* open flags or lseek whence */
+	/* a user pointer, typed as one in the kernel (cf. struct iovec) */
+#ifdef _KERNEL
+	userptr_t so_ubuf;		/* data buffer or pathname */
+#else
+	void *so_buf;			/* data buffer or pathname */
+#endif
+	size_t so_len;			/* buffer length */
+	__off_t so_pos;			/* file position */
+	__off_t so_result;		/* out: return value */
+	int so_error;			/* out: 0 or error code */
+	int so_pad;			/* keeps the size a multiple of 8 */
+};
+
+#endif /* _KERN_SYSBATCH_H_ */
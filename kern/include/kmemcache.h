@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _KMEMCACHE_H_
+#define _KMEMCACHE_H_
+
+/*
+ * Object caches.
+ *
+ * A kmem_cache hands out objects of one fixed size, packed into
+ * whole pages ("slabs") at their exact size rather than rounded up to
+ * one of kmalloc's block sizes. Use one for any structure that is
+ * allocated and freed often.
+ *
+ * If the cache has a constructor, each object is constructed once,
+ * when its slab is set up, and destroyed (with the destructor) only
+ * when its slab is released. In between, objects must be handed back
+ * to kmem_cache_free in their constructed state, and come out of
+ * kmem_cache_alloc that way; this lets things like an object's own
+ * lock survive from one use to the next. The constructor returns 0 or
+ * an error code; it may allocate, but must not use its own cache.
+ *
+ * A cache can be set up statically with KMEM_CACHE_INITIALIZER, which
+ * works from the very start of boot, or at run time with
+ * kmem_cache_create.
+ *
+ * Functions:
+ *    kmem_cache_create     - make a cache of objects of SIZE bytes.
+ *    kmem_cache_destroy    - release a cache; nothing may be in use.
+ *    kmem_cache_alloc      - get an object; NULL if out of memory.
+ *    kmem_cache_free       - give one back.
+ *    kmem_cache_getused    - bytes of objects in use and pages held,
+ *                            over all caches, for kheap_getused.
+ *    kmem_cache_printstats - print each cache's occupancy and what
+ *                            the same objects would take from kmalloc.
+ */
+
+#include <spinlock.h>
+
+struct kmem_slab;	/* Private to kmemcache.c */
+
+struct kmem_cache {
+	const char *kmc_name;
+	size_t kmc_size;
+	int (*kmc_ctor)(void *obj);
+	void (*kmc_dtor)(void *obj);
+	struct spinlock kmc_lock;
+	unsigned kmc_perslab;		/* Objects per slab; 0 until first use */
+	struct kmem_slab *kmc_partial;	/* Slabs with objects free */
+	struct kmem_slab *kmc_empty;	/* One wholly free slab kept back */
+	unsigned kmc_nslabs;		/* Slabs held, including kmc_empty */
+	unsigned kmc_inuse;		/* Objects handed out */
+	bool kmc_listed;		/* On the list of all caches yet */
+	struct kmem_cache *kmc_next;	/* That list */
+};
+
+#define KMEM_CACHE_INITIALIZER(name, size, ctor, dtor) \
+	{ (name), (size), (ctor), (dtor), SPINLOCK_INITIALIZER, \
+	  0, NULL, NULL, 0, 0, false, NULL }
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     int (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+unsigned long kmem_cache_getused(unsigned *npages);
+void kmem_cache_printstats(void);
+
+#endif /* _KMEMCACHE_H_ */
@@ -125,15 +125,36 @@ uint32_t random(void);
  *
  * kheap_nextgeneration, dump, and dumpall do nothing unless heap
  * labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
+ *
+ * kheap_drain returns the free memory kmalloc keeps cached to the VM
+ * system, for tests that count pages.
+ *
+ * kheap_profile turns allocation-site profiling on (starting over) or
+ * off; kheap_printprofile prints the N call sites with the most memory
+ * outstanding, with their peaks and kmalloc/kfree rates.
+ * kheap_profile_alloc and kheap_profile_free let other allocators
+ * (kmem_cache) report objects to the profiler; SITE is the return
+ * address to charge.
+ *
+ * kmalloc_cpu_create sets up a new CPU's per-CPU allocation caches.
+ * kmalloc_blocksize returns how much memory kmalloc(size) really uses.
  */
+struct kmalloc_cpu;
 void *kmalloc(size_t size);
 void kfree(void *ptr);
+struct kmalloc_cpu *kmalloc_cpu_create(void);
+size_t kmalloc_blocksize(size_t size);
 void kheap_printstats(void);
 void kheap_printused(void);
 unsigned long kheap_getused(void);
 void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
+void kheap_drain(void);
+void kheap_profile(bool on);
+void kheap_printprofile(unsigned n);
+void kheap_profile_alloc(void *ptr, size_t size, vaddr_t site);
+void kheap_profile_free(void *ptr);
 
 /*
  * C string functions.
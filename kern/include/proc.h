@@ -30,7 +30,8 @@
 #ifndef _PROC_H_
 #define _PROC_H_
 
-#define MAXFTENTRY 16
+#define FT_MINSIZE 16	/* initial file table size; grows up to OPEN_MAX */
+#define SYSTEM_OPEN_MAX (OPEN_MAX * 8)	/* limit on open file handles */
 #define STDIN 0 
 #define STDOUT 1
 #define STDERR 2
@@ -46,8 +47,10 @@
 #include <limits.h>
 
 struct addrspace;
+struct bitmap;
 struct thread;
 struct vnode;
+struct wchan;
 
 /*
  * Process structure.
@@ -82,37 +85,99 @@ struct proc {
 
 	/* Process ID */
 	pid_t pid;					/* ID of this process */
-	pid_t p_pid;				/* ID of the parent process */
 
-	/* Exit code */
+	/* Family (protected by proc_familylock in proc.c) */
+	struct proc *p_parent;		/* Who will waitpid; NULL if nobody */
+	struct proc *p_children;	/* Children not yet collected */
+	struct proc *p_sibling;		/* Next on p_parent's p_children */
+	bool p_exited;			/* Set by proc_exit */
 	int exitcode; 			/* Encoded exit code from thread */
-	struct semaphore *sem_exit;
+	struct wchan *p_waitchan;	/* Waitpid sleeps here for children */
 
-	/* File Table */
-	struct fileHandle *fileTable[];
+	/* File Table (protected by p_lock) */
+	struct fileHandle **fileTable;	/* Indexed by fd */
+	int p_nfiles;			/* Number of slots in fileTable */
+	struct bitmap *p_fdmap;		/* Which fds are allocated */
+
+	/* Print each system call as it returns (see scstats.c) */
+	bool p_sctrace;
 };
 
 struct fileHandle {
 	struct vnode *fh_vnode; /* abstract structure for an on-disk file (vnode.h) */
 
 	int fh_accmode; /* indicates whether it's read/write/read&write */
-	int fh_refcount; /* reference count */
+	bool fh_seekable; /* whether fh_offset means anything */
+	int fh_refcount; /* fds and in-flight syscalls using the handle */
+	struct spinlock fh_reflock; /* protects fh_refcount */
 	off_t fh_offset; /* file offset */
 
-	struct lock *fh_lock; /* for forked processes */
+	struct lock *fh_lock; /* protects fh_offset */
 };
 
 /* Process table helpers */
-void proc_register(struct proc *);
+int proc_register(struct proc *);
 void proc_deregister(struct proc *);
 struct proc * proc_fetch(pid_t);
+int proc_setsctrace(pid_t, bool on);
+
+/*
+ * Process lifetime.
+ *
+ * proc_addchild - make a new process a child of another, for waitpid.
+ * proc_exit     - exit the current process with a _MKWAIT_* status.
+ *                 Frees everything but the proc structure at once.
+ * proc_wait     - waitpid for a child: collect its status and destroy
+ *                 it. Supports WNOHANG.
+ */
+void proc_addchild(struct proc *parent, struct proc *child);
+__DEAD void proc_exit(int waitcode);
+int proc_wait(struct proc *parent, pid_t pid, int options, int *waitcode,
+	      pid_t *retpid);
 
-/* Create a file handle */
-struct fileHandle * fh_create(void);
+/*
+ * Create a file handle. Fails with ENFILE once SYSTEM_OPEN_MAX handles
+ * exist system-wide.
+ */
+int fh_create(struct fileHandle **);
 
 /* Destroy a file handle */
 void fh_destroy(struct fileHandle*);
 
+/*
+ * Take another reference to a file handle. The handle owns a single
+ * vnode reference, given back by fh_release with the last reference.
+ */
+void fh_incref(struct fileHandle *);
+
+/* Drop a reference to a file handle, closing it with the last one. */
+void fh_release(struct fileHandle *);
+
+/*
+ * File table helpers. The table starts at FT_MINSIZE slots and grows
+ * on demand up to OPEN_MAX; p_fdmap gives the lowest free fd.
+ *
+ * fd_alloc     - install a handle at the lowest free fd (EMFILE if none).
+ * fd_install   - install a handle at a given fd, returning the handle
+ *                that was there before (or NULL) for the caller to
+ *                release.
+ * fd_get       - return the handle at fd in the current process, or
+ *                NULL if fd isn't open. Pair with fd_put.
+ * fd_remove    - take the handle at fd out of the table and return it.
+ * fd_removeif  - take fd out of the table only if it still holds the
+ *                given handle. Returns true if it did, in which case the
+ *                caller gets the table's reference.
+ * fd_copytable - give a new process the same open files as another,
+ *                taking a reference to each handle.
+ */
+int fd_alloc(struct proc *, struct fileHandle *, int *fdret);
+int fd_install(struct proc *, int fd, struct fileHandle *, struct fileHandle **oldret);
+struct fileHandle *fd_get(int fd, bool *borrowed);
+void fd_put(struct fileHandle *, bool borrowed);
+struct fileHandle *fd_remove(struct proc *, int fd);
+bool fd_removeif(struct proc *, int fd, struct fileHandle *);
+int fd_copytable(struct proc *from, struct proc *to);
+
 /* This is the process structure for the kernel and for kernel-only threads. */
 extern struct proc *kproc;
 
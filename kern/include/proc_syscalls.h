@@ -5,4 +5,5 @@ int sys_fork(struct trapframe *, int32_t *);
 int sys_getpid(int32_t *);
 int sys__exit(int);
 int sys_waitpid(pid_t, int *, int, int32_t *);
-int sys_execv(const char *, char **);
\ No newline at end of file
+int sys_execv(const char *, char **);
+int sys_spawn(const char *, char **, int32_t *);
\ No newline at end of file
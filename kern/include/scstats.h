@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SCSTATS_H_
+#define _SCSTATS_H_
+
+/*
+ * System call statistics and tracing.
+ *
+ * Every system call is counted and timed, into a struct scstats (see
+ * <kern/scstats.h>) belonging to the CPU it ran on, so the counting
+ * itself never contends. Processes with p_sctrace set also have each
+ * call printed as it returns.
+ *
+ *    scstats_create    - allocate statistics for a new CPU.
+ *    scstats_bootstrap - set up; attaches the "scstats:" device.
+ *    scstats_enter     - for syscall(): count a call as it starts.
+ *    scstats_record    - for syscall(): account for the result and
+ *                        time of a call that started on CPU startcpu
+ *                        at cycle count start, and trace it if the
+ *                        process asked for that.
+ *    scstats_snapshot  - sum all CPUs' statistics into *sc.
+ *    scstats_reset     - zero all statistics.
+ *    scstats_print     - print a summary, for the kernel menu.
+ *    scstats_tracenew  - if true, programs started from the menu are
+ *                        traced.
+ */
+
+#include <kern/scstats.h>
+
+struct trapframe;
+
+struct scstats *scstats_create(void);
+void scstats_bootstrap(void);
+void scstats_enter(int callno);
+void scstats_record(const struct trapframe *tf, int callno, int err,
+		    int32_t retval, unsigned startcpu, uint32_t start);
+void scstats_snapshot(struct scstats *sc);
+void scstats_reset(void);
+void scstats_print(void);
+
+extern bool scstats_tracenew;
+
+#endif /* _SCSTATS_H_ */
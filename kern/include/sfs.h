@@ -39,8 +39,10 @@
 /*
  * Get abstract structure definitions
  */
+#include <spinlock.h>
 #include <fs.h>
 #include <vnode.h>
+#include <bio.h>
 
 /*
  * Get on-disk structures and constants that are made available to
@@ -56,8 +58,36 @@ struct sfs_vnode {
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	uint32_t sv_ranext;             /* block a sequential read hits next */
+	uint32_t sv_raend;              /* first block not yet read ahead */
+	uint32_t sv_rawindow;           /* current read-ahead window (blocks) */
+	struct sfs_buf *sv_delayed;     /* dirty blocks with no disk block yet */
 };
 
+/*
+ * In-memory copy of a disk block (see sfs_cache.c)
+ */
+struct sfs_buf {
+	daddr_t b_block;                /* disk block number, 0 if delayed */
+	struct sfs_vnode *b_sv;         /* file, if allocation is delayed */
+	uint32_t b_fileblock;           /* block within b_sv */
+	bool b_valid;                   /* true if hashed or on sv_delayed */
+	bool b_dirty;                   /* b_data newer than the disk */
+	bool b_jpinned;                 /* in the running transaction */
+	time_t b_dirtytime;             /* when b_dirty was last set */
+	unsigned b_refcount;            /* holders; held buffers stay put */
+	volatile bool b_busy;           /* I/O on b_data in progress */
+	unsigned b_lastuse;             /* LRU timestamp */
+	struct sfs_buf *b_hashnext;     /* next in hash chain or sv_delayed */
+	struct sfs_fs *b_fs;            /* volume the buffer belongs to */
+	struct bio b_bio;               /* request for asynchronous I/O */
+	char *b_data;                   /* SFS_BLOCKSIZE bytes of data */
+};
+
+/* Number of cached blocks per volume, and number of hash chains */
+#define SFS_NBUFS      128
+#define SFS_BUFHASH    32
+
 /*
  * In-memory info for a whole fs volume
  */
@@ -67,8 +97,33 @@ struct sfs_fs {
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
 	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct kmem_cache *sfs_vnodecache; /* storage for them */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	uint32_t sfs_nfree;             /* blocks free in sfs_freemap */
+	struct sfs_buf *sfs_bufs;       /* block cache, SFS_NBUFS entries */
+	struct sfs_buf *sfs_bufhash[SFS_BUFHASH]; /* cache lookup chains */
+	unsigned sfs_bufclock;          /* source of b_lastuse stamps */
+	struct spinlock sfs_buflock;    /* protects b_busy */
+	struct wchan *sfs_bufwchan;     /* to wait for b_busy to clear */
+	unsigned sfs_ndirty;            /* dirty buffers */
+	unsigned sfs_ndelayed;          /* dirty buffers with no disk block */
+	struct sfs_fs *sfs_nextvol;     /* list of volumes for the flusher */
+
+	/* metadata journal (see sfs_journal.c); sfs_jbufs NULL if none */
+	struct sfs_buf **sfs_jbufs;     /* blocks in the running transaction */
+	unsigned sfs_jnbufs;            /* number of them */
+	daddr_t *sfs_jrevoked;          /* blocks it revokes */
+	unsigned sfs_jnrevoked;         /* number of them */
+	unsigned sfs_jnest;             /* sfs_trans_begin nesting depth */
+	uint32_t sfs_jseq;              /* sequence number of next commit */
+	uint32_t sfs_jhead;             /* journal block it goes in */
+	struct bitmap *sfs_jlogged;     /* blocks in the journal right now */
+	struct bitmap *sfs_jfreed;      /* freed by the running transaction */
+	struct bio *sfs_jbios;          /* for writing out a transaction */
+	void *sfs_jdesc;                /* descriptor block being built */
+	void *sfs_jcommit;              /* commit block being built */
+	unsigned sfs_jpending;          /* sfs_jbios in flight (sfs_buflock) */
 };
 
 /*
@@ -116,6 +116,14 @@ struct thread {
 	 * Public fields
 	 */
 
+	/*
+	 * Pathname buffer for system calls, allocated on first use by
+	 * pathbuf_get and kept until the thread is destroyed (which, with
+	 * recycling, can be many thread lifetimes later).
+	 */
+	char *t_pathbuf;
+	bool t_pathbuf_busy;		/* t_pathbuf is handed out */
+
 	/* add more here as needed */
 };
 
@@ -114,6 +114,19 @@ int vfs_rename(char *oldpath, char *newpath);
 int vfs_chdir(char *path);
 int vfs_getcwd(struct uio *buf);
 
+/*
+ * Pathname buffers.
+ *
+ *    pathbuf_get - Get a PATH_MAX-sized buffer to copy a pathname into:
+ *                  the current thread's own buffer if it isn't in use,
+ *                  else one from a small preallocated pool, else from
+ *                  kmalloc. Returns NULL if out of memory.
+ *    pathbuf_put - Give back a buffer from pathbuf_get.
+ */
+
+char *pathbuf_get(void);
+void pathbuf_put(char *buf);
+
 /*
  * Misc
  *
@@ -65,5 +65,13 @@ unsigned int coremap_used_bytes(void);
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/*
+ * Background work for an idle cpu, such as zeroing free pages. Does a
+ * small bounded amount and returns true if there was anything to do,
+ * in which case the caller should look for runnable threads again
+ * before going idle.
+ */
+bool vm_idle(void);
+
 
 #endif /* _VM_H_ */
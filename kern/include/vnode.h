@@ -50,7 +50,8 @@ struct stat;
  */
 struct vnode {
 	int vn_refcount;                /* Reference count */
-	struct spinlock vn_countlock;   /* Lock for vn_refcount */
+	int vn_textcount;               /* Program images using the file */
+	struct spinlock vn_countlock;   /* Lock for the counts */
 
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
 
@@ -266,6 +267,17 @@ void vnode_decref(struct vnode *);
 #define VOP_INCREF(vn) 			vnode_incref(vn)
 #define VOP_DECREF(vn) 			vnode_decref(vn)
 
+/*
+ * Program images (handled above filesystem level). The VM system
+ * counts the images it reads from a file with vnode_textref and
+ * vnode_textunref; while there are any, writes to the file would
+ * change running programs, so vnode_textbusy tells the write paths
+ * to fail with ETXTBSY.
+ */
+void vnode_textref(struct vnode *);
+void vnode_textunref(struct vnode *);
+bool vnode_textbusy(struct vnode *);
+
 /*
  * Vnode initialization (intended for use by filesystem code)
  * The reference count is initialized to 1.
@@ -42,13 +42,25 @@
  * because if one uses any data type more than a single byte wide,
  * bitmap data saved on disk becomes endian-dependent, which is a
  * severe nuisance.
+ *
+ * Searching, however, goes a 32-bit chunk at a time: whether a chunk
+ * is all ones or all zeros doesn't depend on byte order. Only once a
+ * chunk with a clear bit turns up do we look at its bytes in order.
+ * The byte array is padded out to a whole number of chunks, with the
+ * padding bits marked in use, so every chunk is entirely inside it.
  */
 #define BITS_PER_WORD   (CHAR_BIT)
 #define WORD_TYPE       unsigned char
 #define WORD_ALLBITS    (0xff)
 
+#define BITS_PER_CHUNK  32
+#define WORDS_PER_CHUNK (BITS_PER_CHUNK / BITS_PER_WORD)
+#define CHUNK_ALLBITS   (0xffffffff)
+
 struct bitmap {
         unsigned nbits;
+        unsigned nchunks;
+        unsigned hint;          /* no clear bits in chunks below this */
         WORD_TYPE *v;
 };
 
@@ -57,9 +69,10 @@ struct bitmap *
 bitmap_create(unsigned nbits)
 {
         struct bitmap *b;
-        unsigned words;
+        unsigned chunks, words, j;
 
-        words = DIVROUNDUP(nbits, BITS_PER_WORD);
+        chunks = DIVROUNDUP(nbits, BITS_PER_CHUNK);
+        words = chunks * WORDS_PER_CHUNK;
         b = kmalloc(sizeof(struct bitmap));
         if (b == NULL) {
                 return NULL;
@@ -72,51 +85,110 @@ bitmap_create(unsigned nbits)
 
         bzero(b->v, words*sizeof(WORD_TYPE));
         b->nbits = nbits;
+        b->nchunks = chunks;
+        b->hint = 0;
 
         /* Mark any leftover bits at the end in use */
-        if (words > nbits / BITS_PER_WORD) {
-                unsigned j, ix = words-1;
-                unsigned overbits = nbits - ix*BITS_PER_WORD;
-
-                KASSERT(nbits / BITS_PER_WORD == words-1);
-                KASSERT(overbits > 0 && overbits < BITS_PER_WORD);
-
-                for (j=overbits; j<BITS_PER_WORD; j++) {
-                        b->v[ix] |= ((WORD_TYPE)1 << j);
-                }
+        for (j=nbits; j<words*BITS_PER_WORD; j++) {
+                b->v[j / BITS_PER_WORD] |= ((WORD_TYPE)1 << (j % BITS_PER_WORD));
         }
 
         return b;
 }
 
+/*
+ * Since the caller may change the bits behind our back through the
+ * pointer we return, forget what we know about where the clear bits
+ * are.
+ */
 void *
 bitmap_getdata(struct bitmap *b)
 {
+        b->hint = 0;
         return b->v;
 }
 
+/*
+ * Fetch chunk C. The value is only good for comparing against zero
+ * and CHUNK_ALLBITS, since its bit order depends on the machine.
+ */
+static
+inline
+uint32_t
+bitmap_chunk(struct bitmap *b, unsigned c)
+{
+        return ((uint32_t *)b->v)[c];
+}
+
+/*
+ * Count trailing zeros of X, which must not be zero. (MIPS-I has no
+ * count-leading-zeros instruction, so do it by halves.)
+ */
+static
+inline
+unsigned
+bitmap_ctz(uint32_t x)
+{
+        unsigned n = 0;
+
+        KASSERT(x != 0);
+        if ((x & 0xffff) == 0) {
+                n += 16;
+                x >>= 16;
+        }
+        if ((x & 0xff) == 0) {
+                n += 8;
+                x >>= 8;
+        }
+        if ((x & 0xf) == 0) {
+                n += 4;
+                x >>= 4;
+        }
+        if ((x & 0x3) == 0) {
+                n += 2;
+                x >>= 2;
+        }
+        if ((x & 0x1) == 0) {
+                n += 1;
+        }
+        return n;
+}
+
+/*
+ * Return the bit number, within chunk C, of its first clear bit. The
+ * chunk must not be all ones.
+ */
+static
+unsigned
+bitmap_chunkffz(struct bitmap *b, unsigned c)
+{
+        const WORD_TYPE *w = &b->v[c * WORDS_PER_CHUNK];
+        uint32_t x;
+
+        /* Assemble the chunk in bitmap order, regardless of endianness. */
+        x = (uint32_t)w[0] | ((uint32_t)w[1] << 8) |
+                ((uint32_t)w[2] << 16) | ((uint32_t)w[3] << 24);
+        KASSERT(x != CHUNK_ALLBITS);
+        return bitmap_ctz(~x);
+}
+
 int
 bitmap_alloc(struct bitmap *b, unsigned *index)
 {
-        unsigned ix;
-        unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
-        unsigned offset;
-
-        for (ix=0; ix<maxix; ix++) {
-                if (b->v[ix]!=WORD_ALLBITS) {
-                        for (offset = 0; offset < BITS_PER_WORD; offset++) {
-                                WORD_TYPE mask = ((WORD_TYPE)1) << offset;
+        unsigned c, bit;
 
-                                if ((b->v[ix] & mask)==0) {
-                                        b->v[ix] |= mask;
-                                        *index = (ix*BITS_PER_WORD)+offset;
-                                        KASSERT(*index < b->nbits);
-                                        return 0;
-                                }
-                        }
-                        KASSERT(0);
+        for (c=b->hint; c<b->nchunks; c++) {
+                if (bitmap_chunk(b, c) != CHUNK_ALLBITS) {
+                        bit = c*BITS_PER_CHUNK + bitmap_chunkffz(b, c);
+                        KASSERT(bit < b->nbits);
+                        b->v[bit / BITS_PER_WORD] |=
+                                (WORD_TYPE)1 << (bit % BITS_PER_WORD);
+                        b->hint = c;
+                        *index = bit;
+                        return 0;
                 }
         }
+        b->hint = b->nchunks;
         return ENOSPC;
 }
 
@@ -155,6 +227,79 @@ bitmap_unmark(struct bitmap *b, unsigned index)
 
         KASSERT((b->v[ix] & mask)!=0);
         b->v[ix] &= ~mask;
+
+        if (ix / WORDS_PER_CHUNK < b->hint) {
+                b->hint = ix / WORDS_PER_CHUNK;
+        }
+}
+
+/*
+ * Find the first run of COUNT clear bits, set them, and return the
+ * index of the first. Whole chunks are skipped or taken at once.
+ */
+int
+bitmap_alloc_run(struct bitmap *b, unsigned count, unsigned *index)
+{
+        unsigned bit, start, run, i;
+        uint32_t chunk;
+
+        KASSERT(count > 0);
+
+        start = 0;
+        run = 0;
+        bit = b->hint * BITS_PER_CHUNK;
+        while (bit < b->nbits && run < count) {
+                if (bit % BITS_PER_CHUNK == 0) {
+                        chunk = bitmap_chunk(b, bit / BITS_PER_CHUNK);
+                        if (chunk == CHUNK_ALLBITS) {
+                                run = 0;
+                                bit += BITS_PER_CHUNK;
+                                continue;
+                        }
+                        if (chunk == 0) {
+                                /* padding is marked, so this is all real */
+                                if (run == 0) {
+                                        start = bit;
+                                }
+                                run += BITS_PER_CHUNK;
+                                bit += BITS_PER_CHUNK;
+                                continue;
+                        }
+                }
+                if (bitmap_isset(b, bit)) {
+                        run = 0;
+                }
+                else {
+                        if (run == 0) {
+                                start = bit;
+                        }
+                        run++;
+                }
+                bit++;
+        }
+        if (run < count) {
+                return ENOSPC;
+        }
+
+        for (i=0; i<count; i++) {
+                bitmap_mark(b, start + i);
+        }
+        *index = start;
+        return 0;
+}
+
+/*
+ * Clear COUNT bits starting at INDEX, which must all be set.
+ */
+void
+bitmap_unmark_run(struct bitmap *b, unsigned index, unsigned count)
+{
+        unsigned i;
+
+        KASSERT(index + count <= b->nbits);
+        for (i=0; i<count; i++) {
+                bitmap_unmark(b, index + i);
+        }
 }
 
 
@@ -40,6 +40,9 @@
 #include <thread.h>
 #include <proc.h>
 #include <vfs.h>
+#include <bio.h>
+#include <scstats.h>
+#include <kmemcache.h>
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
@@ -145,8 +148,8 @@ common_prog(int nargs, char **args)
 	}
 
 	/*
-	 * The new process will be destroyed when the program exits...
-	 * once you write the code for handling that.
+	 * Nobody waits for the new process, so it destroys itself when
+	 * the program exits (see proc_exit).
 	 */
 
 	// Wait for all threads to finish cleanup, otherwise khu be a bit behind,
@@ -468,6 +471,100 @@ cmd_bootfs(int nargs, char **args)
 	return vfs_setbootfs(device);
 }
 
+/*
+ * Command to change the I/O scheduling policy of a disk.
+ */
+static
+int
+cmd_biosched(int nargs, char **args)
+{
+	char *device;
+	int result;
+
+	if (nargs != 3) {
+		kprintf("Usage: biosched device fifo|clook\n");
+		return EINVAL;
+	}
+
+	device = args[1];
+
+	/* Allow (but do not require) colon after device name */
+	if (device[strlen(device)-1]==':') {
+		device[strlen(device)-1] = 0;
+	}
+
+	result = bio_setsched(device, args[2]);
+	if (result == EINVAL) {
+		kprintf("Unknown I/O scheduling policy %s\n", args[2]);
+	}
+	return result;
+}
+
+static
+int
+cmd_biostats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	bio_printstats();
+
+	return 0;
+}
+
+/*
+ * Print system call statistics; "scs reset" zeroes them.
+ */
+static
+int
+cmd_scstats(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		scstats_reset();
+		return 0;
+	}
+	if (nargs != 1) {
+		kprintf("Usage: scs [reset]\n");
+		return EINVAL;
+	}
+
+	scstats_print();
+
+	return 0;
+}
+
+/*
+ * Turn system call tracing on or off, either for a running process
+ * or (with no pid) for programs started from the menu from now on.
+ */
+static
+int
+cmd_sctrace(int nargs, char **args)
+{
+	bool on;
+	int result;
+
+	if ((nargs != 2 && nargs != 3) ||
+	    (strcmp(args[1], "on") && strcmp(args[1], "off"))) {
+		kprintf("Usage: sctrace on|off [pid]\n");
+		return EINVAL;
+	}
+	on = !strcmp(args[1], "on");
+
+	if (nargs == 2) {
+		scstats_tracenew = on;
+		return 0;
+	}
+
+	result = proc_setsctrace(atoi(args[2]), on);
+	if (result) {
+		kprintf("sctrace: No process %s\n", args[2]);
+		return result;
+	}
+
+	return 0;
+}
+
 static
 int
 cmd_kheapstats(int nargs, char **args)
@@ -492,6 +589,18 @@ cmd_kheapused(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_kmemcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kmem_cache_printstats();
+
+	return 0;
+}
+
 static
 int
 cmd_kheapgeneration(int nargs, char **args)
@@ -521,6 +630,30 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_kheapprofile(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		kheap_profile(true);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		kheap_profile(false);
+	}
+	else if (nargs == 1) {
+		kheap_printprofile(10);
+	}
+	else if (nargs == 2 && atoi(args[1]) > 0) {
+		kheap_printprofile(atoi(args[1]));
+	}
+	else {
+		kprintf("Usage: khprof [on|off|count]\n");
+		return EINVAL;
+	}
+
+	return 0;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -560,6 +693,8 @@ static const char *opsmenu[] = {
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
+	"[biosched] Set disk I/O scheduler   ",
+	"[sctrace] Trace system calls        ",
 	"[debug]   Drop to debugger          ",
 	"[panic]   Intentional panic         ",
 	"[deadlock] Intentional deadlock     ",
@@ -582,15 +717,19 @@ static const char *testmenu[] = {
 	"[at]  Array test                    ",
 	"[at2] Large array test              ",
 	"[bt]  Bitmap test                   ",
+	"[bt2] Bitmap benchmark              ",
 	"[tlt] Threadlist test               ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
 	"[km3] Large kmalloc test            ",
 	"[km4] Multipage kmalloc test        ",
 	"[km5] kmalloc coremap alloc test    ",
+	"[km6] Object cache test             ",
+	"[mem] memcpy/memset benchmark       ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[tt4] Thread fork+exit benchmark    ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
@@ -672,6 +811,10 @@ static const char *mainmenu[] = {
 	"[khu] Kernel heap usage             ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[khprof] Kernel heap profile        ",
+	"[kmc] Kernel object cache stats     ",
+	"[bs] Disk I/O queue stats           ",
+	"[scs] System call stats             ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -715,6 +858,8 @@ static struct {
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
+	{ "biosched",	cmd_biosched },
+	{ "sctrace",	cmd_sctrace },
 	{ "debug",	cmd_debug },
 	{ "panic",	cmd_panic },
 	{ "deadlock",	cmd_deadlock },
@@ -727,23 +872,31 @@ static struct {
 	{ "khu",        cmd_kheapused },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "khprof",     cmd_kheapprofile },
+	{ "kmc",        cmd_kmemcachestats },
+	{ "bs",         cmd_biostats },
+	{ "scs",        cmd_scstats },
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "at2",	arraytest2 },
 	{ "bt",		bitmaptest },
+	{ "bt2",	bitmaptest2 },
 	{ "tlt",	threadlisttest },
 	{ "km1",	kmalloctest },
 	{ "km2",	kmallocstress },
 	{ "km3",	kmalloctest3 },
 	{ "km4",	kmalloctest4 },
 	{ "km5",	kmalloctest5 },
+	{ "km6",	kmalloctest6 },
+	{ "mem",	memtest },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
+	{ "tt4",	threadtest4 },
 
 	/* synchronization assignment tests */
 	{ "sem1",	semtest },
@@ -51,7 +51,13 @@
 #include <vnode.h>
 #include <synch.h>
 #include <vfs.h>
+#include <bitmap.h>
+#include <wchan.h>
+#include <scstats.h>
+#include <kmemcache.h>
+#include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/wait.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
@@ -68,6 +74,62 @@ struct fileHandle *console = NULL;
  */ 
 struct proc * procTable[PID_MAX] = { NULL };
 
+/*
+ * Protects procTable and every process's family fields: p_parent,
+ * p_children, p_sibling, p_exited and exitcode. A spinlock, so it
+ * works before threads exist (kproc is registered in proc_bootstrap)
+ * and so waiting can use the parent's wchan.
+ */
+static struct spinlock proc_familylock = SPINLOCK_INITIALIZER;
+
+/*
+ * Take child off parent's list of children. Call with
+ * proc_familylock held.
+ */
+static
+void
+proc_unlinkchild(struct proc *parent, struct proc *child)
+{
+	struct proc **pp;
+
+	KASSERT(child->p_parent == parent);
+	for (pp = &parent->p_children; *pp != child; pp = &(*pp)->p_sibling) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = child->p_sibling;
+	child->p_sibling = NULL;
+	child->p_parent = NULL;
+}
+
+/*
+ * Close everything in a process's file table.
+ */
+static
+void
+proc_closefiles(struct proc *proc)
+{
+	struct fileHandle *fh;
+
+	for (int i=0; i<proc->p_nfiles; i++) {
+		fh = fd_remove(proc, i);
+		if (fh != NULL) {
+			fh_release(fh);
+		}
+	}
+}
+
+/*
+ * System-wide open file table. Each file handle is one entry, however
+ * many descriptors in however many processes refer to it; only the
+ * count is needed to enforce SYSTEM_OPEN_MAX.
+ */
+static struct spinlock openfiles_lock = SPINLOCK_INITIALIZER;
+static unsigned openfiles = 0;
+
+/* Cache for struct proc. */
+static struct kmem_cache proc_cache =
+	KMEM_CACHE_INITIALIZER("proc", sizeof(struct proc), NULL, NULL);
+
 /*
  * Create a proc structure.
  */
@@ -76,21 +138,34 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-	// allocate a proc struct and an array fileTable[MAXFTENTRY]
-	proc = kmalloc(sizeof(*proc) + sizeof(struct fileHandle)*MAXFTENTRY);
+	proc = kmem_cache_alloc(&proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 
 	/* File Table */
-	for (int i=0; i<MAXFTENTRY; i++) {
+	proc->fileTable = kmalloc(FT_MINSIZE * sizeof(struct fileHandle *));
+	if (proc->fileTable == NULL) {
+		kmem_cache_free(&proc_cache, proc);
+		return NULL;
+	}
+	for (int i=0; i<FT_MINSIZE; i++) {
 		proc->fileTable[i] = NULL;
 	}
+	proc->p_nfiles = FT_MINSIZE;
+	proc->p_fdmap = bitmap_create(OPEN_MAX);
+	if (proc->p_fdmap == NULL) {
+		kfree(proc->fileTable);
+		kmem_cache_free(&proc_cache, proc);
+		return NULL;
+	}
 
 	/* etc */
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		bitmap_destroy(proc->p_fdmap);
+		kfree(proc->fileTable);
+		kmem_cache_free(&proc_cache, proc);
 		return NULL;
 	}
 	proc->p_numthreads = 0;
@@ -102,26 +177,44 @@ proc_create(const char *name)
 	/* VFS fields */
 	proc->p_cwd = NULL;
 
-	/* Process ID */
-	proc->pid = -1;
-	proc->p_pid = -1;
-
-	/* Exit code */
+	/* Family */
+	proc->p_parent = NULL;
+	proc->p_children = NULL;
+	proc->p_sibling = NULL;
+	proc->p_exited = false;
 	proc->exitcode = -1;
-	proc->sem_exit = sem_create("sem_exit", 0);
-	KASSERT(proc->sem_exit != NULL);
+	proc->p_waitchan = wchan_create(proc->p_name);
+	if (proc->p_waitchan == NULL) {
+		goto fail;
+	}
+
+	proc->p_sctrace = false;
 
-	/* Register to the process table */
-	proc_register(proc);
+	/* Process ID (ENPROC if the table is full) */
+	proc->pid = -1;
+	if (proc_register(proc)) {
+		wchan_destroy(proc->p_waitchan);
+		goto fail;
+	}
 
 	return proc;
+
+ fail:
+	spinlock_cleanup(&proc->p_lock);
+	kfree(proc->p_name);
+	bitmap_destroy(proc->p_fdmap);
+	kfree(proc->fileTable);
+	kmem_cache_free(&proc_cache, proc);
+	return NULL;
 }
 
 /*
  * Destroy a proc structure.
  *
- * Note: nothing currently calls this. Your wait/exit code will
- * probably want to do so.
+ * Called on a process that never ran (fork failed), or that has
+ * exited and been collected: by its parent's waitpid, by its parent
+ * exiting first, or by itself if it had no parent left to wait.
+ * Frees its pid and takes it off its parent's list of children.
  */
 void
 proc_destroy(struct proc *proc)
@@ -137,6 +230,14 @@ proc_destroy(struct proc *proc)
 	KASSERT(proc != NULL);
 	KASSERT(proc != kproc);
 
+	spinlock_acquire(&proc_familylock);
+	KASSERT(proc->p_children == NULL);
+	if (proc->p_parent != NULL) {
+		proc_unlinkchild(proc->p_parent, proc);
+	}
+	proc_deregister(proc);
+	spinlock_release(&proc_familylock);
+
 	/*
 	 * We don't take p_lock in here because we must have the only
 	 * reference to this structure. (Otherwise it would be
@@ -200,25 +301,15 @@ proc_destroy(struct proc *proc)
 	KASSERT(proc->p_numthreads == 0);
 	spinlock_cleanup(&proc->p_lock);
 
-	/* sem_exit */
-	sem_destroy(proc->sem_exit);
+	wchan_destroy(proc->p_waitchan);
 
-	/* File Table */
-	struct fileHandle *fh;
-	for (int i=0; i<MAXFTENTRY; i++) {
-        fh = proc->fileTable[i];
-        if (fh != NULL) {
-			// we can try closing the file though, not gonna do it
-			// vfs_close() destroy the vnode if the refcount hit 0
-			fh->fh_refcount--;
-			if (fh->fh_vnode->vn_refcount > 1) {
-				VOP_DECREF(fh->fh_vnode);
-			}
-        }
-    }
+	/* File Table (already empty if the process ran and exited) */
+	proc_closefiles(proc);
+	kfree(proc->fileTable);
+	bitmap_destroy(proc->p_fdmap);
 
 	kfree(proc->p_name);
-	kfree(proc);
+	kmem_cache_free(&proc_cache, proc);
 }
 
 /*
@@ -253,6 +344,9 @@ proc_create_runprogram(const char *name)
 
 	newproc->p_addrspace = NULL;
 
+	/* Trace it if the menu asked for that */
+	newproc->p_sctrace = scstats_tracenew;
+
 	/* VFS fields */
 	/*
 	 * Lock the current process to copy its current directory.
@@ -367,63 +461,380 @@ proc_setas(struct addrspace *newas)
 	return oldas;
 }
 
-struct fileHandle *
-fh_create()
+/*
+ * Cache for file handles. A cached handle keeps its fh_lock and
+ * fh_reflock from one use to the next; these construct and destroy
+ * them.
+ */
+static
+int
+fh_ctor(void *obj)
 {
-	struct fileHandle *fh;
-	fh = kmalloc(sizeof(*fh));
-	if (fh == NULL) {
-		return NULL;
-	}
+	struct fileHandle *fh = obj;
 
 	fh->fh_lock = lock_create("fh_lock");
 	if (fh->fh_lock == NULL) {
-		kfree(fh);
-		return NULL;
+		return ENOMEM;
+	}
+	spinlock_init(&fh->fh_reflock);
+	return 0;
+}
+
+static
+void
+fh_dtor(void *obj)
+{
+	struct fileHandle *fh = obj;
+
+	spinlock_cleanup(&fh->fh_reflock);
+	lock_destroy(fh->fh_lock);
+}
+
+static struct kmem_cache fh_cache =
+	KMEM_CACHE_INITIALIZER("fileHandle", sizeof(struct fileHandle),
+			       fh_ctor, fh_dtor);
+
+int
+fh_create(struct fileHandle **ret)
+{
+	struct fileHandle *fh;
+
+	spinlock_acquire(&openfiles_lock);
+	if (openfiles >= SYSTEM_OPEN_MAX) {
+		spinlock_release(&openfiles_lock);
+		return ENFILE;
+	}
+	openfiles++;
+	spinlock_release(&openfiles_lock);
+
+	fh = kmem_cache_alloc(&fh_cache);
+	if (fh == NULL) {
+		goto fail;
 	}
 
 	fh->fh_vnode = NULL;
+	fh->fh_seekable = false;
 	fh->fh_offset = 0;
 	fh->fh_refcount = 1;
 
-	return fh;
+	*ret = fh;
+	return 0;
+
+ fail:
+	spinlock_acquire(&openfiles_lock);
+	openfiles--;
+	spinlock_release(&openfiles_lock);
+	return ENOMEM;
 }
 
 void fh_destroy(struct fileHandle *fh)
 {	
 	KASSERT(fh->fh_refcount == 0);
-	lock_destroy(fh->fh_lock);
-	kfree(fh);
+	kmem_cache_free(&fh_cache, fh);
+
+	spinlock_acquire(&openfiles_lock);
+	KASSERT(openfiles > 0);
+	openfiles--;
+	spinlock_release(&openfiles_lock);
+}
+
+void
+fh_incref(struct fileHandle *fh)
+{
+	spinlock_acquire(&fh->fh_reflock);
+	KASSERT(fh->fh_refcount > 0);
+	fh->fh_refcount++;
+	spinlock_release(&fh->fh_reflock);
+}
+
+void
+fh_release(struct fileHandle *fh)
+{
+	int refcount;
+
+	spinlock_acquire(&fh->fh_reflock);
+	KASSERT(fh->fh_refcount > 0);
+	refcount = --fh->fh_refcount;
+	spinlock_release(&fh->fh_reflock);
+
+	if (refcount == 0) {
+		if (fh->fh_vnode != NULL) {
+			vfs_close(fh->fh_vnode);
+		}
+		fh_destroy(fh);
+	}
+}
+
+/*
+ * Make sure the file table has a slot for fd. The new array has to be
+ * allocated without p_lock held, so recheck after taking it again.
+ */
+static
+int
+fd_grow(struct proc *proc, int fd)
+{
+	struct fileHandle **newtable, **oldtable;
+	int oldsize, newsize;
+
+	KASSERT(fd >= 0 && fd < OPEN_MAX);
+
+	spinlock_acquire(&proc->p_lock);
+	oldsize = proc->p_nfiles;
+	spinlock_release(&proc->p_lock);
+
+	while (fd >= oldsize) {
+		newsize = oldsize * 2;
+		while (newsize <= fd) {
+			newsize *= 2;
+		}
+		if (newsize > OPEN_MAX) {
+			newsize = OPEN_MAX;
+		}
+
+		newtable = kmalloc(newsize * sizeof(struct fileHandle *));
+		if (newtable == NULL) {
+			return ENOMEM;
+		}
+
+		spinlock_acquire(&proc->p_lock);
+		oldtable = NULL;
+		if (proc->p_nfiles == oldsize) {
+			for (int i=0; i<newsize; i++) {
+				newtable[i] = i < oldsize ?
+					proc->fileTable[i] : NULL;
+			}
+			oldtable = proc->fileTable;
+			proc->fileTable = newtable;
+			proc->p_nfiles = newsize;
+			newtable = NULL;
+		}
+		oldsize = proc->p_nfiles;
+		spinlock_release(&proc->p_lock);
+
+		/* one of these is NULL; the other lost or was replaced */
+		kfree(newtable);
+		kfree(oldtable);
+	}
+	return 0;
+}
+
+int
+fd_alloc(struct proc *proc, struct fileHandle *fh, int *fdret)
+{
+	unsigned fd;
+	int result;
+
+	spinlock_acquire(&proc->p_lock);
+	result = bitmap_alloc(proc->p_fdmap, &fd);
+	spinlock_release(&proc->p_lock);
+	if (result) {
+		return EMFILE;
+	}
+
+	/* fd is reserved, so nobody else can take it while we grow */
+	result = fd_grow(proc, fd);
+	spinlock_acquire(&proc->p_lock);
+	if (result) {
+		bitmap_unmark(proc->p_fdmap, fd);
+	}
+	else {
+		KASSERT(proc->fileTable[fd] == NULL);
+		proc->fileTable[fd] = fh;
+	}
+	spinlock_release(&proc->p_lock);
+
+	if (result == 0) {
+		*fdret = fd;
+	}
+	return result;
+}
+
+int
+fd_install(struct proc *proc, int fd, struct fileHandle *fh,
+	   struct fileHandle **oldret)
+{
+	int result;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+
+	result = fd_grow(proc, fd);
+	if (result) {
+		return result;
+	}
+
+	spinlock_acquire(&proc->p_lock);
+	*oldret = proc->fileTable[fd];
+	proc->fileTable[fd] = fh;
+	if (!bitmap_isset(proc->p_fdmap, fd)) {
+		bitmap_mark(proc->p_fdmap, fd);
+	}
+	spinlock_release(&proc->p_lock);
+	return 0;
 }
 
 /*
- * Register the newly created process to the process table.
+ * The read/write fast path. Only a process's own threads change its
+ * file table (fork and spawn copy it before the child runs), so if the
+ * caller is the only thread, nothing can close or replace fd until it
+ * returns: read the slot with no lock and borrow the handle without
+ * touching its refcount. Otherwise take a real reference under p_lock,
+ * so a concurrent close or dup2 only drops the table's reference.
  */
+struct fileHandle *
+fd_get(int fd, bool *borrowed)
+{
+	struct proc *proc = curproc;
+	struct fileHandle *fh;
+
+	KASSERT(proc != NULL);
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return NULL;
+	}
+
+	/*
+	 * No lock here: p_nfiles and fileTable are read bare, which is
+	 * safe only because with one thread nobody can grow the table,
+	 * close fd, or dup2 over it under us. Don't relax this test
+	 * without locking, or the read races with fd_grow swapping the
+	 * table out.
+	 */
+	if (proc->p_numthreads == 1) {
+		*borrowed = true;
+		return fd < proc->p_nfiles ? proc->fileTable[fd] : NULL;
+	}
+
+	*borrowed = false;
+	spinlock_acquire(&proc->p_lock);
+	fh = fd < proc->p_nfiles ? proc->fileTable[fd] : NULL;
+	if (fh != NULL) {
+		fh_incref(fh);
+	}
+	spinlock_release(&proc->p_lock);
+	return fh;
+}
+
 void
+fd_put(struct fileHandle *fh, bool borrowed)
+{
+	if (!borrowed) {
+		fh_release(fh);
+	}
+}
+
+struct fileHandle *
+fd_remove(struct proc *proc, int fd)
+{
+	struct fileHandle *fh;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return NULL;
+	}
+
+	spinlock_acquire(&proc->p_lock);
+	fh = fd < proc->p_nfiles ? proc->fileTable[fd] : NULL;
+	if (fh != NULL) {
+		proc->fileTable[fd] = NULL;
+		bitmap_unmark(proc->p_fdmap, fd);
+	}
+	spinlock_release(&proc->p_lock);
+	return fh;
+}
+
+bool
+fd_removeif(struct proc *proc, int fd, struct fileHandle *fh)
+{
+	bool found;
+
+	KASSERT(fh != NULL);
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return false;
+	}
+
+	spinlock_acquire(&proc->p_lock);
+	found = fd < proc->p_nfiles && proc->fileTable[fd] == fh;
+	if (found) {
+		proc->fileTable[fd] = NULL;
+		bitmap_unmark(proc->p_fdmap, fd);
+	}
+	spinlock_release(&proc->p_lock);
+	return found;
+}
+
+/*
+ * Only used on a process nobody else can see yet (fork, spawn), so the
+ * destination needs no locking.
+ */
+int
+fd_copytable(struct proc *from, struct proc *to)
+{
+	int nfiles, result;
+
+	KASSERT(to->p_nfiles == FT_MINSIZE);
+
+	spinlock_acquire(&from->p_lock);
+	nfiles = from->p_nfiles;
+	spinlock_release(&from->p_lock);
+
+	if (nfiles > to->p_nfiles) {
+		result = fd_grow(to, nfiles - 1);
+		if (result) {
+			return result;
+		}
+	}
+
+	spinlock_acquire(&from->p_lock);
+	nfiles = from->p_nfiles < to->p_nfiles ?
+		from->p_nfiles : to->p_nfiles;
+	for (int i=0; i<nfiles; i++) {
+		to->fileTable[i] = from->fileTable[i];
+		if (to->fileTable[i] != NULL) {
+			bitmap_mark(to->p_fdmap, i);
+		}
+	}
+	spinlock_release(&from->p_lock);
+
+	for (int i=0; i<nfiles; i++) {
+		if (to->fileTable[i] != NULL) {
+			fh_incref(to->fileTable[i]);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Give a new process the lowest free pid. Fails with ENPROC if there
+ * isn't one.
+ */
+int
 proc_register(struct proc *newproc) 
 {
 	KASSERT(newproc != NULL);
+
+	spinlock_acquire(&proc_familylock);
 	// find usable pid
 	for (int i=PID_MIN; i<PID_MAX; i++) {
 		if (procTable[i] == NULL) {
 			newproc->pid = i;
+			procTable[i] = newproc;
 			break;
 		}
 	}
+	spinlock_release(&proc_familylock);
 
-	if (newproc->pid < PID_MIN) {
-		panic("Process Table is full!");
-	}
-
-	// assign current proc to the process table 
-	KASSERT(procTable[newproc->pid] == NULL);
-	procTable[newproc->pid] = newproc;
+	return newproc->pid < PID_MIN ? ENPROC : 0;
 }
 
+/*
+ * Free a process's pid. Call with proc_familylock held.
+ */
 void
 proc_deregister(struct proc *proc)
 {
 	KASSERT(proc != NULL);
+	KASSERT(spinlock_do_i_hold(&proc_familylock));
 	KASSERT(procTable[proc->pid] == proc);
 	procTable[proc->pid] = NULL;
 }
@@ -431,4 +842,163 @@ proc_deregister(struct proc *proc)
 struct proc *
 proc_fetch(pid_t pid) {
 	return procTable[pid];
+}
+
+/*
+ * Turn system call tracing on or off for process PID. The lookup and
+ * the store are both done under proc_familylock, so the process can't
+ * be destroyed in between. Returns ESRCH if there's no such process.
+ */
+int
+proc_setsctrace(pid_t pid, bool on)
+{
+	struct proc *proc;
+
+	if (pid < PID_MIN || pid >= PID_MAX) {
+		return ESRCH;
+	}
+
+	spinlock_acquire(&proc_familylock);
+	proc = procTable[pid];
+	if (proc != NULL) {
+		proc->p_sctrace = on;
+	}
+	spinlock_release(&proc_familylock);
+
+	return proc == NULL ? ESRCH : 0;
+}
+
+/*
+ * Record child as a child of parent, to be collected by parent's
+ * waitpid.
+ */
+void
+proc_addchild(struct proc *parent, struct proc *child)
+{
+	spinlock_acquire(&proc_familylock);
+	KASSERT(child->p_parent == NULL);
+	child->p_parent = parent;
+	child->p_sibling = parent->p_children;
+	parent->p_children = child;
+	spinlock_release(&proc_familylock);
+}
+
+/*
+ * Exit the current process, leaving waitcode (made with _MKWAIT_*) for
+ * waitpid.
+ *
+ * Everything but the proc structure itself is released right away:
+ * the address space, open files and current directory don't need to
+ * wait for the parent. Children that already exited are destroyed,
+ * since nobody is left to collect them; the rest are orphaned and
+ * destroy themselves when they exit. Likewise, if this process has
+ * no parent, it destroys itself instead of becoming a zombie.
+ */
+void
+proc_exit(int waitcode)
+{
+	struct proc *proc = curproc;
+	struct proc *child, *next, *dead;
+	struct addrspace *as;
+	bool orphan;
+
+	KASSERT(proc != NULL);
+	KASSERT(proc != kproc);
+
+	/* Release resources early. */
+	proc_closefiles(proc);
+	if (proc->p_cwd != NULL) {
+		VOP_DECREF(proc->p_cwd);
+		proc->p_cwd = NULL;
+	}
+	as = proc_setas(NULL);
+	as_deactivate();
+	if (as != NULL) {
+		as_destroy(as);
+	}
+
+	/*
+	 * Leave the process before announcing the exit, so that once
+	 * the parent sees p_exited it can destroy the proc at once.
+	 */
+	proc_remthread(curthread);
+	KASSERT(proc->p_numthreads == 0);
+
+	spinlock_acquire(&proc_familylock);
+
+	/* Orphan the children, collecting the ones already dead. */
+	dead = NULL;
+	for (child = proc->p_children; child != NULL; child = next) {
+		next = child->p_sibling;
+		child->p_parent = NULL;
+		child->p_sibling = NULL;
+		if (child->p_exited) {
+			child->p_sibling = dead;
+			dead = child;
+		}
+	}
+	proc->p_children = NULL;
+
+	proc->exitcode = waitcode;
+	proc->p_exited = true;
+	orphan = proc->p_parent == NULL;
+	if (!orphan) {
+		wchan_wakeall(proc->p_parent->p_waitchan, &proc_familylock);
+	}
+
+	spinlock_release(&proc_familylock);
+
+	/* Once the lock is dropped, proc belongs to the parent, if any. */
+	while (dead != NULL) {
+		child = dead;
+		dead = child->p_sibling;
+		child->p_sibling = NULL;
+		proc_destroy(child);
+	}
+	if (orphan) {
+		proc_destroy(proc);
+	}
+
+	thread_exit();
+}
+
+/*
+ * Wait for parent's child pid to exit, then collect its wait status
+ * into *waitcode and destroy it. *retpid is pid, or 0 if WNOHANG was
+ * given and the child is still running.
+ */
+int
+proc_wait(struct proc *parent, pid_t pid, int options, int *waitcode,
+	  pid_t *retpid)
+{
+	struct proc *child;
+
+	if (pid < PID_MIN || pid >= PID_MAX) {
+		return ESRCH;
+	}
+
+	spinlock_acquire(&proc_familylock);
+	child = procTable[pid];
+	if (child == NULL) {
+		spinlock_release(&proc_familylock);
+		return ESRCH;
+	}
+	if (child->p_parent != parent) {
+		spinlock_release(&proc_familylock);
+		return ECHILD;
+	}
+	while (!child->p_exited) {
+		if (options & WNOHANG) {
+			spinlock_release(&proc_familylock);
+			*retpid = 0;
+			return 0;
+		}
+		wchan_sleep(parent->p_waitchan, &proc_familylock);
+	}
+	*waitcode = child->exitcode;
+	spinlock_release(&proc_familylock);
+
+	proc_destroy(child);
+	*retpid = pid;
+	return 0;
 }
\ No newline at end of file
@@ -14,7 +14,9 @@
 #include <kern/errno.h>
 #include <kern/stat.h>
 #include <kern/seek.h>
+#include <kern/sysbatch.h>
 #include <limits.h>
+#include <pipe.h>
 #include <proc.h>
 #include <synch.h>
 #include <spl.h>
@@ -55,10 +57,13 @@ sys_open(const char *filename, int flags, int32_t *retval)
         return EFAULT;
     }
     
-    char *filename_copy = kmalloc(__PATH_MAX);
+    char *filename_copy = pathbuf_get();
+    if (filename_copy == NULL) {
+        return ENOMEM;
+    }
     result = copyinstr((const userptr_t)filename, filename_copy, __PATH_MAX, NULL);
     if (result) {
-        kfree(filename_copy);
+        pathbuf_put(filename_copy);
         return EFAULT;
     }
     
@@ -66,45 +71,34 @@ sys_open(const char *filename, int flags, int32_t *retval)
     struct proc *proc = curproc; // load current process
     KASSERT(proc != NULL);
 
-    // create new file handle
+    // create new file handle (ENFILE if the system table is full)
     struct fileHandle *fh;
-    fh = fh_create();
-    if (fh == NULL) {
-        return ENFILE;
+    result = fh_create(&fh);
+    if (result) {
+        pathbuf_put(filename_copy);
+        return result;
     }
 
     // open a file and populate vnode in the file handle struct
     result = vfs_open(filename_copy, flags, 0, &fh->fh_vnode);
-    kfree(filename_copy);
+    pathbuf_put(filename_copy);
 	if (result) {
         // failed to open
+        fh_release(fh);
         return result;
 	}
 
     // access mode
     fh->fh_accmode = flags & O_ACCMODE;
+    fh->fh_seekable = VOP_ISSEEKABLE(fh->fh_vnode);
 
-    int fd = 0; // A file descriptor
-
-    // don't forget we're accessing a shared resource!
-    spinlock_acquire(&proc->p_lock);
-    KASSERT(spinlock_do_i_hold(&proc->p_lock));
-
-    // probe fileTable array, find the first empty space 
-    while(proc->fileTable[fd] != NULL) {
-        fd++;
+    // take the lowest free fd (EMFILE if the process table is full)
+    int fd;
+    result = fd_alloc(proc, fh, &fd);
+    if (result) {
+        fh_release(fh);
+        return result;
     }
-    KASSERT(proc->fileTable[fd] == NULL);
-
-    // assign the file handle to file table entry
-    proc->fileTable[fd] = fh;
-    KASSERT(proc->fileTable[fd] == fh);
-
-    // increase the file handle refcount
-    fh->fh_refcount++; 
-
-    spinlock_release(&curproc->p_lock);
-    KASSERT(!spinlock_do_i_hold(&proc->p_lock));
 
     *retval = fd;
     return 0;
@@ -124,45 +118,152 @@ sys_close(int fd) {
      *  EBADF 	fd is not a valid file descriptor.
      *  EIO		A hard I/O error occurred.
      */
-    // fd check
-    if (fd < 0 || fd > MAXFTENTRY){
-            return EBADF;
-    }
-
     struct fileHandle *fh;
 
     KASSERT(curproc != NULL);
     struct proc *proc = curproc; // load current process
     KASSERT(proc != NULL);
 
-    spinlock_acquire(&proc->p_lock);
-    // query the file table and get the current file handle
-    fh = proc->fileTable[fd];
-    spinlock_release(&proc->p_lock);
+    // unlink from the file table (fd_remove range-checks fd)
+    fh = fd_remove(proc, fd);
+    if (fh == NULL) {
+        return EBADF;
+    }
+
+    // the file itself is closed once the last reference is gone
+    fh_release(fh);
 
+    return 0; 
+}
+
+/*
+ * Common body of the read and write calls. The caller sets up the
+ * uio's iovecs, residual count and direction; this fetches the handle,
+ * checks the access mode, and runs one VOP_READ/VOP_WRITE over the whole
+ * uio. Positional calls use uio_offset as given and leave fh_offset
+ * (and fh_lock) alone; the others use and advance the file offset.
+ *
+ * Return Value : Bytes transferred
+ */
+static int
+file_rw(int fd, struct uio *uio, bool positional, ssize_t *retval)
+{
+    struct fileHandle *fh;
+    bool borrowed, useoffset;
+    size_t len = uio->uio_resid;
+    int result;
+
+    fh = fd_get(fd, &borrowed);
     if (fh == NULL) {
+        /* invalid fd */
         return EBADF;
     }
 
-    lock_acquire(fh->fh_lock);
-    // decrements vnode's reference count
-    // it will automatically destroy the vnode if the refcount hits zero
-    // see vnode.c
-    vfs_close(fh->fh_vnode);
-    fh->fh_refcount--;
-    
-    // destroy the file handle if no one use the file
-    if (fh->fh_refcount == 0) {
-        lock_release(fh->fh_lock);
-        fh_destroy(fh);
+    if (fh->fh_vnode == NULL ||
+        fh->fh_accmode == (uio->uio_rw == UIO_READ ? O_WRONLY : O_RDONLY)) {
+        /* incorrect access mode, or haven't initialized */
+        fd_put(fh, borrowed);
+        return EBADF;
+    }
+
+    if (positional && !fh->fh_seekable) {
+        fd_put(fh, borrowed);
+        return ESPIPE;
+    }
+
+    // only seekable files have an offset to serialize on
+    useoffset = fh->fh_seekable && !positional;
+    if (useoffset) {
+        lock_acquire(fh->fh_lock);
+        uio->uio_offset = fh->fh_offset;
+    }
+
+    uio->uio_segflg = UIO_USERSPACE;
+    uio->uio_space = proc_getas();
+
+    if (uio->uio_rw == UIO_READ) {
+        result = VOP_READ(fh->fh_vnode, uio);
+    } else if (vnode_textbusy(fh->fh_vnode)) {
+        // opened for writing before the program started running
+        result = ETXTBSY;
     } else {
+        result = VOP_WRITE(fh->fh_vnode, uio);
+    }
+
+    // update the offset whether the operation failed or not.
+    *retval = len - uio->uio_resid;
+    if (useoffset) {
+        fh->fh_offset = uio->uio_offset;
         lock_release(fh->fh_lock);
     }
+    fd_put(fh, borrowed);
+
+    return result;
+}
 
-    // unlink from the file table
-    proc->fileTable[fd] = NULL;
+/*
+ * Iovec arrays this short are copied in on the stack.
+ */
+#define UIO_FASTIOV 8
 
-    return 0; 
+/*
+ * Common body of the vectored calls: copy in the user's iovec array
+ * and hand it to file_rw as a single uio.
+ */
+static int
+file_rwv(int fd, const struct iovec *uiov, int iovcnt, off_t pos,
+         bool positional, enum uio_rw rw, ssize_t *retval)
+{
+    struct iovec fastiov[UIO_FASTIOV];
+    struct iovec *iov;
+    struct uio myuio;
+    size_t total;
+    int i, result;
+
+    if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+        return EINVAL;
+    }
+    if (positional && pos < 0) {
+        return EINVAL;
+    }
+
+    if (iovcnt <= UIO_FASTIOV) {
+        iov = fastiov;
+    } else {
+        iov = kmalloc(iovcnt * sizeof(*iov));
+        if (iov == NULL) {
+            return ENOMEM;
+        }
+    }
+
+    result = copyin((const_userptr_t)uiov, iov, iovcnt * sizeof(*iov));
+    if (result) {
+        goto out;
+    }
+
+    // the total has to fit in the ssize_t we return
+    total = 0;
+    for (i = 0; i < iovcnt; i++) {
+        if (total + iov[i].iov_len < total ||
+            (ssize_t)(total + iov[i].iov_len) < 0) {
+            result = EINVAL;
+            goto out;
+        }
+        total += iov[i].iov_len;
+    }
+
+    myuio.uio_iov = iov;
+    myuio.uio_iovcnt = iovcnt;
+    myuio.uio_offset = pos;
+    myuio.uio_resid = total;
+    myuio.uio_rw = rw;
+    result = file_rw(fd, &myuio, positional, retval);
+
+out:
+    if (iov != fastiov) {
+        kfree(iov);
+    }
+    return result;
 }
 
 /*
@@ -182,67 +283,17 @@ sys_write(int fd, void *buf, size_t buflen, ssize_t *retval)
      * EIO 	A hardware I/O error occurred writing the data.
      */
 
-    // fd check
-    if (fd < 0 || fd > MAXFTENTRY){
-            return EBADF;
-    }
-
     // buf check
     if (buf == NULL) {
         return EFAULT;
     }
 
-    // load current process
-    KASSERT(curproc != NULL);
-    struct proc *proc = curproc;
-    KASSERT(proc != NULL);
-
-    // EBADF check section
-    struct fileHandle *fh;
-
-    spinlock_acquire(&proc->p_lock);
-    fh = proc->fileTable[fd];
-    spinlock_release(&proc->p_lock);
-    
-    if (fh == NULL) {
-        /* invalid fd */
-        return EBADF;
-    }
-
-    lock_acquire(fh->fh_lock);
-
-    if (fh->fh_accmode == O_RDONLY) {
-        /* incorrect access mode */
-        lock_release(fh->fh_lock);
-        return EBADF;
-    } else if (fh->fh_vnode == NULL) {
-        /* haven't initialized */
-        lock_release(fh->fh_lock);
-        return EBADF;
-    }
-
-    int result;
-
     // Initialize uio structure
     struct iovec iov;
     struct uio myuio;
 
-    uio_kinit(&iov, &myuio, (void *)buf, buflen, fh->fh_offset, UIO_WRITE);
-    myuio.uio_segflg = UIO_USERSPACE;
-    myuio.uio_space = proc_getas();
-
-    // write to file
-    result = VOP_WRITE(fh->fh_vnode, &myuio);
-    // update the offset whether the operation failed or not.
-    *retval = myuio.uio_offset - fh->fh_offset;
-    fh->fh_offset = myuio.uio_offset;
-    lock_release(fh->fh_lock);
-
-    if (result) {
-        // seek failed or IO failed (mostly EFAULT)
-        return result;
-    }
-    return 0;
+    uio_kinit(&iov, &myuio, buf, buflen, 0, UIO_WRITE);
+    return file_rw(fd, &myuio, false, retval);
 }
 
 /*
@@ -258,87 +309,100 @@ int sys_read(int fd, void *buf, size_t buflen, ssize_t *retval) {
     * EIO 	    A hardware I/O error occurred reading the data.
     */
 
-    // fd check
-    if (fd < 0 || fd > MAXFTENTRY){
-            return EBADF;
-    }
-
     // buf check
     if (buf == NULL) {
         return EFAULT;
     }
 
-    // load current process
-    KASSERT(curproc != NULL);
-    struct proc *proc = curproc;
-    KASSERT(proc != NULL);
+    // Initialize uio structure
+    struct iovec iov;
+    struct uio myuio;
 
-    // EBADF check section
-    struct fileHandle *fh;
+    uio_kinit(&iov, &myuio, buf, buflen, 0, UIO_READ);
+    return file_rw(fd, &myuio, false, retval);
+}
 
-    spinlock_acquire(&proc->p_lock);
-    fh = proc->fileTable[fd];
-    spinlock_release(&proc->p_lock);
+/*
+ * Reads or writes at an explicit position, without using or moving
+ * the file offset.
+ *
+ * Return Value : Bytes transferred. Error number upon failure.
+ */
+int sys_pread(int fd, void *buf, size_t buflen, off_t pos, ssize_t *retval)
+{
+    /*
+     * As read, plus:
+     * ESPIPE 	fd refers to an object that does not support seeking.
+     * EINVAL 	pos is negative.
+     */
+    struct iovec iov;
+    struct uio myuio;
 
-    if (fh == NULL) {
-        /* invalid fd */
-        return EBADF;
+    if (buf == NULL) {
+        return EFAULT;
     }
-
-    lock_acquire(fh->fh_lock);
-    
-    if (fh->fh_accmode == O_WRONLY) {
-        /* incorrect access mode */
-        lock_release(fh->fh_lock);
-        return EBADF;
-    } else if (fh->fh_vnode == NULL) {
-        /* haven't initialized */
-        lock_release(fh->fh_lock);
-        return EBADF;
+    if (pos < 0) {
+        return EINVAL;
     }
 
-    int result;
+    uio_kinit(&iov, &myuio, buf, buflen, pos, UIO_READ);
+    return file_rw(fd, &myuio, true, retval);
+}
 
-    // Initialize uio structure
+int sys_pwrite(int fd, const void *buf, size_t buflen, off_t pos, ssize_t *retval)
+{
     struct iovec iov;
     struct uio myuio;
 
-    uio_kinit(&iov, &myuio, (void *)buf, buflen, fh->fh_offset, UIO_READ);
-    myuio.uio_segflg = UIO_USERSPACE;
-    myuio.uio_space = proc_getas();
+    if (buf == NULL) {
+        return EFAULT;
+    }
+    if (pos < 0) {
+        return EINVAL;
+    }
 
-    result = VOP_READ(fh->fh_vnode, &myuio);
+    uio_kinit(&iov, &myuio, (void *)buf, buflen, pos, UIO_WRITE);
+    return file_rw(fd, &myuio, true, retval);
+}
 
-    *retval = myuio.uio_offset - fh->fh_offset;
-    fh->fh_offset = myuio.uio_offset;
-    lock_release(fh->fh_lock);
+/*
+ * Scatter/gather I/O: the whole iovec array goes to the filesystem as
+ * one uio, so N buffers cost one syscall and one VOP call.
+ *
+ * Return Value : Bytes transferred. Error number upon failure.
+ */
+int sys_readv(int fd, const struct iovec *iov, int iovcnt, ssize_t *retval)
+{
+    /*
+     * As read, plus:
+     * EINVAL 	iovcnt is not in 1..IOV_MAX, or the lengths overflow ssize_t.
+     */
+    return file_rwv(fd, iov, iovcnt, 0, false, UIO_READ, retval);
+}
 
-    if (result) {
-        return result;
-    }
+int sys_writev(int fd, const struct iovec *iov, int iovcnt, ssize_t *retval)
+{
+    return file_rwv(fd, iov, iovcnt, 0, false, UIO_WRITE, retval);
+}
 
-    return 0;
+int sys_preadv(int fd, const struct iovec *iov, int iovcnt, off_t pos, ssize_t *retval)
+{
+    return file_rwv(fd, iov, iovcnt, pos, true, UIO_READ, retval);
+}
+
+int sys_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t pos, ssize_t *retval)
+{
+    return file_rwv(fd, iov, iovcnt, pos, true, UIO_WRITE, retval);
 }
 
 int sys_lseek (int fd, off_t pos, int whence, off_t *retval)
 {   
     int result;
 
-    // fd check
-    if (fd < 0 || fd > MAXFTENTRY){
-            return EBADF;
-    }
-
-    // load current process
-    KASSERT(curproc != NULL);
-    struct proc *proc = curproc;
-    KASSERT(proc != NULL);
-
     struct fileHandle *fh;
+    bool borrowed;
 
-    spinlock_acquire(&proc->p_lock);
-    fh = proc->fileTable[fd];
-    spinlock_release(&proc->p_lock);
+    fh = fd_get(fd, &borrowed);
 
     // sanity checks
     if (fh == NULL) {
@@ -348,32 +412,29 @@ int sys_lseek (int fd, off_t pos, int whence, off_t *retval)
                  (whence == SEEK_CUR) ||
                  (whence == SEEK_END))) {
         /* Invalid argument */
+        fd_put(fh, borrowed);
         return EINVAL;
-    } else {
-        lock_acquire(fh->fh_lock);
+    } else if (!fh->fh_seekable) {
+        /* Non-seekable file */
+        fd_put(fh, borrowed);
+        return ESPIPE;
+    }
 
-        KASSERT(fh->fh_vnode != NULL);
-        KASSERT(lock_do_i_hold(fh->fh_lock));
-        result = VOP_ISSEEKABLE(fh->fh_vnode);
-        if (result == 0) {
-            /* Non-seekable file */
-            lock_release(fh->fh_lock);
-            return ESPIPE;
-        }
-    }   
+    lock_acquire(fh->fh_lock);
 
+    KASSERT(fh->fh_vnode != NULL);
     KASSERT(lock_do_i_hold(fh->fh_lock));
 
     if (whence == SEEK_SET) {
         if (pos < 0) {
-            lock_release(fh->fh_lock);
-            return EINVAL;
+            result = EINVAL;
+            goto out;
         }
         fh->fh_offset = pos;
     } else if (whence == SEEK_CUR) {
         if (fh->fh_offset + pos < 0) {
-            lock_release(fh->fh_lock);
-            return EINVAL;
+            result = EINVAL;
+            goto out;
         }
         fh->fh_offset += pos;
     } else if (whence == SEEK_END) {
@@ -382,24 +443,25 @@ int sys_lseek (int fd, off_t pos, int whence, off_t *retval)
         result = VOP_STAT(fh->fh_vnode, &filestat);
         if (result) {
             /* Can't check filesize */
-            lock_release(fh->fh_lock);
-            return result;
+            goto out;
         }
         if (filestat.st_size + pos < 0) {
-            lock_release(fh->fh_lock);
-            return EINVAL;
+            result = EINVAL;
+            goto out;
         }
 
         fh->fh_offset = filestat.st_size + pos;
     }
 
     *retval = fh->fh_offset;
+    result = 0;
 
+out:
     lock_release(fh->fh_lock);
     KASSERT(!lock_do_i_hold(fh->fh_lock));
+    fd_put(fh, borrowed);
 
-
-    return 0;
+    return result;
 }
 
 /*
@@ -478,25 +540,24 @@ int sys_chdir(const char *pathname)
         return EFAULT;
     }
 
-    char *pathname_copy = kmalloc(__PATH_MAX);
+    char *pathname_copy = pathbuf_get();
+    if (pathname_copy == NULL) {
+        splx(old_p_level);
+        return ENOMEM;
+    }
     int result;
     result = copyinstr((const userptr_t)pathname, pathname_copy, __PATH_MAX, NULL);
     if (result) {
         splx(old_p_level);
-        kfree(pathname_copy);
+        pathbuf_put(pathname_copy);
         return EFAULT;
     }
 
     result = vfs_chdir(pathname_copy);
-    if (result) {
-        splx(old_p_level);
-        return result;
-    }
-
-    kfree(pathname_copy);
+    pathbuf_put(pathname_copy);
     splx(old_p_level);
 
-    return 0;
+    return result;
 }
 
 int sys_dup2(int oldfd, int newfd, int32_t *retval)
@@ -511,10 +572,9 @@ int sys_dup2(int oldfd, int newfd, int32_t *retval)
      */
 
     // fd check
-    if (oldfd < 0 || oldfd > MAXFTENTRY ||
-        newfd < 0 || newfd > MAXFTENTRY  ){
-            return EBADF;
-        }
+    if (newfd < 0 || newfd >= OPEN_MAX) {
+        return EBADF;
+    }
 
     // load current process
     KASSERT(curproc != NULL);
@@ -523,34 +583,279 @@ int sys_dup2(int oldfd, int newfd, int32_t *retval)
 
     // EBADF check section
     struct fileHandle *oldfh;
+    bool borrowed;
 
-    oldfh = proc->fileTable[oldfd];
+    oldfh = fd_get(oldfd, &borrowed);
     if (oldfh == NULL) {
         /* invalid fd */
         return EBADF;
     }
 
-    // check if we can use new fd right away
+    if (oldfd == newfd) {
+        fd_put(oldfh, borrowed);
+        *retval = newfd;
+        return 0;
+    }
+
+    // attach the fh reference to new fd, replacing whatever was there
     struct fileHandle *newfh;
+    int result;
 
-    newfh = proc->fileTable[newfd];
+    fh_incref(oldfh);
+    fd_put(oldfh, borrowed);
+    result = fd_install(proc, newfd, oldfh, &newfh);
+    if (result) {
+        fh_release(oldfh);
+        return result;
+    }
     if (newfh != NULL) {
-        // sorry we need to close this first
-        // call sys_close
-        int result;
-        result = sys_close(newfd);
+        // close the file that used to be at newfd
+        fh_release(newfh);
+    }
+
+    *retval = newfd;
+
+    return 0;
+}
+
+/*
+ * Creates a pipe.
+ *
+ * Using pipe_create(), make a pipe and give each end its own file
+ * handle and fd: fds[0] reads, fds[1] writes.
+ *
+ * Return Value : 0 upon success.
+ */
+int sys_pipe(userptr_t fds, int32_t *retval)
+{
+    /*
+     * EMFILE	The process's file table was full, or a process-
+     *          specific limit on open files was reached.
+     * ENFILE	The system's file table was full, if such a thing
+     *          is possible, or a global limit on open files was reached.
+     * EFAULT	fds was an invalid pointer.
+     */
+
+    KASSERT(curproc != NULL);
+    struct proc *proc = curproc;
+
+    struct vnode *rv, *wv;
+    struct fileHandle *rfh = NULL, *wfh = NULL;
+    int kfds[2] = { -1, -1 };
+    int result;
+
+    result = pipe_create(&rv, &wv);
+    if (result) {
+        return result;
+    }
+
+    // each handle takes over one end's vnode reference
+    result = fh_create(&rfh);
+    if (result) {
+        vfs_close(rv);
+        vfs_close(wv);
+        return result;
+    }
+    rfh->fh_vnode = rv;
+    rfh->fh_accmode = O_RDONLY;
+    rfh->fh_seekable = false;
+
+    result = fh_create(&wfh);
+    if (result) {
+        vfs_close(wv);
+        goto fail;
+    }
+    wfh->fh_vnode = wv;
+    wfh->fh_accmode = O_WRONLY;
+    wfh->fh_seekable = false;
+
+    result = fd_alloc(proc, rfh, &kfds[0]);
+    if (result) {
+        goto fail;
+    }
+    result = fd_alloc(proc, wfh, &kfds[1]);
+    if (result) {
+        goto fail;
+    }
+
+    result = copyout(kfds, fds, sizeof(kfds));
+    if (result) {
+        goto fail;
+    }
+
+    *retval = 0;
+    return 0;
+
+fail:
+    // once installed, the table owns the reference; take it back out,
+    // but only if the slot still holds our handle: another thread may
+    // already have closed the fd (dropping the reference) and reused it
+    if (kfds[1] >= 0 && !fd_removeif(proc, kfds[1], wfh)) {
+        wfh = NULL;
+    }
+    if (kfds[0] >= 0 && !fd_removeif(proc, kfds[0], rfh)) {
+        rfh = NULL;
+    }
+    if (wfh != NULL) {
+        fh_release(wfh);
+    }
+    if (rfh != NULL) {
+        fh_release(rfh);
+    }
+    return result;
+}
+
+/*
+ * Flushes a file to disk.
+ *
+ * Using VOP_FSYNC(), write back everything the filesystem is holding
+ * in memory for the file and wait for it to reach the disk.
+ *
+ * Return Value : 0 upon success.
+ */
+int
+sys_fsync(int fd)
+{
+    /*
+     * EBADF 	fd is not a valid file handle.
+     * EIO		A hard I/O error occurred.
+     */
+
+    struct fileHandle *fh;
+    bool borrowed;
+    int result;
+
+    fh = fd_get(fd, &borrowed);
+    if (fh == NULL) {
+        return EBADF;
+    }
+
+    result = VOP_FSYNC(fh->fh_vnode);
+    fd_put(fh, borrowed);
+    return result;
+}
+
+/*
+ * Flushes all filesystems to disk.
+ *
+ * Return Value : none (always succeeds).
+ */
+int
+sys_sync(void)
+{
+    vfs_sync();
+    return 0;
+}
+
+/*
+ * Batched operations are copied in this many at a time, on the stack.
+ */
+#define SYSBATCH_CHUNK 8
+
+/*
+ * Runs one batched operation, leaving its outcome in so_result and
+ * so_error.
+ */
+static int
+sysop_run(struct sysop *op)
+{
+    ssize_t len = -1;
+    int32_t fd = -1;
+    off_t pos = -1;
+    int result;
+
+    switch (op->so_op) {
+    case SYSOP_OPEN:
+        result = sys_open((const char *)op->so_ubuf, op->so_arg, &fd);
+        op->so_result = fd;
+        break;
+    case SYSOP_CLOSE:
+        result = sys_close(op->so_fd);
+        op->so_result = 0;
+        break;
+    case SYSOP_READ:
+        result = sys_read(op->so_fd, (void *)op->so_ubuf, op->so_len, &len);
+        op->so_result = len;
+        break;
+    case SYSOP_WRITE:
+        result = sys_write(op->so_fd, (void *)op->so_ubuf, op->so_len, &len);
+        op->so_result = len;
+        break;
+    case SYSOP_PREAD:
+        result = sys_pread(op->so_fd, (void *)op->so_ubuf, op->so_len,
+                           op->so_pos, &len);
+        op->so_result = len;
+        break;
+    case SYSOP_PWRITE:
+        result = sys_pwrite(op->so_fd, (const void *)op->so_ubuf, op->so_len,
+                            op->so_pos, &len);
+        op->so_result = len;
+        break;
+    case SYSOP_LSEEK:
+        result = sys_lseek(op->so_fd, op->so_pos, op->so_arg, &pos);
+        op->so_result = pos;
+        break;
+    default:
+        result = EINVAL;
+        break;
+    }
+
+    op->so_error = result;
+    if (result) {
+        op->so_result = -1;
+    }
+    return result;
+}
+
+/*
+ * Runs an array of file operations with one trap.
+ *
+ * The operations are copied in a few at a time, run in order, and
+ * their results copied back over them. An operation failing doesn't
+ * stop the batch unless it has SYSOP_STOP set.
+ *
+ * Return Value : Number of operations run. Error number if the array
+ *                itself can't be accessed.
+ */
+int
+sys_sysbatch(userptr_t uops, int nops, int32_t *retval)
+{
+    /*
+     * EINVAL	nops is negative.
+     * EFAULT	uops was an invalid pointer.
+     */
+
+    struct sysop ops[SYSBATCH_CHUNK];
+    int done, n, i, result;
+    bool stop = false;
+
+    if (nops < 0) {
+        return EINVAL;
+    }
+
+    for (done = 0; done < nops && !stop; done += n) {
+        userptr_t where = uops + done * sizeof(struct sysop);
+
+        n = nops - done < SYSBATCH_CHUNK ? nops - done : SYSBATCH_CHUNK;
+        result = copyin(where, ops, n * sizeof(struct sysop));
         if (result) {
             return result;
         }
-    }
 
-    // attach the fh reference to new fd
-    proc->fileTable[newfd] = oldfh;
-    // increment refcount
-    VOP_INCREF(oldfh->fh_vnode);
-    oldfh->fh_refcount++;
+        for (i = 0; i < n; i++) {
+            if (sysop_run(&ops[i]) && (ops[i].so_flags & SYSOP_STOP)) {
+                n = i + 1;
+                stop = true;
+                break;
+            }
+        }
 
-    *retval = newfd;
+        result = copyout(ops, where, n * sizeof(struct sysop));
+        if (result) {
+            return result;
+        }
+    }
 
+    *retval = done;
     return 0;
-}
\ No newline at end of file
+}
@@ -3,6 +3,7 @@
 #include <addrspace.h>
 #include <copyinout.h>
 #include <proc.h>
+#include <spinlock.h>
 #include <synch.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
@@ -32,6 +33,34 @@ int sys_getpid(int32_t *retval)
     return 0;
 }
 
+/*
+ * Gives a new child what it inherits from its parent besides the
+ * address space: the file table and the working directory. Also
+ * records it as the parent's child, for waitpid.
+ */
+static int proc_inherit(struct proc *parent_proc, struct proc *child_proc)
+{
+    int result;
+
+    KASSERT(child_proc->pid != -1);
+
+    proc_addchild(parent_proc, child_proc);
+
+    // copy parent file table
+    result = fd_copytable(parent_proc, child_proc);
+    if (result) {
+        return result;
+    }
+
+    // copy parent working directory
+    child_proc->p_cwd = parent_proc->p_cwd;
+    VOP_INCREF(parent_proc->p_cwd);
+
+    // children of traced processes are traced too
+    child_proc->p_sctrace = parent_proc->p_sctrace;
+    return 0;
+}
+
 /*
  * Duplicates the current process to a newly created process. 
  * 
@@ -57,7 +86,6 @@ int sys_fork(struct trapframe *tf, int32_t *retval)
     The process id must be greater than 0.
     */
     struct proc *child_proc = NULL;
-    int parent_pid;
     int result;
 
     // load current process
@@ -77,54 +105,38 @@ int sys_fork(struct trapframe *tf, int32_t *retval)
     
     parent_tf = memcpy(parent_tf, tf, sizeof(*tf));
 
-    // remember the pid of current proc    
-    parent_pid = parent_proc->pid;
-
-    // create new proc
+    // create new proc (fails if there are no pids left)
     child_proc = proc_create(parent_proc->p_name);
     if (child_proc == NULL) {
-        return ENOMEM;
+        kfree(parent_tf);
+        return ENPROC;
     }
 
-    // copy things from the current proc
-    // struct addrspace *p_addrspace
-    // new room for our child
-    child_proc->p_addrspace = as_create();
-    if (child_proc->p_addrspace == NULL) {
-        return ENOMEM;
-    }
     // copy parent addrspace
     result = as_copy(parent_proc->p_addrspace, &child_proc->p_addrspace);
     if (result) {
-        return result;
+        goto fail;
     }
-    // copy parent pid information
-    child_proc->p_pid = parent_pid;
-
-    KASSERT(child_proc->p_pid != -1 && child_proc->pid != -1);
-
-    // copy parent file table
-    struct fileHandle *fh = NULL;
-    
-    for (int i=0; i<MAXFTENTRY; i++) {
-        fh = parent_proc->fileTable[i];
-        if (fh != NULL) {
-            child_proc->fileTable[i] = fh;
-            VOP_INCREF(child_proc->fileTable[i]->fh_vnode);
-            fh->fh_refcount++;
-        }
+    // become the parent; copy file table and working directory
+    result = proc_inherit(parent_proc, child_proc);
+    if (result) {
+        goto fail;
     }
 
-    // copy parent working directory
-    child_proc->p_cwd = parent_proc->p_cwd;
-    VOP_INCREF(parent_proc->p_cwd);
-
-    // thread_fork properly (and implement enter_forked_process later!)
-    thread_fork(child_proc->p_name, child_proc, enter_forked_process, (void *)parent_tf, 0);
+    result = thread_fork(child_proc->p_name, child_proc, enter_forked_process, (void *)parent_tf, 0);
+    if (result) {
+        goto fail;
+    }
 
     *retval = child_proc->pid;
 
     return 0;
+
+fail:
+    // the child never ran, so it can go straight away
+    proc_destroy(child_proc);
+    kfree(parent_tf);
+    return result;
 }
 
 /*
@@ -136,23 +148,16 @@ int sys__exit(int exitcode)
 {
     // load current process
     KASSERT(curproc != NULL);
-    struct proc *proc = curproc;
-    KASSERT(proc != NULL);
-
-    // store encoded exit code
-    proc->exitcode = _MKWAIT_EXIT(exitcode);
-    V(proc->sem_exit);
 
-    // thread can exit now
-    thread_exit();
-
-    return 0;
+    // store encoded exit code, release everything and exit the thread
+    proc_exit(_MKWAIT_EXIT(exitcode));
 }
 
 /*
  * Wait until the given pid finishes its execution and exit.
  * 
- * Return Value : Returns pid. Upon error, returns -1 and error is set.
+ * Return Value : Returns pid, or 0 if WNOHANG was given and the child
+ *                hasn't exited. Upon error, returns -1 and error is set.
  */ 
 int sys_waitpid(pid_t pid, int *status, int options, int32_t *retval)
 {
@@ -163,7 +168,8 @@ int sys_waitpid(pid_t pid, int *status, int options, int32_t *retval)
      * EFAULT 	The status argument was an invalid pointer.
      */
     int result;
-    char *temp = kmalloc(1);
+    int waitcode;
+    pid_t childpid;
 
     // "child" means the process we're waiting for
 
@@ -173,63 +179,164 @@ int sys_waitpid(pid_t pid, int *status, int options, int32_t *retval)
     struct proc *proc = curproc;
     KASSERT(proc != NULL);
 
-    // is status a valid pointer?
-    if (status == NULL) {
-        /* POSIX explicitly says passing NULL for status is allowed */
-    } else {
-        result = copyin((userptr_t)status, temp, 1);
-        kfree(temp);
-        if (result) {
-            return EFAULT;
-        }
+    // WNOHANG is the only option we support
+    if (options & ~WNOHANG) {
+        return EINVAL;
     }
 
-    // is the pid valid?
-    if (pid < PID_MIN || pid > PID_MAX) {
-        // pid out of range
-        return ESRCH;
+    // sleep until the child exits, then collect and destroy it
+    result = proc_wait(proc, pid, options, &waitcode, &childpid);
+    if (result) {
+        return result;
     }
-    // is the "options" argument 0?
-    if (options != 0) {
-        // since we do not support other than 0
-        return EINVAL;
+
+    // store the encoded exitcode to *status
+    // (POSIX explicitly says passing NULL for status is allowed)
+    if (childpid != 0 && status != NULL) {
+        result = copyout(&waitcode, (userptr_t)status, sizeof(waitcode));
+        if (result) {
+            return result;
+        }
     }
-    // does the child exist?
-    struct proc *childproc = proc_fetch(pid);
-    if (childproc == NULL) {
-        // child process does not exist
-        return ESRCH;
+
+    *retval = childpid;
+    return 0;
+}
+
+/*
+ * Argument buffer for execv. One ARG_MAX-sized buffer is kept around so
+ * the common case of a single exec in flight needs no allocation; a
+ * concurrent exec falls back to kmalloc.
+ */
+static char execv_argbuf[ARG_MAX];
+static bool execv_argbuf_busy = false;
+static struct spinlock execv_argbuf_lock = SPINLOCK_INITIALIZER;
+
+static char *execv_getbuf(void)
+{
+    bool busy;
+
+    spinlock_acquire(&execv_argbuf_lock);
+    busy = execv_argbuf_busy;
+    execv_argbuf_busy = true;
+    spinlock_release(&execv_argbuf_lock);
+
+    if (busy) {
+        return kmalloc(ARG_MAX);
     }
-    // is this process the parent?
-    if (childproc->p_pid != proc->pid) {
-        // it's not your child!
-        return ECHILD;
+    return execv_argbuf;
+}
+
+static void execv_putbuf(char *buf)
+{
+    if (buf != execv_argbuf) {
+        kfree(buf);
+        return;
     }
 
-    // set a return value 
-    *retval = childproc->pid;
+    spinlock_acquire(&execv_argbuf_lock);
+    KASSERT(execv_argbuf_busy);
+    execv_argbuf_busy = false;
+    spinlock_release(&execv_argbuf_lock);
+}
+
+/*
+ * Copies the program path into buf and opens it. The path is only
+ * needed until vfs_open, so it borrows the argument buffer.
+ */
+static int execv_open(const char *program, char *buf, struct vnode **ret)
+{
+    int result;
 
-    // if the child has not exited yet, just sleep
-    P(childproc->sem_exit);
-    
-    KASSERT(childproc->exitcode != -1);
-    // store the encoded exitcode to *status
-    if (status != NULL) {
-        result = copyout(&childproc->exitcode, (userptr_t)status, sizeof(childproc->exitcode));
+    result = copyinstr((const_userptr_t)program, buf, __PATH_MAX, NULL);
+    if (result) {
+        return result;
+    }
+    return vfs_open(buf, O_RDONLY, 0, ret);
+}
+
+/*
+ * Copies the user argv into buf in one pass. Strings are packed
+ * downward from the top of the buffer, and their offsets are recorded
+ * in slots growing upward from the bottom; the two meeting means
+ * E2BIG. A slot is always held back for the terminating NULL.
+ *
+ * On success the buffer holds [offsets | NULL | pad | strings] from
+ * *ptrbase_ret up to ARG_MAX, ready to go out in one copyout.
+ */
+static int execv_copyargs(char *buf, char **args, int *argc_ret, size_t *ptrbase_ret)
+{
+    vaddr_t *offsets;
+    userptr_t uarg;
+    size_t strtop, gap, ptrbase, len;
+    int result, argc;
+
+    offsets = (vaddr_t *)buf;
+    strtop = ARG_MAX;
+    argc = 0;
+    while (1) {
+        result = copyin((const_userptr_t)&args[argc], &uarg, sizeof(uarg));
         if (result) {
             return result;
         }
+        if (uarg == NULL) {
+            break;
+        }
+        gap = (argc + 2) * sizeof(vaddr_t);
+        if (strtop <= gap) {
+            return E2BIG;
+        }
+        // copy into the gap, then slide the string up against the others
+        result = copyinstr(uarg, buf + gap, strtop - gap, &len);
+        if (result) {
+            return result == ENAMETOOLONG ? E2BIG : result;
+        }
+        strtop -= len;
+        memmove(buf + strtop, buf + gap, len);
+        offsets[argc++] = strtop;
     }
 
-    // unlink the proc table
-    proc_deregister(childproc);
-
-    // destroy the child process
-    proc_destroy(childproc);
+    // the block start doubles as the initial stack pointer, so keep it 8-aligned
+    ptrbase = (strtop - (argc + 1) * sizeof(vaddr_t)) & ~(size_t)7;
+    memmove(buf + ptrbase, offsets, argc * sizeof(vaddr_t));
+    // don't hand stale bytes from an earlier exec to the new program
+    gap = ptrbase + (argc + 1) * sizeof(vaddr_t);
+    bzero(buf + gap, strtop - gap);
 
+    *argc_ret = argc;
+    *ptrbase_ret = ptrbase;
     return 0;
 }
 
+/*
+ * Loads the executable into the current address space and copies the
+ * marshalled arguments onto its stack. The stack pointer returned is
+ * also the user address of argv.
+ */
+static int execv_load(struct vnode *v, char *buf, int argc, size_t ptrbase,
+                      vaddr_t *entrypoint, vaddr_t *stackptr)
+{
+    vaddr_t *argv = (vaddr_t *)(buf + ptrbase);
+    int result, i;
+
+    result = load_elf(v, entrypoint);
+    if (result) {
+        return result;
+    }
+
+    result = as_define_stack(proc_getas(), stackptr);
+    if (result) {
+        return result;
+    }
+
+    *stackptr -= ARG_MAX - ptrbase;
+    for (i = 0; i < argc; i++) {
+        argv[i] += *stackptr - ptrbase;
+    }
+    argv[argc] = 0;
+    return copyout(argv, (userptr_t)*stackptr, ARG_MAX - ptrbase);
+}
+
 /*
  * Replaces the currently executing program with a newly loaded program image.
  * This occurs within one process; the process id is unchanged. 
@@ -241,9 +348,11 @@ int sys_execv(const char *program, char **args)
     /* The process file table and current working directory are not modified!!! */
     struct addrspace *new_as;
     struct addrspace *old_as;
-	struct vnode *elf_v;
-	vaddr_t entrypoint, stackptr, initial_stackptr;
-	int result, argc, i, total_size;
+    struct vnode *elf_v;
+    vaddr_t entrypoint, stackptr;
+    char *buf;
+    size_t ptrbase;
+    int result, argc;
 
     /*
      * ENODEV 	The device prefix of program did not exist.
@@ -262,238 +371,188 @@ int sys_execv(const char *program, char **args)
         return EFAULT;
     }
 
-    /* Is program legit? */ 
-    char *program_copy = kmalloc(__PATH_MAX);
-    if (program_copy == NULL) {
+    buf = execv_getbuf();
+    if (buf == NULL) {
         return ENOMEM;
     }
 
-    result = copyinstr((const_userptr_t)program, program_copy, __PATH_MAX, NULL);
+    /* Open Executable */
+    result = execv_open(program, buf, &elf_v);
     if (result) {
-        kfree(program_copy);
+        execv_putbuf(buf);
         return result;
     }
 
-    /* Is args legit?*/
-    char *temp = kmalloc(1);
-    if (temp == NULL) {
-        kfree(program_copy);
-        return ENOMEM;
-    }
-    // verify args itself
-    result = copyin((const_userptr_t)args, temp, 1);
+    /* Argument Backup */
+    result = execv_copyargs(buf, args, &argc, &ptrbase);
     if (result) {
-        kfree(program_copy);
-        kfree(temp);
-        return result;
+        goto fail;
     }
-    // verify contents of args and calculate argc
-    for(i=0, argc=0; args[i] != NULL; i++, argc++) {
-        result = copyin((const_userptr_t)args[i], temp, 1);
-        if (result) {
-            kfree(temp);
-            kfree(program_copy);
-            return result;
-        }
-    }
-    kfree(temp);
 
-    /* Is the size managable? */
-    int *size = kmalloc(sizeof(int) * argc);
-    if (size == NULL) {
-        kfree(program_copy);
-        kfree(temp);
-        return ENOMEM;
-    }
-    
-    total_size = 0;
-    for (i=0; i<argc; i++) {
-        size[i] = strlen(args[i]) + 1;
-        total_size += size[i];
-    }
-
-    if (total_size > __ARG_MAX) {
-        kfree(program_copy);
-        kfree(size);
-        return E2BIG;
-    }
-
-    /* Open Executable */
-    result = vfs_open(program_copy, O_RDONLY, 0, &elf_v);
-    kfree(program_copy);
-    if (result) {
-        kfree(size);
-        return result;
-    }
-    
     /* Addrspace Creation */
     new_as = as_create();
     if (new_as == NULL) {
-        kfree(size);
-        vfs_close(elf_v);
-        return ENOMEM;
+        result = ENOMEM;
+        goto fail;
     }
 
-    /* Argument Backup */
-    char **kargs = (char **)kmalloc(sizeof(char *) * argc);
-    if (kargs == NULL) {
-        kfree(size);
-        vfs_close(elf_v);
+    /* Addrspace Activation */
+    old_as = proc_setas(new_as);
+    as_activate();
+
+    /* Load the executable and copyout to Userstack */
+    result = execv_load(elf_v, buf, argc, ptrbase, &entrypoint, &stackptr);
+    if (result) {
+        as_deactivate();
+        proc_setas(old_as);
+        as_activate();
         as_destroy(new_as);
-        return ENOMEM;
+        goto fail;
     }
 
-    for(i=0; i<argc; i++) {
-        // store each arguments on kernel heap
-        kargs[i] = kmalloc(size[i]);
-        if (kargs[i] == NULL) {
-            for(i--; i>-1; i--) {
-                kfree(kargs[i]);
-            }
-            kfree(kargs);
-            kfree(size);
-            vfs_close(elf_v);
-            as_destroy(new_as);
-            return ENOMEM;
-        }
+    /* Recycle */
+    vfs_close(elf_v);
+    execv_putbuf(buf);
+    as_destroy(old_as);
 
-        result = copyinstr((userptr_t)args[i], kargs[i], size[i], NULL);
-        if (result) {
-            for(; i>-1; i--) {
-                kfree(kargs[i]);
-            }
-            kfree(kargs);
-            kfree(size);
-            vfs_close(elf_v);
-            as_destroy(new_as);
-            return result;
-        }    
-    }
+    /* Warp to user mode. */
+    enter_new_process(argc /*argc*/, (userptr_t)stackptr /*userspace addr of argv*/,
+                      (userptr_t)stackptr /*userspace addr of environment*/,
+                      stackptr, entrypoint);
 
-    /* Addrspace Activation */
-    // throw away the old one
-    old_as = proc_getas();
-    
-    // set the new one
-    proc_setas(new_as);
-    as_activate();
+    /* enter_new_process does not return. */
+    panic("enter_new_process returned\n");
+    return EINVAL;
 
-    /* Load the executable. */
-	result = load_elf(elf_v, &entrypoint);
+fail:
     vfs_close(elf_v);
-	if (result) {
-        as_deactivate(); 
-        proc_setas(old_as);
+    execv_putbuf(buf);
+    return result;
+}
 
-        for(i--; i>-1; i--) {
-            kfree(kargs[i]);
-        }
-        kfree(size);
-        kfree(kargs);
-        as_destroy(new_as);
+/*
+ * Where a spawned child starts: everything was set up by the parent.
+ */
+struct spawn_entry {
+    int argc;
+    vaddr_t stackptr;
+    vaddr_t entrypoint;
+};
+
+static void enter_spawned_process(void *data, unsigned long unused)
+{
+    struct spawn_entry se;
 
-		return result;
-	}
+    (void)unused;
 
-    /* Define the user stack in the address space */
-	result = as_define_stack(new_as, &stackptr);
-	if (result) {
-		as_deactivate(); 
-        proc_setas(old_as);
+    se = *(struct spawn_entry *)data;
+    kfree(data);
 
-        for(i--; i>-1; i--) {
-            kfree(kargs[i]);
-        }
-        kfree(size);
-        kfree(kargs);
-        as_destroy(new_as);
-		return result;
-	}
-
-    /* Copyout to Userstack */
-    int offset;
-    vaddr_t *argptr = kmalloc(sizeof(vaddr_t) * argc);
-    if (argptr == NULL) {
-		as_deactivate(); 
-        proc_setas(old_as);
+    as_activate();
+    enter_new_process(se.argc, (userptr_t)se.stackptr, (userptr_t)se.stackptr,
+                      se.stackptr, se.entrypoint);
+}
 
-        for(i--; i>-1; i--) {
-            kfree(kargs[i]);
-        }
-        kfree(size);
-        kfree(kargs);
-        as_destroy(new_as);
-		return ENOMEM;
-	}
-    argptr[argc] = 0;
-    
-    stackptr -= 4;
-    bzero((void *)stackptr, 4);
+/*
+ * Creates a child process running a newly loaded program image, as if by
+ * fork followed by execv in the child, but without copying the parent's
+ * address space only to throw it away. The child inherits the file
+ * table and current working directory.
+ *
+ * The new image is built by the parent, so every execv error is reported
+ * here instead of surfacing later as a failed child.
+ *
+ * Return Value : Returns child process' pid. Upon error, returns -1 and error is set.
+ */
+int sys_spawn(const char *program, char **args, int32_t *retval)
+{
+    struct proc *parent_proc = curproc;
+    struct proc *child_proc;
+    struct addrspace *new_as;
+    struct addrspace *old_as;
+    struct spawn_entry *se;
+    struct vnode *elf_v;
+    char *buf;
+    size_t ptrbase;
+    int result;
 
-    // allign the argument pointers
-    for(i=0; i<argc; i++) {
-        offset = size[i] + ((4-(size[i]%4)) % 4);
-        KASSERT(offset % 4 == 0);
-        stackptr -= offset; // progress
-        argptr[i] = stackptr;
+    KASSERT(parent_proc != NULL);
+
+    if (args == NULL || program == NULL) {
+        return EFAULT;
     }
 
-    stackptr -= sizeof(char *) * (argc+1); // + NULL
-    initial_stackptr = stackptr;
+    se = kmalloc(sizeof(*se));
+    if (se == NULL) {
+        return ENOMEM;
+    }
 
-    // copyout argument pointers to userstack
-    for(i=0; i<argc+1; i++) {
-        result = copyout(&argptr[i], (userptr_t)stackptr, sizeof(char *));
-        if (result) {
-            as_deactivate(); 
-            proc_setas(old_as);
-
-            for(i--; i>-1; i--) {
-                kfree(kargs[i]);
-            }
-            kfree(size);
-            kfree(kargs);
-            kfree(argptr);
-            as_destroy(new_as);
-            return result;
-        }
-        stackptr += 4;
+    buf = execv_getbuf();
+    if (buf == NULL) {
+        kfree(se);
+        return ENOMEM;
     }
 
-    // copyout arguments to userstack
-    for(i=0; i<argc; i++) {
-        result = copyoutstr(kargs[i], (userptr_t)argptr[i], size[i], NULL);
-        if (result) {
-            as_deactivate(); 
-            proc_setas(old_as);
-
-            for(i--; i>-1; i--) {
-                kfree(kargs[i]);
-            }
-            kfree(size);
-            kfree(kargs);
-            kfree(argptr);
-            as_destroy(new_as);
-            return result;
-        }
+    result = execv_open(program, buf, &elf_v);
+    if (result) {
+        execv_putbuf(buf);
+        kfree(se);
+        return result;
     }
 
-    /* Recycle */    
-    as_destroy(old_as);
-    for(i=0; i<argc; i++) {
-        kfree(kargs[i]);
+    result = execv_copyargs(buf, args, &se->argc, &ptrbase);
+    if (result) {
+        goto fail;
+    }
+
+    new_as = as_create();
+    if (new_as == NULL) {
+        result = ENOMEM;
+        goto fail;
     }
-    kfree(kargs); 
-    kfree(size);
-    kfree(argptr);
-    
-    /* Warp to user mode. */
-	enter_new_process(argc /*argc*/, (userptr_t)initial_stackptr /*userspace addr of argv*/,
-			  (userptr_t)initial_stackptr /*userspace addr of environment*/,
-			  initial_stackptr, entrypoint);
 
-	/* enter_new_process does not return. */
-	panic("enter_new_process returned\n");
-	return EINVAL;
+    // build the child's image from here, then switch back
+    old_as = proc_setas(new_as);
+    as_activate();
+    result = execv_load(elf_v, buf, se->argc, ptrbase, &se->entrypoint, &se->stackptr);
+    proc_setas(old_as);
+    as_activate();
+    if (result) {
+        as_destroy(new_as);
+        goto fail;
+    }
 
-}
\ No newline at end of file
+    vfs_close(elf_v);
+    execv_putbuf(buf);
+
+    // fails if there are no pids left, as in fork
+    child_proc = proc_create(parent_proc->p_name);
+    if (child_proc == NULL) {
+        as_destroy(new_as);
+        kfree(se);
+        return ENPROC;
+    }
+    child_proc->p_addrspace = new_as;
+    result = proc_inherit(parent_proc, child_proc);
+    if (result) {
+        proc_destroy(child_proc);
+        kfree(se);
+        return result;
+    }
+
+    result = thread_fork(child_proc->p_name, child_proc, enter_spawned_process, se, 0);
+    if (result) {
+        proc_destroy(child_proc);
+        kfree(se);
+        return result;
+    }
+
+    *retval = child_proc->pid;
+    return 0;
+
+fail:
+    vfs_close(elf_v);
+    execv_putbuf(buf);
+    kfree(se);
+    return result;
+}
@@ -101,14 +101,9 @@ runprogram(char *progname)
 	struct fileHandle *stdout = NULL;
 	struct fileHandle *stderr = NULL;
 
-	stdin = fh_create();
-	stdout = fh_create();
-	stderr = fh_create();
-
-	if (stdin == NULL) {
+	if (fh_create(&stdin) || fh_create(&stdout) || fh_create(&stderr)) {
 		panic("File handle creation failed!");
 	}
-	KASSERT(stdout != NULL && stderr != NULL);
 
 	/* 
 	 * "Because lookup may destroy pathnames, these all may too."
@@ -138,9 +133,13 @@ runprogram(char *progname)
 	stdout->fh_accmode = O_WRONLY;
 	stderr->fh_accmode = O_WRONLY;
 	
-	curproc->fileTable[STDIN] = stdin;
-	curproc->fileTable[STDOUT] = stdout;
-	curproc->fileTable[STDERR] = stderr;
+	struct fileHandle *old;
+
+	if (fd_install(curproc, STDIN, stdin, &old) ||
+	    fd_install(curproc, STDOUT, stdout, &old) ||
+	    fd_install(curproc, STDERR, stderr, &old)) {
+		panic("Failed to set up the console file descriptors.");
+	}
 
 	/* Warp to user mode. */
 	enter_new_process(0 /*argc*/, NULL /*userspace addr of argv*/,
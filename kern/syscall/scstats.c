@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * System call statistics and tracing.
+ *
+ * Each CPU has its own struct scstats, updated only by that CPU with
+ * interrupts off, so recording a call takes no locks and touches no
+ * shared cache lines. Readers (the menu and the scstats: device) sum
+ * the per-CPU copies without stopping anyone, so a snapshot taken
+ * while calls are running may be off by the calls in progress.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/syscall.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <synch.h>
+#include <current.h>
+#include <proc.h>
+#include <uio.h>
+#include <vfs.h>
+#include <device.h>
+#include <mips/trapframe.h>
+#include <scstats.h>
+
+bool scstats_tracenew = false;
+
+/*
+ * Every CPU's statistics, for the readers. CPUs are only created
+ * during boot, one at a time, so the list needs no lock.
+ */
+struct scstats_cpu {
+	struct scstats sp_stats;
+	struct scstats_cpu *sp_next;
+};
+static struct scstats_cpu *scstats_cpus;
+
+/* Buffer for summing the per-CPU statistics, and its lock. */
+static struct scstats scstats_sum;
+static struct lock *scstats_sumlock;
+
+/* Names for tracing and printing. Calls not listed print as numbers. */
+static const char *const scstats_names[SCSTATS_NCALLS] = {
+	[SYS_fork] = "fork",
+	[SYS_spawn] = "spawn",
+	[SYS_execv] = "execv",
+	[SYS__exit] = "_exit",
+	[SYS_waitpid] = "waitpid",
+	[SYS_getpid] = "getpid",
+	[SYS_open] = "open",
+	[SYS_pipe] = "pipe",
+	[SYS_dup2] = "dup2",
+	[SYS_close] = "close",
+	[SYS_read] = "read",
+	[SYS_pread] = "pread",
+	[SYS_readv] = "readv",
+	[SYS_preadv] = "preadv",
+	[SYS_write] = "write",
+	[SYS_pwrite] = "pwrite",
+	[SYS_writev] = "writev",
+	[SYS_pwritev] = "pwritev",
+	[SYS_lseek] = "lseek",
+	[SYS_fsync] = "fsync",
+	[SYS_chdir] = "chdir",
+	[SYS___getcwd] = "__getcwd",
+	[SYS___time] = "__time",
+	[SYS_sync] = "sync",
+	[SYS_reboot] = "reboot",
+	[SYS_sysbatch] = "sysbatch",
+};
+
+struct scstats *
+scstats_create(void)
+{
+	struct scstats_cpu *sp;
+
+	sp = kmalloc(sizeof(*sp));
+	if (sp == NULL) {
+		return NULL;
+	}
+	bzero(&sp->sp_stats, sizeof(sp->sp_stats));
+	sp->sp_next = scstats_cpus;
+	scstats_cpus = sp;
+	return &sp->sp_stats;
+}
+
+/*
+ * Histogram bucket for a latency: floor(log2(cycles)), with 0 and 1
+ * both in bucket 0, and everything too big in the last bucket.
+ */
+static
+unsigned
+scstats_bucket(uint32_t cycles)
+{
+	unsigned b = 0;
+
+	while (cycles > 1 && b < SCSTATS_NBUCKETS - 1) {
+		cycles >>= 1;
+		b++;
+	}
+	return b;
+}
+
+static
+void
+scstats_trace(const struct trapframe *tf, int callno, int err,
+	      int32_t retval)
+{
+	const char *name;
+
+	name = (callno >= 0 && callno < SCSTATS_NCALLS) ?
+		scstats_names[callno] : NULL;
+	if (name != NULL) {
+		kprintf("[%d] %s(", curproc->pid, name);
+	}
+	else {
+		kprintf("[%d] syscall%d(", curproc->pid, callno);
+	}
+	kprintf("0x%x, 0x%x, 0x%x, 0x%x) = ",
+		tf->tf_a0, tf->tf_a1, tf->tf_a2, tf->tf_a3);
+	if (err) {
+		kprintf("-1 %s\n", strerror(err));
+	}
+	else {
+		kprintf("%d\n", retval);
+	}
+}
+
+/*
+ * Calls are counted on the way in, so that execv and _exit, which
+ * don't come back when they work, are counted too.
+ */
+void
+scstats_enter(int callno)
+{
+	int spl;
+
+	if (callno >= 0 && callno < SCSTATS_NCALLS) {
+		/* Stay on this CPU and keep its other threads out. */
+		spl = splhigh();
+		curcpu->c_scstats->sc_calls[callno]++;
+		splx(spl);
+	}
+}
+
+void
+scstats_record(const struct trapframe *tf, int callno, int err,
+	       int32_t retval, unsigned startcpu, uint32_t start)
+{
+	struct scstats *sc;
+	uint32_t cycles;
+	int spl;
+
+	if (callno >= 0 && callno < SCSTATS_NCALLS) {
+		spl = splhigh();
+		cycles = cpu_getcycles() - start;
+		sc = curcpu->c_scstats;
+		if (err) {
+			sc->sc_errors[callno]++;
+		}
+		if (curcpu->c_number == startcpu) {
+			sc->sc_cycles[callno] += cycles;
+			sc->sc_hist[callno][scstats_bucket(cycles)]++;
+		}
+		splx(spl);
+	}
+
+	if (curproc->p_sctrace) {
+		scstats_trace(tf, callno, err, retval);
+	}
+}
+
+void
+scstats_snapshot(struct scstats *total)
+{
+	const struct scstats_cpu *sp;
+	const struct scstats *sc;
+	unsigned n, b;
+
+	bzero(total, sizeof(*total));
+	for (sp = scstats_cpus; sp != NULL; sp = sp->sp_next) {
+		sc = &sp->sp_stats;
+		for (n=0; n<SCSTATS_NCALLS; n++) {
+			if (sc->sc_calls[n] == 0) {
+				continue;
+			}
+			total->sc_calls[n] += sc->sc_calls[n];
+			total->sc_errors[n] += sc->sc_errors[n];
+			total->sc_cycles[n] += sc->sc_cycles[n];
+			for (b=0; b<SCSTATS_NBUCKETS; b++) {
+				total->sc_hist[n][b] += sc->sc_hist[n][b];
+			}
+		}
+	}
+}
+
+/*
+ * Calls running on other CPUs while this happens may survive it.
+ */
+void
+scstats_reset(void)
+{
+	struct scstats_cpu *sp;
+
+	for (sp = scstats_cpus; sp != NULL; sp = sp->sp_next) {
+		bzero(&sp->sp_stats, sizeof(sp->sp_stats));
+	}
+}
+
+void
+scstats_print(void)
+{
+	const struct scstats *sc = &scstats_sum;
+	uint32_t timed;
+	unsigned n, b;
+
+	lock_acquire(scstats_sumlock);
+	scstats_snapshot(&scstats_sum);
+
+	kprintf("call           calls   errors avgcycles  "
+		"log2(cycles):count\n");
+	for (n=0; n<SCSTATS_NCALLS; n++) {
+		if (sc->sc_calls[n] == 0) {
+			continue;
+		}
+		timed = 0;
+		for (b=0; b<SCSTATS_NBUCKETS; b++) {
+			timed += sc->sc_hist[n][b];
+		}
+		if (scstats_names[n] != NULL) {
+			kprintf("%-10s", scstats_names[n]);
+		}
+		else {
+			kprintf("syscall%-3u", n);
+		}
+		kprintf(" %9u %8u %9llu ", sc->sc_calls[n], sc->sc_errors[n],
+			timed ? (unsigned long long)sc->sc_cycles[n] / timed
+			: 0ULL);
+		for (b=0; b<SCSTATS_NBUCKETS; b++) {
+			if (sc->sc_hist[n][b] > 0) {
+				kprintf(" %u:%u", b, sc->sc_hist[n][b]);
+			}
+		}
+		kprintf("\n");
+	}
+
+	lock_release(scstats_sumlock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// The scstats: device. Each read returns (from the start) a
+// struct scstats summed over all CPUs.
+
+static
+int
+scstats_devopen(struct device *dev, int openflags)
+{
+	(void)dev;
+
+	if ((openflags & O_ACCMODE) != O_RDONLY) {
+		return EINVAL;
+	}
+	return 0;
+}
+
+static
+int
+scstats_devio(struct device *dev, struct uio *uio)
+{
+	size_t len;
+	int result;
+
+	(void)dev;
+
+	if (uio->uio_rw != UIO_READ) {
+		return EINVAL;
+	}
+	if (uio->uio_offset < 0 ||
+	    uio->uio_offset >= (off_t)sizeof(struct scstats)) {
+		return 0;
+	}
+	len = sizeof(struct scstats) - uio->uio_offset;
+
+	lock_acquire(scstats_sumlock);
+	scstats_snapshot(&scstats_sum);
+	result = uiomove((char *)&scstats_sum + uio->uio_offset, len, uio);
+	lock_release(scstats_sumlock);
+
+	return result;
+}
+
+static
+int
+scstats_devioctl(struct device *dev, int op, userptr_t data)
+{
+	(void)dev;
+	(void)op;
+	(void)data;
+
+	return EINVAL;
+}
+
+static const struct device_ops scstats_devops = {
+	.devop_eachopen = scstats_devopen,
+	.devop_io = scstats_devio,
+	.devop_ioctl = scstats_devioctl,
+};
+
+static struct device scstats_dev;
+
+void
+scstats_bootstrap(void)
+{
+	int result;
+
+	scstats_sumlock = lock_create("scstats");
+	if (scstats_sumlock == NULL) {
+		panic("scstats: Could not create lock\n");
+	}
+
+	scstats_dev.d_ops = &scstats_devops;
+	scstats_dev.d_blocks = 0;
+	scstats_dev.d_blocksize = 1;
+	scstats_dev.d_devnumber = 0; /* assigned by vfs_adddev */
+	scstats_dev.d_data = NULL;
+
+	result = vfs_adddev("scstats", &scstats_dev, 0);
+	if (result) {
+		panic("Could not add scstats device: %s\n", strerror(result));
+	}
+}
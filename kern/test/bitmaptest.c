@@ -28,12 +28,20 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
 #include <bitmap.h>
 #include <test.h>
 
 #define TESTSIZE 533
 
+/* Freemap of a 16M disk with 512-byte blocks. */
+#define BENCHSIZE 32768
+#define BENCHFREE 64
+#define BENCHLOOPS 2000
+#define BENCHRUN 8
+
 int
 bitmaptest(int nargs, char **args)
 {
@@ -101,6 +109,115 @@ bitmaptest(int nargs, char **args)
 		KASSERT(data[i]==0);
 	}
 
+	/* Lowest bits first, even after freeing below an allocation. */
+	bitmap_unmark(b, 100);
+	bitmap_unmark(b, 7);
+	KASSERT(bitmap_alloc(b, &x)==0 && x==7);
+	KASSERT(bitmap_alloc(b, &x)==0 && x==100);
+	KASSERT(bitmap_alloc(b, &x)==ENOSPC);
+
+	/* Runs: a hole of 3 and a hole of 40; the 40 must be split. */
+	bitmap_unmark_run(b, 10, 3);
+	bitmap_unmark_run(b, 200, 40);
+	KASSERT(bitmap_alloc_run(b, 4, &x)==0 && x==200);
+	KASSERT(bitmap_alloc_run(b, 3, &x)==0 && x==10);
+	KASSERT(bitmap_alloc_run(b, 37, &x)==ENOSPC);
+	KASSERT(bitmap_alloc_run(b, 36, &x)==0 && x==204);
+	KASSERT(bitmap_alloc(b, &x)==ENOSPC);
+
+	/* Nothing past the end, though the padding is there. */
+	bitmap_unmark_run(b, TESTSIZE-5, 5);
+	KASSERT(bitmap_alloc_run(b, 6, &x)==ENOSPC);
+	KASSERT(bitmap_alloc_run(b, 5, &x)==0 && x==TESTSIZE-5);
+
+	bitmap_destroy(b);
+
 	kprintf("Bitmap test complete\n");
 	return 0;
 }
+
+/*
+ * The old allocator: test every bit from the start.
+ */
+static
+int
+bitmaptest2_scan(struct bitmap *b, unsigned nbits, unsigned *index)
+{
+	unsigned i;
+
+	for (i=0; i<nbits; i++) {
+		if (!bitmap_isset(b, i)) {
+			bitmap_mark(b, i);
+			*index = i;
+			return 0;
+		}
+	}
+	return ENOSPC;
+}
+
+static
+void
+bitmaptest2_report(const char *what, struct timespec *start)
+{
+	struct timespec end;
+	uint64_t ns;
+
+	gettime(&end);
+	timespec_sub(&end, start, &end);
+	ns = end.tv_sec * 1000000000ULL + end.tv_nsec;
+	kprintf("%s: %llu ns per op\n", what,
+		(unsigned long long)(ns / BENCHLOOPS));
+}
+
+/*
+ * Benchmark allocation from a nearly full bitmap the size of an SFS
+ * freemap: the case where the filesystem scans under its lock.
+ */
+int
+bitmaptest2(int nargs, char **args)
+{
+	struct bitmap *b;
+	struct timespec start;
+	unsigned i, x;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting bitmap benchmark...\n");
+
+	b = bitmap_create(BENCHSIZE);
+	KASSERT(b != NULL);
+	for (i=0; i<BENCHSIZE-BENCHFREE; i++) {
+		bitmap_mark(b, i);
+	}
+
+	gettime(&start);
+	for (i=0; i<BENCHLOOPS; i++) {
+		KASSERT(bitmaptest2_scan(b, BENCHSIZE, &x)==0);
+		bitmap_unmark(b, x);
+	}
+	bitmaptest2_report("bit-at-a-time alloc", &start);
+
+	/* Make the hint start from scratch, as after a remount. */
+	bitmap_getdata(b);
+	gettime(&start);
+	for (i=0; i<BENCHLOOPS; i++) {
+		KASSERT(bitmap_alloc(b, &x)==0);
+		KASSERT(x == BENCHSIZE-BENCHFREE);
+		bitmap_unmark(b, x);
+	}
+	bitmaptest2_report("bitmap_alloc", &start);
+
+	gettime(&start);
+	for (i=0; i<BENCHLOOPS; i++) {
+		KASSERT(bitmap_alloc_run(b, BENCHRUN, &x)==0);
+		KASSERT(x == BENCHSIZE-BENCHFREE);
+		bitmap_unmark_run(b, x, BENCHRUN);
+	}
+	bitmaptest2_report("bitmap_alloc_run", &start);
+
+	bitmap_destroy(b);
+
+	kprintf("Bitmap benchmark complete\n");
+	return 0;
+}
@@ -37,6 +37,7 @@
 #include <thread.h>
 #include <synch.h>
 #include <vm.h> /* for PAGE_SIZE */
+#include <kmemcache.h>
 #include <test.h>
 #include <kern/test161.h>
 #include <mainbus.h>
@@ -497,6 +498,9 @@ kmalloctest5(int nargs, char **args)
 	// Initially, there must be at least 1 page allocated for each thread stack,
 	// one page for kmalloc for this thread struct, plus what we just allocated).
 	// This probably isn't the GLB, but its a decent lower bound.
+	// kmalloc caches freed blocks and spare slabs; drop them so every
+	// allocation below takes a new page and every free gives one back.
+	kheap_drain();
 	orig_used = coremap_used_bytes();
 	known_pages = num_cpus + num_ptr_blocks + 1;
 	if (orig_used < known_pages * PAGE_SIZE) {
@@ -589,6 +593,7 @@ kmalloctest5(int nargs, char **args)
 		}
 
 		// Check that we're back to where we started
+		kheap_drain();
 		used = coremap_used_bytes();
 		if (used != orig_used) {
 			panic("orig (%u) != used (%u)", orig_used, used);
@@ -605,3 +610,106 @@ kmalloctest5(int nargs, char **args)
 
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+// km6
+
+/*
+ * Test object caches: objects come out constructed, are packed at
+ * their exact size, keep their constructed state across a free and
+ * a new allocation without the constructor running again, and all
+ * get destroyed with the cache.
+ */
+
+#define KM6_SIZE 72
+#define KM6_NOBJS 200
+#define KM6_MAGIC 0xc0ffee11
+
+static unsigned km6_live;
+
+static
+int
+km6_ctor(void *obj)
+{
+	*(uint32_t *)obj = KM6_MAGIC;
+	km6_live++;
+	return 0;
+}
+
+static
+void
+km6_dtor(void *obj)
+{
+	KASSERT(*(uint32_t *)obj == KM6_MAGIC);
+	km6_live--;
+}
+
+int
+kmalloctest6(int nargs, char **args)
+{
+	struct kmem_cache *kc;
+	void **objs;
+	unsigned i, constructed;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting km6...\n");
+
+	kc = kmem_cache_create("km6", KM6_SIZE, km6_ctor, km6_dtor);
+	objs = kmalloc(KM6_NOBJS * sizeof(void *));
+	if (kc == NULL || objs == NULL) {
+		panic("km6: out of memory\n");
+	}
+
+	for (i=0; i<KM6_NOBJS; i++) {
+		objs[i] = kmem_cache_alloc(kc);
+		if (objs[i] == NULL) {
+			panic("km6: kmem_cache_alloc failed at %u\n", i);
+		}
+		if (*(uint32_t *)objs[i] != KM6_MAGIC) {
+			panic("km6: object %u not constructed\n", i);
+		}
+		((uint32_t *)objs[i])[1] = i;
+	}
+
+	/* A fresh slab hands out its objects in order, KM6_SIZE apart. */
+	if ((vaddr_t)objs[1] - (vaddr_t)objs[0] != KM6_SIZE) {
+		panic("km6: objects %p and %p not packed\n", objs[0], objs[1]);
+	}
+
+	constructed = km6_live;
+	for (i=0; i<KM6_NOBJS; i+=2) {
+		kmem_cache_free(kc, objs[i]);
+	}
+	for (i=0; i<KM6_NOBJS; i+=2) {
+		objs[i] = kmem_cache_alloc(kc);
+		if (objs[i] == NULL) {
+			panic("km6: kmem_cache_alloc failed at %u\n", i);
+		}
+		if (*(uint32_t *)objs[i] != KM6_MAGIC) {
+			panic("km6: reused object %u lost its state\n", i);
+		}
+		((uint32_t *)objs[i])[1] = i;
+	}
+	if (km6_live != constructed) {
+		panic("km6: constructor ran again on reuse\n");
+	}
+
+	for (i=0; i<KM6_NOBJS; i++) {
+		if (((uint32_t *)objs[i])[1] != i) {
+			panic("km6: object %u was overwritten\n", i);
+		}
+		kmem_cache_free(kc, objs[i]);
+	}
+	kmem_cache_destroy(kc);
+	kfree(objs);
+
+	if (km6_live != 0) {
+		panic("km6: %u objects never destroyed\n", km6_live);
+	}
+
+	success(TEST161_SUCCESS, SECRET, "km6");
+
+	return 0;
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Benchmark for memcpy, memmove, and memset.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <test.h>
+
+#define MT_BUFSIZE	(4096 + 64)
+#define MT_TOTAL	(1024*1024)	/* bytes moved per measurement */
+
+/*
+ * The old byte-at-a-time copy, for comparison.
+ */
+static
+void
+mt_bytecopy(void *dst, const void *src, size_t len)
+{
+	char *d = dst;
+	const char *s = src;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		d[i] = s[i];
+	}
+}
+
+static
+unsigned
+mt_kbps(struct timespec *start)
+{
+	struct timespec end;
+	uint64_t ns;
+
+	gettime(&end);
+	timespec_sub(&end, start, &end);
+	ns = end.tv_sec * 1000000000ULL + end.tv_nsec;
+	if (ns == 0) {
+		ns = 1;
+	}
+	return (unsigned)((uint64_t)MT_TOTAL * 1000000000ULL / 1024 / ns);
+}
+
+static
+void
+mt_check(const char *dst, const char *src, size_t len, const char *what)
+{
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		if (dst[i] != src[i]) {
+			panic("memtest: %s: byte %u of %u is wrong\n",
+			      what, (unsigned)i, (unsigned)len);
+		}
+	}
+}
+
+int
+memtest(int nargs, char **args)
+{
+	static const size_t lens[] = { 16, 256, 4096 };
+	static const unsigned offs[] = { 0, 1 };
+	char *src, *dst, *expect;
+	struct timespec start;
+	unsigned i, j, k, n, bytes, words, moves, fills;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting memtest...\n");
+
+	src = kmalloc(MT_BUFSIZE);
+	dst = kmalloc(MT_BUFSIZE);
+	expect = kmalloc(MT_BUFSIZE);
+	if (src == NULL || dst == NULL || expect == NULL) {
+		panic("memtest: Out of memory\n");
+	}
+	for (i=0; i<MT_BUFSIZE; i++) {
+		src[i] = random();
+	}
+
+	kprintf("  size  dst+  byte loop    memcpy   memmove    memset"
+		"  (KB/s)\n");
+	for (i=0; i<sizeof(lens)/sizeof(lens[0]); i++) {
+		for (j=0; j<sizeof(offs)/sizeof(offs[0]); j++) {
+			char *d = dst + offs[j];
+			n = MT_TOTAL / lens[i];
+
+			gettime(&start);
+			for (k=0; k<n; k++) {
+				mt_bytecopy(d, src, lens[i]);
+			}
+			bytes = mt_kbps(&start);
+
+			bzero(dst, MT_BUFSIZE);
+			gettime(&start);
+			for (k=0; k<n; k++) {
+				memcpy(d, src, lens[i]);
+			}
+			words = mt_kbps(&start);
+			mt_check(d, src, lens[i], "memcpy");
+
+			/*
+			 * Overlapping, destination above the source. Check
+			 * one move first against the expected result, built
+			 * a byte at a time: the first 32 bytes unchanged,
+			 * then the old first LEN bytes, then whatever
+			 * followed.
+			 */
+			for (k=0; k<MT_BUFSIZE; k++) {
+				expect[k] = dst[k];
+			}
+			for (k=0; k<lens[i]; k++) {
+				expect[offs[j] + 32 + k] = dst[offs[j] + k];
+			}
+			memmove(d + 32, d, lens[i]);
+			mt_check(dst, expect, MT_BUFSIZE, "memmove");
+
+			gettime(&start);
+			for (k=0; k<n; k++) {
+				memmove(d + 32, d, lens[i]);
+			}
+			moves = mt_kbps(&start);
+
+			gettime(&start);
+			for (k=0; k<n; k++) {
+				memset(d, k, lens[i]);
+			}
+			fills = mt_kbps(&start);
+			for (k=0; k<lens[i]; k++) {
+				expect[k] = n - 1;
+			}
+			mt_check(d, expect, lens[i], "memset");
+
+			kprintf("%6u  %4u  %9u %9u %9u %9u\n",
+				(unsigned)lens[i], offs[j],
+				bytes, words, moves, fills);
+		}
+	}
+
+	kfree(src);
+	kfree(dst);
+	kfree(expect);
+
+	kprintf("memtest done.\n");
+	return 0;
+}
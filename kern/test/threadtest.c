@@ -32,11 +32,13 @@
  */
 #include <types.h>
 #include <lib.h>
+#include <clock.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
 
 #define NTHREADS  8
+#define NFORKS    1000
 
 static struct semaphore *tsem = NULL;
 
@@ -144,3 +146,52 @@ threadtest2(int nargs, char **args)
 
 	return 0;
 }
+
+static
+void
+emptythread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	V(tsem);
+}
+
+/*
+ * Time thread_fork plus thread exit, one thread at a time, so each
+ * fork can reuse the thread that just died.
+ */
+int
+threadtest4(int nargs, char **args)
+{
+	struct timespec start, end;
+	uint64_t ns;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	init_sem();
+	kprintf("Starting thread test 4...\n");
+
+	gettime(&start);
+	for (i=0; i<NFORKS; i++) {
+		result = thread_fork("threadtest4", NULL, emptythread, NULL, i);
+		if (result) {
+			panic("threadtest4: thread_fork failed %s)\n",
+			      strerror(result));
+		}
+		P(tsem);
+	}
+	gettime(&end);
+
+	timespec_sub(&end, &start, &end);
+	ns = end.tv_sec * 1000000000ULL + end.tv_nsec;
+	kprintf("%d forks in %llu.%09lu seconds: %llu ns per fork+exit\n",
+		NFORKS, (unsigned long long)end.tv_sec,
+		(unsigned long)end.tv_nsec,
+		(unsigned long long)(ns / NFORKS));
+	kprintf("Thread test 4 done.\n");
+
+	return 0;
+}
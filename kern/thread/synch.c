@@ -33,6 +33,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
@@ -41,31 +42,36 @@
 #include <synch.h>
 #include <spl.h>
 #include <cpu.h>
+#include <kmemcache.h>
 
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
 
+static struct kmem_cache sem_cache =
+	KMEM_CACHE_INITIALIZER("semaphore", sizeof(struct semaphore),
+			       NULL, NULL);
+
 struct semaphore *
 sem_create(const char *name, unsigned initial_count)
 {
 	struct semaphore *sem;
 
-	sem = kmalloc(sizeof(*sem));
+	sem = kmem_cache_alloc(&sem_cache);
 	if (sem == NULL) {
 		return NULL;
 	}
 
 	sem->sem_name = kstrdup(name);
 	if (sem->sem_name == NULL) {
-		kfree(sem);
+		kmem_cache_free(&sem_cache, sem);
 		return NULL;
 	}
 
 	sem->sem_wchan = wchan_create(sem->sem_name);
 	if (sem->sem_wchan == NULL) {
 		kfree(sem->sem_name);
-		kfree(sem);
+		kmem_cache_free(&sem_cache, sem);
 		return NULL;
 	}
 
@@ -84,7 +90,7 @@ sem_destroy(struct semaphore *sem)
 	spinlock_cleanup(&sem->sem_lock);
 	wchan_destroy(sem->sem_wchan);
 	kfree(sem->sem_name);
-	kfree(sem);
+	kmem_cache_free(&sem_cache, sem);
 }
 
 void
@@ -140,31 +146,59 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+/*
+ * Locks come from a cache whose objects keep their binary semaphore
+ * while free, so creating a lock doesn't have to make a new one.
+ */
+static
+int
+lock_ctor(void *obj)
+{
+	struct lock *lock = obj;
+
+	lock->lk_sem = sem_create("binary_sem", 1);
+	if (lock->lk_sem == NULL) {
+		return ENOMEM;
+	}
+	lock->lk_holder = NULL;
+	return 0;
+}
+
+static
+void
+lock_dtor(void *obj)
+{
+	struct lock *lock = obj;
+
+	sem_destroy(lock->lk_sem);
+}
+
+static struct kmem_cache lock_cache =
+	KMEM_CACHE_INITIALIZER("lock", sizeof(struct lock),
+			       lock_ctor, lock_dtor);
+
 struct lock *
 lock_create(const char *name)
 {
 	struct lock *lock;
 
-	lock = kmalloc(sizeof(*lock));
+	lock = kmem_cache_alloc(&lock_cache);
 	if (lock == NULL) {
 		return NULL;
 	}
 
 	lock->lk_name = kstrdup(name);
 	if (lock->lk_name == NULL) {
-		kfree(lock);
+		kmem_cache_free(&lock_cache, lock);
 		return NULL;
 	}
 
 	HANGMAN_LOCKABLEINIT(&lock->lk_hangman, lock->lk_name);
 
 	// add stuff here as needed
-	struct semaphore *sem;
-
-	sem = sem_create("binary_sem", 1); // create a binary semaphore, "binary_sem"
-	lock->lk_sem = sem;
-	
-	lock->lk_holder = NULL;
+	/* lk_sem and lk_holder are already set up; see lock_ctor */
+	KASSERT(lock->lk_sem->sem_count == 1);
+	KASSERT(lock->lk_holder == NULL);
 	// END OF ADDED STUFFS
 
 	return lock;
@@ -177,11 +211,11 @@ lock_destroy(struct lock *lock)
 
 	// add stuff here as needed
 	KASSERT(lock->lk_holder == NULL);
-	sem_destroy(lock->lk_sem);
+	KASSERT(lock->lk_sem->sem_count == 1);
 	// END OF ADDED STUFFS
 
 	kfree(lock->lk_name);
-	kfree(lock);
+	kmem_cache_free(&lock_cache, lock);
 }
 
 void
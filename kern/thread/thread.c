@@ -50,11 +50,17 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <scstats.h>
+#include <kmemcache.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/* Cache for struct thread. */
+static struct kmem_cache thread_cache =
+	KMEM_CACHE_INITIALIZER("thread", sizeof(struct thread), NULL, NULL);
+
 /* Wait channel. A wchan is protected by an associated, passed-in spinlock. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -115,25 +121,65 @@ thread_checkstack(struct thread *thread)
 }
 
 /*
- * Create a thread. This is used both to create a first thread
- * for each CPU and to create subsequent forked threads.
+ * Get a stack for a new thread. Each cpu keeps the last few stacks
+ * freed on it, most recent on top, so a new thread is likely to get
+ * one that's still in the cache. Only when there are none does the
+ * stack come from kmalloc.
  */
 static
-struct thread *
-thread_create(const char *name)
+void *
+thread_stack_get(void)
 {
-	struct thread *thread;
+	struct cpu *c;
+	void *stack = NULL;
+	int spl;
 
-	DEBUGASSERT(name != NULL);
-	if (strlen(name) > MAX_NAME_LENGTH) {
-		return NULL;
+	spl = splhigh();
+	c = curcpu->c_self;
+	if (c->c_nstacks > 0) {
+		stack = c->c_stacks[--c->c_nstacks];
 	}
+	splx(spl);
 
-	thread = kmalloc(sizeof(*thread));
-	if (thread == NULL) {
-		return NULL;
+	if (stack == NULL) {
+		stack = kmalloc(STACK_SIZE);
 	}
+	return stack;
+}
 
+/*
+ * Give back a stack from thread_stack_get. The thread using it must
+ * have passed thread_checkstack, so the guard band is still intact
+ * for whoever gets it next.
+ */
+static
+void
+thread_stack_put(void *stack)
+{
+	struct cpu *c;
+	int spl;
+
+	spl = splhigh();
+	c = curcpu->c_self;
+	if (c->c_nstacks < CPU_NSTACKS) {
+		c->c_stacks[c->c_nstacks++] = stack;
+		stack = NULL;
+	}
+	splx(spl);
+
+	if (stack != NULL) {
+		kfree(stack);
+	}
+}
+
+/*
+ * Set up the fields of a new or recycled thread. Everything but the
+ * stack is (re)initialized.
+ */
+static
+void
+thread_init(struct thread *thread, const char *name)
+{
 	strcpy(thread->t_name, name);
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
@@ -141,7 +187,6 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
@@ -152,7 +197,65 @@ thread_create(const char *name)
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	/* Public fields */
+	thread->t_pathbuf_busy = false;
+
 	/* If you add to struct thread, be sure to initialize here */
+}
+
+/*
+ * Create a thread. This is used both to create a first thread
+ * for each CPU and to create subsequent forked threads.
+ */
+static
+struct thread *
+thread_create(const char *name)
+{
+	struct thread *thread;
+
+	DEBUGASSERT(name != NULL);
+	if (strlen(name) >= MAX_NAME_LENGTH) {
+		return NULL;
+	}
+
+	thread = kmem_cache_alloc(&thread_cache);
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	thread_init(thread, name);
+	thread->t_stack = NULL;
+	thread->t_pathbuf = NULL;
+
+	return thread;
+}
+
+/*
+ * Get a dead thread, stack and all, from this cpu's free list and
+ * set it up as though it came from thread_create. Returns NULL if
+ * there aren't any.
+ */
+static
+struct thread *
+thread_getrecycled(const char *name)
+{
+	struct thread *thread;
+	int spl;
+
+	DEBUGASSERT(name != NULL);
+	if (strlen(name) >= MAX_NAME_LENGTH) {
+		return NULL;
+	}
+
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_freethreads);
+	splx(spl);
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	KASSERT(thread->t_stack != NULL);
+	thread_init(thread, name);
 
 	return thread;
 }
@@ -184,6 +287,16 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_scstats = scstats_create();
+	if (c->c_scstats == NULL) {
+		panic("cpu_create: Out of memory\n");
+	}
+	c->c_kmalloc = kmalloc_cpu_create();
+	if (c->c_kmalloc == NULL) {
+		panic("cpu_create: Out of memory\n");
+	}
+	c->c_nstacks = 0;
+	threadlist_init(&c->c_freethreads);
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
@@ -215,7 +328,7 @@ cpu_create(unsigned hardware_number)
 		/*c->c_curthread->t_stack = ... */
 	}
 	else {
-		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
+		c->c_curthread->t_stack = thread_stack_get();
 		if (c->c_curthread->t_stack == NULL) {
 			panic("cpu_create: couldn't allocate stack");
 		}
@@ -278,20 +391,62 @@ thread_destroy(struct thread *thread)
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
 	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
+		thread_checkstack(thread);
+		thread_stack_put(thread->t_stack);
 	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
 
+	/* Public fields */
+	KASSERT(!thread->t_pathbuf_busy);
+	if (thread->t_pathbuf != NULL) {
+		kfree(thread->t_pathbuf);
+	}
+
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
-	kfree(thread);
+	kmem_cache_free(&thread_cache, thread);
+}
+
+/*
+ * Finish off a dead thread by putting it on this cpu's free list, with
+ * its stack, for thread_fork to reuse. Recently exited threads go on
+ * the front, since their stacks are the most likely to be in the
+ * cache. If the list is full, or the thread has no stack of its own,
+ * destroy it instead.
+ */
+static
+void
+thread_recycle(struct thread *thread)
+{
+	struct cpu *c;
+	int spl;
+
+	KASSERT(thread != curthread);
+	KASSERT(thread->t_state != S_RUN);
+	KASSERT(thread->t_proc == NULL);
+
+	spl = splhigh();
+	c = curcpu->c_self;
+	if (thread->t_stack == NULL ||
+	    c->c_freethreads.tl_count >= CPU_NTHREADS) {
+		splx(spl);
+		thread_destroy(thread);
+		return;
+	}
+
+	thread_checkstack(thread);
+	thread_machdep_cleanup(&thread->t_machdep);
+	KASSERT(!thread->t_pathbuf_busy);
+	thread->t_wchan_name = "RECYCLED";
+	threadlist_addhead(&c->c_freethreads, thread);
+	splx(spl);
 }
 
 /*
  * Clean up zombies. (Zombies are threads that have exited but still
- * need to have thread_destroy called on them.)
+ * need to have thread_recycle or thread_destroy called on them.)
  *
  * The list of zombies is per-cpu.
  */
@@ -304,7 +459,7 @@ exorcise(void)
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
-		thread_destroy(z);
+		thread_recycle(z);
 	}
 }
 
@@ -513,16 +668,20 @@ thread_fork(const char *name,
 	struct thread *newthread;
 	int result;
 
-	newthread = thread_create(name);
+	/* Reuse a dead thread and its stack if we can */
+	newthread = thread_getrecycled(name);
 	if (newthread == NULL) {
-		return ENOMEM;
-	}
+		newthread = thread_create(name);
+		if (newthread == NULL) {
+			return ENOMEM;
+		}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		/* Allocate a stack */
+		newthread->t_stack = thread_stack_get();
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
 	}
 	thread_checkstack_init(newthread);
 
@@ -662,7 +821,10 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			/* Do some background work if there is any */
+			if (!vm_idle()) {
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -789,7 +951,7 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
  *
  * The parts of the thread structure we don't actually need to run
  * should be cleaned up right away. The rest has to wait until
- * thread_destroy is called from exorcise().
+ * thread_recycle is called from exorcise().
  *
  * Note that any dynamically-allocated structures that can vary in size from
  * thread to thread should be cleaned up here, not in thread_destroy. This is
@@ -808,10 +970,11 @@ thread_exit(void)
 	cur = curthread;
 
 	/*
-	 * Detach from our process. You might need to move this action
-	 * around, depending on how your wait/exit works.
+	 * Detach from our process, unless proc_exit already did so.
 	 */
-	proc_remthread(cur);
+	if (cur->t_proc != NULL) {
+		proc_remthread(cur);
+	}
 
 	/* Make sure we *are* detached (move this only if you're sure!) */
 	KASSERT(cur->t_proc == NULL);
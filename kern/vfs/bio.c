@@ -0,0 +1,517 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Block I/O request plumbing. See bio.h.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <uio.h>
+#include <device.h>
+#include <bio.h>
+
+/*
+ * Sleepers in bio_io wait here. One channel for everyone is crude,
+ * but there are never many of them and it saves a semaphore per
+ * request.
+ */
+static struct spinlock bio_lock = SPINLOCK_INITIALIZER;
+static struct wchan *bio_wchan;
+
+void
+bio_bootstrap(void)
+{
+	bio_wchan = wchan_create("bio");
+	if (bio_wchan == NULL) {
+		panic("bio: Could not create wait channel\n");
+	}
+}
+
+/*
+ * Fill in a request.
+ */
+void
+bio_init(struct bio *bio, daddr_t block, void *data, size_t len,
+	 enum uio_rw rw, void (*done)(struct bio *), void *arg)
+{
+	bio->bio_block = block;
+	bio->bio_data = data;
+	bio->bio_len = len;
+	bio->bio_rw = rw;
+	bio->bio_result = 0;
+	bio->bio_done = done;
+	bio->bio_arg = arg;
+	bio->bio_next = NULL;
+	bio->bio_chain = NULL;
+	bio->bio_deadline = 0;
+}
+
+/*
+ * Hand a request to a device. Devices that don't queue requests
+ * (no devop_strategy) are driven synchronously through devop_io, so
+ * callers don't have to care which kind they have.
+ */
+void
+bio_submit(struct device *d, struct bio *bio)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	if (d->d_ops->devop_strategy != NULL) {
+		DEVOP_STRATEGY(d, bio);
+		return;
+	}
+
+	uio_kinit(&iov, &ku, bio->bio_data, bio->bio_len,
+		  (off_t)bio->bio_block * d->d_blocksize, bio->bio_rw);
+	result = DEVOP_IO(d, &ku);
+	bio_finish(bio, result);
+}
+
+/*
+ * Complete a request.
+ */
+void
+bio_finish(struct bio *bio, int result)
+{
+	bio->bio_result = result;
+	if (bio->bio_done != NULL) {
+		/* The request may be gone once this returns */
+		bio->bio_done(bio);
+	}
+}
+
+/*
+ * Completion function for bio_io. bio_arg points at the flag the
+ * sleeper is watching.
+ */
+static
+void
+bio_wakeup(struct bio *bio)
+{
+	volatile bool *donep = bio->bio_arg;
+
+	spinlock_acquire(&bio_lock);
+	*donep = true;
+	wchan_wakeall(bio_wchan, &bio_lock);
+	spinlock_release(&bio_lock);
+}
+
+/*
+ * Do a request synchronously.
+ */
+int
+bio_io(struct device *d, daddr_t block, void *data, size_t len,
+       enum uio_rw rw)
+{
+	struct bio bio;
+	volatile bool done = false;
+
+	bio_init(&bio, block, data, len, rw, bio_wakeup, (void *)&done);
+	bio_submit(d, &bio);
+
+	spinlock_acquire(&bio_lock);
+	while (!done) {
+		wchan_sleep(bio_wchan, &bio_lock);
+	}
+	spinlock_release(&bio_lock);
+
+	return bio.bio_result;
+}
+
+////////////////////////////////////////////////////////////
+// Request queues and scheduling
+
+/*
+ * Scheduling policies.
+ *
+ * fifo issues requests in arrival order, merging a request only
+ * into the one queued just before it.
+ *
+ * clook (circular LOOK) keeps the queue sorted by block and sweeps
+ * upward from the last position issued, wrapping around to the
+ * lowest pending block when nothing is left above it. A request can
+ * merge into any queued request it directly follows. So nothing
+ * waits forever behind a stream of nearby requests, every request
+ * gets a deadline of BIOQ_DEADLINE dispatches after it arrives, and
+ * a request past its deadline is issued next regardless of where it
+ * is.
+ */
+struct biosched {
+	const char *bs_name;
+	void (*bs_insert)(struct bioqueue *bq, struct bio *bio);
+	struct bio *(*bs_remove)(struct bioqueue *bq);
+};
+
+/* Dispatches a request may be passed over for before it must go */
+#define BIOQ_DEADLINE    32
+
+/* Most requests to merge into one chain */
+#define BIOQ_MAXCHAIN    16
+
+/* All queues, for stats and policy changes */
+static struct bioqueue *bio_queues;
+
+/*
+ * Try to merge BIO behind the chain starting at HEAD. Returns true
+ * if it was merged.
+ */
+static
+bool
+bioq_trymerge(struct bioqueue *bq, struct bio *head, struct bio *bio)
+{
+	struct bio *last;
+	unsigned n;
+
+	if (bio->bio_chain != NULL || head->bio_rw != bio->bio_rw) {
+		return false;
+	}
+	for (last = head, n = 1; last->bio_chain != NULL;
+	     last = last->bio_chain, n++) {
+		/* nothing */
+	}
+	if (n >= BIOQ_MAXCHAIN) {
+		return false;
+	}
+	if (last->bio_block + last->bio_len / bq->bq_blocksize
+	    != bio->bio_block) {
+		return false;
+	}
+	last->bio_chain = bio;
+	bq->bq_merged++;
+	return true;
+}
+
+/*
+ * Unlink BIO, whose predecessor is PREV (NULL if it's first).
+ */
+static
+void
+bioq_unlink(struct bioqueue *bq, struct bio *prev, struct bio *bio)
+{
+	if (prev == NULL) {
+		bq->bq_head = bio->bio_next;
+	}
+	else {
+		prev->bio_next = bio->bio_next;
+	}
+	if (bq->bq_tail == bio) {
+		bq->bq_tail = prev;
+	}
+	bio->bio_next = NULL;
+	bq->bq_count--;
+}
+
+static
+void
+fifo_insert(struct bioqueue *bq, struct bio *bio)
+{
+	if (bq->bq_tail != NULL && bioq_trymerge(bq, bq->bq_tail, bio)) {
+		return;
+	}
+	bio->bio_next = NULL;
+	if (bq->bq_tail == NULL) {
+		bq->bq_head = bio;
+	}
+	else {
+		bq->bq_tail->bio_next = bio;
+	}
+	bq->bq_tail = bio;
+	bq->bq_count++;
+}
+
+static
+struct bio *
+fifo_remove(struct bioqueue *bq)
+{
+	struct bio *bio;
+
+	bio = bq->bq_head;
+	if (bio != NULL) {
+		bioq_unlink(bq, NULL, bio);
+	}
+	return bio;
+}
+
+static
+void
+clook_insert(struct bioqueue *bq, struct bio *bio)
+{
+	struct bio *prev, *cur;
+
+	/* Find the first request that sorts after this one */
+	prev = NULL;
+	for (cur = bq->bq_head; cur != NULL; cur = cur->bio_next) {
+		if (cur->bio_block > bio->bio_block) {
+			break;
+		}
+		prev = cur;
+	}
+
+	/* Merge into the one before it if we can */
+	if (prev != NULL && bioq_trymerge(bq, prev, bio)) {
+		return;
+	}
+
+	bio->bio_next = cur;
+	if (prev == NULL) {
+		bq->bq_head = bio;
+	}
+	else {
+		prev->bio_next = bio;
+	}
+	if (cur == NULL) {
+		bq->bq_tail = bio;
+	}
+	bq->bq_count++;
+}
+
+static
+struct bio *
+clook_remove(struct bioqueue *bq)
+{
+	struct bio *prev, *cur, *pick, *pickprev;
+
+	if (bq->bq_head == NULL) {
+		return NULL;
+	}
+
+	/*
+	 * First choice: the oldest request that's run out of time.
+	 * Deadlines are compared by difference so the dispatch count
+	 * can wrap.
+	 */
+	pick = pickprev = NULL;
+	prev = NULL;
+	for (cur = bq->bq_head; cur != NULL; cur = cur->bio_next) {
+		if ((int)(cur->bio_deadline - bq->bq_dispatched) <= 0 &&
+		    (pick == NULL ||
+		     (int)(cur->bio_deadline - pick->bio_deadline) < 0)) {
+			pick = cur;
+			pickprev = prev;
+		}
+		prev = cur;
+	}
+	if (pick != NULL) {
+		bq->bq_expired++;
+		bioq_unlink(bq, pickprev, pick);
+		return pick;
+	}
+
+	/* Otherwise, the next request at or above the head position */
+	prev = NULL;
+	for (cur = bq->bq_head; cur != NULL; cur = cur->bio_next) {
+		if (cur->bio_block >= bq->bq_headpos) {
+			bioq_unlink(bq, prev, cur);
+			return cur;
+		}
+		prev = cur;
+	}
+
+	/* Nothing above; wrap around to the lowest */
+	cur = bq->bq_head;
+	bioq_unlink(bq, NULL, cur);
+	return cur;
+}
+
+static const struct biosched bio_scheds[] = {
+	{ "fifo", fifo_insert, fifo_remove },
+	{ "clook", clook_insert, clook_remove },
+};
+
+/* Policy for new queues */
+#define BIOQ_DEFAULTSCHED (&bio_scheds[1])
+
+/*
+ * Set up a queue. NAME must stay valid as long as the queue does;
+ * LOCK is the driver's lock that protects it.
+ */
+void
+bioq_init(struct bioqueue *bq, const char *name,
+	  struct spinlock *lock, size_t blocksize)
+{
+	bq->bq_name = name;
+	bq->bq_lock = lock;
+	bq->bq_blocksize = blocksize;
+	bq->bq_sched = BIOQ_DEFAULTSCHED;
+	bq->bq_head = NULL;
+	bq->bq_tail = NULL;
+	bq->bq_count = 0;
+	bq->bq_headpos = 0;
+	bq->bq_dispatched = 0;
+	bq->bq_maxcount = 0;
+	bq->bq_merged = 0;
+	bq->bq_expired = 0;
+	bq->bq_seektotal = 0;
+	bq->bq_seekmax = 0;
+
+	spinlock_acquire(&bio_lock);
+	bq->bq_nextq = bio_queues;
+	bio_queues = bq;
+	spinlock_release(&bio_lock);
+}
+
+void
+bioq_insert(struct bioqueue *bq, struct bio *bio)
+{
+	KASSERT(spinlock_do_i_hold(bq->bq_lock));
+
+	bio->bio_next = NULL;
+	bio->bio_deadline = bq->bq_dispatched + BIOQ_DEADLINE;
+	bq->bq_sched->bs_insert(bq, bio);
+	if (bq->bq_count > bq->bq_maxcount) {
+		bq->bq_maxcount = bq->bq_count;
+	}
+}
+
+/*
+ * Take the next chain to issue and account for the seek to it.
+ */
+struct bio *
+bioq_remove(struct bioqueue *bq)
+{
+	struct bio *bio, *last;
+	daddr_t seek;
+
+	KASSERT(spinlock_do_i_hold(bq->bq_lock));
+
+	bio = bq->bq_sched->bs_remove(bq);
+	if (bio == NULL) {
+		return NULL;
+	}
+
+	seek = bio->bio_block >= bq->bq_headpos ?
+		bio->bio_block - bq->bq_headpos :
+		bq->bq_headpos - bio->bio_block;
+	bq->bq_seektotal += seek;
+	if (seek > bq->bq_seekmax) {
+		bq->bq_seekmax = seek;
+	}
+
+	for (last = bio; last->bio_chain != NULL; last = last->bio_chain) {
+		/* nothing */
+	}
+	bq->bq_headpos = last->bio_block + last->bio_len / bq->bq_blocksize;
+	bq->bq_dispatched++;
+	return bio;
+}
+
+bool
+bioq_isempty(struct bioqueue *bq)
+{
+	return bq->bq_head == NULL;
+}
+
+/*
+ * Find a queue by device name.
+ */
+static
+struct bioqueue *
+bio_findqueue(const char *devname)
+{
+	struct bioqueue *bq;
+
+	spinlock_acquire(&bio_lock);
+	for (bq = bio_queues; bq != NULL; bq = bq->bq_nextq) {
+		if (!strcmp(bq->bq_name, devname)) {
+			break;
+		}
+	}
+	spinlock_release(&bio_lock);
+	return bq;
+}
+
+/*
+ * Switch a queue to another policy, re-sorting whatever is pending.
+ */
+int
+bio_setsched(const char *devname, const char *policy)
+{
+	const struct biosched *sched;
+	struct bioqueue *bq;
+	struct bio *pending, *bio;
+	unsigned i;
+
+	sched = NULL;
+	for (i=0; i<ARRAYCOUNT(bio_scheds); i++) {
+		if (!strcmp(bio_scheds[i].bs_name, policy)) {
+			sched = &bio_scheds[i];
+		}
+	}
+	if (sched == NULL) {
+		return EINVAL;
+	}
+
+	bq = bio_findqueue(devname);
+	if (bq == NULL) {
+		return ENODEV;
+	}
+
+	spinlock_acquire(bq->bq_lock);
+	pending = bq->bq_head;
+	bq->bq_head = bq->bq_tail = NULL;
+	bq->bq_count = 0;
+	bq->bq_sched = sched;
+	while (pending != NULL) {
+		bio = pending;
+		pending = bio->bio_next;
+		bio->bio_next = NULL;
+		bq->bq_sched->bs_insert(bq, bio);
+	}
+	spinlock_release(bq->bq_lock);
+	return 0;
+}
+
+/*
+ * Print statistics for all queues. These are read without the
+ * queue locks, so they may be slightly out of date.
+ */
+void
+bio_printstats(void)
+{
+	struct bioqueue *bq;
+	uint64_t avgseek;
+
+	kprintf("device   policy  issued  merged expired depth maxdepth "
+		"avgseek maxseek\n");
+	for (bq = bio_queues; bq != NULL; bq = bq->bq_nextq) {
+		avgseek = bq->bq_dispatched > 0 ?
+			bq->bq_seektotal / bq->bq_dispatched : 0;
+		kprintf("%-8s %-6s %7u %7u %7u %5u %8u %7llu %7u\n",
+			bq->bq_name, bq->bq_sched->bs_name,
+			bq->bq_dispatched, bq->bq_merged, bq->bq_expired,
+			bq->bq_count, bq->bq_maxcount,
+			(unsigned long long)avgseek,
+			(unsigned)bq->bq_seekmax);
+	}
+}
@@ -0,0 +1,444 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Pipes: a single-page ring buffer shared by two vnodes.
+ *
+ * Readers serialize among themselves on pi_rlock and writers on
+ * pi_wlock, so at any time one reader and one writer work on the
+ * ring and copy data with uiomove without holding anything else. The
+ * spinlock pi_lock covers only the ring indices, the closed flags and
+ * the sleep/wakeup protocol; it is held for a few instructions per
+ * call, never across a copy.
+ *
+ * pi_head and pi_tail count bytes written and read since creation and
+ * are allowed to wrap; head - tail is the amount buffered. Wakeups are
+ * batched: each side wakes the other at most once per chunk moved,
+ * and only if the other side is actually asleep.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <wchan.h>
+#include <stat.h>
+#include <uio.h>
+#include <vm.h>
+#include <vnode.h>
+#include <pipe.h>
+
+#define PIPE_SIZE	PAGE_SIZE
+
+struct pipe {
+	char *pi_buf;			/* PIPE_SIZE bytes */
+	unsigned pi_head;		/* bytes ever written */
+	unsigned pi_tail;		/* bytes ever read */
+
+	struct spinlock pi_lock;	/* protects everything below */
+	bool pi_rclosed;		/* read end is gone */
+	bool pi_wclosed;		/* write end is gone */
+	bool pi_rwaiting;		/* a reader is asleep on pi_rwchan */
+	bool pi_wwaiting;		/* a writer is asleep on pi_wwchan */
+	struct wchan *pi_rwchan;
+	struct wchan *pi_wwchan;
+
+	struct lock *pi_rlock;		/* one reader at a time */
+	struct lock *pi_wlock;		/* one writer at a time */
+
+	struct vnode pi_rvnode;		/* read end */
+	struct vnode pi_wvnode;		/* write end */
+};
+
+static const struct vnode_ops pipe_rvnode_ops;
+static const struct vnode_ops pipe_wvnode_ops;
+
+static
+struct pipe *
+pipe_fromvnode(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+
+	KASSERT(v == &p->pi_rvnode || v == &p->pi_wvnode);
+	return p;
+}
+
+static
+void
+pipe_destroy(struct pipe *p)
+{
+	vnode_cleanup(&p->pi_rvnode);
+	vnode_cleanup(&p->pi_wvnode);
+	lock_destroy(p->pi_wlock);
+	lock_destroy(p->pi_rlock);
+	wchan_destroy(p->pi_wwchan);
+	wchan_destroy(p->pi_rwchan);
+	spinlock_cleanup(&p->pi_lock);
+	kfree(p->pi_buf);
+	kfree(p);
+}
+
+/*
+ * Called when the last reference to one end goes away. Wake anyone
+ * on the other end so they notice, and free the pipe with the second
+ * end.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *p = pipe_fromvnode(v);
+	bool both;
+
+	spinlock_acquire(&p->pi_lock);
+	if (v == &p->pi_rvnode) {
+		p->pi_rclosed = true;
+		wchan_wakeall(p->pi_wwchan, &p->pi_lock);
+	}
+	else {
+		p->pi_wclosed = true;
+		wchan_wakeall(p->pi_rwchan, &p->pi_lock);
+	}
+	both = p->pi_rclosed && p->pi_wclosed;
+	spinlock_release(&p->pi_lock);
+
+	if (both) {
+		pipe_destroy(p);
+	}
+	return 0;
+}
+
+/*
+ * Copy up to len bytes between the ring at position pos and the uio,
+ * in at most two pieces if the range wraps.
+ */
+static
+int
+pipe_move(struct pipe *p, unsigned pos, size_t len, struct uio *uio)
+{
+	size_t off, first;
+	int result;
+
+	off = pos % PIPE_SIZE;
+	first = len < PIPE_SIZE - off ? len : PIPE_SIZE - off;
+	result = uiomove(p->pi_buf + off, first, uio);
+	if (result == 0 && first < len) {
+		result = uiomove(p->pi_buf, len - first, uio);
+	}
+	return result;
+}
+
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = pipe_fromvnode(v);
+	size_t avail, len, before;
+	int result;
+
+	KASSERT(v == &p->pi_rvnode);
+	KASSERT(uio->uio_rw == UIO_READ);
+	if (uio->uio_resid == 0) {
+		return 0;
+	}
+
+	lock_acquire(p->pi_rlock);
+
+	/* Wait for data, or for EOF. */
+	spinlock_acquire(&p->pi_lock);
+	while (p->pi_head == p->pi_tail && !p->pi_wclosed) {
+		p->pi_rwaiting = true;
+		wchan_sleep(p->pi_rwchan, &p->pi_lock);
+	}
+	avail = p->pi_head - p->pi_tail;
+	spinlock_release(&p->pi_lock);
+
+	/* Only the writer touches the free part, so copy unlocked. */
+	len = avail < uio->uio_resid ? avail : uio->uio_resid;
+	before = uio->uio_resid;
+	result = pipe_move(p, p->pi_tail, len, uio);
+	len = before - uio->uio_resid;
+
+	spinlock_acquire(&p->pi_lock);
+	p->pi_tail += len;
+	if (len > 0 && p->pi_wwaiting) {
+		p->pi_wwaiting = false;
+		wchan_wakeall(p->pi_wwchan, &p->pi_lock);
+	}
+	spinlock_release(&p->pi_lock);
+
+	lock_release(p->pi_rlock);
+	return result;
+}
+
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = pipe_fromvnode(v);
+	size_t room, len, before, start;
+	int result = 0;
+
+	KASSERT(v == &p->pi_wvnode);
+	KASSERT(uio->uio_rw == UIO_WRITE);
+
+	/* Holding pi_wlock for the whole write keeps it in one piece. */
+	lock_acquire(p->pi_wlock);
+
+	start = uio->uio_resid;
+	while (uio->uio_resid > 0) {
+		/* Wait for room, or for the reader to go away. */
+		spinlock_acquire(&p->pi_lock);
+		while (p->pi_head - p->pi_tail == PIPE_SIZE &&
+		       !p->pi_rclosed) {
+			p->pi_wwaiting = true;
+			wchan_sleep(p->pi_wwchan, &p->pi_lock);
+		}
+		if (p->pi_rclosed) {
+			spinlock_release(&p->pi_lock);
+			/*
+			 * A short write if some of it got through; the
+			 * caller sees EPIPE on its next try.
+			 */
+			if (uio->uio_resid == start) {
+				result = EPIPE;
+			}
+			break;
+		}
+		room = PIPE_SIZE - (p->pi_head - p->pi_tail);
+		spinlock_release(&p->pi_lock);
+
+		len = room < uio->uio_resid ? room : uio->uio_resid;
+		before = uio->uio_resid;
+		result = pipe_move(p, p->pi_head, len, uio);
+		len = before - uio->uio_resid;
+
+		spinlock_acquire(&p->pi_lock);
+		p->pi_head += len;
+		if (len > 0 && p->pi_rwaiting) {
+			p->pi_rwaiting = false;
+			wchan_wakeall(p->pi_rwchan, &p->pi_lock);
+		}
+		spinlock_release(&p->pi_lock);
+
+		if (result) {
+			break;
+		}
+	}
+
+	lock_release(p->pi_wlock);
+	return result;
+}
+
+/*
+ * Called for stat(). The size is the amount currently buffered.
+ */
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *p = pipe_fromvnode(v);
+
+	bzero(statbuf, sizeof(struct stat));
+
+	spinlock_acquire(&p->pi_lock);
+	statbuf->st_size = p->pi_head - p->pi_tail;
+	spinlock_release(&p->pi_lock);
+
+	statbuf->st_mode = S_IFIFO | 0600;
+	statbuf->st_nlink = 1;
+	statbuf->st_blksize = PIPE_SIZE;
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+static
+bool
+pipe_isseekable(struct vnode *v)
+{
+	(void)v;
+	return false;
+}
+
+/*
+ * Pipes are never opened by name, and have nothing to sync, truncate
+ * or name.
+ */
+static
+int
+pipe_eachopen(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+	return EINVAL;
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EIOCTL;
+}
+
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return EINVAL;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+static
+int
+pipe_namefile(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return EINVAL;
+}
+
+#define PIPE_VNODE_OPS(rd, wr) {				\
+	.vop_magic = VOP_MAGIC,					\
+								\
+	.vop_eachopen = pipe_eachopen,				\
+	.vop_reclaim = pipe_reclaim,				\
+	.vop_read = rd,						\
+	.vop_readlink = vopfail_uio_inval,			\
+	.vop_getdirentry = vopfail_uio_notdir,			\
+	.vop_write = wr,					\
+	.vop_ioctl = pipe_ioctl,				\
+	.vop_stat = pipe_stat,					\
+	.vop_gettype = pipe_gettype,				\
+	.vop_isseekable = pipe_isseekable,			\
+	.vop_fsync = pipe_fsync,				\
+	.vop_mmap = vopfail_mmap_nosys,				\
+	.vop_truncate = pipe_truncate,				\
+	.vop_namefile = pipe_namefile,				\
+	.vop_creat = vopfail_creat_notdir,			\
+	.vop_symlink = vopfail_symlink_notdir,			\
+	.vop_mkdir = vopfail_mkdir_notdir,			\
+	.vop_link = vopfail_link_notdir,			\
+	.vop_remove = vopfail_string_notdir,			\
+	.vop_rmdir = vopfail_string_notdir,			\
+	.vop_rename = vopfail_rename_notdir,			\
+	.vop_lookup = vopfail_lookup_notdir,			\
+	.vop_lookparent = vopfail_lookparent_notdir,		\
+}
+
+/* Each end gets only its own direction; the other one fails. */
+static const struct vnode_ops pipe_rvnode_ops =
+	PIPE_VNODE_OPS(pipe_read, vopfail_uio_inval);
+static const struct vnode_ops pipe_wvnode_ops =
+	PIPE_VNODE_OPS(vopfail_uio_inval, pipe_write);
+
+int
+pipe_create(struct vnode **rd, struct vnode **wr)
+{
+	struct pipe *p;
+	int result;
+
+	p = kmalloc(sizeof(*p));
+	if (p == NULL) {
+		return ENOMEM;
+	}
+	p->pi_buf = kmalloc(PIPE_SIZE);
+	if (p->pi_buf == NULL) {
+		goto fail_pipe;
+	}
+	p->pi_head = p->pi_tail = 0;
+
+	spinlock_init(&p->pi_lock);
+	p->pi_rclosed = p->pi_wclosed = false;
+	p->pi_rwaiting = p->pi_wwaiting = false;
+	p->pi_rwchan = wchan_create("pipe read");
+	if (p->pi_rwchan == NULL) {
+		goto fail_buf;
+	}
+	p->pi_wwchan = wchan_create("pipe write");
+	if (p->pi_wwchan == NULL) {
+		goto fail_rwchan;
+	}
+	p->pi_rlock = lock_create("pipe reader");
+	if (p->pi_rlock == NULL) {
+		goto fail_wwchan;
+	}
+	p->pi_wlock = lock_create("pipe writer");
+	if (p->pi_wlock == NULL) {
+		goto fail_rlock;
+	}
+
+	result = vnode_init(&p->pi_rvnode, &pipe_rvnode_ops, NULL, p);
+	if (result) {
+		goto fail_wlock;
+	}
+	result = vnode_init(&p->pi_wvnode, &pipe_wvnode_ops, NULL, p);
+	if (result) {
+		vnode_cleanup(&p->pi_rvnode);
+		goto fail_wlock;
+	}
+
+	*rd = &p->pi_rvnode;
+	*wr = &p->pi_wvnode;
+	return 0;
+
+ fail_wlock:
+	lock_destroy(p->pi_wlock);
+ fail_rlock:
+	lock_destroy(p->pi_rlock);
+ fail_wwchan:
+	wchan_destroy(p->pi_wwchan);
+ fail_rwchan:
+	wchan_destroy(p->pi_rwchan);
+ fail_buf:
+	spinlock_cleanup(&p->pi_lock);
+	kfree(p->pi_buf);
+ fail_pipe:
+	kfree(p);
+	return ENOMEM;
+}
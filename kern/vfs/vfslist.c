@@ -43,6 +43,7 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <bio.h>
 
 /*
  * Structure for a single named device.
@@ -112,6 +113,7 @@ vfs_bootstrap(void)
 	}
 	vfs_biglock_depth = 0;
 
+	bio_bootstrap();
 	devnull_create();
 	semfs_bootstrap();
 }
@@ -36,6 +36,9 @@
 #include <kern/fcntl.h>
 #include <limits.h>
 #include <lib.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <current.h>
 #include <vfs.h>
 #include <vnode.h>
 
@@ -93,6 +96,12 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 		return result;
 	}
 
+	/* Don't let anyone change a program that is running */
+	if (canwrite && vnode_textbusy(vn)) {
+		VOP_DECREF(vn);
+		return ETXTBSY;
+	}
+
 	if (openflags & O_TRUNC) {
 		if (canwrite==0) {
 			result = EINVAL;
@@ -314,3 +323,70 @@ vfs_rmdir(char *path)
 	return result;
 }
 
+
+/*
+ * Pathname buffers. open, chdir, and friends each need a PATH_MAX
+ * buffer for the duration of the call. Each thread gets one of its
+ * own the first time it asks, and keeps it; that needs no locking.
+ * Should a thread need a second one at once, it comes from a small
+ * pool, and only if that's used up from kmalloc.
+ */
+#define NPATHBUFS 8
+
+static char pathbufs[NPATHBUFS][PATH_MAX];
+static uint32_t pathbufs_busy;		/* bit i set if pathbufs[i] is out */
+static struct spinlock pathbufs_lock = SPINLOCK_INITIALIZER;
+
+char *
+pathbuf_get(void)
+{
+	struct thread *cur = curthread;
+	unsigned i;
+
+	if (!cur->t_pathbuf_busy) {
+		if (cur->t_pathbuf == NULL) {
+			cur->t_pathbuf = kmalloc(PATH_MAX);
+		}
+		if (cur->t_pathbuf != NULL) {
+			cur->t_pathbuf_busy = true;
+			return cur->t_pathbuf;
+		}
+	}
+
+	spinlock_acquire(&pathbufs_lock);
+	for (i=0; i<NPATHBUFS; i++) {
+		if ((pathbufs_busy & ((uint32_t)1 << i)) == 0) {
+			pathbufs_busy |= (uint32_t)1 << i;
+			spinlock_release(&pathbufs_lock);
+			return pathbufs[i];
+		}
+	}
+	spinlock_release(&pathbufs_lock);
+
+	return kmalloc(PATH_MAX);
+}
+
+void
+pathbuf_put(char *buf)
+{
+	unsigned i;
+
+	if (buf == curthread->t_pathbuf) {
+		KASSERT(curthread->t_pathbuf_busy);
+		curthread->t_pathbuf_busy = false;
+		return;
+	}
+
+	if (buf < pathbufs[0] || buf >= pathbufs[NPATHBUFS]) {
+		kfree(buf);
+		return;
+	}
+
+	i = (buf - pathbufs[0]) / PATH_MAX;
+	KASSERT(buf == pathbufs[i]);
+
+	spinlock_acquire(&pathbufs_lock);
+	KASSERT(pathbufs_busy & ((uint32_t)1 << i));
+	pathbufs_busy &= ~((uint32_t)1 << i);
+	spinlock_release(&pathbufs_lock);
+}
@@ -49,6 +49,7 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 
 	vn->vn_ops = ops;
 	vn->vn_refcount = 1;
+	vn->vn_textcount = 0;
 	spinlock_init(&vn->vn_countlock);
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
@@ -62,6 +63,7 @@ void
 vnode_cleanup(struct vnode *vn)
 {
 	KASSERT(vn->vn_refcount == 1);
+	KASSERT(vn->vn_textcount == 0);
 
 	spinlock_cleanup(&vn->vn_countlock);
 
@@ -122,6 +124,44 @@ vnode_decref(struct vnode *vn)
 	}
 }
 
+/*
+ * Count a program image reading from the file. The image holds a
+ * reference of its own, so the vnode stays put.
+ */
+void
+vnode_textref(struct vnode *vn)
+{
+	spinlock_acquire(&vn->vn_countlock);
+	vn->vn_textcount++;
+	spinlock_release(&vn->vn_countlock);
+}
+
+/*
+ * Drop the count from vnode_textref.
+ */
+void
+vnode_textunref(struct vnode *vn)
+{
+	spinlock_acquire(&vn->vn_countlock);
+	KASSERT(vn->vn_textcount > 0);
+	vn->vn_textcount--;
+	spinlock_release(&vn->vn_countlock);
+}
+
+/*
+ * Check if any program image is reading from the file.
+ */
+bool
+vnode_textbusy(struct vnode *vn)
+{
+	bool busy;
+
+	spinlock_acquire(&vn->vn_countlock);
+	busy = vn->vn_textcount > 0;
+	spinlock_release(&vn->vn_countlock);
+	return busy;
+}
+
 /*
  * Check for various things being valid.
  * Called before all VOP_* calls.
@@ -119,7 +119,9 @@ as_deactivate(void)
 /*
  * Set up a segment at virtual address VADDR of size MEMSIZE. The
  * segment in memory extends from VADDR up to (but not including)
- * VADDR+MEMSIZE.
+ * VADDR+MEMSIZE. If V is not NULL the first FILESZ bytes of it are
+ * found in V at offset OFFSET and should be read in when touched;
+ * the rest is zero-filled.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
  * write, or execute permission should be set on the segment. At the
@@ -128,6 +130,7 @@ as_deactivate(void)
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
+		 struct vnode *v, off_t offset, size_t filesz,
 		 int readable, int writeable, int executable)
 {
 	/*
@@ -137,6 +140,9 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 	(void)as;
 	(void)vaddr;
 	(void)memsize;
+	(void)v;
+	(void)offset;
+	(void)filesz;
 	(void)readable;
 	(void)writeable;
 	(void)executable;
@@ -214,6 +214,13 @@ copyout(const void *src, userptr_t userdest, size_t len)
 	return 0;
 }
 
+/*
+ * Nonzero if any byte of the word X is zero. (Subtracting 1 from each
+ * byte borrows out of the top bit only for a byte that was 0, and the
+ * ~X term discards bytes whose top bit was already set.)
+ */
+#define HASZERO(x) (((x) - 0x01010101U) & ~(x) & 0x80808080U)
+
 /*
  * Common string copying function that behaves the way that's desired
  * for copyinstr and copyoutstr.
@@ -235,9 +242,41 @@ int
 copystr(char *dest, const char *src, size_t maxlen, size_t stoplen,
 	size_t *gotlen)
 {
-	size_t i;
+	size_t i, limit;
+	uint32_t w;
+
+	limit = maxlen < stoplen ? maxlen : stoplen;
+
+	/*
+	 * Copy a word at a time while there's no null in it. The source
+	 * is aligned first, so a word never crosses a page boundary and
+	 * can't fault unless the first byte of it would. The destination
+	 * may still be unaligned, in which case memcpy does the store.
+	 */
+	for (i=0; i<limit && ((uintptr_t)(src + i) & 3) != 0; i++) {
+		dest[i] = src[i];
+		if (src[i] == 0) {
+			if (gotlen != NULL) {
+				*gotlen = i+1;
+			}
+			return 0;
+		}
+	}
+	for (; i + 4 <= limit; i += 4) {
+		w = *(const uint32_t *)(src + i);
+		if (HASZERO(w)) {
+			break;
+		}
+		if (((uintptr_t)(dest + i) & 3) == 0) {
+			*(uint32_t *)(dest + i) = w;
+		}
+		else {
+			memcpy(dest + i, &w, 4);
+		}
+	}
 
-	for (i=0; i<maxlen && i<stoplen; i++) {
+	/* Finish, including the word with the null in it, bytewise. */
+	for (; i<maxlen && i<stoplen; i++) {
 		dest[i] = src[i];
 		if (src[i] == 0) {
 			if (gotlen != NULL) {
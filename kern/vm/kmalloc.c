@@ -30,7 +30,11 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
 #include <vm.h>
+#include <kmemcache.h>
 #include <kern/test161.h>
 #include <test.h>
 
@@ -80,6 +84,14 @@ fill_deadbeef(void *vptr, size_t len)
 //    cannot recursively use the subpage allocator. (We could probably
 //    make that work, but it would be painful.)
 //
+//    Blocks of 3K are handled the same way, except that their "page"
+//    is a slab of three contiguous pages holding four of them. Blocks
+//    of 4K and 8K are simply whole pages, with no pageref; the point
+//    of having those sizes is that they go through the per-CPU
+//    magazines like everything else, so big allocations that come and
+//    go often, like thread stacks, are recycled instead of going to
+//    alloc_kpages and free_kpages every time.
+//
 
 ////////////////////////////////////////
 
@@ -127,11 +139,19 @@ fill_deadbeef(void *vptr, size_t len)
 
 #if PAGE_SIZE == 4096
 
-#define NSIZES 8
-static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
+#define NSIZES 11
+static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048,
+				      3072, 4096, 8192 };
+
+/*
+ * Pages in the slab for each size: four 3K blocks go in 12K. A size
+ * with one block per slab is a "big block", which needs no pageref.
+ */
+static const unsigned slabpages[NSIZES] = { 1, 1, 1, 1, 1, 1, 1, 1,
+					    3, 1, 2 };
 
 #define SMALLEST_SUBPAGE_SIZE 16
-#define LARGEST_SUBPAGE_SIZE 2048
+#define LARGEST_SUBPAGE_SIZE 8192
 
 #elif PAGE_SIZE == 8192
 #error "No support for 8k pages (yet?)"
@@ -139,6 +159,17 @@ static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
 #error "Odd page size"
 #endif
 
+#define SLABSIZE(blktype) (slabpages[blktype] * PAGE_SIZE)
+#define SLABBLOCKS(blktype) (SLABSIZE(blktype) / sizes[blktype])
+#define ISBIG(blktype) (SLABBLOCKS(blktype) == 1)
+
+/*
+ * Wholly free slabs of each size kept back rather than released, so
+ * that a size that is allocated and freed one at a time (most of the
+ * big ones) doesn't get and release a slab on every call.
+ */
+#define KEEP_EMPTY 1
+
 ////////////////////////////////////////
 
 struct freelist {
@@ -162,16 +193,81 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * One spinlock covers the pages and their bookkeeping. Most
+ * allocations and frees don't take it, though: they are served from
+ * per-CPU magazines (see below), and only go to the pages, a batch at
+ * a time, when a magazine runs empty or overflows.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
 
 ////////////////////////////////////////
 
+/*
+ * Per-CPU magazines.
+ *
+ * Each CPU keeps, for each block size, a small stack ("magazine") of
+ * free blocks it can hand out and take back without touching
+ * kmalloc_spinlock. A magazine has its own spinlock, which normally
+ * only its own CPU takes; it's there so kheap_getused can empty
+ * everyone's magazines, and so a thread that moves to another CPU
+ * between looking up curcpu and using the magazine does no harm.
+ *
+ * Small blocks get deep magazines and big ones shallow ones (see
+ * mag_capacity) so an idle CPU doesn't sit on much memory. Blocks in
+ * a magazine count as allocated as far as the pages are concerned.
+ */
+
+#define MAGSIZE 16
+
+struct kmagazine {
+	unsigned km_count;		/* Blocks in km_rounds[] */
+	unsigned km_hits;		/* Allocations served from here */
+	unsigned km_misses;		/* Allocations that had to refill */
+	unsigned km_spills;		/* Frees that found it full */
+	void *km_rounds[MAGSIZE];
+};
+
+struct kmalloc_cpu {
+	struct spinlock kc_lock;
+	unsigned kc_number;
+	struct kmalloc_cpu *kc_next;
+	struct kmagazine kc_mags[NSIZES];
+};
+
+/*
+ * Every CPU's magazines, for draining and printing. CPUs are only
+ * created during boot, one at a time, so the list needs no lock.
+ */
+static struct kmalloc_cpu *kmalloc_cpus;
+static unsigned kmalloc_ncpus;
+
+/*
+ * Number of blocks of type BLKTYPE a magazine may hold (about a page's
+ * worth, but at least two), and how many move between a magazine and
+ * the pages at a time.
+ */
+static
+unsigned
+mag_capacity(unsigned blktype)
+{
+	unsigned n = PAGE_SIZE / sizes[blktype];
+
+	if (n < 2) {
+		return 2;
+	}
+	return n < MAGSIZE ? n : MAGSIZE;
+}
+
+static
+unsigned
+mag_batch(unsigned blktype)
+{
+	return (mag_capacity(blktype) + 1) / 2;
+}
+
+////////////////////////////////////////
+
 /*
  * We can only allocate whole pages of pageref structure at a time.
  * This is a struct type for such a page.
@@ -338,15 +434,97 @@ freepageref(struct pageref *p)
 	KASSERT(0);
 }
 
+/*
+ * Return the index of a pageref among all of them.
+ */
+static
+unsigned
+pageref_number(struct pageref *p)
+{
+	unsigned whichroot;
+	size_t j;
+
+	for (whichroot=0; whichroot < NUM_PAGEREFPAGES; whichroot++) {
+		if (kheaproots[whichroot].page == NULL) {
+			continue;
+		}
+		j = p - kheaproots[whichroot].page->refs;
+		if (j < NPAGEREFS_PER_PAGE) {
+			return whichroot * NPAGEREFS_PER_PAGE + j;
+		}
+	}
+	/* pageref wasn't on any of the pages */
+	KASSERT(0);
+	return 0;
+}
+
 ////////////////////////////////////////
 
 /*
- * Each pageref is on two linked lists: one list of pages of blocks of
- * that same size, and one of all blocks.
+ * Each heap page's pageref is on the list of all heap pages; if it
+ * has any free blocks, it's also on the list of partial pages of
+ * blocks of that same size, so the first page there always has a
+ * block to give out.
  */
 static struct pageref *sizebases[NSIZES];
 static struct pageref *allbase;
 
+/* Number of wholly free slabs on each of the partial lists. */
+static unsigned nempty[NSIZES];
+
+/*
+ * Map from physical page number to pageref, so kfree can find a
+ * block's page without searching. Entries hold pageref_number() + 1,
+ * or PAGEMAP_BIG + the block type on the first page of a big block,
+ * or 0 for pages that aren't heap pages. Like the pageref table, this
+ * is sized for System/161's 16M RAM limit.
+ */
+#define KHEAP_MAXPAGES (16*1024*1024 / PAGE_SIZE)
+#define KHEAP_PAGENUM(va) (KVADDR_TO_PADDR(va) / PAGE_SIZE)
+#define PAGEMAP_BIG 0xff00
+
+static uint16_t kheap_pagemap[KHEAP_MAXPAGES];
+
+/*
+ * Find the pageref for the heap page holding ADDR, or NULL.
+ */
+static
+struct pageref *
+pageref_lookup(vaddr_t addr)
+{
+	vaddr_t pagenum;
+	unsigned n;
+	struct pagerefpage *page;
+
+	pagenum = KHEAP_PAGENUM(addr);
+	if (pagenum >= KHEAP_MAXPAGES || kheap_pagemap[pagenum] == 0 ||
+	    kheap_pagemap[pagenum] >= PAGEMAP_BIG) {
+		return NULL;
+	}
+	n = kheap_pagemap[pagenum] - 1;
+	page = kheaproots[n / NPAGEREFS_PER_PAGE].page;
+	KASSERT(page != NULL);
+	return &page->refs[n % NPAGEREFS_PER_PAGE];
+}
+
+/*
+ * If ADDR is the start of a big block, return its block type;
+ * otherwise -1.
+ */
+static
+int
+bigblock_lookup(vaddr_t addr)
+{
+	vaddr_t pagenum;
+
+	pagenum = KHEAP_PAGENUM(addr);
+	if (addr % PAGE_SIZE != 0 || pagenum >= KHEAP_MAXPAGES ||
+	    kheap_pagemap[pagenum] < PAGEMAP_BIG) {
+		return -1;
+	}
+	return kheap_pagemap[pagenum] - PAGEMAP_BIG;
+}
+
 ////////////////////////////////////////
 
 #ifdef GUARDS
@@ -533,7 +711,7 @@ checksubpage(struct pageref *pr)
 	KASSERT(prpage < MIPS_KSEG1);
 #endif
 
-	KASSERT(pr->freelist_offset < PAGE_SIZE);
+	KASSERT(pr->freelist_offset < SLABSIZE(blktype));
 	KASSERT(pr->freelist_offset % blocksize == 0);
 
 	fla = prpage + pr->freelist_offset;
@@ -541,7 +719,7 @@ checksubpage(struct pageref *pr)
 
 	for (; fl != NULL; fl = fl->next) {
 		fla = (vaddr_t)fl;
-		KASSERT(fla >= prpage && fla < prpage + PAGE_SIZE);
+		KASSERT(fla >= prpage && fla < prpage + SLABSIZE(blktype));
 		KASSERT((fla-prpage) % blocksize == 0);
 #ifdef CHECKBEEF
 		checkdeadbeef(fl, blocksize);
@@ -558,7 +736,7 @@ checksubpage(struct pageref *pr)
 	KASSERT(nfree==pr->nfree);
 
 #ifdef CHECKGUARDS
-	numblocks = PAGE_SIZE / blocksize;
+	numblocks = SLABBLOCKS(blktype);
 	for (i=0; i<numblocks; i++) {
 		mask = 1U << (i % 32);
 		if ((isfree[i / 32] & mask) == 0) {
@@ -588,19 +766,30 @@ checksubpages(void)
 	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
 	for (i=0; i<NSIZES; i++) {
+		unsigned ec = 0;
+
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
+			KASSERT(pr->nfree > 0);
 			KASSERT(sc < TOTAL_PAGEREFS);
 			sc++;
+			if (pr->nfree == SLABBLOCKS(i)) {
+				ec++;
+			}
 		}
+		KASSERT(ec == nempty[i]);
 	}
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		checksubpage(pr);
+		KASSERT(pageref_lookup(PR_PAGEADDR(pr)) == pr);
 		KASSERT(ac < TOTAL_PAGEREFS);
-		ac++;
+		if (pr->nfree > 0) {
+			ac++;
+		}
 	}
 
+	/* the partial lists hold exactly the pages with free blocks */
 	KASSERT(sc==ac);
 }
 #else
@@ -642,7 +831,7 @@ void
 dump_subpage(struct pageref *pr, unsigned generation)
 {
 	unsigned blocksize = sizes[PR_BLOCKTYPE(pr)];
-	unsigned numblocks = PAGE_SIZE / blocksize;
+	unsigned numblocks = SLABBLOCKS(PR_BLOCKTYPE(pr));
 	unsigned numfreewords = DIVROUNDUP(numblocks, 32);
 	uint32_t isfree[numfreewords], mask;
 	vaddr_t prpage;
@@ -656,7 +845,10 @@ dump_subpage(struct pageref *pr, unsigned generation)
 	}
 
 	prpage = PR_PAGEADDR(pr);
-	fl = (struct freelist *)(prpage + pr->freelist_offset);
+	fl = NULL;
+	if (pr->freelist_offset != INVALID_OFFSET) {
+		fl = (struct freelist *)(prpage + pr->freelist_offset);
+	}
 	for (; fl != NULL; fl = fl->next) {
 		i = ((vaddr_t)fl - prpage) / blocksize;
 		mask = 1U << (i % 32);
@@ -683,13 +875,10 @@ void
 dump_subpages(unsigned generation)
 {
 	struct pageref *pr;
-	int i;
 
 	kprintf("Remaining allocations from generation %u:\n", generation);
-	for (i=0; i<NSIZES; i++) {
-		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
-			dump_subpage(pr, generation);
-		}
+	for (pr = allbase; pr != NULL; pr = pr->next_all) {
+		dump_subpage(pr, generation);
 	}
 }
 
@@ -767,7 +956,7 @@ subpage_stats(struct pageref *pr, bool quiet)
 	KASSERT(blktype >= 0 && blktype < NSIZES);
 
 	/* compute how many bits we need in freemap and assert we fit */
-	n = PAGE_SIZE / sizes[blktype];
+	n = SLABBLOCKS(blktype);
 	KASSERT(n <= 32 * ARRAYCOUNT(freemap));
 
 	if (pr->freelist_offset != INVALID_OFFSET) {
@@ -800,12 +989,29 @@ subpage_stats(struct pageref *pr, bool quiet)
 }
 
 /*
- * Print the whole heap.
+ * Compute PART as a percentage of WHOLE without overflowing.
+ */
+static
+unsigned
+percent(unsigned part, unsigned whole)
+{
+	while (part > 0xffffffffU / 100) {
+		part >>= 1;
+		whole >>= 1;
+	}
+	return whole == 0 ? 0 : part * 100 / whole;
+}
+
+/*
+ * Print the whole heap, and how well each CPU's magazines are doing.
  */
 void
 kheap_printstats(void)
 {
 	struct pageref *pr;
+	struct kmalloc_cpu *kc;
+	struct kmagazine *km;
+	unsigned i;
 
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
@@ -817,8 +1023,29 @@ kheap_printstats(void)
 	}
 
 	spinlock_release(&kmalloc_spinlock);
+
+	for (kc = kmalloc_cpus; kc != NULL; kc = kc->kc_next) {
+		kprintf("cpu%u magazines:\n", kc->kc_number);
+		spinlock_acquire(&kc->kc_lock);
+		for (i=0; i<NSIZES; i++) {
+			km = &kc->kc_mags[i];
+			if (km->km_hits == 0 && km->km_misses == 0) {
+				continue;
+			}
+			kprintf("   size %-4lu  %u/%u cached  %u hits  "
+				"%u misses (%u%% hit)  %u spills\n",
+				(unsigned long) sizes[i], km->km_count,
+				mag_capacity(i), km->km_hits, km->km_misses,
+				percent(km->km_hits,
+					km->km_hits + km->km_misses),
+				km->km_spills);
+		}
+		spinlock_release(&kc->kc_lock);
+	}
 }
 
+/* Defined below with the rest of the magazine code. */
+static void mag_drainall(void);
 
 /*
  * Return the number of used bytes.
@@ -828,19 +1055,25 @@ unsigned long
 kheap_getused(void) {
 	struct pageref *pr;
 	unsigned long total = 0;
-	unsigned int num_pages = 0, coremap_bytes = 0;
+	unsigned int num_pages = 0, coremap_bytes = 0, cache_pages;
+
+	/* blocks sitting in magazines aren't in use */
+	mag_drainall();
 
 	/* compute with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		total += subpage_stats(pr, true);
-		num_pages++;
+		num_pages += slabpages[PR_BLOCKTYPE(pr)];
 	}
 
+	total += kmem_cache_getused(&cache_pages);
+	num_pages += cache_pages;
+
 	coremap_bytes = coremap_used_bytes();
 
-	// Don't double-count the pages we're using for subpage allocation;
-	// we've already accounted for the used portion.
+	// Don't double-count the pages we're using for subpage allocation
+	// or object caches; we've already accounted for the used portion.
 	if (coremap_bytes > 0) {
 		total += coremap_bytes - (num_pages * PAGE_SIZE);
 	}
@@ -865,7 +1098,315 @@ kheap_printused(void)
 ////////////////////////////////////////
 
 /*
- * Remove a pageref from both lists that it's on.
+ * Allocation-site profiling.
+ *
+ * Unlike LABELS this is always compiled in, and turned on and off at
+ * runtime; while it's off it costs kmalloc and kfree one test each.
+ * While it's on, each kmalloc is charged to its caller's return
+ * address, and the block is remembered in a table of live blocks so
+ * the kfree can be charged to the same site. Blocks allocated while
+ * profiling was off aren't in the table; their frees are just
+ * counted. kmem_cache objects come from pages kmalloc never sees, so
+ * kmem_cache_alloc and kmem_cache_free report them (at object size,
+ * charged to their own callers) through kheap_profile_alloc and
+ * kheap_profile_free.
+ *
+ * Both tables are open-addressed hash tables with linear probing,
+ * statically allocated so profiling never calls kmalloc. Should
+ * either fill up (past 3/4), further sites or blocks are counted as
+ * lost rather than tracked.
+ */
+
+#define KPROF_SITEBITS 8
+#define KPROF_NSITES (1U << KPROF_SITEBITS)
+#define KPROF_BLOCKBITS 12
+#define KPROF_NBLOCKS (1U << KPROF_BLOCKBITS)
+#define KPROF_NOSITE 0xffffffff
+
+struct kprof_site {
+	vaddr_t ks_site;		/* kmalloc's return address; 0 if unused */
+	unsigned ks_allocs;		/* number of kmallocs */
+	unsigned ks_frees;		/* number of those kfreed */
+	size_t ks_live;			/* bytes allocated and not yet freed */
+	size_t ks_peak;			/* most ks_live has been */
+};
+
+struct kprof_block {
+	vaddr_t kb_addr;		/* block address; 0 if unused */
+	size_t kb_size;			/* bytes charged for it */
+	unsigned kb_site;		/* index into kprof_sites */
+};
+
+static volatile bool kprof_on;
+static struct spinlock kprof_lock = SPINLOCK_INITIALIZER;
+static struct kprof_site kprof_sites[KPROF_NSITES];
+static unsigned kprof_nsites;
+static struct kprof_block kprof_blocks[KPROF_NBLOCKS];
+static unsigned kprof_nblocks;
+static unsigned kprof_lostsites;	/* kmallocs from sites that didn't fit */
+static unsigned kprof_lostblocks;	/* kmallocs whose kfree we can't charge */
+static unsigned kprof_untracked;	/* kfrees of blocks not in the table */
+static struct timespec kprof_start;
+
+static
+unsigned
+kprof_hash(vaddr_t addr, unsigned bits)
+{
+	return ((uint32_t)addr * 2654435761U) >> (32 - bits);
+}
+
+/*
+ * Find (or add) the entry for SITE. Returns KPROF_NOSITE if the table
+ * is full.
+ */
+static
+unsigned
+kprof_getsite(vaddr_t site)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&kprof_lock));
+
+	i = kprof_hash(site, KPROF_SITEBITS);
+	while (kprof_sites[i].ks_site != 0) {
+		if (kprof_sites[i].ks_site == site) {
+			return i;
+		}
+		i = (i + 1) % KPROF_NSITES;
+	}
+	if (kprof_nsites >= KPROF_NSITES * 3 / 4) {
+		return KPROF_NOSITE;
+	}
+	kprof_sites[i].ks_site = site;
+	kprof_nsites++;
+	return i;
+}
+
+/*
+ * Remove entry I from the live block table, moving later entries of
+ * the same probe sequence back so lookups don't stop short.
+ */
+static
+void
+kprof_removeblock(unsigned i)
+{
+	unsigned j, k;
+
+	KASSERT(spinlock_do_i_hold(&kprof_lock));
+
+	j = i;
+	while (1) {
+		j = (j + 1) % KPROF_NBLOCKS;
+		if (kprof_blocks[j].kb_addr == 0) {
+			break;
+		}
+		k = kprof_hash(kprof_blocks[j].kb_addr, KPROF_BLOCKBITS);
+		/* Leave it if its home slot is cyclically in (i, j]. */
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+			continue;
+		}
+		kprof_blocks[i] = kprof_blocks[j];
+		i = j;
+	}
+	kprof_blocks[i].kb_addr = 0;
+	kprof_nblocks--;
+}
+
+/*
+ * Charge a SIZE-byte kmalloc returning PTR to SITE.
+ */
+static
+void
+kprof_alloc(void *ptr, size_t size, vaddr_t site)
+{
+	struct kprof_site *ks;
+	unsigned si, i;
+
+	spinlock_acquire(&kprof_lock);
+	if (!kprof_on) {
+		spinlock_release(&kprof_lock);
+		return;
+	}
+
+	si = kprof_getsite(site);
+	if (si == KPROF_NOSITE) {
+		kprof_lostsites++;
+		spinlock_release(&kprof_lock);
+		return;
+	}
+	ks = &kprof_sites[si];
+	ks->ks_allocs++;
+
+	if (kprof_nblocks >= KPROF_NBLOCKS * 3 / 4) {
+		/* We won't see it freed, so don't count it as live. */
+		kprof_lostblocks++;
+		spinlock_release(&kprof_lock);
+		return;
+	}
+	ks->ks_live += size;
+	if (ks->ks_live > ks->ks_peak) {
+		ks->ks_peak = ks->ks_live;
+	}
+
+	i = kprof_hash((vaddr_t)ptr, KPROF_BLOCKBITS);
+	while (kprof_blocks[i].kb_addr != 0) {
+		KASSERT(kprof_blocks[i].kb_addr != (vaddr_t)ptr);
+		i = (i + 1) % KPROF_NBLOCKS;
+	}
+	kprof_blocks[i].kb_addr = (vaddr_t)ptr;
+	kprof_blocks[i].kb_size = size;
+	kprof_blocks[i].kb_site = si;
+	kprof_nblocks++;
+
+	spinlock_release(&kprof_lock);
+}
+
+/*
+ * Charge the kfree of PTR to whoever allocated it.
+ */
+static
+void
+kprof_free(void *ptr)
+{
+	struct kprof_site *ks;
+	unsigned i;
+
+	spinlock_acquire(&kprof_lock);
+	if (!kprof_on) {
+		spinlock_release(&kprof_lock);
+		return;
+	}
+
+	i = kprof_hash((vaddr_t)ptr, KPROF_BLOCKBITS);
+	while (kprof_blocks[i].kb_addr != 0) {
+		if (kprof_blocks[i].kb_addr == (vaddr_t)ptr) {
+			ks = &kprof_sites[kprof_blocks[i].kb_site];
+			ks->ks_frees++;
+			KASSERT(ks->ks_live >= kprof_blocks[i].kb_size);
+			ks->ks_live -= kprof_blocks[i].kb_size;
+			kprof_removeblock(i);
+			spinlock_release(&kprof_lock);
+			return;
+		}
+		i = (i + 1) % KPROF_NBLOCKS;
+	}
+	kprof_untracked++;
+
+	spinlock_release(&kprof_lock);
+}
+
+/*
+ * Hooks for other allocators (kmem_cache) to report their objects.
+ * Like the checks in kmalloc and kfree, cheap when profiling is off.
+ */
+void
+kheap_profile_alloc(void *ptr, size_t size, vaddr_t site)
+{
+	if (kprof_on && ptr != NULL) {
+		kprof_alloc(ptr, size, site);
+	}
+}
+
+void
+kheap_profile_free(void *ptr)
+{
+	if (kprof_on && ptr != NULL) {
+		kprof_free(ptr);
+	}
+}
+
+/*
+ * Turn profiling on, starting over from nothing, or off, leaving the
+ * results for kheap_printprofile.
+ */
+void
+kheap_profile(bool on)
+{
+	spinlock_acquire(&kprof_lock);
+	if (on) {
+		bzero(kprof_sites, sizeof(kprof_sites));
+		bzero(kprof_blocks, sizeof(kprof_blocks));
+		kprof_nsites = 0;
+		kprof_nblocks = 0;
+		kprof_lostsites = 0;
+		kprof_lostblocks = 0;
+		kprof_untracked = 0;
+		gettime(&kprof_start);
+	}
+	kprof_on = on;
+	spinlock_release(&kprof_lock);
+}
+
+/*
+ * Print the N sites with the most bytes outstanding, with their peak
+ * and their kmalloc and kfree rates since profiling started. (The
+ * numbers are copied out first so we can print without the lock.)
+ */
+void
+kheap_printprofile(unsigned n)
+{
+	static struct kprof_site snap[KPROF_NSITES];
+	unsigned lostsites, lostblocks, untracked;
+	struct timespec now;
+	uint64_t ms;
+	unsigned i, j, best;
+
+	spinlock_acquire(&kprof_lock);
+	memcpy(snap, kprof_sites, sizeof(snap));
+	lostsites = kprof_lostsites;
+	lostblocks = kprof_lostblocks;
+	untracked = kprof_untracked;
+	gettime(&now);
+	timespec_sub(&now, &kprof_start, &now);
+	spinlock_release(&kprof_lock);
+
+	ms = now.tv_sec * 1000ULL + now.tv_nsec / 1000000;
+	if (ms == 0) {
+		ms = 1;
+	}
+
+	kprintf("kmalloc profile, %s, over %llu.%03u seconds:\n",
+		kprof_on ? "running" : "stopped",
+		(unsigned long long)(ms / 1000), (unsigned)(ms % 1000));
+	kprintf("      site        live      peak    allocs     frees"
+		"  allocs/s   frees/s\n");
+	for (i=0; i<n; i++) {
+		/* Selection sort by live bytes, a row at a time. */
+		best = KPROF_NSITES;
+		for (j=0; j<KPROF_NSITES; j++) {
+			if (snap[j].ks_site == 0) {
+				continue;
+			}
+			if (best == KPROF_NSITES ||
+			    snap[j].ks_live > snap[best].ks_live) {
+				best = j;
+			}
+		}
+		if (best == KPROF_NSITES) {
+			break;
+		}
+		kprintf("%p %9lu %9lu %9u %9u %9u %9u\n",
+			(void *)snap[best].ks_site,
+			(unsigned long)snap[best].ks_live,
+			(unsigned long)snap[best].ks_peak,
+			snap[best].ks_allocs, snap[best].ks_frees,
+			(unsigned)(snap[best].ks_allocs * 1000ULL / ms),
+			(unsigned)(snap[best].ks_frees * 1000ULL / ms));
+		snap[best].ks_site = 0;
+	}
+	if (lostsites > 0 || lostblocks > 0 || untracked > 0) {
+		kprintf("Untracked: %u kmallocs from sites that didn't fit, "
+			"%u kmallocs whose blocks didn't fit, "
+			"%u untracked kfrees\n",
+			lostsites, lostblocks, untracked);
+	}
+}
+
+////////////////////////////////////////
+
+/*
+ * Remove a pageref from both lists that it's on. A full page is on
+ * the all-pages list only.
  */
 static
 void
@@ -915,113 +1456,65 @@ int blocktype(size_t clientsz)
 }
 
 /*
- * Allocate a block of size SZ, where SZ is not large enough to
- * warrant a whole-page allocation.
+ * Take a wholly free slab off the lists and forget it. The caller
+ * releases its pages once it has dropped kmalloc_spinlock.
  */
 static
-void *
-subpage_kmalloc(size_t sz
-#ifdef LABELS
-		, vaddr_t label
-#endif
-	)
+void
+subpage_releaseslab(struct pageref *pr)
 {
-	unsigned blktype;	// index into sizes[] that we're using
-	struct pageref *pr;	// pageref for page we're allocating from
-	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *volatile fl;	// free list entry
-	void *retptr;		// our result
+	unsigned blktype, j, pagenum;
 
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	blktype = PR_BLOCKTYPE(pr);
+	KASSERT(pr->nfree == SLABBLOCKS(blktype));
+	remove_lists(pr, blktype);
+	pagenum = KHEAP_PAGENUM(PR_PAGEADDR(pr));
+	for (j=0; j<slabpages[blktype]; j++) {
+		kheap_pagemap[pagenum + j] = 0;
+	}
+	freepageref(pr);
+}
+
+/*
+ * Get a fresh slab for blocks of type BLKTYPE and put it on the
+ * lists. Returns with kmalloc_spinlock held either way, but drops it
+ * in between, so the caller should look at sizebases[] again
+ * afterwards rather than assume the new page is the one to use.
+ * Returns false if out of memory.
+ */
+static
+bool
+subpage_newpage(unsigned blktype)
+{
+	struct pageref *pr;
+	vaddr_t prpage;
+	vaddr_t fla;
+	struct freelist *volatile fl;
 	volatile int i;
+	unsigned j, pagenum;
 
-#ifdef GUARDS
-	size_t clientsz;
-#endif
-
-#ifdef GUARDS
-	clientsz = sz;
-	sz += GUARD_OVERHEAD;
-#endif
-#ifdef LABELS
-#ifdef GUARDS
-	/* Include the label in what GUARDS considers the client data. */
-	clientsz += LABEL_PTROFFSET;
-#endif
-	sz += LABEL_PTROFFSET;
-#endif
-	blktype = blocktype(sz);
-#ifdef GUARDS
-	sz = sizes[blktype];
-#endif
-
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
-
-	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
-
-		/* check for corruption */
-		KASSERT(PR_BLOCKTYPE(pr) == blktype);
-		checksubpage(pr);
-
-		if (pr->nfree > 0) {
-
-		doalloc: /* comes here after getting a whole fresh page */
-
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
-
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
-
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
-#ifdef GUARDS
-			retptr = establishguardband(retptr, clientsz, sz);
-#endif
-#ifdef LABELS
-			retptr = establishlabel(retptr, label);
-#endif
-
-			checksubpages();
-
-			spinlock_release(&kmalloc_spinlock);
-			return retptr;
-		}
-	}
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(!ISBIG(blktype));
 
 	/*
-	 * No page of the right size available.
-	 * Make a new one.
-	 *
 	 * We release the spinlock while calling alloc_kpages. This
 	 * avoids deadlock if alloc_kpages needs to come back here.
-	 * Note that this means things can change behind our back...
 	 */
-
 	spinlock_release(&kmalloc_spinlock);
-	prpage = alloc_kpages(1);
+	prpage = alloc_kpages(slabpages[blktype]);
 	if (prpage==0) {
 		/* Out of memory. */
 		silent("kmalloc: Subpage allocator couldn't get a page\n");
-		return NULL;
+		spinlock_acquire(&kmalloc_spinlock);
+		return false;
 	}
 	KASSERT(prpage % PAGE_SIZE == 0);
+	KASSERT(KHEAP_PAGENUM(prpage) + slabpages[blktype] <= KHEAP_MAXPAGES);
 #ifdef CHECKBEEF
-	/* deadbeef the whole page, as it probably starts zeroed */
-	fill_deadbeef((void *)prpage, PAGE_SIZE);
+	/* deadbeef the whole slab, as it probably starts zeroed */
+	fill_deadbeef((void *)prpage, SLABSIZE(blktype));
 #endif
 	spinlock_acquire(&kmalloc_spinlock);
 
@@ -1031,11 +1524,12 @@ subpage_kmalloc(size_t sz
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
 		kprintf("kmalloc: Subpage allocator couldn't get pageref\n");
-		return NULL;
+		spinlock_acquire(&kmalloc_spinlock);
+		return false;
 	}
 
 	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
-	pr->nfree = PAGE_SIZE / sizes[blktype];
+	pr->nfree = SLABBLOCKS(blktype);
 
 	/*
 	 * Note: fl is volatile because the MIPS toolchain we were
@@ -1061,8 +1555,460 @@ subpage_kmalloc(size_t sz
 	pr->next_all = allbase;
 	allbase = pr;
 
-	/* This is kind of cheesy, but avoids duplicating the alloc code. */
-	goto doalloc;
+	pagenum = KHEAP_PAGENUM(prpage);
+	for (j=0; j<slabpages[blktype]; j++) {
+		kheap_pagemap[pagenum + j] = pageref_number(pr) + 1;
+	}
+	nempty[blktype]++;
+
+	return true;
+}
+
+/*
+ * Take one block off the first partial page of type BLKTYPE, which
+ * must exist. If that empties the page, it comes off the partial
+ * list.
+ */
+static
+void *
+subpage_takeblock(unsigned blktype)
+{
+	struct pageref *pr;	// pageref for page we're allocating from
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	void *retptr;		// our result
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	pr = sizebases[blktype];
+	KASSERT(pr != NULL);
+
+	/* check for corruption */
+	KASSERT(PR_BLOCKTYPE(pr) == blktype);
+	checksubpage(pr);
+
+	KASSERT(pr->nfree > 0);
+	KASSERT(pr->freelist_offset < SLABSIZE(blktype));
+	prpage = PR_PAGEADDR(pr);
+	fla = prpage + pr->freelist_offset;
+	fl = (struct freelist *)fla;
+
+	if (pr->nfree == SLABBLOCKS(blktype)) {
+		KASSERT(nempty[blktype] > 0);
+		nempty[blktype]--;
+	}
+
+	retptr = fl;
+	fl = fl->next;
+	pr->nfree--;
+
+	if (fl != NULL) {
+		KASSERT(pr->nfree > 0);
+		fla = (vaddr_t)fl;
+		KASSERT(fla - prpage < SLABSIZE(blktype));
+		pr->freelist_offset = fla - prpage;
+	}
+	else {
+		KASSERT(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
+		sizebases[blktype] = pr->next_samesize;
+		pr->next_samesize = NULL;
+	}
+	return retptr;
+}
+
+/*
+ * Return the block at PTRADDR to the page PR it came from. If that
+ * makes the whole page free, take the page off the lists and return
+ * its address for the caller to release once it has dropped
+ * kmalloc_spinlock; otherwise return 0.
+ */
+static
+vaddr_t
+subpage_putblock(struct pageref *pr, vaddr_t ptraddr)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	struct freelist *fl;	// free list entry
+	vaddr_t offset;		// offset into page
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	KASSERT(blktype >= 0 && blktype < NSIZES);
+	checksubpage(pr);
+
+	offset = ptraddr - prpage;
+	KASSERT(offset < SLABSIZE(blktype) && offset % sizes[blktype] == 0);
+
+	fl = (struct freelist *)ptraddr;
+	if (pr->freelist_offset == INVALID_OFFSET) {
+		/* Page was full, so it goes back on the partial list. */
+		KASSERT(pr->nfree == 0);
+		fl->next = NULL;
+		pr->next_samesize = sizebases[blktype];
+		sizebases[blktype] = pr;
+	} else {
+		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+
+		/* this block should not already be on the free list! */
+#ifdef SLOW
+		{
+			struct freelist *fl2;
+
+			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
+				KASSERT(fl2 != fl);
+			}
+		}
+#else
+		/* check just the head */
+		KASSERT(fl != fl->next);
+#endif
+	}
+	pr->freelist_offset = offset;
+	pr->nfree++;
+
+	KASSERT(pr->nfree <= SLABBLOCKS(blktype));
+	if (pr->nfree == SLABBLOCKS(blktype)) {
+		/* Whole slab is free. Keep it if we're short of spares. */
+		if (nempty[blktype] < KEEP_EMPTY) {
+			nempty[blktype]++;
+			return 0;
+		}
+		subpage_releaseslab(pr);
+		return prpage;
+	}
+	return 0;
+}
+
+/*
+ * Get up to N blocks of type BLKTYPE from the pages into BLOCKS[],
+ * in one trip through kmalloc_spinlock. A new page is fetched only
+ * if there's nothing at all to be had. Big blocks come straight from
+ * alloc_kpages, one at a time. Returns the number of blocks gotten;
+ * 0 means out of memory.
+ */
+static
+unsigned
+subpage_getblocks(unsigned blktype, void **blocks, unsigned n)
+{
+	unsigned got = 0;
+	vaddr_t va;
+
+	if (ISBIG(blktype)) {
+		/* Nothing to batch; just get one. */
+		va = alloc_kpages(slabpages[blktype]);
+		if (va == 0) {
+			silent("kmalloc: couldn't get a big block\n");
+			return 0;
+		}
+		KASSERT(KHEAP_PAGENUM(va) < KHEAP_MAXPAGES);
+		kheap_pagemap[KHEAP_PAGENUM(va)] = PAGEMAP_BIG + blktype;
+		blocks[0] = (void *)va;
+		return 1;
+	}
+
+	spinlock_acquire(&kmalloc_spinlock);
+	checksubpages();
+
+	while (got < n) {
+		if (sizebases[blktype] == NULL) {
+			if (got > 0 || !subpage_newpage(blktype)) {
+				break;
+			}
+			continue;
+		}
+		blocks[got++] = subpage_takeblock(blktype);
+	}
+
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+	return got;
+}
+
+/*
+ * Give N blocks in BLOCKS[] back to their pages, in one trip through
+ * kmalloc_spinlock, and release any pages that become free.
+ */
+static
+void
+subpage_putblocks(void **blocks, unsigned n)
+{
+	vaddr_t freepages[MAGSIZE];
+	unsigned i, nfreepages = 0;
+	struct pageref *pr;
+	vaddr_t prpage;
+
+	KASSERT(n <= MAGSIZE);
+
+	spinlock_acquire(&kmalloc_spinlock);
+	checksubpages();
+
+	for (i=0; i<n; i++) {
+		pr = pageref_lookup((vaddr_t)blocks[i]);
+		if (pr == NULL) {
+			/* Big block; the pages go straight back. */
+			KASSERT(bigblock_lookup((vaddr_t)blocks[i]) >= 0);
+			kheap_pagemap[KHEAP_PAGENUM((vaddr_t)blocks[i])] = 0;
+			freepages[nfreepages++] = (vaddr_t)blocks[i];
+			continue;
+		}
+		prpage = subpage_putblock(pr, (vaddr_t)blocks[i]);
+		if (prpage != 0) {
+			freepages[nfreepages++] = prpage;
+		}
+	}
+
+	checksubpages();
+	/* Call free_kpages without kmalloc_spinlock. */
+	spinlock_release(&kmalloc_spinlock);
+
+	for (i=0; i<nfreepages; i++) {
+		free_kpages(freepages[i]);
+	}
+}
+
+/*
+ * Get a free block of type BLKTYPE: from this CPU's magazine if it
+ * has one, otherwise from the pages, taking a batch at once to
+ * reload the magazine with.
+ */
+static
+void *
+mag_get(unsigned blktype)
+{
+	struct kmalloc_cpu *kc;
+	struct kmagazine *km;
+	void *blocks[MAGSIZE];
+	void *ret;
+	unsigned n, i;
+
+	kc = CURCPU_EXISTS() ? curcpu->c_kmalloc : NULL;
+	if (kc == NULL) {
+		/* Still booting; no magazines yet. */
+		n = subpage_getblocks(blktype, blocks, 1);
+		return n > 0 ? blocks[0] : NULL;
+	}
+
+	km = &kc->kc_mags[blktype];
+	spinlock_acquire(&kc->kc_lock);
+	if (km->km_count > 0) {
+		km->km_hits++;
+		ret = km->km_rounds[--km->km_count];
+		spinlock_release(&kc->kc_lock);
+		return ret;
+	}
+	km->km_misses++;
+	spinlock_release(&kc->kc_lock);
+
+	n = subpage_getblocks(blktype, blocks, mag_batch(blktype));
+	if (n == 0) {
+		return NULL;
+	}
+
+	/*
+	 * We had to let go of the magazine, so somebody may have
+	 * refilled it meanwhile; anything that doesn't fit goes back.
+	 */
+	spinlock_acquire(&kc->kc_lock);
+	for (i=1; i<n && km->km_count < mag_capacity(blktype); i++) {
+		km->km_rounds[km->km_count++] = blocks[i];
+	}
+	spinlock_release(&kc->kc_lock);
+	if (i < n) {
+		subpage_putblocks(&blocks[i], n - i);
+	}
+	return blocks[0];
+}
+
+/*
+ * Put a free block of type BLKTYPE in this CPU's magazine. If the
+ * magazine is full, send a batch back to the pages to make room.
+ */
+static
+void
+mag_put(unsigned blktype, void *block)
+{
+	struct kmalloc_cpu *kc;
+	struct kmagazine *km;
+	void *blocks[MAGSIZE];
+	unsigned n;
+
+	kc = CURCPU_EXISTS() ? curcpu->c_kmalloc : NULL;
+	if (kc == NULL) {
+		subpage_putblocks(&block, 1);
+		return;
+	}
+
+	km = &kc->kc_mags[blktype];
+	spinlock_acquire(&kc->kc_lock);
+
+	/* We probably ought to check the whole magazine for a double free. */
+#ifdef SLOW
+	for (n=0; n<km->km_count; n++) {
+		KASSERT(km->km_rounds[n] != block);
+	}
+#else
+	KASSERT(km->km_count == 0 || km->km_rounds[km->km_count-1] != block);
+#endif
+
+	n = 0;
+	if (km->km_count >= mag_capacity(blktype)) {
+		km->km_spills++;
+		n = mag_batch(blktype);
+		km->km_count -= n;
+		memcpy(blocks, &km->km_rounds[km->km_count], n * sizeof(void *));
+	}
+	km->km_rounds[km->km_count++] = block;
+	spinlock_release(&kc->kc_lock);
+
+	if (n > 0) {
+		subpage_putblocks(blocks, n);
+	}
+}
+
+/*
+ * Empty every CPU's magazines back into the pages, so the pages show
+ * what is really in use and any that are entirely free get released.
+ */
+static
+void
+mag_drainall(void)
+{
+	struct kmalloc_cpu *kc;
+	struct kmagazine *km;
+	void *blocks[MAGSIZE];
+	unsigned blktype, n;
+
+	for (kc = kmalloc_cpus; kc != NULL; kc = kc->kc_next) {
+		for (blktype=0; blktype<NSIZES; blktype++) {
+			km = &kc->kc_mags[blktype];
+			spinlock_acquire(&kc->kc_lock);
+			n = km->km_count;
+			memcpy(blocks, km->km_rounds, n * sizeof(void *));
+			km->km_count = 0;
+			spinlock_release(&kc->kc_lock);
+			if (n > 0) {
+				subpage_putblocks(blocks, n);
+			}
+		}
+	}
+}
+
+/*
+ * Give back everything kmalloc is holding on to in case it's wanted
+ * again: the magazines' blocks and the spare empty slabs. Afterwards
+ * the pages in use are exactly those with blocks allocated on them.
+ */
+void
+kheap_drain(void)
+{
+	struct pageref *pr;
+	vaddr_t prpage;
+	unsigned i;
+
+	mag_drainall();
+
+	spinlock_acquire(&kmalloc_spinlock);
+	for (i=0; i<NSIZES; i++) {
+		while (nempty[i] > 0) {
+			pr = sizebases[i];
+			while (pr->nfree != SLABBLOCKS(i)) {
+				pr = pr->next_samesize;
+				KASSERT(pr != NULL);
+			}
+			nempty[i]--;
+			prpage = PR_PAGEADDR(pr);
+			subpage_releaseslab(pr);
+
+			/* Call free_kpages without kmalloc_spinlock. */
+			spinlock_release(&kmalloc_spinlock);
+			free_kpages(prpage);
+			spinlock_acquire(&kmalloc_spinlock);
+		}
+	}
+	spinlock_release(&kmalloc_spinlock);
+}
+
+/*
+ * Set up magazines for a new CPU. Called from cpu_create.
+ */
+struct kmalloc_cpu *
+kmalloc_cpu_create(void)
+{
+	struct kmalloc_cpu *kc, **kcp;
+	unsigned i;
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	spinlock_init(&kc->kc_lock);
+	kc->kc_number = kmalloc_ncpus++;
+	kc->kc_next = NULL;
+	for (i=0; i<NSIZES; i++) {
+		kc->kc_mags[i].km_count = 0;
+		kc->kc_mags[i].km_hits = 0;
+		kc->kc_mags[i].km_misses = 0;
+		kc->kc_mags[i].km_spills = 0;
+	}
+
+	/* keep the list in CPU order for printing */
+	for (kcp = &kmalloc_cpus; *kcp != NULL; kcp = &(*kcp)->kc_next) {
+		/* nothing */
+	}
+	*kcp = kc;
+	return kc;
+}
+
+/*
+ * Allocate a block of size SZ, where SZ is not large enough to
+ * warrant a whole-page allocation.
+ */
+static
+void *
+subpage_kmalloc(size_t sz
+#ifdef LABELS
+		, vaddr_t label
+#endif
+	)
+{
+	unsigned blktype;	// index into sizes[] that we're using
+	void *retptr;		// our result
+
+#ifdef GUARDS
+	size_t clientsz;
+#endif
+
+#ifdef GUARDS
+	clientsz = sz;
+	sz += GUARD_OVERHEAD;
+#endif
+#ifdef LABELS
+#ifdef GUARDS
+	/* Include the label in what GUARDS considers the client data. */
+	clientsz += LABEL_PTROFFSET;
+#endif
+	sz += LABEL_PTROFFSET;
+#endif
+	blktype = blocktype(sz);
+#ifdef GUARDS
+	sz = sizes[blktype];
+#endif
+
+	retptr = mag_get(blktype);
+	if (retptr == NULL) {
+		return NULL;
+	}
+#ifdef GUARDS
+	retptr = establishguardband(retptr, clientsz, sz);
+#endif
+#ifdef LABELS
+	retptr = establishlabel(retptr, label);
+#endif
+	return retptr;
 }
 
 /*
@@ -1077,8 +2023,6 @@ subpage_kfree(void *ptr)
 	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
 	vaddr_t offset;		// offset into page
 #ifdef GUARDS
 	size_t blocksize, smallerblocksize;
@@ -1109,38 +2053,28 @@ subpage_kfree(void *ptr)
 	ptraddr -= LABEL_PTROFFSET;
 #endif
 
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
-
-	/* Silence warnings with gcc 4.8 -Og (but not -O2) */
-	prpage = 0;
-	blktype = 0;
-
-	for (pr = allbase; pr; pr = pr->next_all) {
+	/*
+	 * No lock needed to look up the page: it can't stop being a
+	 * heap page while the block we're freeing is still allocated.
+	 */
+	pr = pageref_lookup(ptraddr);
+	if (pr != NULL) {
 		prpage = PR_PAGEADDR(pr);
 		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
 	}
-
-	if (pr==NULL) {
-		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
-		return -1;
+	else {
+		blktype = bigblock_lookup(ptraddr);
+		if (blktype < 0) {
+			/* Not on any of our pages - not a subpage allocation */
+			return -1;
+		}
+		prpage = ptraddr;
 	}
-
+	KASSERT(blktype >= 0 && blktype < NSIZES);
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
-	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
+	if (offset >= SLABSIZE(blktype) || offset % sizes[blktype] != 0) {
 		panic("kfree: subpage free of invalid addr %p\n", ptr);
 	}
 
@@ -1152,51 +2086,14 @@ subpage_kfree(void *ptr)
 
 	/*
 	 * Clear the block to 0xdeadbeef to make it easier to detect
-	 * uses of dangling pointers.
+	 * uses of dangling pointers. Big blocks never got this when they
+	 * came from alloc_kpages directly, and it would be too slow.
 	 */
-	fill_deadbeef((void *)ptraddr, sizes[blktype]);
-
-	/*
-	 * We probably ought to check for free twice by seeing if the block
-	 * is already on the free list. But that's expensive, so we don't.
-	 */
-
-	fla = prpage + offset;
-	fl = (struct freelist *)fla;
-	if (pr->freelist_offset == INVALID_OFFSET) {
-		fl->next = NULL;
-	} else {
-		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
-
-		/* this block should not already be on the free list! */
-#ifdef SLOW
-		{
-			struct freelist *fl2;
-
-			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
-				KASSERT(fl2 != fl);
-			}
-		}
-#else
-		/* check just the head */
-		KASSERT(fl != fl->next);
-#endif
+	if (!ISBIG(blktype)) {
+		fill_deadbeef((void *)ptraddr, sizes[blktype]);
 	}
-	pr->freelist_offset = offset;
-	pr->nfree++;
 
-	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
-	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
-		/* Whole page is free. */
-		remove_lists(pr, blktype);
-		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
-	}
-	else {
-		spinlock_release(&kmalloc_spinlock);
-	}
+	mag_put(blktype, (void *)ptraddr);
 
 #ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
 	spinlock_acquire(&kmalloc_spinlock);
@@ -1218,6 +2115,7 @@ void *
 kmalloc(size_t sz)
 {
 	size_t checksz;
+	void *ret;
 #ifdef LABELS
 	vaddr_t label;
 #endif
@@ -1231,7 +2129,7 @@ kmalloc(size_t sz)
 #endif /* LABELS */
 
 	checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD;
-	if (checksz >= LARGEST_SUBPAGE_SIZE) {
+	if (checksz > LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
 		vaddr_t address;
 
@@ -1243,14 +2141,37 @@ kmalloc(size_t sz)
 		}
 		KASSERT(address % PAGE_SIZE == 0);
 
-		return (void *)address;
+		ret = (void *)address;
 	}
-
+	else {
 #ifdef LABELS
-	return subpage_kmalloc(sz, label);
+		ret = subpage_kmalloc(sz, label);
 #else
-	return subpage_kmalloc(sz);
+		ret = subpage_kmalloc(sz);
 #endif
+	}
+
+	if (kprof_on && ret != NULL) {
+		kprof_alloc(ret, kmalloc_blocksize(sz),
+			    (vaddr_t)__builtin_return_address(0));
+	}
+	return ret;
+}
+
+/*
+ * Return the number of bytes kmalloc sets aside for a request of SZ
+ * bytes.
+ */
+size_t
+kmalloc_blocksize(size_t sz)
+{
+	size_t checksz;
+
+	checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD;
+	if (checksz > LARGEST_SUBPAGE_SIZE) {
+		return ROUNDUP(sz, PAGE_SIZE);
+	}
+	return sizes[blocktype(checksz)];
 }
 
 /*
@@ -1264,7 +2185,11 @@ kfree(void *ptr)
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+	if (kprof_on) {
+		kprof_free(ptr);
+	}
+	if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
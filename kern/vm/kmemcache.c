@@ -0,0 +1,388 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Object caches. See kmemcache.h for the interface.
+ *
+ * A slab is one page. It starts with a struct kmem_slab, followed by
+ * a stack of the indexes of its free objects, followed by the objects
+ * themselves. Keeping the free list outside the objects is what lets
+ * a free object stay constructed. Freeing finds the slab by rounding
+ * the object's address down to the page.
+ *
+ * Each cache keeps its slabs that have free objects on a list, so
+ * allocating is always O(1), and holds on to at most one wholly free
+ * slab so that a create/destroy cycle doesn't get and release a page
+ * every time. Full slabs aren't on any list; a slab finds its way
+ * back to the partial list when something on it is freed.
+ */
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <kmemcache.h>
+
+struct kmem_slab {
+	struct kmem_cache *ks_cache;
+	struct kmem_slab *ks_next;	/* On kmc_partial */
+	struct kmem_slab *ks_prev;
+	vaddr_t ks_objs;		/* Address of object 0 */
+	unsigned ks_nfree;		/* Entries in ks_free[] */
+	uint16_t ks_free[];		/* Indexes of free objects */
+};
+
+/* Objects are aligned as kmalloc would align them. */
+#define KMEM_ALIGN 8
+
+#define SLAB_OF(obj) ((struct kmem_slab *)((vaddr_t)(obj) & PAGE_FRAME))
+
+/*
+ * All caches that have ever had a slab, for the statistics.
+ */
+static struct spinlock kmem_caches_lock = SPINLOCK_INITIALIZER;
+static struct kmem_cache *kmem_caches;
+
+/*
+ * Work out the layout of a cache's slabs the first time it needs one.
+ */
+static
+void
+kmem_cache_setup(struct kmem_cache *kc)
+{
+	unsigned n;
+
+	kc->kmc_size = ROUNDUP(kc->kmc_size, KMEM_ALIGN);
+	KASSERT(kc->kmc_size > 0);
+
+	n = (PAGE_SIZE - sizeof(struct kmem_slab)) /
+		(kc->kmc_size + sizeof(uint16_t));
+	while (n > 0 && ROUNDUP(sizeof(struct kmem_slab) +
+				n * sizeof(uint16_t), KMEM_ALIGN) +
+	       n * kc->kmc_size > PAGE_SIZE) {
+		n--;
+	}
+	if (n == 0) {
+		panic("kmem_cache %s: %zu-byte objects don't fit in a page\n",
+		      kc->kmc_name, kc->kmc_size);
+	}
+	kc->kmc_perslab = n;
+}
+
+/*
+ * Run the destructor on every object of a slab and release its page.
+ */
+static
+void
+kmem_slab_destroy(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+	unsigned i;
+
+	KASSERT(ks->ks_nfree == kc->kmc_perslab);
+	if (kc->kmc_dtor != NULL) {
+		for (i=0; i<kc->kmc_perslab; i++) {
+			kc->kmc_dtor((void *)(ks->ks_objs + i*kc->kmc_size));
+		}
+	}
+	free_kpages((vaddr_t)ks);
+}
+
+/*
+ * Get a page and set it up as a slab of constructed objects. Called
+ * without the cache lock, since constructors may allocate.
+ */
+static
+struct kmem_slab *
+kmem_slab_create(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	vaddr_t va;
+	unsigned i;
+	int result;
+
+	va = alloc_kpages(1);
+	if (va == 0) {
+		return NULL;
+	}
+	KASSERT(va % PAGE_SIZE == 0);
+
+	ks = (struct kmem_slab *)va;
+	ks->ks_cache = kc;
+	ks->ks_next = ks->ks_prev = NULL;
+	ks->ks_objs = va + ROUNDUP(sizeof(struct kmem_slab) +
+				   kc->kmc_perslab * sizeof(uint16_t),
+				   KMEM_ALIGN);
+	ks->ks_nfree = kc->kmc_perslab;
+
+	for (i=0; i<kc->kmc_perslab; i++) {
+		/* Hand out low addresses first */
+		ks->ks_free[i] = kc->kmc_perslab - 1 - i;
+		if (kc->kmc_ctor == NULL) {
+			continue;
+		}
+		result = kc->kmc_ctor((void *)(ks->ks_objs + i*kc->kmc_size));
+		if (result) {
+			while (i-- > 0 && kc->kmc_dtor != NULL) {
+				kc->kmc_dtor((void *)(ks->ks_objs +
+						      i*kc->kmc_size));
+			}
+			free_kpages(va);
+			return NULL;
+		}
+	}
+	return ks;
+}
+
+static
+void
+kmem_partial_add(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+	ks->ks_prev = NULL;
+	ks->ks_next = kc->kmc_partial;
+	if (ks->ks_next != NULL) {
+		ks->ks_next->ks_prev = ks;
+	}
+	kc->kmc_partial = ks;
+}
+
+static
+void
+kmem_partial_remove(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+	if (ks->ks_prev != NULL) {
+		ks->ks_prev->ks_next = ks->ks_next;
+	}
+	else {
+		KASSERT(kc->kmc_partial == ks);
+		kc->kmc_partial = ks->ks_next;
+	}
+	if (ks->ks_next != NULL) {
+		ks->ks_next->ks_prev = ks->ks_prev;
+	}
+	ks->ks_next = ks->ks_prev = NULL;
+}
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc;
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	kc->kmc_name = name;
+	kc->kmc_size = size;
+	kc->kmc_ctor = ctor;
+	kc->kmc_dtor = dtor;
+	spinlock_init(&kc->kmc_lock);
+	kc->kmc_perslab = 0;
+	kc->kmc_partial = NULL;
+	kc->kmc_empty = NULL;
+	kc->kmc_nslabs = 0;
+	kc->kmc_inuse = 0;
+	kc->kmc_listed = false;
+	kc->kmc_next = NULL;
+	return kc;
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_cache **kcp;
+	struct kmem_slab *ks;
+
+	KASSERT(kc->kmc_inuse == 0);
+
+	if (kc->kmc_listed) {
+		spinlock_acquire(&kmem_caches_lock);
+		for (kcp = &kmem_caches; *kcp != kc; kcp = &(*kcp)->kmc_next) {
+			KASSERT(*kcp != NULL);
+		}
+		*kcp = kc->kmc_next;
+		spinlock_release(&kmem_caches_lock);
+	}
+
+	/* With nothing in use, every slab is partial or the empty one. */
+	while ((ks = kc->kmc_partial) != NULL) {
+		kmem_partial_remove(kc, ks);
+		kmem_slab_destroy(kc, ks);
+	}
+	if (kc->kmc_empty != NULL) {
+		kmem_slab_destroy(kc, kc->kmc_empty);
+	}
+	spinlock_cleanup(&kc->kmc_lock);
+	kfree(kc);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	void *obj;
+
+	spinlock_acquire(&kc->kmc_lock);
+	while (kc->kmc_partial == NULL) {
+		if (kc->kmc_empty != NULL) {
+			kmem_partial_add(kc, kc->kmc_empty);
+			kc->kmc_empty = NULL;
+			break;
+		}
+		if (kc->kmc_perslab == 0) {
+			kmem_cache_setup(kc);
+		}
+		spinlock_release(&kc->kmc_lock);
+
+		ks = kmem_slab_create(kc);
+		if (ks == NULL) {
+			return NULL;
+		}
+		if (!kc->kmc_listed) {
+			spinlock_acquire(&kmem_caches_lock);
+			if (!kc->kmc_listed) {
+				kc->kmc_next = kmem_caches;
+				kmem_caches = kc;
+				kc->kmc_listed = true;
+			}
+			spinlock_release(&kmem_caches_lock);
+		}
+
+		/* Someone else may have added a slab meanwhile; fine. */
+		spinlock_acquire(&kc->kmc_lock);
+		kmem_partial_add(kc, ks);
+		kc->kmc_nslabs++;
+	}
+
+	ks = kc->kmc_partial;
+	KASSERT(ks->ks_nfree > 0);
+	obj = (void *)(ks->ks_objs + ks->ks_free[--ks->ks_nfree] * kc->kmc_size);
+	if (ks->ks_nfree == 0) {
+		kmem_partial_remove(kc, ks);
+	}
+	kc->kmc_inuse++;
+	spinlock_release(&kc->kmc_lock);
+
+	kheap_profile_alloc(obj, kc->kmc_size,
+			    (vaddr_t)__builtin_return_address(0));
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_slab *ks, *release = NULL;
+	vaddr_t offset;
+
+	if (obj == NULL) {
+		return;
+	}
+	kheap_profile_free(obj);
+	ks = SLAB_OF(obj);
+	KASSERT(ks->ks_cache == kc);
+	KASSERT((vaddr_t)obj >= ks->ks_objs);
+	offset = (vaddr_t)obj - ks->ks_objs;
+	KASSERT(offset % kc->kmc_size == 0);
+
+	spinlock_acquire(&kc->kmc_lock);
+	KASSERT(ks->ks_nfree < kc->kmc_perslab);
+	KASSERT(kc->kmc_inuse > 0);
+	kc->kmc_inuse--;
+
+	if (ks->ks_nfree == 0) {
+		/* Was full; it has something to give again. */
+		kmem_partial_add(kc, ks);
+	}
+	ks->ks_free[ks->ks_nfree++] = offset / kc->kmc_size;
+
+	if (ks->ks_nfree == kc->kmc_perslab) {
+		/* Wholly free: keep one such slab, release the rest. */
+		kmem_partial_remove(kc, ks);
+		if (kc->kmc_empty == NULL) {
+			kc->kmc_empty = ks;
+		}
+		else {
+			release = ks;
+			kc->kmc_nslabs--;
+		}
+	}
+	spinlock_release(&kc->kmc_lock);
+
+	if (release != NULL) {
+		/* Destructors may free things; do it without the lock. */
+		kmem_slab_destroy(kc, release);
+	}
+}
+
+unsigned long
+kmem_cache_getused(unsigned *npages)
+{
+	struct kmem_cache *kc;
+	unsigned long total = 0;
+
+	*npages = 0;
+	spinlock_acquire(&kmem_caches_lock);
+	for (kc = kmem_caches; kc != NULL; kc = kc->kmc_next) {
+		spinlock_acquire(&kc->kmc_lock);
+		total += (unsigned long)kc->kmc_inuse * kc->kmc_size;
+		*npages += kc->kmc_nslabs;
+		spinlock_release(&kc->kmc_lock);
+	}
+	spinlock_release(&kmem_caches_lock);
+	return total;
+}
+
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_cache *kc;
+	unsigned long held, askmalloc;
+	unsigned long totalheld = 0, totalkmalloc = 0;
+
+	kprintf("%-16s %6s %6s %6s %8s %10s %10s\n", "cache", "size",
+		"/slab", "slabs", "in use", "held", "kmalloc");
+
+	spinlock_acquire(&kmem_caches_lock);
+	for (kc = kmem_caches; kc != NULL; kc = kc->kmc_next) {
+		spinlock_acquire(&kc->kmc_lock);
+		held = (unsigned long)kc->kmc_nslabs * PAGE_SIZE;
+		askmalloc = (unsigned long)kc->kmc_inuse *
+			kmalloc_blocksize(kc->kmc_size);
+		kprintf("%-16s %6zu %6u %6u %8u %10lu %10lu\n",
+			kc->kmc_name, kc->kmc_size, kc->kmc_perslab,
+			kc->kmc_nslabs, kc->kmc_inuse, held, askmalloc);
+		spinlock_release(&kc->kmc_lock);
+		totalheld += held;
+		totalkmalloc += askmalloc;
+	}
+	spinlock_release(&kmem_caches_lock);
+
+	kprintf("%-16s %6s %6s %6s %8s %10lu %10lu\n", "total", "", "", "",
+		"", totalheld, totalkmalloc);
+}
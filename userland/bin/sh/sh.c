@@ -73,6 +73,9 @@ static int timing = 0;
 #define MAXBG 128
 static pid_t bgpids[MAXBG];
 
+/* most commands in one pipeline */
+#define MAXPIPE 16
+
 /*
  * can_bg
  * just checks for an open slot.
@@ -340,6 +343,110 @@ cmd_exit(int ac, char *av[], struct exitinfo *ei)
 	exit(code);
 }
 
+/*
+ * runpipeline
+ * runs "a | b | ..." with each command's stdout feeding the next one's
+ * stdin through a pipe, waits for all of them, and reports the status
+ * of the last. The commands are forked rather than spawned so that
+ * each child can close the pipe ends it doesn't use; a reader that
+ * inherited its own pipe's write end would never see EOF.
+ */
+static
+void
+runpipeline(char **args, struct exitinfo *ei)
+{
+	pid_t pids[MAXPIPE];
+	int npids, i, status;
+	int infd, fds[2];
+	int failed = 0;
+	char **cmd, **next;
+	pid_t pid;
+
+	infd = -1;
+	npids = 0;
+	for (cmd = args; cmd != NULL; cmd = next) {
+		/* cut this command off at the next | */
+		for (next = cmd; *next != NULL && strcmp(*next, "|"); next++);
+		if (*next != NULL) {
+			*next++ = NULL;
+		}
+		else {
+			next = NULL;
+		}
+
+		if (cmd[0] == NULL) {
+			printf("sh: Missing command in pipeline\n");
+			failed = 1;
+			break;
+		}
+		if (npids == MAXPIPE) {
+			printf("sh: Too many commands in pipeline\n");
+			failed = 1;
+			break;
+		}
+
+		fds[0] = fds[1] = -1;
+		if (next != NULL && pipe(fds) < 0) {
+			warn("pipe");
+			failed = 1;
+			break;
+		}
+
+		pid = fork();
+		if (pid < 0) {
+			warn("fork");
+			if (next != NULL) {
+				close(fds[0]);
+				close(fds[1]);
+			}
+			failed = 1;
+			break;
+		}
+		if (pid == 0) {
+			/* child */
+			if (infd >= 0) {
+				dup2(infd, STDIN_FILENO);
+				close(infd);
+			}
+			if (next != NULL) {
+				dup2(fds[1], STDOUT_FILENO);
+				close(fds[1]);
+				close(fds[0]);
+			}
+			execvp(cmd[0], cmd);
+			warn("%s", cmd[0]);
+			_exit(1);
+		}
+
+		/* parent: the child has its own copies now */
+		pids[npids++] = pid;
+		if (infd >= 0) {
+			close(infd);
+		}
+		if (next != NULL) {
+			close(fds[1]);
+		}
+		infd = fds[0];
+	}
+	if (infd >= 0) {
+		/* stopped early; writers upstream will get EPIPE */
+		close(infd);
+	}
+
+	for (i = 0; i < npids; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			warn("waitpid");
+			failed = 1;
+		}
+		else if (i == npids - 1 && !failed) {
+			readstatus(status, ei);
+		}
+	}
+	if (failed) {
+		exitinfo_exit(ei, 1);
+	}
+}
+
 /*
  * a struct of the builtins associates the builtin name with the function that
  * executes it.  they must all take an argc and argv.
@@ -360,7 +467,8 @@ static struct {
  * tokenizes the command line using strtok.  if there aren't any commands,
  * simply returns.  checks to see if it's a builtin, running it if it is.
  * otherwise, it's a standard command.  check for the '&', try to background
- * the job if possible, otherwise just run it and wait on it.
+ * the job if possible, otherwise just run it and wait on it.  commands
+ * joined with '|' run as a pipeline.
  */
 static
 void
@@ -421,44 +529,50 @@ docommand(char *buf, struct exitinfo *ei)
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
-	switch (pid) {
-		case -1:
-			/* error */
-			warn("fork");
-			exitinfo_exit(ei, 255);
-			return;
-		case 0:
-			/* child */
-			execvp(args[0], args);
-			warn("%s", args[0]);
-			/*
-			 * Use _exit() instead of exit() in the child
-			 * process to avoid calling atexit() functions,
-			 * which would cause hostcompat (if present) to
-			 * reset the tty state and mess up our input
-			 * handling.
-			 */
-			_exit(1);
-		default:
+	for (i=0; i<nargs; i++) {
+		if (!strcmp(args[i], "|")) {
 			break;
+		}
 	}
 
-	/* parent */
-	if (bg) {
-		/* background this command */
-		remember_bg(pid);
-		printf("[%d] %s ... &\n", pid, args[0]);
-		exitinfo_exit(ei, 0);
-		return;
-	}
-
-	if (waitpid(pid, &status, 0) < 0) {
-		warn("waitpid");
-		exitinfo_exit(ei, 255);
+	if (i < nargs) {
+		if (bg) {
+			printf("sh: Pipelines can't be run in the "
+			       "background\n");
+			exitinfo_exit(ei, 1);
+			return;
+		}
+		runpipeline(args, ei);
 	}
 	else {
-		readstatus(status, ei);
+		/*
+		 * Start the program with spawnvp() rather than fork() and
+		 * execvp(), so the shell's image isn't copied only to be
+		 * thrown away. Load errors come back here directly.
+		 */
+		pid = spawnvp(args[0], args);
+		if (pid < 0) {
+			warn("%s", args[0]);
+			exitinfo_exit(ei, 1);
+			return;
+		}
+
+		/* parent */
+		if (bg) {
+			/* background this command */
+			remember_bg(pid);
+			printf("[%d] %s ... &\n", pid, args[0]);
+			exitinfo_exit(ei, 0);
+			return;
+		}
+
+		if (waitpid(pid, &status, 0) < 0) {
+			warn("waitpid");
+			exitinfo_exit(ei, 255);
+		}
+		else {
+			readstatus(status, ei);
+		}
 	}
 
 	if (timing) {
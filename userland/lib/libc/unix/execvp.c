@@ -35,17 +35,22 @@
 #include <limits.h>
 
 /*
- * POSIX C function: exec a program on the search path. Tries
- * execv() repeatedly until one of the choices works.
+ * Run a program on the search path, either by exec or by spawn. Tries
+ * each choice in turn until one of them works.
  */
-int
-execvp(const char *prog, char *const *args)
+static
+pid_t
+runpath(const char *prog, char *const *args, int spawning)
 {
 	const char *searchpath, *s, *t;
 	char progpath[PATH_MAX];
 	size_t len;
+	pid_t pid;
 
 	if (strchr(prog, '/') != NULL) {
+		if (spawning) {
+			return spawn(prog, args);
+		}
 		execv(prog, args);
 		return -1;
 	}
@@ -74,7 +79,15 @@ execvp(const char *prog, char *const *args)
 		}
 		memcpy(progpath, s, len);
 		snprintf(progpath + len, sizeof(progpath) - len, "/%s", prog);
-		execv(progpath, args);
+		if (spawning) {
+			pid = spawn(progpath, args);
+			if (pid >= 0) {
+				return pid;
+			}
+		}
+		else {
+			execv(progpath, args);
+		}
 		switch (errno) {
 		    case ENOENT:
 		    case ENOTDIR:
@@ -89,3 +102,24 @@ execvp(const char *prog, char *const *args)
 	errno = ENOENT;
 	return -1;
 }
+
+/*
+ * POSIX C function: exec a program on the search path. Tries
+ * execv() repeatedly until one of the choices works.
+ */
+int
+execvp(const char *prog, char *const *args)
+{
+	runpath(prog, args, 0);
+	return -1;
+}
+
+/*
+ * OS/161 extension: like execvp(), but starts the program in a new
+ * process with spawn() and returns its pid.
+ */
+pid_t
+spawnvp(const char *prog, char *const *args)
+{
+	return runpath(prog, args, 1);
+}
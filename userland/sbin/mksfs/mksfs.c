@@ -73,6 +73,9 @@ check(void)
 	assert(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	assert(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	assert(sizeof(struct sfs_jheader)==SFS_BLOCKSIZE);
+	assert(sizeof(struct sfs_jdesc)==SFS_BLOCKSIZE);
+	assert(sizeof(struct sfs_jcommit)==SFS_BLOCKSIZE);
 }
 
 /*
@@ -89,6 +92,28 @@ allocblock(uint32_t block)
 	freemapbuf[mapbyte] |= mask;
 }
 
+/*
+ * Where the journal goes, and how big it is; 0 for no journal. It
+ * goes right after the freemap, on volumes big enough that it won't
+ * crowd out the files.
+ */
+static
+uint32_t
+journalstart(uint32_t fsblocks)
+{
+	return SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(fsblocks);
+}
+
+static
+uint32_t
+journalblocks(uint32_t fsblocks)
+{
+	if (fsblocks < 4 * SFS_JOURNAL_SIZE) {
+		return 0;
+	}
+	return SFS_JOURNAL_SIZE;
+}
+
 /*
  * Initialize the free block bitmap.
  */
@@ -114,6 +139,11 @@ initfreemap(uint32_t fsblocks)
 		allocblock(SFS_FREEMAP_START + i);
 	}
 
+	/* so must the journal */
+	for (i=0; i<journalblocks(fsblocks); i++) {
+		allocblock(journalstart(fsblocks) + i);
+	}
+
 	/* all blocks in the freemap but past the volume end are "in use" */
 	for (i=fsblocks; i<freemapbits; i++) {
 		allocblock(i);
@@ -140,6 +170,9 @@ writesuper(const char *volname, uint32_t nblocks)
 	sb.sb_magic = SWAP32(SFS_MAGIC);
 	sb.sb_nblocks = SWAP32(nblocks);
 	strcpy(sb.sb_volname, volname);
+	sb.sb_journalstart = SWAP32(journalblocks(nblocks) > 0 ?
+				    journalstart(nblocks) : 0);
+	sb.sb_journalblocks = SWAP32(journalblocks(nblocks));
 
 	/* and write it out. */
 	diskwrite(&sb, SFS_SUPER_BLOCK);
@@ -164,6 +197,31 @@ writefreemap(uint32_t fsblocks)
 	}
 }
 
+/*
+ * Write out an empty journal: the header, and a blank block where
+ * the first transaction would go so nothing left on the disk from
+ * before can be mistaken for one.
+ */
+static
+void
+writejournal(uint32_t fsblocks)
+{
+	struct sfs_jheader jh;
+	char zeros[SFS_BLOCKSIZE];
+
+	if (journalblocks(fsblocks) == 0) {
+		return;
+	}
+
+	bzero((void *)&jh, sizeof(jh));
+	jh.jh_magic = SWAP32(SFS_JMAGIC_HEAD);
+	jh.jh_seq = SWAP32(1);
+	diskwrite(&jh, journalstart(fsblocks));
+
+	bzero(zeros, sizeof(zeros));
+	diskwrite(zeros, journalstart(fsblocks) + 1);
+}
+
 /*
  * Write out the root directory inode.
  */
@@ -232,6 +290,7 @@ main(int argc, char **argv)
 	initfreemap(size);
 	writesuper(volname, size);
 	writefreemap(size);
+	writejournal(size);
 	writerootdir();
 
 	closedisk();
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2006, 2009, 2013
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <err.h>
+
+#include "compat.h"
+#include <kern/sfs.h>
+
+#include "disk.h"
+#include "utils.h"
+#include "sfs.h"
+#include "sb.h"
+#include "journal.h"
+#include "main.h"
+
+/*
+ * Checksum a block as the kernel does: rotate and add each word. If
+ * SWAPPED is set the block has been converted to host byte order
+ * already; otherwise it's straight off the disk.
+ */
+static
+uint32_t
+journal_sum(uint32_t sum, const void *block, int swapped)
+{
+	const uint32_t *words = block;
+	uint32_t word;
+	unsigned i;
+
+	for (i=0; i<SFS_BLOCKSIZE/sizeof(uint32_t); i++) {
+		word = swapped ? words[i] : SWAP32(words[i]);
+		sum = ((sum << 1) | (sum >> 31)) + word;
+	}
+	return sum;
+}
+
+/*
+ * Check if block HOME is revoked by any of descriptors D[0..N-1].
+ */
+static
+int
+journal_isrevoked(const struct sfs_jdesc *d, unsigned n, uint32_t home)
+{
+	unsigned i, j;
+
+	for (i=0; i<n; i++) {
+		for (j=0; j<d[i].jd_nrevoked; j++) {
+			if (d[i].jd_entries[d[i].jd_nblocks + j] == home) {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+int
+journal_replay(void)
+{
+	uint32_t start, size, pos, seq, sum, home;
+	unsigned ntrans, maxtrans, t, i;
+	struct sfs_jheader jh;
+	struct sfs_jcommit jc;
+	struct sfs_jdesc *descs, *jd;
+	uint32_t *positions;
+	char buf[SFS_BLOCKSIZE];
+
+	start = sb_journalstart();
+	size = sb_journalblocks();
+	if (size < 3) {
+		return 0;
+	}
+
+	sfs_readjblock(start, &jh);
+	if (jh.jh_magic != SFS_JMAGIC_HEAD) {
+		warnx("Journal header is missing (fixed)");
+		setbadness(EXIT_RECOV);
+		jh.jh_magic = SFS_JMAGIC_HEAD;
+		jh.jh_seq = 1;
+		sfs_writejblock(start, &jh);
+		return 0;
+	}
+	seq = jh.jh_seq;
+
+	maxtrans = size / 3;
+	descs = domalloc(maxtrans * sizeof(struct sfs_jdesc));
+	positions = domalloc(maxtrans * sizeof(uint32_t));
+
+	/* Find the committed transactions */
+	ntrans = 0;
+	pos = 1;
+	while (ntrans < maxtrans && pos + 2 <= size) {
+		jd = &descs[ntrans];
+		sfs_readjblock(start + pos, jd);
+		if (jd->jd_magic != SFS_JMAGIC_DESC || jd->jd_seq != seq ||
+		    jd->jd_nblocks + jd->jd_nrevoked > SFS_JDESC_NENTRIES ||
+		    pos + jd->jd_nblocks + 2 > size) {
+			break;
+		}
+		sum = journal_sum(0, jd, 1);
+		for (i=0; i<jd->jd_nblocks; i++) {
+			diskread(buf, start + pos + 1 + i);
+			sum = journal_sum(sum, buf, 0);
+		}
+		sfs_readjblock(start + pos + 1 + jd->jd_nblocks, &jc);
+		if (jc.jc_magic != SFS_JMAGIC_COMMIT || jc.jc_seq != seq ||
+		    jc.jc_sum != sum) {
+			break;
+		}
+		positions[ntrans++] = pos;
+		pos += jd->jd_nblocks + 2;
+		seq++;
+	}
+
+	/* Write them home; the copies are already in disk byte order */
+	for (t=0; t<ntrans; t++) {
+		jd = &descs[t];
+		for (i=0; i<jd->jd_nblocks; i++) {
+			home = jd->jd_entries[i];
+			if (home >= sb_totalblocks() ||
+			    (home >= start && home < start + size)) {
+				warnx("Journal names invalid block %lu "
+				      "(ignored)", (unsigned long)home);
+				setbadness(EXIT_RECOV);
+				continue;
+			}
+			if (journal_isrevoked(descs + t + 1, ntrans - t - 1,
+					      home)) {
+				continue;
+			}
+			diskread(buf, start + positions[t] + 1 + i);
+			diskwrite(buf, home);
+		}
+	}
+
+	/* Empty the journal */
+	if (ntrans > 0) {
+		jh.jh_seq = seq;
+		sfs_writejblock(start, &jh);
+		printf("Replayed %u journal transaction%s\n",
+		       ntrans, ntrans == 1 ? "" : "s");
+	}
+
+	free(descs);
+	free(positions);
+	return ntrans > 0;
+}
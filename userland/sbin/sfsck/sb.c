@@ -83,6 +83,23 @@ sb_check(void)
 		setbadness(EXIT_RECOV);
 		schanged = 1;
 	}
+	if (sb.sb_journalblocks > 0 &&
+	    (sb.sb_journalstart < SFS_FREEMAP_START + sb_freemapblocks() ||
+	     sb.sb_journalblocks > sb.sb_nblocks ||
+	     sb.sb_journalstart > sb.sb_nblocks - sb.sb_journalblocks)) {
+		warnx("Journal location %lu+%lu is invalid (removed)",
+		      (unsigned long)sb.sb_journalstart,
+		      (unsigned long)sb.sb_journalblocks);
+		sb.sb_journalstart = sb.sb_journalblocks = 0;
+		setbadness(EXIT_RECOV);
+		schanged = 1;
+	}
+	if (sb.sb_journalblocks == 0 && sb.sb_journalstart != 0) {
+		warnx("Journal start set with no journal (fixed)");
+		sb.sb_journalstart = 0;
+		setbadness(EXIT_RECOV);
+		schanged = 1;
+	}
 	if (checkzeroed(sb.reserved, sizeof(sb.reserved))) {
 		warnx("Reserved section of superblock not zeroed (fixed)");
 		setbadness(EXIT_RECOV);
@@ -114,6 +131,22 @@ sb_freemapblocks(void)
 	return SFS_FREEMAPBLOCKS(sb.sb_nblocks);
 }
 
+/*
+ * Return the first block of the journal, and its size (0 if there is
+ * no journal).
+ */
+uint32_t
+sb_journalstart(void)
+{
+	return sb.sb_journalstart;
+}
+
+uint32_t
+sb_journalblocks(void)
+{
+	return sb.sb_journalblocks;
+}
+
 /*
  * Return the volume name.
  */
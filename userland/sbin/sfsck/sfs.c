@@ -51,6 +51,9 @@ sfs_setup(void)
 	assert(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	assert(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	assert(sizeof(struct sfs_jheader)==SFS_BLOCKSIZE);
+	assert(sizeof(struct sfs_jdesc)==SFS_BLOCKSIZE);
+	assert(sizeof(struct sfs_jcommit)==SFS_BLOCKSIZE);
 }
 
 ////////////////////////////////////////////////////////////
@@ -62,6 +65,19 @@ swapsb(struct sfs_superblock *sb)
 {
 	sb->sb_magic = SWAP32(sb->sb_magic);
 	sb->sb_nblocks = SWAP32(sb->sb_nblocks);
+	sb->sb_journalstart = SWAP32(sb->sb_journalstart);
+	sb->sb_journalblocks = SWAP32(sb->sb_journalblocks);
+}
+
+static
+void
+swapwords(uint32_t *words)
+{
+	unsigned i;
+
+	for (i=0; i<SFS_BLOCKSIZE/sizeof(uint32_t); i++) {
+		words[i] = SWAP32(words[i]);
+	}
 }
 
 static
@@ -206,6 +222,26 @@ sfs_writesb(uint32_t blocknum, struct sfs_superblock *sb)
 	swapsb(sb);
 }
 
+/*
+ * journal header, descriptor, and commit blocks, which are all just
+ * words as far as byte order goes - blocknum is a disk block number.
+ */
+
+void
+sfs_readjblock(uint32_t blocknum, void *jblock)
+{
+	diskread(jblock, blocknum);
+	swapwords(jblock);
+}
+
+void
+sfs_writejblock(uint32_t blocknum, void *jblock)
+{
+	swapwords(jblock);
+	diskwrite(jblock, blocknum);
+	swapwords(jblock);
+}
+
 /*
  * freemap blocks - whichblock is a block number within the free block
  * bitmap.
@@ -53,6 +53,10 @@ void sfs_setup(void);
 void sfs_readsb(uint32_t blocknum, struct sfs_superblock *sb);
 void sfs_writesb(uint32_t blocknum, struct sfs_superblock *sb);
 
+/* journal header, descriptor, and commit blocks */
+void sfs_readjblock(uint32_t blocknum, void *jblock);
+void sfs_writejblock(uint32_t blocknum, void *jblock);
+
 /* freemap blocks; whichblock is the freemap block number (starts at 0) */
 void sfs_readfreemapblock(uint32_t whichblock, uint8_t *bits);
 void sfs_writefreemapblock(uint32_t whichblock, uint8_t *bits);
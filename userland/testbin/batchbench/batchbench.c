@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * batchbench - compare one-trap-per-call I/O with sysbatch().
+ *
+ * Does many 1-byte writes on the null device, first one write() at a
+ * time and then in sysbatch() batches of the given size, and reports
+ * calls per second for each. Before that, checks that a mixed batch
+ * on a scratch file gives the same results the separate calls would.
+ *
+ * Usage: batchbench [iterations [batchsize]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <sys/sysbatch.h>
+
+#define DEFAULT_ITERATIONS 100000
+#define DEFAULT_BATCH 64
+#define MAX_BATCH 1024
+#define SCRATCH "batchbench.tmp"
+
+static struct sysop ops[MAX_BATCH];
+
+static
+unsigned long long
+now_ns(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return (unsigned long long)secs * 1000000000ULL + nsecs;
+}
+
+static
+void
+report(const char *what, unsigned iters, unsigned long long ns)
+{
+	printf("%-10s %u calls in %llu.%03llu ms, %llu calls/sec\n",
+	       what, iters, ns / 1000000, (ns / 1000) % 1000,
+	       ns ? iters * 1000000000ULL / ns : 0);
+}
+
+static
+void
+setop(struct sysop *op, int code, int fd, void *buf, size_t len, off_t pos)
+{
+	memset(op, 0, sizeof(*op));
+	op->so_op = code;
+	op->so_fd = fd;
+	op->so_buf = buf;
+	op->so_len = len;
+	op->so_pos = pos;
+}
+
+/*
+ * open, write, lseek back, read, close: all in one batch, then a
+ * failing operation with SYSOP_STOP to check the rest are skipped.
+ */
+static
+void
+check(void)
+{
+	char buf[8];
+	int fd;
+
+	setop(&ops[0], SYSOP_OPEN, -1, (void *)SCRATCH, 0, 0);
+	ops[0].so_arg = O_RDWR | O_CREAT | O_TRUNC;
+	ops[0].so_flags = SYSOP_STOP;
+	if (sysbatch(ops, 1) != 1 || ops[0].so_error) {
+		errx(1, "batched open: %s", strerror(ops[0].so_error));
+	}
+	fd = ops[0].so_result;
+
+	memset(buf, 0, sizeof(buf));
+	setop(&ops[0], SYSOP_WRITE, fd, (void *)"batched", 7, 0);
+	setop(&ops[1], SYSOP_LSEEK, fd, NULL, 0, 1);
+	ops[1].so_arg = SEEK_SET;
+	setop(&ops[2], SYSOP_READ, fd, buf, 6, 0);
+	setop(&ops[3], SYSOP_PREAD, fd, buf + 6, 1, 0);
+	setop(&ops[4], SYSOP_CLOSE, fd, NULL, 0, 0);
+	if (sysbatch(ops, 5) != 5) {
+		err(1, "sysbatch");
+	}
+	if (ops[0].so_result != 7 || ops[1].so_result != 1 ||
+	    ops[2].so_result != 6 || ops[3].so_result != 1 ||
+	    ops[4].so_error != 0 || strcmp(buf, "atchedb")) {
+		errx(1, "mixed batch gave wrong results (read \"%s\")", buf);
+	}
+
+	setop(&ops[0], SYSOP_CLOSE, fd, NULL, 0, 0);
+	ops[0].so_flags = SYSOP_STOP;
+	setop(&ops[1], SYSOP_CLOSE, 0, NULL, 0, 0);
+	if (sysbatch(ops, 2) != 1 || ops[0].so_error != EBADF) {
+		errx(1, "SYSOP_STOP did not stop the batch");
+	}
+
+	remove(SCRATCH);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long long start, single, batched;
+	unsigned iters, batch, i, n;
+	char ch = 0;
+	int fd;
+
+	iters = DEFAULT_ITERATIONS;
+	batch = DEFAULT_BATCH;
+	if (argc >= 2) {
+		iters = atoi(argv[1]);
+	}
+	if (argc >= 3) {
+		batch = atoi(argv[2]);
+	}
+	if (argc > 3) {
+		errx(1, "Usage: batchbench [iterations [batchsize]]");
+	}
+	if (iters == 0 || batch == 0 || batch > MAX_BATCH) {
+		errx(1, "Need at least one iteration and 1-%d per batch",
+		     MAX_BATCH);
+	}
+
+	check();
+
+	fd = open("null:", O_RDWR);
+	if (fd < 0) {
+		err(1, "null:");
+	}
+
+	start = now_ns();
+	for (i=0; i<iters; i++) {
+		if (write(fd, &ch, 1) != 1) {
+			err(1, "write");
+		}
+	}
+	single = now_ns() - start;
+
+	for (i=0; i<batch; i++) {
+		setop(&ops[i], SYSOP_WRITE, fd, &ch, 1, 0);
+	}
+	start = now_ns();
+	for (i=0; i<iters; i+=n) {
+		n = iters - i < batch ? iters - i : batch;
+		if (sysbatch(ops, n) != (int)n) {
+			err(1, "sysbatch");
+		}
+	}
+	batched = now_ns() - start;
+
+	close(fd);
+
+	report("write:", iters, single);
+	report("sysbatch:", iters, batched);
+	return 0;
+}
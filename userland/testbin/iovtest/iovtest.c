@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * iovtest.c
+ *
+ * 	Tests the scatter/gather and positional I/O calls: writev,
+ * 	readv, pread, pwrite, preadv and pwritev. Checks that data
+ * 	lands in the right place across iovecs and that the positional
+ * 	calls leave the file offset alone.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <sys/uio.h>
+#include <test161/test161.h>
+
+#define FILENAME "iovtest.dat"
+
+static const char part1[] = "scatter";
+static const char part2[] = "/gather";
+static const char part3[] = " works";
+
+static
+void
+checkoffset(int fd, off_t expected, const char *what)
+{
+	off_t pos;
+
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos != expected) {
+		errx(1, "%s: file offset is %lld, expected %lld",
+		     what, (long long)pos, (long long)expected);
+	}
+}
+
+int
+main(void)
+{
+	struct iovec iov[3];
+	char a[8], b[8], c[8], buf[32];
+	ssize_t len;
+	size_t total;
+	int fd;
+
+	total = strlen(part1) + strlen(part2) + strlen(part3);
+
+	fd = open(FILENAME, O_RDWR | O_CREAT | O_TRUNC);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+
+	/* writev: three pieces, one call */
+	iov[0].iov_base = (void *)part1;
+	iov[0].iov_len = strlen(part1);
+	iov[1].iov_base = (void *)part2;
+	iov[1].iov_len = strlen(part2);
+	iov[2].iov_base = (void *)part3;
+	iov[2].iov_len = strlen(part3);
+	len = writev(fd, iov, 3);
+	if (len < 0) {
+		err(1, "writev");
+	}
+	if ((size_t)len != total) {
+		errx(1, "writev wrote %zd bytes, expected %zu", len, total);
+	}
+	checkoffset(fd, total, "writev");
+	nprintf(".");
+
+	/* pread: whole file, offset must not move */
+	memset(buf, 0, sizeof(buf));
+	len = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (len != (ssize_t)total) {
+		err(1, "pread returned %zd", len);
+	}
+	if (strcmp(buf, "scatter/gather works")) {
+		errx(1, "pread got \"%s\"", buf);
+	}
+	checkoffset(fd, total, "pread");
+	nprintf(".");
+
+	/* pwrite into the middle */
+	if (pwrite(fd, "G", 1, 8) != 1) {
+		err(1, "pwrite");
+	}
+	checkoffset(fd, total, "pwrite");
+	nprintf(".");
+
+	/* readv from the start, split 7/7/6 */
+	if (lseek(fd, 0, SEEK_SET) != 0) {
+		err(1, "lseek");
+	}
+	memset(a, 0, sizeof(a));
+	memset(b, 0, sizeof(b));
+	memset(c, 0, sizeof(c));
+	iov[0].iov_base = a;
+	iov[0].iov_len = 7;
+	iov[1].iov_base = b;
+	iov[1].iov_len = 7;
+	iov[2].iov_base = c;
+	iov[2].iov_len = 6;
+	len = readv(fd, iov, 3);
+	if (len != 20) {
+		err(1, "readv returned %zd", len);
+	}
+	if (strcmp(a, "scatter") || strcmp(b, "/Gather") || strcmp(c, " works")) {
+		errx(1, "readv got \"%s\" \"%s\" \"%s\"", a, b, c);
+	}
+	checkoffset(fd, total, "readv");
+	nprintf(".");
+
+	/* preadv/pwritev at an offset */
+	iov[0].iov_base = (void *)"W";
+	iov[0].iov_len = 1;
+	if (pwritev(fd, iov, 1, 15) != 1) {
+		err(1, "pwritev");
+	}
+	memset(a, 0, sizeof(a));
+	iov[0].iov_base = a;
+	iov[0].iov_len = 5;
+	if (preadv(fd, iov, 1, 15) != 5 || strcmp(a, "Works")) {
+		errx(1, "preadv got \"%s\"", a);
+	}
+	checkoffset(fd, total, "preadv");
+	nprintf(".");
+
+	/* bad iovcnt */
+	if (readv(fd, iov, 0) != -1 || errno != EINVAL) {
+		errx(1, "readv with iovcnt 0 did not fail with EINVAL");
+	}
+	if (pread(fd, buf, 1, -1) != -1 || errno != EINVAL) {
+		errx(1, "pread at a negative offset did not fail with EINVAL");
+	}
+	nprintf(".");
+
+	close(fd);
+	remove(FILENAME);
+	nprintf("\n");
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/iovtest");
+	return 0;
+}
@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * pipetest.c
+ *
+ * 	Tests pipes: data order, EOF once the write end is closed,
+ * 	EPIPE once the read end is closed, ESPIPE on lseek, and that
+ * 	writes of PIPE_BUF bytes from two processes never interleave.
+ * 	Finally pushes a few megabytes through a pipe between two
+ * 	processes and reports the throughput.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define NBLOCKS 64		/* PIPE_BUF writes per writer */
+#define BULKSIZE (4*1024*1024)	/* bytes for the throughput run */
+#define CHUNK 4096
+
+static char buf[CHUNK];
+
+static
+unsigned long long
+now_ns(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return (unsigned long long)secs * 1000000000ULL + nsecs;
+}
+
+static
+void
+waitchild(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child %d failed", pid);
+	}
+}
+
+/* read exactly len bytes, or fail */
+static
+void
+readall(int fd, char *p, size_t len)
+{
+	ssize_t r;
+
+	while (len > 0) {
+		r = read(fd, p, len);
+		if (r < 0) {
+			err(1, "read");
+		}
+		if (r == 0) {
+			errx(1, "unexpected EOF");
+		}
+		p += r;
+		len -= r;
+	}
+}
+
+static
+void
+test_basic(void)
+{
+	int fds[2];
+	ssize_t r;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	if (write(fds[1], "hello", 5) != 5) {
+		err(1, "write");
+	}
+	if (lseek(fds[0], 0, SEEK_SET) != -1 || errno != ESPIPE) {
+		errx(1, "lseek on a pipe did not fail with ESPIPE");
+	}
+	if (read(fds[1], buf, 1) != -1 || errno != EBADF) {
+		errx(1, "read from the write end did not fail with EBADF");
+	}
+	memset(buf, 0, 8);
+	r = read(fds[0], buf, 8);
+	if (r != 5 || memcmp(buf, "hello", 5)) {
+		errx(1, "read %zd bytes from pipe, expected \"hello\"", r);
+	}
+
+	/* EOF once the writer is gone */
+	write(fds[1], "x", 1);
+	close(fds[1]);
+	if (read(fds[0], buf, 8) != 1 || read(fds[0], buf, 8) != 0) {
+		errx(1, "no EOF after closing the write end");
+	}
+	close(fds[0]);
+	nprintf(".");
+
+	/* EPIPE once the reader is gone */
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	close(fds[0]);
+	if (write(fds[1], "x", 1) != -1 || errno != EPIPE) {
+		errx(1, "write with no reader did not fail with EPIPE");
+	}
+	close(fds[1]);
+	nprintf(".");
+}
+
+static
+void
+writeblocks(int fd, char c)
+{
+	int i;
+
+	memset(buf, c, PIPE_BUF);
+	for (i = 0; i < NBLOCKS; i++) {
+		if (write(fd, buf, PIPE_BUF) != PIPE_BUF) {
+			err(1, "write");
+		}
+	}
+}
+
+static
+void
+test_atomic(void)
+{
+	int fds[2], i, j, count[2];
+	pid_t pids[2];
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	for (i = 0; i < 2; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			close(fds[0]);
+			writeblocks(fds[1], 'a' + i);
+			_exit(0);
+		}
+	}
+	close(fds[1]);
+
+	count[0] = count[1] = 0;
+	for (i = 0; i < 2 * NBLOCKS; i++) {
+		readall(fds[0], buf, PIPE_BUF);
+		for (j = 1; j < PIPE_BUF; j++) {
+			if (buf[j] != buf[0]) {
+				errx(1, "PIPE_BUF write was split at %d", j);
+			}
+		}
+		count[buf[0] - 'a']++;
+	}
+	if (count[0] != NBLOCKS || count[1] != NBLOCKS) {
+		errx(1, "got %d and %d blocks, expected %d each",
+		     count[0], count[1], NBLOCKS);
+	}
+	if (read(fds[0], buf, 1) != 0) {
+		errx(1, "no EOF after both writers exited");
+	}
+	close(fds[0]);
+	waitchild(pids[0]);
+	waitchild(pids[1]);
+	nprintf(".");
+}
+
+static
+void
+test_bulk(void)
+{
+	unsigned long long start, ns;
+	size_t total;
+	ssize_t r;
+	int fds[2];
+	pid_t pid;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		for (total = 0; total < BULKSIZE; total += CHUNK) {
+			if (write(fds[1], buf, CHUNK) != CHUNK) {
+				err(1, "write");
+			}
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+
+	start = now_ns();
+	total = 0;
+	while ((r = read(fds[0], buf, CHUNK)) > 0) {
+		total += r;
+	}
+	if (r < 0) {
+		err(1, "read");
+	}
+	ns = now_ns() - start;
+	close(fds[0]);
+	waitchild(pid);
+
+	if (total != BULKSIZE) {
+		errx(1, "read %zu bytes, expected %d", total, BULKSIZE);
+	}
+	tprintf("\n%zu bytes in %llu ns (%llu KB/s)\n", total, ns,
+		ns ? (unsigned long long)total * 1000000000ULL / 1024 / ns : 0);
+}
+
+int
+main(void)
+{
+	test_basic();
+	test_atomic();
+	test_bulk();
+	nprintf("\n");
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/pipetest");
+	return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * readbench - measure per-syscall overhead on the read/write path.
+ *
+ * Does many 1-byte reads and writes on the null device, where the
+ * device itself does no work, so the time is almost all fd lookup and
+ * syscall entry/exit. Reports the average cost of each.
+ *
+ * Usage: readbench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define DEFAULT_ITERATIONS 100000
+
+static
+unsigned long long
+now_ns(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return (unsigned long long)secs * 1000000000ULL + nsecs;
+}
+
+static
+void
+report(const char *what, unsigned iters, unsigned long long ns)
+{
+	printf("%-8s %u calls in %llu.%03llu ms, %llu ns each\n",
+	       what, iters, ns / 1000000, (ns / 1000) % 1000, ns / iters);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long long start, rd, wr;
+	unsigned iters, i;
+	char ch = 0;
+	int fd;
+
+	iters = DEFAULT_ITERATIONS;
+	if (argc == 2) {
+		iters = atoi(argv[1]);
+	}
+	else if (argc > 2) {
+		errx(1, "Usage: readbench [iterations]");
+	}
+	if (iters == 0) {
+		errx(1, "Need at least one iteration");
+	}
+
+	fd = open("null:", O_RDWR);
+	if (fd < 0) {
+		err(1, "null:");
+	}
+
+	start = now_ns();
+	for (i=0; i<iters; i++) {
+		if (read(fd, &ch, 1) < 0) {
+			err(1, "read");
+		}
+	}
+	rd = now_ns() - start;
+
+	start = now_ns();
+	for (i=0; i<iters; i++) {
+		if (write(fd, &ch, 1) != 1) {
+			err(1, "write");
+		}
+	}
+	wr = now_ns() - start;
+
+	close(fd);
+
+	report("read:", iters, rd);
+	report("write:", iters, wr);
+	return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * scstat - print system call statistics.
+ *
+ * With no arguments, prints the kernel's system call counts and
+ * latencies since boot (or the last "scs reset" from the menu). Given
+ * a command, runs it and prints only what happened while it ran,
+ * e.g. "scstat /testbin/psort". The figures are system-wide, so they
+ * include scstat's own few calls and anything else running.
+ *
+ * Usage: scstat [command [args...]]
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <kern/syscall.h>
+#include <kern/scstats.h>
+
+#define STATSDEV "scstats:"
+
+static struct scstats before, after;
+
+static const char *const names[SCSTATS_NCALLS] = {
+	[SYS_fork] = "fork",
+	[SYS_spawn] = "spawn",
+	[SYS_execv] = "execv",
+	[SYS__exit] = "_exit",
+	[SYS_waitpid] = "waitpid",
+	[SYS_getpid] = "getpid",
+	[SYS_open] = "open",
+	[SYS_pipe] = "pipe",
+	[SYS_dup2] = "dup2",
+	[SYS_close] = "close",
+	[SYS_read] = "read",
+	[SYS_pread] = "pread",
+	[SYS_readv] = "readv",
+	[SYS_preadv] = "preadv",
+	[SYS_write] = "write",
+	[SYS_pwrite] = "pwrite",
+	[SYS_writev] = "writev",
+	[SYS_pwritev] = "pwritev",
+	[SYS_lseek] = "lseek",
+	[SYS_fsync] = "fsync",
+	[SYS_chdir] = "chdir",
+	[SYS___getcwd] = "__getcwd",
+	[SYS___time] = "__time",
+	[SYS_sync] = "sync",
+	[SYS_reboot] = "reboot",
+	[SYS_sysbatch] = "sysbatch",
+};
+
+static
+void
+getstats(struct scstats *sc)
+{
+	ssize_t len;
+	int fd;
+
+	fd = open(STATSDEV, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", STATSDEV);
+	}
+	len = read(fd, sc, sizeof(*sc));
+	if (len < 0) {
+		err(1, "%s: read", STATSDEV);
+	}
+	if ((size_t)len != sizeof(*sc)) {
+		errx(1, "%s: short read (%zd bytes)", STATSDEV, len);
+	}
+	close(fd);
+}
+
+/* after -= before, field by field */
+static
+void
+subtract(struct scstats *a, const struct scstats *b)
+{
+	unsigned n, k;
+
+	for (n=0; n<SCSTATS_NCALLS; n++) {
+		a->sc_calls[n] -= b->sc_calls[n];
+		a->sc_errors[n] -= b->sc_errors[n];
+		a->sc_cycles[n] -= b->sc_cycles[n];
+		for (k=0; k<SCSTATS_NBUCKETS; k++) {
+			a->sc_hist[n][k] -= b->sc_hist[n][k];
+		}
+	}
+}
+
+static
+void
+print(const struct scstats *sc)
+{
+	unsigned n, k;
+	uint32_t timed;
+
+	printf("call           calls   errors avgcycles  "
+	       "log2(cycles):count\n");
+	for (n=0; n<SCSTATS_NCALLS; n++) {
+		if (sc->sc_calls[n] == 0) {
+			continue;
+		}
+		timed = 0;
+		for (k=0; k<SCSTATS_NBUCKETS; k++) {
+			timed += sc->sc_hist[n][k];
+		}
+		if (names[n] != NULL) {
+			printf("%-10s", names[n]);
+		}
+		else {
+			printf("syscall%-3u", n);
+		}
+		printf(" %9u %8u %9llu ", sc->sc_calls[n], sc->sc_errors[n],
+		       timed ? (unsigned long long)sc->sc_cycles[n] / timed
+		       : 0ULL);
+		for (k=0; k<SCSTATS_NBUCKETS; k++) {
+			if (sc->sc_hist[n][k] > 0) {
+				printf(" %u:%u", k, sc->sc_hist[n][k]);
+			}
+		}
+		printf("\n");
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	pid_t pid;
+	int status;
+
+	if (argc == 1) {
+		getstats(&after);
+		print(&after);
+		return 0;
+	}
+
+	getstats(&before);
+	pid = spawnvp(argv[1], argv + 1);
+	if (pid < 0) {
+		err(1, "%s", argv[1]);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	getstats(&after);
+
+	subtract(&after, &before);
+	print(&after);
+	return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * spawnbench - measure process start latency.
+ *
+ * Starts a trivial child (this program, told to exit at once) many
+ * times, first with fork+execv and then with spawn, and reports the
+ * average time for each from start to reaping the child. The child
+ * does nothing, so the figures are dominated by process creation and
+ * program loading.
+ *
+ * Usage: spawnbench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#define _PATH_MYSELF "/testbin/spawnbench"
+#define DEFAULT_ITERATIONS 100
+
+static
+unsigned long long
+now_ns(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return (unsigned long long)secs * 1000000000ULL + nsecs;
+}
+
+static
+void
+reap(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child %d failed (status 0x%x)", pid, status);
+	}
+}
+
+static
+unsigned long long
+bench_forkexec(unsigned iters, char **args)
+{
+	unsigned long long start;
+	unsigned i;
+	pid_t pid;
+
+	start = now_ns();
+	for (i=0; i<iters; i++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			execv(_PATH_MYSELF, args);
+			warn("execv");
+			_exit(1);
+		}
+		reap(pid);
+	}
+	return now_ns() - start;
+}
+
+static
+unsigned long long
+bench_spawn(unsigned iters, char **args)
+{
+	unsigned long long start;
+	unsigned i;
+	pid_t pid;
+
+	start = now_ns();
+	for (i=0; i<iters; i++) {
+		pid = spawn(_PATH_MYSELF, args);
+		if (pid < 0) {
+			err(1, "spawn");
+		}
+		reap(pid);
+	}
+	return now_ns() - start;
+}
+
+static
+void
+report(const char *what, unsigned iters, unsigned long long ns)
+{
+	printf("%-12s %u runs in %llu.%03llu ms, %llu us each\n",
+	       what, iters, ns / 1000000, (ns / 1000) % 1000,
+	       ns / 1000 / iters);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char *childargs[3];
+	unsigned iters;
+	unsigned long long fe, sp;
+
+	if (argc == 2 && !strcmp(argv[1], "-x")) {
+		/* we are the child */
+		return 0;
+	}
+
+	iters = DEFAULT_ITERATIONS;
+	if (argc == 2) {
+		iters = atoi(argv[1]);
+	}
+	else if (argc > 2) {
+		errx(1, "Usage: spawnbench [iterations]");
+	}
+	if (iters == 0) {
+		errx(1, "Need at least one iteration");
+	}
+
+	childargs[0] = (char *)_PATH_MYSELF;
+	childargs[1] = (char *)"-x";
+	childargs[2] = NULL;
+
+	fe = bench_forkexec(iters, childargs);
+	sp = bench_spawn(iters, childargs);
+
+	report("fork+execv:", iters, fe);
+	report("spawn:", iters, sp);
+	return 0;
+}
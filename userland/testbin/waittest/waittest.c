@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * waittest.c
+ *
+ * 	Tests waitpid: WNOHANG on a running child, collecting exit
+ * 	status, ECHILD and ESRCH, and that a pid can't be waited for
+ * 	twice. Then leaves orphans and unwaited zombies behind for the
+ * 	kernel to reap: a child that forks a grandchild and exits at
+ * 	once, and a child this process never waits for.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define NORPHANS 16
+
+/* spin long enough that the parent's WNOHANG finds us running */
+static
+void
+busywait(void)
+{
+	volatile unsigned i;
+
+	for (i = 0; i < 200000; i++) {
+	}
+}
+
+int
+main(void)
+{
+	pid_t pid, ret;
+	int status, i;
+
+	/* WNOHANG, then a real wait */
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		busywait();
+		_exit(7);
+	}
+	ret = waitpid(pid, &status, WNOHANG);
+	if (ret < 0) {
+		err(1, "waitpid WNOHANG");
+	}
+	if (ret != 0 && ret != pid) {
+		errx(1, "waitpid WNOHANG returned %d", ret);
+	}
+	if (ret == 0) {
+		ret = waitpid(pid, &status, 0);
+		if (ret != pid) {
+			err(1, "waitpid");
+		}
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 7) {
+		errx(1, "child exit status 0x%x, expected exit 7", status);
+	}
+	nprintf(".");
+
+	/* a collected child is gone */
+	if (waitpid(pid, &status, 0) != -1 || errno != ESRCH) {
+		errx(1, "second waitpid on pid %d did not fail with ESRCH",
+		     pid);
+	}
+	/* we are not our own child */
+	if (waitpid(getpid(), &status, 0) != -1 || errno != ECHILD) {
+		errx(1, "waitpid on self did not fail with ECHILD");
+	}
+	if (waitpid(pid, &status, 12345) != -1 || errno != EINVAL) {
+		errx(1, "waitpid with bad options did not fail with EINVAL");
+	}
+	nprintf(".");
+
+	/* orphans: each child exits leaving a running grandchild */
+	for (i = 0; i < NORPHANS; i++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			if (fork() == 0) {
+				busywait();
+			}
+			_exit(0);
+		}
+		if (waitpid(pid, &status, 0) != pid) {
+			err(1, "waitpid");
+		}
+	}
+	nprintf(".");
+
+	/* a zombie left for our own exit to clean up */
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		_exit(0);
+	}
+	nprintf("\n");
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/waittest");
+	return 0;
+}